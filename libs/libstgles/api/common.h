@@ -18,4 +18,9 @@
       }                                                        \
   }
 
+/* glcore.c */
+void glcore_flush(void);
+void glcore_release_surface(void);
+void glcore_terminate(void);
+
 #endif
@@ -212,6 +212,8 @@ eglSwapBuffers (EGLDisplay dpy,
 #endif
 
   //DFBSurfaceFlipFlags flags;
+
+  glcore_flush();
   
   DFBCHECK (m_mainwindow->Flip (m_mainwindow, NULL, m_vsync==EGL_TRUE?DSFLIP_WAITFORSYNC:0));
   return EGL_TRUE;
@@ -256,6 +258,9 @@ eglDestroySurface (EGLDisplay dpy,
   printf("%s:%s[%d]\n", __FILE__, __func__, __LINE__);
 #endif
 
+  // blit pending quads while the surface is still there
+  glcore_release_surface();
+
   m_mainwindow->Release(m_mainwindow);
 
   return EGL_TRUE;
@@ -267,6 +272,8 @@ eglTerminate (EGLDisplay dpy)
 #ifdef DEBUG
   printf("%s:%s[%d]\n", __FILE__, __func__, __LINE__);
 #endif
+  glcore_terminate();
+
   m_displaylayer->Release(m_displaylayer);
   m_screen->Release(m_screen);
   m_dfb->Release(m_dfb);
@@ -1,5 +1,7 @@
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <directfb.h>
 
@@ -27,13 +29,38 @@ typedef struct {
 
 typedef struct {
 IDirectFBSurface *surface;
+DFBRectangle      rect;  /* area of the texture in surface */
+int               atlas; /* atlas page the area belongs to, -1 if surface is our own */
+int               used;  /* name handed out by glGenTextures */
 //EGLDisplay display;
 } EGLTexture;
 
-static EGLTexture   egl_textures[256];
+#define TEXTURES_INITIAL 256
+
+static EGLTexture  *egl_textures = NULL;
+static unsigned int texturesAllocated = 0;
 static int          texturesCurrent = 0;
 static unsigned int texturesActive = GL_TEXTURE0;
 
+/*
+ * Atlas mode (STGLES_ATLAS=1): textures up to ATLAS_MAX_ITEM pixels in
+ * both directions share ATLAS_SIZE square surfaces.
+ */
+#define ATLAS_SIZE      1024
+#define ATLAS_MAX_ITEM  128
+#define ATLAS_PADDING   1
+#define ATLAS_MAX_PAGES 16
+
+typedef struct {
+IDirectFBSurface *surface;
+int               shelf_x, shelf_y, shelf_h;
+int               textures;
+} EGLAtlas;
+
+static EGLAtlas     egl_atlas[ATLAS_MAX_PAGES];
+static int          atlasPages = 0;
+static int          m_atlas_mode = -1;
+
 static int m_bound_texture;
 static unsigned int m_drawflags = 0;
 
@@ -128,40 +155,368 @@ void glDisableClientState(GLenum array)
 
 
 
-void glGenTextures (GLsizei n, GLuint *textures)
+/*
+ * Render state of the main window. DirectFB state changes are only issued
+ * when the value differs from what was set last on the same surface.
+ */
+#define STATE_BLITTINGFLAGS (1<<0)
+#define STATE_DRAWINGFLAGS  (1<<1)
+#define STATE_COLOR         (1<<2)
+#define STATE_PORTERDUFF    (1<<3)
+
+static void batch_flush(void);
+
+static IDirectFBSurface        *m_state_surface = NULL;
+static unsigned int             m_state_valid = 0;
+static DFBSurfaceBlittingFlags  m_state_blittingflags;
+static DFBSurfaceDrawingFlags   m_state_drawingflags;
+static unsigned int             m_state_color;
+static DFBSurfacePorterDuffRule m_state_porterduff;
+
+static void state_check_surface(void)
+{
+  if (m_state_surface != m_mainwindow)
+  {
+    batch_flush();
+    m_state_surface = m_mainwindow;
+    m_state_valid = 0;
+  }
+}
+
+static void state_blitting_flags(DFBSurfaceBlittingFlags flags)
+{
+  state_check_surface();
+  if ((m_state_valid & STATE_BLITTINGFLAGS) && m_state_blittingflags == flags)
+    return;
+  batch_flush();
+  m_mainwindow->SetBlittingFlags(m_mainwindow, flags);
+  m_state_blittingflags = flags;
+  m_state_valid |= STATE_BLITTINGFLAGS;
+}
+
+static void state_drawing_flags(DFBSurfaceDrawingFlags flags)
+{
+  state_check_surface();
+  if ((m_state_valid & STATE_DRAWINGFLAGS) && m_state_drawingflags == flags)
+    return;
+  batch_flush();
+  m_mainwindow->SetDrawingFlags(m_mainwindow, flags);
+  m_state_drawingflags = flags;
+  m_state_valid |= STATE_DRAWINGFLAGS;
+}
+
+static void state_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a)
 {
-  texturesCurrent++;
-  texturesCurrent %= 256;
-  if (texturesCurrent == 0)
-    texturesCurrent++; /* 0 is reserved*/
+  unsigned int color = (a << 24) | (r << 16) | (g << 8) | b;
+
+  state_check_surface();
+  if ((m_state_valid & STATE_COLOR) && m_state_color == color)
+    return;
+  batch_flush();
+  m_mainwindow->SetColor(m_mainwindow, r, g, b, a);
+  m_state_color = color;
+  m_state_valid |= STATE_COLOR;
+}
+
+static void state_porter_duff(DFBSurfacePorterDuffRule rule)
+{
+  state_check_surface();
+  if ((m_state_valid & STATE_PORTERDUFF) && m_state_porterduff == rule)
+    return;
+  batch_flush();
+  m_mainwindow->SetPorterDuff(m_mainwindow, rule);
+  m_state_porterduff = rule;
+  m_state_valid |= STATE_PORTERDUFF;
+}
+
+/*
+ * Consecutive quads with the same texture surface, blitting flags and colour
+ * are collected and submitted with a single batch blit. A batch may span
+ * several glDrawArrays calls (e.g. icons sharing an atlas page), it is
+ * flushed before any other operation on the main window or a texture.
+ */
+#define BATCH_MAX 64
+
+#if DIRECTFB_MAJOR_VERSION > 1 || (DIRECTFB_MAJOR_VERSION == 1 && DIRECTFB_MINOR_VERSION >= 6)
+#define HAVE_BATCHSTRETCHBLIT
+#endif
+
+static DFBRectangle            m_batch_src[BATCH_MAX];
+static DFBRectangle            m_batch_dst[BATCH_MAX];
+static DFBPoint                m_batch_points[BATCH_MAX];
+static IDirectFBSurface       *m_batch_texture = NULL;
+static int                     m_batch_count = 0;
+static int                     m_batch_scaled = 0;
+static DFBSurfaceBlittingFlags m_batch_blittingflags;
+static unsigned int            m_batch_color;
+
+static void batch_flush(void)
+{
+  IDirectFBSurface *texture = m_batch_texture;
+  int i;
+
+  if (m_batch_count == 0)
+    return;
 
-  while(1)
+#ifdef DRAWDEBUG
+  printf("%s:%s[%d] %d quads scaled=%d flags=%x\n", __FILE__, __func__, __LINE__, m_batch_count, m_batch_scaled, m_batch_blittingflags);
+#endif
+
+  if (!m_batch_scaled)
+  {
+    for (i = 0; i < m_batch_count; i++)
+    {
+      m_batch_points[i].x = m_batch_dst[i].x;
+      m_batch_points[i].y = m_batch_dst[i].y;
+    }
+    m_mainwindow->BatchBlit(m_mainwindow, texture, m_batch_src, m_batch_points, m_batch_count);
+  }
+  else
   {
-    if (egl_textures[texturesCurrent].surface == NULL)
-      break;
+#ifdef HAVE_BATCHSTRETCHBLIT
+    m_mainwindow->BatchStretchBlit(m_mainwindow, texture, m_batch_src, m_batch_dst, m_batch_count);
+#else
+    for (i = 0; i < m_batch_count; i++)
+      m_mainwindow->StretchBlit(m_mainwindow, texture, &m_batch_src[i], &m_batch_dst[i]);
+#endif
+  }
+
+  m_batch_count = 0;
+  m_batch_scaled = 0;
+}
+
+static void batch_add(IDirectFBSurface *texture, DFBSurfaceBlittingFlags flags,
+                      unsigned char r, unsigned char g, unsigned char b, unsigned char a,
+                      const DFBRectangle *src, const DFBRectangle *dst)
+{
+  int use_color = (flags & (DSBLIT_BLEND_COLORALPHA | DSBLIT_COLORIZE)) != 0;
+  unsigned int color = (a << 24) | (r << 16) | (g << 8) | b;
+
+  if (m_batch_count > 0 && (m_batch_count == BATCH_MAX || texture != m_batch_texture ||
+                            flags != m_batch_blittingflags || (use_color && color != m_batch_color)))
+    batch_flush();
 
-    texturesCurrent++;
-    texturesCurrent %= 256;
-    if (texturesCurrent == 0)
-      texturesCurrent++; /* 0 is reserved*/
+  if (m_batch_count == 0)
+  {
+    state_blitting_flags(flags);
+    if (use_color)
+      state_color(r, g, b, a);
+    m_batch_texture = texture;
+    m_batch_blittingflags = flags;
+    m_batch_color = color;
   }
-  *textures = texturesCurrent;
+
+  m_batch_src[m_batch_count] = *src;
+  m_batch_dst[m_batch_count] = *dst;
+  if (src->w != dst->w || src->h != dst->h)
+    m_batch_scaled = 1;
+  m_batch_count++;
+}
+
+/* submit pending blits, called before the main window is flipped */
+void glcore_flush(void)
+{
+  batch_flush();
+}
+
+/* the main window is released, a new one may get the same address */
+void glcore_release_surface(void)
+{
+  batch_flush();
+  m_state_surface = NULL;
+  m_state_valid = 0;
+}
+
+/* grow the texture table so that texture is a valid index */
+static EGLTexture *texture_lookup(GLuint texture)
+{
+  if (texture >= texturesAllocated)
+  {
+    int allocated = texturesAllocated ? texturesAllocated : TEXTURES_INITIAL;
+    EGLTexture *table;
+
+    while (allocated <= texture)
+      allocated *= 2;
+    table = (EGLTexture *) realloc(egl_textures, allocated * sizeof(EGLTexture));
+    if (table == NULL)
+      return NULL;
+    memset(table + texturesAllocated, 0, (allocated - texturesAllocated) * sizeof(EGLTexture));
+    egl_textures = table;
+    texturesAllocated = allocated;
+  }
+  return &egl_textures[texture];
+}
+
+static int atlas_enabled(void)
+{
+  if (m_atlas_mode < 0)
+  {
+    const char *env = getenv("STGLES_ATLAS");
+    m_atlas_mode = (env != NULL && strcmp(env, "0") != 0);
+  }
+  return m_atlas_mode;
+}
+
+/* shelf packing: items fill a row left to right, a new row starts below */
+static int atlas_place(EGLAtlas *atlas, int width, int height, DFBRectangle *rect)
+{
+  int w = width + ATLAS_PADDING, h = height + ATLAS_PADDING;
+  int shelf_x = atlas->shelf_x, shelf_y = atlas->shelf_y, shelf_h = atlas->shelf_h;
+
+  if (shelf_x + w > ATLAS_SIZE || (h > shelf_h && shelf_x > 0))
+  {
+    shelf_y += shelf_h;
+    shelf_x = 0;
+    shelf_h = 0;
+  }
+  if (shelf_x + w > ATLAS_SIZE || shelf_y + h > ATLAS_SIZE)
+    return 0;
+
+  rect->x = shelf_x;
+  rect->y = shelf_y;
+  rect->w = width;
+  rect->h = height;
+  atlas->shelf_x = shelf_x + w;
+  atlas->shelf_y = shelf_y;
+  atlas->shelf_h = h > shelf_h ? h : shelf_h;
+  atlas->textures++;
+  return 1;
+}
+
+/* returns the atlas page holding the new area or -1 */
+static int atlas_alloc(int width, int height, DFBRectangle *rect)
+{
+  DFBSurfaceDescription dsc;
+  int i;
+
+  for (i = 0; i < atlasPages; i++)
+  {
+    if (atlas_place(&egl_atlas[i], width, height, rect))
+      return i;
+  }
+  if (atlasPages == ATLAS_MAX_PAGES)
+    return -1;
+
+  dsc.flags  = (DFBSurfaceDescriptionFlags) (DSDESC_WIDTH | DSDESC_HEIGHT | 
+                                             DSDESC_PIXELFORMAT | DSDESC_CAPS);
+  dsc.caps   = DSCAPS_PREMULTIPLIED;
+  dsc.width  = ATLAS_SIZE;
+  dsc.height = ATLAS_SIZE;
+  dsc.pixelformat = DSPF_ARGB;
+
+  memset(&egl_atlas[i], 0, sizeof(EGLAtlas));
+  if (m_dfb->CreateSurface(m_dfb, &dsc, &egl_atlas[i].surface) != DFB_OK)
+    return -1;
+  /* padding between the items stays transparent */
+  egl_atlas[i].surface->Clear(egl_atlas[i].surface, 0, 0, 0, 0);
+  atlasPages++;
+
 #ifdef DEBUG
-  printf("%s:%s[%d] n=%d texture=%d\n", __FILE__, __func__, __LINE__, n, *textures);
+  printf("%s:%s[%d] new atlas page %d\n", __FILE__, __func__, __LINE__, i);
 #endif
+  return atlas_place(&egl_atlas[i], width, height, rect) ? i : -1;
+}
+
+/* an empty page is packed again from the top, the surface is kept */
+static void atlas_release(int page)
+{
+  EGLAtlas *atlas = &egl_atlas[page];
+
+  if (--atlas->textures == 0)
+  {
+    atlas->shelf_x = 0;
+    atlas->shelf_y = 0;
+    atlas->shelf_h = 0;
+    /* the padding of the next items has to be transparent again */
+    atlas->surface->Clear(atlas->surface, 0, 0, 0, 0);
+  }
+}
+
+static void texture_release(EGLTexture *texture)
+{
+  if (texture->surface == NULL)
+    return;
+
+  if (texture->atlas >= 0)
+    atlas_release(texture->atlas);
+  else
+    texture->surface->Release(texture->surface);
+  texture->surface = NULL;
+  texture->atlas = -1;
+}
+
+/* eglTerminate, the surfaces have to go before the IDirectFB interface */
+void glcore_terminate(void)
+{
+  int i;
+
+  glcore_release_surface();
+
+  /* textures in the atlas go with their page */
+  for (i = 0; i < texturesAllocated; i++)
+  {
+    if (egl_textures[i].surface != NULL && egl_textures[i].atlas < 0)
+      egl_textures[i].surface->Release(egl_textures[i].surface);
+  }
+  free(egl_textures);
+  egl_textures = NULL;
+  texturesAllocated = 0;
+  texturesCurrent = 0;
+
+  for (i = 0; i < atlasPages; i++)
+    egl_atlas[i].surface->Release(egl_atlas[i].surface);
+  memset(egl_atlas, 0, sizeof(egl_atlas));
+  atlasPages = 0;
+}
+
+void glGenTextures (GLsizei n, GLuint *textures)
+{
+  int i, j;
+
+  for (i = 0; i < n; i++)
+  {
+    /* search for a free name after the last one handed out, 0 is reserved */
+    for (j = 0; j < texturesAllocated; j++)
+    {
+      texturesCurrent++;
+      if (texturesCurrent >= texturesAllocated)
+        texturesCurrent = 1;
+      if (!egl_textures[texturesCurrent].used)
+        break;
+    }
+    if (j == texturesAllocated)
+      texturesCurrent = texturesAllocated > 0 ? texturesAllocated : 1;
+
+    if (texture_lookup(texturesCurrent) == NULL)
+    {
+      textures[i] = 0;
+      continue;
+    }
+    egl_textures[texturesCurrent].used = 1;
+    textures[i] = texturesCurrent;
+#ifdef DEBUG
+    printf("%s:%s[%d] n=%d texture=%d\n", __FILE__, __func__, __LINE__, n, textures[i]);
+#endif
+  }
 }
 
 void glDeleteTextures (GLsizei n, GLuint *textures)
 {
 #ifdef DEBUG
-  printf("%s:%s[%d] -> n=%d texture=%d p=%p\n", __FILE__, __func__, __LINE__, n, *textures, (void*)egl_textures[*textures].surface );
+  printf("%s:%s[%d] -> n=%d texture=%d\n", __FILE__, __func__, __LINE__, n, *textures);
 #endif
 
-  if (egl_textures[*textures].surface == NULL) return;
-  
-  egl_textures[*textures].surface->Release(egl_textures[*textures].surface);
-  
-  egl_textures[*textures].surface = NULL;
+  int i;
+
+  batch_flush();
+
+  for (i = 0; i < n; i++)
+  {
+    if (textures[i] == 0 || textures[i] >= texturesAllocated) continue;
+
+    texture_release(&egl_textures[textures[i]]);
+    egl_textures[textures[i]].used = 0;
+  }
 #ifdef DEBUG
   printf("%s:%s[%d] <-\n", __FILE__, __func__, __LINE__);
 #endif
@@ -171,7 +526,7 @@ void glDeleteTextures (GLsizei n, GLuint *textures)
 void glBindTexture (GLenum target, GLuint texture)
 {
 #ifdef DEBUG
-  printf("%s:%s[%d] ---------------- texture=%d (%p)\n", __FILE__, __func__, __LINE__, texture, egl_textures[texture].surface);
+  printf("%s:%s[%d] ---------------- texture=%d\n", __FILE__, __func__, __LINE__, texture);
 #endif
   //if (target == GL_TEXTURE_2D)
   m_bound_texture = texture;
@@ -182,6 +537,7 @@ GLboolean glIsTexture (GLuint texture) {
 #ifdef DEBUG
   printf("%s:%s[%d]\n", __FILE__, __func__, __LINE__);
 #endif
+  if (texture >= texturesAllocated) return GL_FALSE;
   return egl_textures[texture].surface == NULL?GL_FALSE:GL_TRUE;
 }
 
@@ -205,6 +561,33 @@ void glActiveTexture(GLenum texture)
 
 EGLint g_pixelformat = -1;
 
+/* Write a rectangle of 32bit pixels into the texture, x and y are relative to its area */
+static void texture_write(EGLTexture *texture, GLint x, GLint y,
+                          GLsizei width, GLsizei height, const GLvoid *pixels)
+{
+  DFBRectangle rect;
+  int w = texture->rect.w, h = texture->rect.h;
+  int pitch = 4 * width;
+
+  if (pixels == NULL || width <= 0 || height <= 0)
+    return;
+
+  /* clip to the area, the source pitch stays that of the full rectangle */
+  if (x < 0) { pixels = (const unsigned char *)pixels - 4 * x; width += x; x = 0; }
+  if (y < 0) { pixels = (const unsigned char *)pixels - pitch * y; height += y; y = 0; }
+  if (x + width > w) width = w - x;
+  if (y + height > h) height = h - y;
+  if (width <= 0 || height <= 0)
+    return;
+
+  rect.x = texture->rect.x + x;
+  rect.y = texture->rect.y + y;
+  rect.w = width;
+  rect.h = height;
+
+  texture->surface->Write(texture->surface, &rect, pixels, pitch);
+}
+
 //Hardcore translateion
 void glTexImage2D (GLenum target, GLint level, GLint internalformat, 
                    GLsizei width, GLsizei height, GLint border, GLenum format, 
@@ -214,42 +597,57 @@ void glTexImage2D (GLenum target, GLint level, GLint internalformat,
   printf("%s:%s[%d]\n", __FILE__, __func__, __LINE__);
 #endif
 
-  IDirectFBSurface * surface = NULL;
-  EGLSurface egl_surface = NULL;
-  DFBResult err = 0;
+  EGLTexture *texture = texture_lookup(m_bound_texture);
   DFBSurfaceDescription dsc;
-  CoreSurfaceBufferLock lock;
 
-  dsc.flags  = (DFBSurfaceDescriptionFlags) (DSDESC_WIDTH | DSDESC_HEIGHT | 
-                                             DSDESC_PIXELFORMAT | DSDESC_CAPS);
-  dsc.caps   = DSCAPS_PREMULTIPLIED;
-  dsc.width  = width;
-  dsc.height = height;
+  if (texture == NULL || width <= 0 || height <= 0)
+    return;
 
-  dsc.pixelformat = DSPF_ARGB;
+  /* pending blits may read the old content */
+  batch_flush();
 
-  m_dfb->CreateSurface(
-      m_dfb, 
-      &dsc, 
-      &surface);
+  /* a texture respecified with the same size keeps its surface */
+  if (texture->surface != NULL && (texture->rect.w != width || texture->rect.h != height))
+    texture_release(texture);
 
-#if 0
-  surface->Lock (surface, DSLF_WRITE, &lock.addr, &lock.pitch);
-  memcpy(lock.addr, pixels, width*height*4);
-  surface->Unlock (surface);
-#else
-  DFBRectangle rect;
-  rect.x = 0;
-  rect.y = 0;
-  rect.w = width;
-  rect.h = height;
+  if (texture->surface == NULL && atlas_enabled() &&
+      width <= ATLAS_MAX_ITEM && height <= ATLAS_MAX_ITEM)
+  {
+    int page = atlas_alloc(width, height, &texture->rect);
+    if (page >= 0)
+    {
+      texture->surface = egl_atlas[page].surface;
+      texture->atlas = page;
+    }
+  }
 
-  surface->Write(surface, &rect, pixels, 4*width);
-#endif
-  egl_textures[m_bound_texture].surface = surface;
+  if (texture->surface == NULL)
+  {
+    dsc.flags  = (DFBSurfaceDescriptionFlags) (DSDESC_WIDTH | DSDESC_HEIGHT | 
+                                               DSDESC_PIXELFORMAT | DSDESC_CAPS);
+    dsc.caps   = DSCAPS_PREMULTIPLIED;
+    dsc.width  = width;
+    dsc.height = height;
+
+    dsc.pixelformat = DSPF_ARGB;
+
+    if (m_dfb->CreateSurface(m_dfb, &dsc, &texture->surface) != DFB_OK)
+    {
+      texture->surface = NULL;
+      return;
+    }
+    texture->rect.x = 0;
+    texture->rect.y = 0;
+    texture->rect.w = width;
+    texture->rect.h = height;
+    texture->atlas = -1;
+  }
+  texture->used = 1;
+
+  texture_write(texture, 0, 0, width, height, pixels);
   
 #ifdef DEBUG
-  printf("%s:%s[%d] ---------------- texture=%d (%p)\n", __FILE__, __func__, __LINE__, texturesCurrent, egl_textures[texturesCurrent].surface);
+  printf("%s:%s[%d] ---------------- texture=%d (%p) atlas=%d\n", __FILE__, __func__, __LINE__, m_bound_texture, texture->surface, texture->atlas);
 #endif
 }
 
@@ -258,10 +656,15 @@ void glTexSubImage2D(GLenum target, GLint level, GLint xoffset,
                      GLenum format, GLenum type, const GLvoid * pixels)
 {
 #ifdef DEBUG
-  printf("%s:%s[%d]\n", __FILE__, __func__, __LINE__);
+  printf("%s:%s[%d] %d,%d:%d,%d\n", __FILE__, __func__, __LINE__, xoffset, yoffset, width, height);
 #endif
-  glTexImage2D(target, level, 0, width, height, 0, format, type, pixels);
 
+  /* no glTexImage2D yet, nothing to update */
+  if (m_bound_texture >= texturesAllocated || egl_textures[m_bound_texture].surface == NULL)
+    return;
+
+  batch_flush();
+  texture_write(&egl_textures[m_bound_texture], xoffset, yoffset, width, height, pixels);
 }
 
 
@@ -275,7 +678,7 @@ void glDrawArrays(GLenum mode, GLint first, GLsizei count)
 #endif
 
   if ((m_drawflags & GL_BLEND_BIT) == GL_BLEND_BIT)
-    m_mainwindow->SetPorterDuff (m_mainwindow, DSPD_SRC_OVER);
+    state_porter_duff(DSPD_SRC_OVER);
 
   if (mode == GL_QUADS)
   {
@@ -288,6 +691,19 @@ void glDrawArrays(GLenum mode, GLint first, GLsizei count)
     if (!count) return;
     
     if(g_glVertexPointerEnabled == 0) return;
+
+    if (m_bound_texture >= texturesAllocated) return;
+
+    IDirectFBSurface *texture = egl_textures[m_bound_texture].surface;
+    DFBRectangle area = egl_textures[m_bound_texture].rect;
+    int w = area.w, h = area.h;
+
+    if (texture == NULL) return;
+
+    if ((m_drawflags & GL_BLEND_BIT) == GL_BLEND_BIT)
+      state_drawing_flags(DSDRAW_BLEND);
+    else
+      state_drawing_flags(DSDRAW_NOFX);
     
     unsigned char *glColorPointerItr    = g_glColorPointer;
     GLfloat       *glVertexPointerItr   = g_glVertexPointer;
@@ -323,9 +739,6 @@ void glDrawArrays(GLenum mode, GLint first, GLsizei count)
             b != 0xff || a != 0xff)
           dsbf |= DSBLIT_COLORIZE;
 
-        if ((dsbf & DSBLIT_BLEND_COLORALPHA) == DSBLIT_BLEND_COLORALPHA || (dsbf & DSBLIT_COLORIZE) == DSBLIT_COLORIZE)
-          m_mainwindow->SetColor (m_mainwindow, r, g, b, a);
-
 #ifdef DEBUG
         glColorPointerItr += g_glColorPointerStride;
         
@@ -402,8 +815,6 @@ void glDrawArrays(GLenum mode, GLint first, GLsizei count)
       dstRectangle.y = points[7];
 
       DFBRectangle srcRectangle;
-      int w, h;
-      egl_textures[m_bound_texture].surface->GetSize(egl_textures[m_bound_texture].surface, &w, &h);
 
       if (g_glTexCoordPointerEnabled)
       {
@@ -459,6 +870,9 @@ void glDrawArrays(GLenum mode, GLint first, GLsizei count)
         srcRectangle.w = w;
         srcRectangle.h = h;
       }
+      /* texture area inside an atlas page */
+      srcRectangle.x += area.x;
+      srcRectangle.y += area.y;
 
       //DRAW
 #ifdef DRAWDEBUG
@@ -467,22 +881,13 @@ void glDrawArrays(GLenum mode, GLint first, GLsizei count)
 #endif
       //if (g_glColorPointerEnabled) m_mainwindow->FillRectangle (m_mainwindow, dstRectangle.x, dstRectangle.y, dstRectangle.w, dstRectangle.h);
 
-      m_mainwindow->SetBlittingFlags(m_mainwindow, dsbf);
-
-      if ((m_drawflags & GL_BLEND_BIT) == GL_BLEND_BIT)
-        m_mainwindow->SetDrawingFlags(m_mainwindow, DSDRAW_BLEND);
-      else
-        m_mainwindow->SetDrawingFlags(m_mainwindow, DSDRAW_NOFX);
-
-      //m_mainwindow->SetColor (m_mainwindow, r, g, b, a);
-
 #if DEBUG
       if (dsbf != DSBLIT_NOFX)
         printf("StrechBlit %d,%d:%d,%d -> %d,%d:%d,%d\n", srcRectangle.x, srcRectangle.y, srcRectangle.w, srcRectangle.h,
                                                         dstRectangle.x, dstRectangle.y, dstRectangle.w, dstRectangle.h);
 #endif
 
-      m_mainwindow->StretchBlit(m_mainwindow, egl_textures[m_bound_texture].surface, &srcRectangle, &dstRectangle);
+      batch_add(texture, dsbf, r, g, b, a, &srcRectangle, &dstRectangle);
     }
   }
 }
@@ -506,10 +911,11 @@ void glClear (GLbitfield mask)
   printf("%s:%s[%d]\n", __FILE__, __func__, __LINE__);
 #endif
 
-  DFBCHECK (m_mainwindow->SetColor (m_mainwindow, m_color_clear_r, m_color_clear_g
-                                                , m_color_clear_b, m_color_clear_a));
+  batch_flush();
+
+  state_color(m_color_clear_r, m_color_clear_g, m_color_clear_b, m_color_clear_a);
 
-  m_mainwindow->SetDrawingFlags(m_mainwindow, DSDRAW_NOFX);
+  state_drawing_flags(DSDRAW_NOFX);
 
   DFBCHECK (m_mainwindow->FillRectangle (m_mainwindow, 0, 0, MAINWINDOW_WIDTH, MAINWINDOW_HEIGHT));
 }
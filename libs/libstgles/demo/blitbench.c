@@ -0,0 +1,296 @@
+/*
+ * Offscreen blit benchmark for libstgles
+ *
+ * Draws a text page (glyph quads out of one texture, a few colour runs)
+ * and a row of scaled icons, each icon its own texture, into an offscreen
+ * surface. The DirectFB calls on that surface are counted, so the number
+ * of blit calls per frame can be compared with the number of quads, which
+ * is what one StretchBlit per quad used to cost. The frame time includes
+ * waiting for the accelerator.
+ *
+ * Build against the library sources, e.g.:
+ *   sh4-linux-gcc -O2 -o blitbench blitbench.c ../api/eglcore.c ../api/glcore.c \
+ *     -I../includes -I../api -ldirectfb -lpthread
+ *
+ * STGLES_ATLAS=1 puts the icons into the texture atlas.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <directfb.h>
+
+#include <EGL/egl.h>
+#include <GLES/gl.h>
+
+#include "common.h"
+
+#if DIRECTFB_MAJOR_VERSION > 1 || (DIRECTFB_MAJOR_VERSION == 1 && DIRECTFB_MINOR_VERSION >= 6)
+#define HAVE_BATCHSTRETCHBLIT
+#endif
+
+#define GLYPH_W      16
+#define GLYPH_H      24
+#define GLYPH_COLS   32
+#define GLYPH_ROWS   8
+#define TEXT_COLUMNS 76
+#define TEXT_LINES   28
+#define TEXT_QUADS   (TEXT_COLUMNS * TEXT_LINES)
+#define ICONS        12
+#define ICON_SIZE    64
+#define ICON_SCALED  96
+
+extern IDirectFB        *m_dfb;
+extern IDirectFBSurface *m_mainwindow;
+
+/* counted calls on the offscreen surface */
+static unsigned long m_blits = 0;
+static unsigned long m_blit_rects = 0;
+static unsigned long m_fills = 0;
+static unsigned long m_state_calls = 0;
+
+static DFBResult (*m_Blit)(IDirectFBSurface *, IDirectFBSurface *, const DFBRectangle *, int, int);
+static DFBResult (*m_StretchBlit)(IDirectFBSurface *, IDirectFBSurface *, const DFBRectangle *, const DFBRectangle *);
+static DFBResult (*m_BatchBlit)(IDirectFBSurface *, IDirectFBSurface *, const DFBRectangle *, const DFBPoint *, int);
+#ifdef HAVE_BATCHSTRETCHBLIT
+static DFBResult (*m_BatchStretchBlit)(IDirectFBSurface *, IDirectFBSurface *, const DFBRectangle *, const DFBRectangle *, int);
+#endif
+static DFBResult (*m_FillRectangle)(IDirectFBSurface *, int, int, int, int);
+static DFBResult (*m_SetBlittingFlags)(IDirectFBSurface *, DFBSurfaceBlittingFlags);
+static DFBResult (*m_SetDrawingFlags)(IDirectFBSurface *, DFBSurfaceDrawingFlags);
+static DFBResult (*m_SetColor)(IDirectFBSurface *, u8, u8, u8, u8);
+static DFBResult (*m_SetPorterDuff)(IDirectFBSurface *, DFBSurfacePorterDuffRule);
+
+static DFBResult count_Blit(IDirectFBSurface *thiz, IDirectFBSurface *source, const DFBRectangle *rect, int x, int y)
+{
+  m_blits++;
+  m_blit_rects++;
+  return m_Blit(thiz, source, rect, x, y);
+}
+
+static DFBResult count_StretchBlit(IDirectFBSurface *thiz, IDirectFBSurface *source, const DFBRectangle *src, const DFBRectangle *dst)
+{
+  m_blits++;
+  m_blit_rects++;
+  return m_StretchBlit(thiz, source, src, dst);
+}
+
+static DFBResult count_BatchBlit(IDirectFBSurface *thiz, IDirectFBSurface *source, const DFBRectangle *rects, const DFBPoint *points, int num)
+{
+  m_blits++;
+  m_blit_rects += num;
+  return m_BatchBlit(thiz, source, rects, points, num);
+}
+
+#ifdef HAVE_BATCHSTRETCHBLIT
+static DFBResult count_BatchStretchBlit(IDirectFBSurface *thiz, IDirectFBSurface *source, const DFBRectangle *src, const DFBRectangle *dst, int num)
+{
+  m_blits++;
+  m_blit_rects += num;
+  return m_BatchStretchBlit(thiz, source, src, dst, num);
+}
+#endif
+
+static DFBResult count_FillRectangle(IDirectFBSurface *thiz, int x, int y, int w, int h)
+{
+  m_fills++;
+  return m_FillRectangle(thiz, x, y, w, h);
+}
+
+static DFBResult count_SetBlittingFlags(IDirectFBSurface *thiz, DFBSurfaceBlittingFlags flags)
+{
+  m_state_calls++;
+  return m_SetBlittingFlags(thiz, flags);
+}
+
+static DFBResult count_SetDrawingFlags(IDirectFBSurface *thiz, DFBSurfaceDrawingFlags flags)
+{
+  m_state_calls++;
+  return m_SetDrawingFlags(thiz, flags);
+}
+
+static DFBResult count_SetColor(IDirectFBSurface *thiz, u8 r, u8 g, u8 b, u8 a)
+{
+  m_state_calls++;
+  return m_SetColor(thiz, r, g, b, a);
+}
+
+static DFBResult count_SetPorterDuff(IDirectFBSurface *thiz, DFBSurfacePorterDuffRule rule)
+{
+  m_state_calls++;
+  return m_SetPorterDuff(thiz, rule);
+}
+
+/* offscreen surface in place of the main window, with counting methods */
+static void create_offscreen(void)
+{
+  DFBSurfaceDescription dsc;
+
+  dsc.flags       = DSDESC_WIDTH | DSDESC_HEIGHT | DSDESC_PIXELFORMAT | DSDESC_CAPS;
+  dsc.caps        = DSCAPS_NONE;
+  dsc.width       = MAINWINDOW_WIDTH;
+  dsc.height      = MAINWINDOW_HEIGHT;
+  dsc.pixelformat = DSPF_ARGB;
+  DFBCHECK (m_dfb->CreateSurface(m_dfb, &dsc, &m_mainwindow));
+
+  m_Blit              = m_mainwindow->Blit;
+  m_StretchBlit       = m_mainwindow->StretchBlit;
+  m_BatchBlit         = m_mainwindow->BatchBlit;
+  m_FillRectangle     = m_mainwindow->FillRectangle;
+  m_SetBlittingFlags  = m_mainwindow->SetBlittingFlags;
+  m_SetDrawingFlags   = m_mainwindow->SetDrawingFlags;
+  m_SetColor          = m_mainwindow->SetColor;
+  m_SetPorterDuff     = m_mainwindow->SetPorterDuff;
+
+  m_mainwindow->Blit              = count_Blit;
+  m_mainwindow->StretchBlit       = count_StretchBlit;
+  m_mainwindow->BatchBlit         = count_BatchBlit;
+  m_mainwindow->FillRectangle     = count_FillRectangle;
+  m_mainwindow->SetBlittingFlags  = count_SetBlittingFlags;
+  m_mainwindow->SetDrawingFlags   = count_SetDrawingFlags;
+  m_mainwindow->SetColor          = count_SetColor;
+  m_mainwindow->SetPorterDuff     = count_SetPorterDuff;
+#ifdef HAVE_BATCHSTRETCHBLIT
+  m_BatchStretchBlit  = m_mainwindow->BatchStretchBlit;
+  m_mainwindow->BatchStretchBlit  = count_BatchStretchBlit;
+#endif
+}
+
+static GLuint create_texture(int width, int height, unsigned int seed)
+{
+  unsigned int *pixels = (unsigned int *) malloc(width * height * 4);
+  GLuint texture;
+  int i;
+
+  for (i = 0; i < width * height; i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    pixels[i] = (seed >> 8) | 0xff000000;
+  }
+
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+  free(pixels);
+  return texture;
+}
+
+/* quad vertices in the order glDrawArrays reads them */
+static void quad(GLfloat *v, GLfloat *t, float x, float y, float w, float h,
+                 float u1, float v1, float u2, float v2)
+{
+  v[0] = x;     v[1] = y;
+  v[2] = x;     v[3] = y + h;
+  v[4] = x + w; v[5] = y;
+  v[6] = x + w; v[7] = y + h;
+
+  t[0] = u1; t[1] = v1;
+  t[2] = u1; t[3] = v2;
+  t[4] = u2; t[5] = v1;
+  t[6] = u2; t[7] = v2;
+}
+
+static long long now_us(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (long long) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+int main(int argc, char *argv[])
+{
+  int frames = argc > 1 ? atoi(argv[1]) : 200;
+  static GLfloat text_vertex[TEXT_QUADS * 8], text_coord[TEXT_QUADS * 8];
+  static GLubyte text_color[TEXT_QUADS * 16];
+  GLfloat icon_vertex[8], icon_coord[8];
+  GLubyte icon_color[16];
+  GLuint glyphs, icons[ICONS];
+  long long start, elapsed;
+  int i, j;
+
+  if (frames < 1)
+    frames = 1;
+
+  if (!eglInitialize(eglGetDisplay(EGL_DEFAULT_DISPLAY), NULL, NULL))
+  {
+    printf("EGL failed to initialize\n");
+    return 1;
+  }
+  create_offscreen();
+
+  glyphs = create_texture(GLYPH_W * GLYPH_COLS, GLYPH_H * GLYPH_ROWS, 1);
+  for (i = 0; i < ICONS; i++)
+    icons[i] = create_texture(ICON_SIZE, ICON_SIZE, i + 2);
+
+  /* text page, the colour changes every 12 glyphs */
+  for (i = 0; i < TEXT_QUADS; i++)
+  {
+    int c = (i * 7) % (GLYPH_COLS * GLYPH_ROWS);
+    float u = (float) (c % GLYPH_COLS) / GLYPH_COLS;
+    float v = (float) (c / GLYPH_COLS) / GLYPH_ROWS;
+
+    quad(text_vertex + i * 8, text_coord + i * 8,
+         40 + (i % TEXT_COLUMNS) * GLYPH_W, 24 + (i / TEXT_COLUMNS) * GLYPH_H, GLYPH_W, GLYPH_H,
+         u, v, u + 1.0f / GLYPH_COLS, v + 1.0f / GLYPH_ROWS);
+    for (j = 0; j < 4; j++)
+    {
+      text_color[i * 16 + j * 4 + 0] = (i / 12) & 1 ? 0xff : 0xc0;
+      text_color[i * 16 + j * 4 + 1] = 0xff;
+      text_color[i * 16 + j * 4 + 2] = (i / 12) & 1 ? 0xff : 0x40;
+      text_color[i * 16 + j * 4 + 3] = 0xff;
+    }
+  }
+  memset(icon_color, 0xff, sizeof(icon_color));
+
+  glEnable(GL_TEXTURE_2D);
+  glEnable(GL_BLEND);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+  glEnableClientState(GL_COLOR_ARRAY);
+  glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+
+  m_blits = m_blit_rects = m_fills = m_state_calls = 0;
+  start = now_us();
+
+  for (i = 0; i < frames; i++)
+  {
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    glBindTexture(GL_TEXTURE_2D, glyphs);
+    glVertexPointer(2, GL_FLOAT, 0, text_vertex);
+    glTexCoordPointer(2, GL_FLOAT, 0, text_coord);
+    glColorPointer(4, GL_UNSIGNED_BYTE, 0, text_color);
+    glDrawArrays(GL_QUADS, 0, TEXT_QUADS * 4);
+
+    for (j = 0; j < ICONS; j++)
+    {
+      quad(icon_vertex, icon_coord, 40 + j * (ICON_SCALED + 8), MAINWINDOW_HEIGHT - ICON_SCALED - 8,
+           ICON_SCALED, ICON_SCALED, 0.0f, 0.0f, 1.0f, 1.0f);
+      glBindTexture(GL_TEXTURE_2D, icons[j]);
+      glVertexPointer(2, GL_FLOAT, 0, icon_vertex);
+      glTexCoordPointer(2, GL_FLOAT, 0, icon_coord);
+      glColorPointer(4, GL_UNSIGNED_BYTE, 0, icon_color);
+      glDrawArrays(GL_QUADS, 0, 4);
+    }
+
+    /* what eglSwapBuffers does before the flip, then wait for the accelerator */
+    glcore_flush();
+    m_dfb->WaitIdle(m_dfb);
+  }
+
+  elapsed = now_us() - start;
+
+  printf("%d frames, %d quads per frame (%d glyphs, %d scaled icons)\n", frames, TEXT_QUADS + ICONS, TEXT_QUADS, ICONS);
+  printf("blit calls per frame:  %.1f (%.1f rectangles)\n", (double) m_blits / frames, (double) m_blit_rects / frames);
+  printf("state calls per frame: %.1f\n", (double) m_state_calls / frames);
+  printf("fills per frame:       %.1f\n", (double) m_fills / frames);
+  printf("frame time:            %.3f ms\n", elapsed / 1000.0 / frames);
+
+  glDeleteTextures(1, &glyphs);
+  glDeleteTextures(ICONS, icons);
+  eglDestroySurface(NULL, NULL);
+  eglTerminate(NULL);
+
+  return 0;
+}
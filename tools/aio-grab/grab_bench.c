@@ -0,0 +1,342 @@
+/*
+ * aio-grab kernel benchmark
+ *
+ * Runs the yuv2rgb conversion, the resize and the combine stages of grab
+ * on synthetic 720p and 1080p frames, no decoder or framebuffer needed.
+ * Each stage is timed with the current kernel and with the loop it
+ * replaced, and the outputs of both are compared.
+ *
+ * usage: grab_bench [iterations]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#define main grab_main
+#include "main.c"
+#undef main
+
+// the loops as they were before the kernels were reworked
+
+static void old_yuv420_to_rgb(unsigned char *video, const unsigned char *luma, const unsigned char *chroma, int stride, int res)
+{
+	const int rgbstride = stride * 3;
+	const int scans = res / 2;
+	int y;
+	for (y = 0; y < scans; ++y)
+	{
+		int x;
+		int out1 = y * rgbstride * 2;
+		int pos = y * stride * 2;
+		const unsigned char *chroma_p = chroma + (y * stride);
+
+		for (x = stride; x != 0; x -= 2)
+		{
+			int U = *chroma_p++;
+			int V = *chroma_p++;
+
+			int RU = yuv2rgbtable_ru[U];
+			int GU = yuv2rgbtable_gu[U];
+			int GV = yuv2rgbtable_gv[V];
+			int BV = yuv2rgbtable_bv[V];
+
+			int Y = yuv2rgbtable_y[luma[pos]];
+
+			video[out1] = CLAMP((Y + RU) >> 16);
+			video[out1 + 1] = CLAMP((Y - GV - GU) >> 16);
+			video[out1 + 2] = CLAMP((Y + BV) >> 16);
+
+			Y = yuv2rgbtable_y[luma[stride + pos]];
+
+			video[out1 + rgbstride] = CLAMP((Y + RU) >> 16);
+			video[out1 + 1 + rgbstride] = CLAMP((Y - GV - GU) >> 16);
+			video[out1 + 2 + rgbstride] = CLAMP((Y + BV) >> 16);
+
+			pos++;
+			out1 += 3;
+
+			Y = yuv2rgbtable_y[luma[pos]];
+
+			video[out1] = CLAMP((Y + RU) >> 16);
+			video[out1 + 1] = CLAMP((Y - GV - GU) >> 16);
+			video[out1 + 2] = CLAMP((Y + BV) >> 16);
+
+			Y = yuv2rgbtable_y[luma[stride + pos]];
+
+			video[out1 + rgbstride] = CLAMP((Y + RU) >> 16);
+			video[out1 + 1 + rgbstride] = CLAMP((Y - GV - GU) >> 16);
+			video[out1 + 2 + rgbstride] = CLAMP((Y + BV) >> 16);
+
+			pos++;
+			out1 += 3;
+		}
+	}
+}
+
+// the old loop reads one pixel past the line on the last box, the source has room for it
+static void old_smooth_resize(const unsigned char *source, unsigned char *dest, int xsource, int ysource, int xdest, int ydest, int colors)
+{
+	const unsigned int xs = xsource;
+	const unsigned int ys = ysource;
+	const unsigned int xd = xdest;
+	const unsigned int yd = ydest;
+
+	unsigned int sx1[xd];
+	unsigned int sx2[xd];
+	const int fx = ((xs - 1) << 16) / xd;
+	const int fy = ((ys - 1) << 16) / yd;
+	int x, y;
+
+	for (x = 0; x < xd; x++)
+	{
+		sx1[x] = (fx * x) >> 16;
+		sx2[x] = sx1[x] + (fx >> 16);
+		if (fx & 0x7FFF)
+			sx2[x]++;
+	}
+
+	for (y = 0; y < yd; y++)
+	{
+		unsigned int dpixel;
+		unsigned int c, tmp_i;
+		int t, t1;
+
+		const unsigned int sy1 = (fy * y) >> 16;
+		unsigned int sy2 = sy1 + (fy >> 16);
+		if (fy & 0x7FFF)
+			sy2++;
+
+		for (x = 0; x < xd; x++)
+		{
+			for (c = 0; c < colors; c++)
+			{
+				tmp_i = 0;
+				dpixel = 0;
+
+				for (t1 = sy1; t1 < sy2; t1++)
+				{
+					for (t = sx1[x]; t <= sx2[x]; t++)
+					{
+						tmp_i += (int)source[(t * colors) + c + (t1 * xs * colors)];
+						dpixel++;
+					}
+				}
+				dest[(x * colors) + c + (y * xd * colors)] = tmp_i / dpixel;
+			}
+		}
+	}
+}
+
+static void old_fast_resize(const unsigned char *source, unsigned char *dest, int xsource, int ysource, int xdest, int ydest, int colors)
+{
+	const int x_ratio = (int)((xsource << 16) / xdest) ;
+	const int y_ratio = (int)((ysource << 16) / ydest) ;
+	int i;
+	for (i = 0; i < ydest; i++)
+	{
+		int y2_xsource = ((i * y_ratio) >> 16) * xsource;
+		int i_xdest = i * xdest;
+		int j;
+		for (j = 0; j < xdest; j++)
+		{
+			int x2 = ((j * x_ratio) >> 16) ;
+			int y2_x2_colors = (y2_xsource + x2) * colors;
+			int i_x_colors = (i_xdest + j) * colors;
+			int c;
+			for (c = 0; c < colors; c++)
+				dest[i_x_colors + c] = source[y2_x2_colors + c] ;
+		}
+	}
+}
+
+static void old_combine_osd(unsigned char *output, const unsigned char *osd, int count)
+{
+	for (; count > 0; count--, output += 3, osd += 4)
+	{
+		output[0] = (osd[0] * osd[3]) >> 8;
+		output[1] = (osd[1] * osd[3]) >> 8;
+		output[2] = (osd[2] * osd[3]) >> 8;
+	}
+}
+
+static void old_combine(unsigned char *output, const unsigned char *video, const unsigned char *osd, int vleft, int vtop, int vwidth, int vheight, int xres, int yres)
+{
+	const int vbottom = vtop + vheight;
+	const int vright = vleft + vwidth;
+	int x, y;
+	for (y = 0; y < yres; y++)
+	{
+		unsigned char *oline = output + y * xres * 3;
+		const unsigned char *osdline = osd + y * xres * 4;
+		if (y < vtop || y >= vbottom)
+		{
+			old_combine_osd(oline, osdline, xres);
+			continue;
+		}
+		old_combine_osd(oline, osdline, vleft);
+		for (x = vleft; x < vright; x++)
+		{
+			const unsigned char *o = osdline + x * 4;
+			const unsigned char *v = video + ((y - vtop) * vwidth + (x - vleft)) * 3;
+			const int a2 = 0xFF - o[3];
+			oline[x * 3 + 0] = ((v[0] * a2) + (o[0] * o[3])) >> 8;
+			oline[x * 3 + 1] = ((v[1] * a2) + (o[1] * o[3])) >> 8;
+			oline[x * 3 + 2] = ((v[2] * a2) + (o[2] * o[3])) >> 8;
+		}
+		old_combine_osd(oline + vright * 3, osdline + vright * 4, xres - vright);
+	}
+}
+
+// benchmark
+
+static long long now_us(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static unsigned int seed = 1;
+
+static unsigned char rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 16;
+}
+
+// osd with large transparent areas, a few opaque boxes and some antialiased edges
+static void fill_osd(unsigned char *osd, int xres, int yres)
+{
+	int x, y;
+	for (y = 0; y < yres; y++)
+	{
+		for (x = 0; x < xres; x++)
+		{
+			unsigned char *p = osd + (y * xres + x) * 4;
+			p[0] = rnd();
+			p[1] = rnd();
+			p[2] = rnd();
+			if (y > yres * 3 / 4 && x > xres / 8 && x < xres * 7 / 8)
+				p[3] = (x & 15) == 0 ? rnd() : 0xFF;
+			else
+				p[3] = (rnd() & 63) == 0 ? rnd() : 0;
+		}
+	}
+}
+
+static void report(const char *stage, long long old_us, long long new_us, int iterations, int same)
+{
+	printf("  %-14s old %8.2f ms  new %8.2f ms  x%5.2f  %s\n", stage,
+		old_us / 1000.0 / iterations, new_us / 1000.0 / iterations,
+		new_us ? (double)old_us / new_us : 0.0, same ? "identical" : "differs");
+}
+
+static void run(int xres, int yres, int osd_xres, int osd_yres, int iterations)
+{
+	const int stride = xres;
+	const int res = yres;
+	const int vleft = osd_xres / 8, vtop = osd_yres / 8;
+	const int vwidth = osd_xres / 2, vheight = osd_yres / 2;
+	unsigned char *luma = malloc(stride * res);
+	unsigned char *chroma = malloc(stride * res / 2);
+	unsigned char *video = malloc(stride * res * 3 + 3);
+	unsigned char *scaled_old = malloc(osd_xres * osd_yres * 3);
+	unsigned char *scaled_new = malloc(osd_xres * osd_yres * 3);
+	unsigned char *pip = malloc(vwidth * vheight * 3);
+	unsigned char *osd = malloc(osd_xres * osd_yres * 4);
+	unsigned char *out_old = malloc(osd_xres * osd_yres * 3);
+	unsigned char *out_new = malloc(osd_xres * osd_yres * 3);
+	unsigned char *video_old = malloc(stride * res * 3 + 3);
+	long long t, old_us, new_us;
+	int i;
+
+	if (!luma || !chroma || !video || !scaled_old || !scaled_new || !pip || !osd || !out_old || !out_new || !video_old)
+	{
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	for (i = 0; i < stride * res; i++)
+		luma[i] = rnd();
+	for (i = 0; i < stride * res / 2; i++)
+		chroma[i] = rnd();
+	fill_osd(osd, osd_xres, osd_yres);
+	memset(video + stride * res * 3, 0, 3);
+	memset(video_old + stride * res * 3, 0, 3);
+
+	printf("video %dx%d, osd %dx%d, %d iterations\n", xres, yres, osd_xres, osd_yres, iterations);
+
+	t = now_us();
+	for (i = 0; i < iterations; i++)
+		old_yuv420_to_rgb(video_old, luma, chroma, stride, res);
+	old_us = now_us() - t;
+	t = now_us();
+	for (i = 0; i < iterations; i++)
+		yuv420_to_rgb(video, luma, chroma, stride, res, 0);
+	new_us = now_us() - t;
+	report("yuv420_to_rgb", old_us, new_us, iterations, !memcmp(video, video_old, stride * res * 3));
+
+	// sx2 is clamped now, only the last column may differ from the old loop
+	t = now_us();
+	for (i = 0; i < iterations; i++)
+		old_smooth_resize(video, scaled_old, xres, yres, osd_xres, osd_yres, 3);
+	old_us = now_us() - t;
+	t = now_us();
+	for (i = 0; i < iterations; i++)
+		smooth_resize(video, scaled_new, xres, yres, osd_xres, osd_yres, 3);
+	new_us = now_us() - t;
+	{
+		int y, same = 1;
+		for (y = 0; y < osd_yres; y++)
+			same &= !memcmp(scaled_old + y * osd_xres * 3, scaled_new + y * osd_xres * 3, (osd_xres - 1) * 3);
+		report("smooth_resize", old_us, new_us, iterations, same);
+	}
+
+	t = now_us();
+	for (i = 0; i < iterations; i++)
+		old_fast_resize(video, scaled_old, xres, yres, osd_xres, osd_yres, 3);
+	old_us = now_us() - t;
+	t = now_us();
+	for (i = 0; i < iterations; i++)
+		fast_resize(video, scaled_new, xres, yres, osd_xres, osd_yres, 3);
+	new_us = now_us() - t;
+	report("fast_resize", old_us, new_us, iterations, !memcmp(scaled_old, scaled_new, osd_xres * osd_yres * 3));
+
+	// picture in picture, the video covers a quarter of the osd
+	fast_resize(video, pip, xres, yres, vwidth, vheight, 3);
+	t = now_us();
+	for (i = 0; i < iterations; i++)
+		old_combine(out_old, pip, osd, vleft, vtop, vwidth, vheight, osd_xres, osd_yres);
+	old_us = now_us() - t;
+	t = now_us();
+	for (i = 0; i < iterations; i++)
+		combine(out_new, pip, osd, vleft, vtop, vwidth, vheight, osd_xres, osd_yres);
+	new_us = now_us() - t;
+	report("combine", old_us, new_us, iterations, !memcmp(out_old, out_new, osd_xres * osd_yres * 3));
+
+	free(luma);
+	free(chroma);
+	free(video);
+	free(video_old);
+	free(scaled_old);
+	free(scaled_new);
+	free(pip);
+	free(osd);
+	free(out_old);
+	free(out_new);
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = argc > 1 ? atoi(argv[1]) : 10;
+	if (iterations < 1)
+		iterations = 1;
+
+	init_tables();
+	run(1280, 720, 1280, 720, iterations);
+	run(1920, 1080, 1280, 720, iterations);
+	return 0;
+}
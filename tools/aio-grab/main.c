@@ -144,12 +144,26 @@ static const int yuv2rgbtable_bv[256] =
 	0xFF33A280, 0xFF353B3B, 0xFF36D3F6, 0xFF386CB1, 0xFF3A056C, 0xFF3B9E27, 0xFF3D36E2, 0xFF3ECF9D, 0xFF406858, 0xFF420113, 0xFF4399CE, 0xFF453289, 0xFF46CB44, 0xFF4863FF, 0xFF49FCBA, 0xFF4B9575, 0xFF4D2E30, 0xFF4EC6EB, 0xFF505FA6, 0xFF51F861, 0xFF53911C, 0xFF5529D7, 0xFF56C292, 0xFF585B4D, 0xFF59F408, 0xFF5B8CC3, 0xFF5D257E, 0xFF5EBE39, 0xFF6056F4, 0xFF61EFAF, 0xFF63886A, 0xFF652125, 0xFF66B9E0, 0xFF68529B, 0xFF69EB56, 0xFF6B8411, 0xFF6D1CCC, 0xFF6EB587, 0xFF704E42, 0xFF71E6FD, 0xFF737FB8, 0xFF751873, 0xFF76B12E, 0xFF7849E9, 0xFF79E2A4, 0xFF7B7B5F, 0xFF7D141A, 0xFF7EACD5, 0xFF804590, 0xFF81DE4B, 0xFF837706, 0xFF850FC1, 0xFF86A87C, 0xFF884137, 0xFF89D9F2, 0xFF8B72AD, 0xFF8D0B68, 0xFF8EA423, 0xFF903CDE, 0xFF91D599, 0xFF936E54, 0xFF95070F, 0xFF969FCA, 0xFF983885, 0xFF99D140, 0xFF9B69FB, 0xFF9D02B6, 0xFF9E9B71, 0xFFA0342C, 0xFFA1CCE7, 0xFFA365A2, 0xFFA4FE5D, 0xFFA69718, 0xFFA82FD3, 0xFFA9C88E, 0xFFAB6149, 0xFFACFA04, 0xFFAE92BF, 0xFFB02B7A, 0xFFB1C435, 0xFFB35CF0, 0xFFB4F5AB, 0xFFB68E66, 0xFFB82721, 0xFFB9BFDC, 0xFFBB5897, 0xFFBCF152, 0xFFBE8A0D, 0xFFC022C8, 0xFFC1BB83, 0xFFC3543E, 0xFFC4ECF9, 0xFFC685B4, 0xFFC81E6F, 0xFFC9B72A, 0xFFCB4FE5, 0xFFCCE8A0, 0xFFCE815B, 0xFFD01A16, 0xFFD1B2D1, 0xFFD34B8C, 0xFFD4E447, 0xFFD67D02, 0xFFD815BD, 0xFFD9AE78, 0xFFDB4733, 0xFFDCDFEE, 0xFFDE78A9, 0xFFE01164, 0xFFE1AA1F, 0xFFE342DA, 0xFFE4DB95, 0xFFE67450, 0xFFE80D0B, 0xFFE9A5C6, 0xFFEB3E81, 0xFFECD73C, 0xFFEE6FF7, 0xFFF008B2, 0xFFF1A16D, 0xFFF33A28, 0xFFF4D2E3, 0xFFF66B9E, 0xFFF80459, 0xFFF99D14, 0xFFFB35CF, 0xFFFCCE8A, 0xFFFE6745, 0x0, 0x198BB, 0x33176, 0x4CA31, 0x662EC, 0x7FBA7, 0x99462, 0xB2D1D, 0xCC5D8, 0xE5E93, 0xFF74E, 0x119009, 0x1328C4, 0x14C17F, 0x165A3A, 0x17F2F5, 0x198BB0, 0x1B246B, 0x1CBD26, 0x1E55E1, 0x1FEE9C, 0x218757, 0x232012, 0x24B8CD, 0x265188, 0x27EA43, 0x2982FE, 0x2B1BB9, 0x2CB474, 0x2E4D2F, 0x2FE5EA, 0x317EA5, 0x331760, 0x34B01B, 0x3648D6, 0x37E191, 0x397A4C, 0x3B1307, 0x3CABC2, 0x3E447D, 0x3FDD38, 0x4175F3, 0x430EAE, 0x44A769, 0x464024, 0x47D8DF, 0x49719A, 0x4B0A55, 0x4CA310, 0x4E3BCB, 0x4FD486, 0x516D41, 0x5305FC, 0x549EB7, 0x563772, 0x57D02D, 0x5968E8, 0x5B01A3, 0x5C9A5E, 0x5E3319, 0x5FCBD4, 0x61648F, 0x62FD4A, 0x649605, 0x662EC0, 0x67C77B, 0x696036, 0x6AF8F1, 0x6C91AC, 0x6E2A67, 0x6FC322, 0x715BDD, 0x72F498, 0x748D53, 0x76260E, 0x77BEC9, 0x795784, 0x7AF03F, 0x7C88FA, 0x7E21B5, 0x7FBA70, 0x81532B, 0x82EBE6, 0x8484A1, 0x861D5C, 0x87B617, 0x894ED2, 0x8AE78D, 0x8C8048, 0x8E1903, 0x8FB1BE, 0x914A79, 0x92E334, 0x947BEF, 0x9614AA, 0x97AD65, 0x994620, 0x9ADEDB, 0x9C7796, 0x9E1051, 0x9FA90C, 0xA141C7, 0xA2DA82, 0xA4733D, 0xA60BF8, 0xA7A4B3, 0xA93D6E, 0xAAD629, 0xAC6EE4, 0xAE079F, 0xAFA05A, 0xB13915, 0xB2D1D0, 0xB46A8B, 0xB60346, 0xB79C01, 0xB934BC, 0xBACD77, 0xBC6632, 0xBDFEED, 0xBF97A8, 0xC13063, 0xC2C91E, 0xC461D9, 0xC5FA94, 0xC7934F, 0xC92C0A, 0xCAC4C5
 };
 
+// clamping table for yuv2rgb, indexed by the unclamped value + YUV2RGB_CLAMP_OFS
+#define YUV2RGB_CLAMP_OFS 1024
+static unsigned char yuv2rgb_clamp[YUV2RGB_CLAMP_OFS * 2];
+
+// (x * 255) >> 8, result of blending with a fully transparent or opaque osd pixel
+static unsigned char mul255[256];
+
+// largest box for which smooth_resize divides by multiplying with a 8.24 reciprocal,
+// the result is exact as long as 255 * box * (box - 1) < 1 << 24
+#define BOX_RECIP_MAX 256
+static unsigned int box_recip[BOX_RECIP_MAX + 1];
+
 void getvideo(unsigned char *video, int *xres, int *yres);
 void getosd(unsigned char *osd, int *xres, int *yres);
 void smooth_resize(const unsigned char *source, unsigned char *dest, int xsource, int ysource, int xdest, int ydest, int colors);
 void fast_resize(const unsigned char *source, unsigned char *dest, int xsource, int ysource, int xdest, int ydest, int colors);
 void (*resize)(const unsigned char *source, unsigned char *dest, int xsource, int ysource, int xdest, int ydest, int colors);
 void combine(unsigned char *output, const unsigned char *video, const unsigned char *osd, int vleft, int vtop, int vwidth, int vheight, int xres, int yres);
+void yuv420_to_rgb(unsigned char *video, const unsigned char *luma, const unsigned char *chroma, int stride, int res, int bgr);
+void init_tables(void);
 
 static enum {UNKNOWN, AZBOX863x, AZBOX865x, ST, PALLAS, VULCAN, XILLEON, BRCM7400, BRCM7401, BRCM7405, BRCM7325, BRCM7335, BRCM7346, BRCM7358, BRCM7362, BRCM7241, BRCM7356, BRCM7424, BRCM7425} stb_type = UNKNOWN;
 
@@ -168,6 +182,7 @@ int main(int argc, char **argv)
 
 	// we use fast resize as standard now
 	resize = &fast_resize;
+	init_tables();
 
 	osd_only = video_only = use_osd_res = width = use_png = use_jpg = no_aspect = use_letterbox = 0;
 	jpg_quality = 50;
@@ -1562,72 +1577,70 @@ void getvideo(unsigned char *video, int *xres, int *yres)
 
 	close(mem_fd);
 
-	// yuv2rgb conversion (4:2:0)
+	// yuv2rgb conversion (4:2:0), on xilleon we use bgr instead of rgb
+	yuv420_to_rgb(video, luma, chroma, stride, res, stb_type == XILLEON);
+
+	*xres = stride;
+	*yres = res;
+	free(luma);
+	free(chroma);
+}
+
+// yuv2rgb conversion (4:2:0), two lines at once sharing the chroma samples
+void yuv420_to_rgb(unsigned char *video, const unsigned char *luma, const unsigned char *chroma, int stride, int res, int bgr)
+{
+	const unsigned char *clamp = yuv2rgb_clamp + YUV2RGB_CLAMP_OFS;
 	const int rgbstride = stride * 3;
 	const int scans = res / 2;
+	// on bgr simply swap the position of red and blue
+	const int r = bgr ? 2 : 0;
+	const int b = bgr ? 0 : 2;
 	int y;
 	#pragma omp parallel for
 	for (y = 0; y < scans; ++y)
 	{
-		int x;
-		int out1 = y * rgbstride * 2;
-		int pos = y * stride * 2;
+		const unsigned char *luma0 = luma + y * stride * 2;
+		const unsigned char *luma1 = luma0 + stride;
 		const unsigned char *chroma_p = chroma + (y * stride);
+		unsigned char *out0 = video + y * rgbstride * 2;
+		unsigned char *out1 = out0 + rgbstride;
+		int x;
 
 		for (x = stride; x != 0; x -= 2)
 		{
-			int U = *chroma_p++;
-			int V = *chroma_p++;
-
-			int RU = yuv2rgbtable_ru[U]; // use lookup tables to speedup the whole thing
-			int GU = yuv2rgbtable_gu[U];
-			int GV = yuv2rgbtable_gv[V];
-			int BV = yuv2rgbtable_bv[V];
-
-			switch (stb_type) //on xilleon we use bgr instead of rgb so simply swap the coeffs
-			{
-				case XILLEON:
-					SWAP(RU, BV);
-					break;
-			}
+			const int RU = yuv2rgbtable_ru[chroma_p[0]]; // use lookup tables to speedup the whole thing
+			const int G = yuv2rgbtable_gu[chroma_p[0]] + yuv2rgbtable_gv[chroma_p[1]];
+			const int BV = yuv2rgbtable_bv[chroma_p[1]];
+			int Y;
 
 			// now we do 4 pixels on each iteration this is more code but much faster
-			int Y = yuv2rgbtable_y[luma[pos]];
-
-			video[out1] = CLAMP((Y + RU) >> 16);
-			video[out1 + 1] = CLAMP((Y - GV - GU) >> 16);
-			video[out1 + 2] = CLAMP((Y + BV) >> 16);
-
-			Y = yuv2rgbtable_y[luma[stride + pos]];
-
-			video[out1 + rgbstride] = CLAMP((Y + RU) >> 16);
-			video[out1 + 1 + rgbstride] = CLAMP((Y - GV - GU) >> 16);
-			video[out1 + 2 + rgbstride] = CLAMP((Y + BV) >> 16);
-
-			pos++;
-			out1 += 3;
-
-			Y = yuv2rgbtable_y[luma[pos]];
-
-			video[out1] = CLAMP((Y + RU) >> 16);
-			video[out1 + 1] = CLAMP((Y - GV - GU) >> 16);
-			video[out1 + 2] = CLAMP((Y + BV) >> 16);
-
-			Y = yuv2rgbtable_y[luma[stride + pos]];
-
-			video[out1 + rgbstride] = CLAMP((Y + RU) >> 16);
-			video[out1 + 1 + rgbstride] = CLAMP((Y - GV - GU) >> 16);
-			video[out1 + 2 + rgbstride] = CLAMP((Y + BV) >> 16);
-
-			out1 += 3;
-			pos++;
+			Y = yuv2rgbtable_y[luma0[0]];
+			out0[r] = clamp[(Y + RU) >> 16];
+			out0[1] = clamp[(Y - G) >> 16];
+			out0[b] = clamp[(Y + BV) >> 16];
+
+			Y = yuv2rgbtable_y[luma1[0]];
+			out1[r] = clamp[(Y + RU) >> 16];
+			out1[1] = clamp[(Y - G) >> 16];
+			out1[b] = clamp[(Y + BV) >> 16];
+
+			Y = yuv2rgbtable_y[luma0[1]];
+			out0[r + 3] = clamp[(Y + RU) >> 16];
+			out0[4] = clamp[(Y - G) >> 16];
+			out0[b + 3] = clamp[(Y + BV) >> 16];
+
+			Y = yuv2rgbtable_y[luma1[1]];
+			out1[r + 3] = clamp[(Y + RU) >> 16];
+			out1[4] = clamp[(Y - G) >> 16];
+			out1[b + 3] = clamp[(Y + BV) >> 16];
+
+			chroma_p += 2;
+			luma0 += 2;
+			luma1 += 2;
+			out0 += 6;
+			out1 += 6;
 		}
 	}
-
-	*xres = stride;
-	*yres = res;
-	free(luma);
-	free(chroma);
 }
 
 // grabing the osd picture
@@ -1807,6 +1820,19 @@ void getosd(unsigned char *osd, int *xres, int *yres)
 		fprintf(stderr, "Framebuffer-Size    : %d x %d\n", *xres, *yres);
 }
 
+// lookup tables used by the conversion, resize and combine loops
+
+void init_tables(void)
+{
+	int i;
+	for (i = 0; i < YUV2RGB_CLAMP_OFS * 2; i++)
+		yuv2rgb_clamp[i] = CLAMP(i - YUV2RGB_CLAMP_OFS);
+	for (i = 0; i < 256; i++)
+		mul255[i] = (i * 255) >> 8;
+	for (i = 1; i <= BOX_RECIP_MAX; i++)
+		box_recip[i] = ((1 << 24) + i - 1) / i;
+}
+
 // bicubic pixmap resizing
 
 void smooth_resize(const unsigned char *source, unsigned char *dest, int xsource, int ysource, int xdest, int ydest, int colors)
@@ -1822,6 +1848,8 @@ void smooth_resize(const unsigned char *source, unsigned char *dest, int xsource
 	const int fx = ((xs - 1) << 16) / xd;
 	// get y scale factor, use bitshifting to get rid of floats
 	const int fy = ((ys - 1) << 16) / yd;
+	// boxes are small for usual sizes, then the division is done by the reciprocal
+	const int use_recip = ((fx >> 16) + 2) * ((fy >> 16) + 2) <= BOX_RECIP_MAX;
 
 	{
 		// pre calculating sx1/sx2 for faster resizing
@@ -1835,6 +1863,8 @@ void smooth_resize(const unsigned char *source, unsigned char *dest, int xsource
 			sx2[x] = sx1[x] + (fx >> 16);
 			if (fx & 0x7FFF) //ceil()
 				sx2[x]++;
+			if (sx2[x] >= xs)
+				sx2[x] = xs - 1;
 		}
 	}
 
@@ -1843,9 +1873,11 @@ void smooth_resize(const unsigned char *source, unsigned char *dest, int xsource
 	#pragma omp parallel for shared(sx1, sx2, source, dest)
 	for (y = 0; y < yd; y++)
 	{
-		unsigned int dpixel;
-		unsigned int c, tmp_i;
-		int t, t1;
+		// sum of the source lines of this destination line, per source pixel and color
+		unsigned int colsum[xs * colors];
+		unsigned char *dline = dest + y * xd * colors;
+		unsigned int i, c;
+		int t;
 
 		// first y source pixel for calculating destination pixel
 		const unsigned int sy1 = (fy * y) >> 16; //floor()
@@ -1853,27 +1885,36 @@ void smooth_resize(const unsigned char *source, unsigned char *dest, int xsource
 		unsigned int sy2 = sy1 + (fy >> 16);
 		if (fy & 0x7FFF) //ceil()
 			sy2++;
+		if (sy2 == sy1)
+			sy2++;
+
+		memset(colsum, 0, sizeof(colsum));
+		for (i = sy1; i < sy2; i++)
+		{
+			const unsigned char *sline = source + i * xs * colors;
+			for (t = 0; t < xs * colors; t++)
+				colsum[t] += sline[t];
+		}
 
 		int x;
 		for (x = 0; x < xd; x++)
 		{
+			const unsigned int *col = colsum + sx1[x] * colors;
+			const unsigned int width = sx2[x] - sx1[x] + 1;
+			const unsigned int dpixel = width * (sy2 - sy1);
+
 			// we do this for every color
 			for (c = 0; c < colors; c++)
 			{
-				// calculationg destination pixel
-				tmp_i = 0;
-				dpixel = 0;
+				unsigned int tmp_i = 0;
+				for (i = 0; i < width; i++)
+					tmp_i += col[i * colors + c];
 
-				for (t1 = sy1; t1 < sy2; t1++)
-				{
-					for (t = sx1[x]; t <= sx2[x]; t++)
-					{
-						tmp_i += (int)source[(t * colors) + c + (t1 * xs * colors)];
-						dpixel++;
-					}
-				}
 				// writing calculated pixel into destination pixmap
-				dest[(x * colors) + c + (y * xd * colors)] = tmp_i / dpixel;
+				if (use_recip)
+					dline[x * colors + c] = (tmp_i * box_recip[dpixel]) >> 24;
+				else
+					dline[x * colors + c] = tmp_i / dpixel;
 			}
 		}
 	}
@@ -1884,90 +1925,119 @@ void fast_resize(const unsigned char *source, unsigned char *dest, int xsource,
 {
 	const int x_ratio = (int)((xsource << 16) / xdest) ;
 	const int y_ratio = (int)((ysource << 16) / ydest) ;
+	int x2_colors[xdest];
 	int i;
-	#pragma omp parallel for shared (dest, source)
+
+	for (i = 0; i < xdest; i++)
+		x2_colors[i] = ((i * x_ratio) >> 16) * colors; // source offset is the same for every line
+
+	#pragma omp parallel for shared (dest, source, x2_colors)
 	for (i = 0; i < ydest; i++)
 	{
-		int y2_xsource = ((i * y_ratio) >> 16) * xsource; // do some precalculations
-		int i_xdest = i * xdest;
+		const unsigned char *sline = source + ((i * y_ratio) >> 16) * xsource * colors; // do some precalculations
+		unsigned char *dline = dest + i * xdest * colors;
 		int j;
-		for (j = 0; j < xdest; j++)
+		if (colors == 3)
 		{
-			int x2 = ((j * x_ratio) >> 16) ;
-			int y2_x2_colors = (y2_xsource + x2) * colors;
-			int i_x_colors = (i_xdest + j) * colors;
-			int c;
-			for (c = 0; c < colors; c++)
-				dest[i_x_colors + c] = source[y2_x2_colors + c] ;
+			for (j = 0; j < xdest; j++, dline += 3)
+			{
+				const unsigned char *s = sline + x2_colors[j];
+				dline[0] = s[0];
+				dline[1] = s[1];
+				dline[2] = s[2];
+			}
+		}
+		else if (colors == 4)
+		{
+			for (j = 0; j < xdest; j++, dline += 4)
+				memcpy(dline, sline + x2_colors[j], 4);
+		}
+		else
+		{
+			for (j = 0; j < xdest; j++)
+			{
+				int c;
+				for (c = 0; c < colors; c++)
+					*dline++ = sline[x2_colors[j] + c];
+			}
 		}
 	}
 }
 
-// combining pixmaps by using an alphamap
-void combine(unsigned char *output, const unsigned char *video, const unsigned char *osd, int vleft, int vtop, int vwidth, int vheight, int xres, int yres)
+// osd pixels only, multiplied by their alpha
+static void combine_osd(unsigned char *output, const unsigned char *osd, int count)
 {
-	const int vbottom = vtop + vheight;
-	const int vright = vleft + vwidth;
-	int y;
-	for (y = 0; y < vtop; y++)
+	for (; count > 0; count--, output += 3, osd += 4)
 	{
-		int pos1 = y * xres * 4;
-		int vpos1 = y * xres * 3;
-		int x;
-		for (x = 0; x < xres; x++)
+		const unsigned int a = osd[3];
+		if (a == 0) // most of the osd is transparent
+		{
+			output[0] = output[1] = output[2] = 0;
+		}
+		else if (a == 0xFF)
+		{
+			output[0] = mul255[osd[0]];
+			output[1] = mul255[osd[1]];
+			output[2] = mul255[osd[2]];
+		}
+		else
 		{
-			const int apos = pos1 + 3;
-			output[vpos1++] = ((osd[pos1++] * osd[apos])) >> 8;
-			output[vpos1++] = ((osd[pos1++] * osd[apos])) >> 8;
-			output[vpos1++] = ((osd[pos1++] * osd[apos])) >> 8;
-			pos1++; // skip alpha byte
+			output[0] = (osd[0] * a) >> 8;
+			output[1] = (osd[1] * a) >> 8;
+			output[2] = (osd[2] * a) >> 8;
 		}
 	}
-	#pragma omp parallel for
-	for (y = vtop; y < vbottom; y++)
+}
+
+// osd pixels over video pixels
+static void combine_blend(unsigned char *output, const unsigned char *video, const unsigned char *osd, int count)
+{
+	for (; count > 0; count--, output += 3, video += 3, osd += 4)
 	{
-		int pos1 = y * xres * 4;
-		int vpos1 = y * xres * 3;
-		int x;
-		for (x = 0; x < vleft; x++)
+		const unsigned int a = osd[3];
+		if (a == 0)
 		{
-			int apos = pos1 + 3;
-			output[vpos1++] = ((osd[pos1++] * osd[apos])) >> 8;
-			output[vpos1++] = ((osd[pos1++] * osd[apos])) >> 8;
-			output[vpos1++] = ((osd[pos1++] * osd[apos])) >> 8;
-			pos1++; // skip alpha byte
+			output[0] = mul255[video[0]];
+			output[1] = mul255[video[1]];
+			output[2] = mul255[video[2]];
 		}
-		for (x = vleft; x < vright; x++)
+		else if (a == 0xFF)
 		{
-			int apos = pos1 + 3;
-			int a2 = 0xFF - osd[apos];
-			int pixel = ((y - vtop) * vwidth + (x - vleft)) * 3;
-			output[vpos1++] = ((video[pixel + 0] * a2) + (osd[pos1++] * osd[apos])) >> 8;
-			output[vpos1++] = ((video[pixel + 1] * a2) + (osd[pos1++] * osd[apos])) >> 8;
-			output[vpos1++] = ((video[pixel + 2] * a2) + (osd[pos1++] * osd[apos])) >> 8;
-			pos1++; // skip alpha byte
+			output[0] = mul255[osd[0]];
+			output[1] = mul255[osd[1]];
+			output[2] = mul255[osd[2]];
 		}
-		for (x = vright; x < xres; x++)
+		else
 		{
-			int apos = pos1 + 3;
-			output[vpos1++] = ((osd[pos1++] * osd[apos])) >> 8;
-			output[vpos1++] = ((osd[pos1++] * osd[apos])) >> 8;
-			output[vpos1++] = ((osd[pos1++] * osd[apos])) >> 8;
-			pos1++; // skip alpha byte
+			// first and third color at once, each sum is below 0xFF * 0xFF so they don't overlap
+			const unsigned int a2 = 0xFF - a;
+			const unsigned int v02 = video[0] | (video[2] << 16);
+			const unsigned int o02 = osd[0] | (osd[2] << 16);
+			const unsigned int p02 = (v02 * a2 + o02 * a) >> 8;
+			output[0] = p02;
+			output[1] = (video[1] * a2 + osd[1] * a) >> 8;
+			output[2] = p02 >> 16;
 		}
 	}
-	for (y = vbottom; y < yres; y++)
+}
+
+// combining pixmaps by using an alphamap
+void combine(unsigned char *output, const unsigned char *video, const unsigned char *osd, int vleft, int vtop, int vwidth, int vheight, int xres, int yres)
+{
+	const int vbottom = vtop + vheight;
+	const int vright = vleft + vwidth;
+	int y;
+	for (y = 0; y < vtop; y++)
+		combine_osd(output + y * xres * 3, osd + y * xres * 4, xres);
+	#pragma omp parallel for
+	for (y = vtop; y < vbottom; y++)
 	{
-		int pos1 = y * xres * 4;
-		int vpos1 = y * xres * 3;
-		int x;
-		for (x = 0; x < xres; x++)
-		{
-			int apos = pos1 + 3;
-			output[vpos1++] = ((osd[pos1++] * osd[apos])) >> 8;
-			output[vpos1++] = ((osd[pos1++] * osd[apos])) >> 8;
-			output[vpos1++] = ((osd[pos1++] * osd[apos])) >> 8;
-			pos1++; // skip alpha byte
-		}
+		unsigned char *oline = output + y * xres * 3;
+		const unsigned char *osdline = osd + y * xres * 4;
+		combine_osd(oline, osdline, vleft);
+		combine_blend(oline + vleft * 3, video + (y - vtop) * vwidth * 3, osdline + vleft * 4, vright - vleft);
+		combine_osd(oline + vright * 3, osdline + vright * 4, xres - vright);
 	}
+	for (y = vbottom; y < yres; y++)
+		combine_osd(output + y * xres * 3, osd + y * xres * 4, xres);
 }
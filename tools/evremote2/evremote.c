@@ -36,8 +36,10 @@
 #include <signal.h>
 #include <time.h>
 
-#include <semaphore.h>
 #include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
 
 #include "global.h"
 #include "remotes.h"
@@ -58,19 +60,90 @@ static unsigned int gKeyCode = 0;
 static unsigned int gNextKey = 0;
 static unsigned int gNextKeyFlag = 0xFF;
 
-static sem_t keydown_sem;
 static pthread_t keydown_thread;
+static int keydown_pipe[2] = { -1, -1 };
 
 static bool countFlag = false;
 
-static unsigned char keydown_sem_helper = 1;
+// key sample passed from the reader to the key up task
+typedef struct
+{
+	unsigned int keyCode;
+	unsigned int nextKey;
+	bool suppress;  // power key reboot counter is running
+	unsigned long long readUs;  // time the driver delivered the key
+} tKeySample;
+
+typedef struct
+{
+	Context_r_t *context_r;
+	Context_t *context;
+} tKeyUpArgs;
+
+// keypress (driver read) to input event latency, bucket i < 250us << i
+#define LATENCY_BUCKETS 12
+static unsigned int latencyHist[LATENCY_BUCKETS];
+static volatile sig_atomic_t latencyDump = 0;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+static unsigned long long monotonicUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void addLatency(unsigned long long readUs)
+{
+	unsigned long long us = monotonicUs() - readUs;
+	unsigned long long limit = 250;
+	int bucket = 0;
+
+	while (bucket < LATENCY_BUCKETS - 1 && us >= limit)
+	{
+		limit <<= 1;
+		bucket++;
+	}
+	latencyHist[bucket]++;
+}
+
+static void printLatency(void)
+{
+	unsigned long long limit = 250;
+	int bucket;
+
+	fprintf(stderr, "[evremote2] key press latency:\n");
+	for (bucket = 0; bucket < LATENCY_BUCKETS; bucket++, limit <<= 1)
+	{
+		if (bucket < LATENCY_BUCKETS - 1)
+		{
+			fprintf(stderr, "[evremote2]   < %6llu us: %u\n", limit, latencyHist[bucket]);
+		}
+		else
+		{
+			fprintf(stderr, "[evremote2]  >= %6llu us: %u\n", limit >> 1, latencyHist[bucket]);
+		}
+	}
+}
+
+static void latencySignal(int sig)
+{
+	latencyDump = 1;
+}
+
 int processSimple(Context_r_t *context_r, Context_t *context, int argc, char *argv[])
 {
 	int vCurrentCode = -1;
+	unsigned long long readUs;
+	struct sigaction vAction;
+
+	vAction.sa_handler = latencySignal;
+	sigemptyset(&vAction.sa_mask);
+	vAction.sa_flags = 0;
+	sigaction(SIGUSR1, &vAction, (struct sigaction *)NULL);
 
 //	printf("[evremote2] %s >\n", __func__);
 	if ((context_r->br)->Init)
@@ -94,10 +167,16 @@ int processSimple(Context_r_t *context_r, Context_t *context, int argc, char *ar
 		{
 			vCurrentCode = context_r->br->Read(context);
 		}
+		if (latencyDump)
+		{
+			latencyDump = 0;
+			printLatency();
+		}
 		if (vCurrentCode <= 0)
 		{
 			continue;
 		}
+		readUs = monotonicUs();
 		// activate visual notification
 		if (context_r->br->Notification)
 		{
@@ -106,7 +185,9 @@ int processSimple(Context_r_t *context_r, Context_t *context, int argc, char *ar
 		// Check if tuxtxt is running
 		if (checkTuxTxt(vCurrentCode) == false)
 		{
-			sendInputEvent(vCurrentCode);
+			sendInputEventT(INPUT_PRESS, vCurrentCode);
+			addLatency(readUs);
+			sendInputEventT(INPUT_RELEASE, vCurrentCode);
 		}
 		// deactivate visual notification
 		if (((BoxRoutines_t *)context_r->br)->Notification)
@@ -126,23 +207,6 @@ int processSimple(Context_r_t *context_r, Context_t *context, int argc, char *ar
 	return 0;
 }
 
-static void sem_up(void)
-{
-	if (keydown_sem_helper == 0)
-	{
-//		printf("[evremote2] SEM up\n");
-		sem_post(&keydown_sem);
-		keydown_sem_helper = 1;
-	}
-}
-
-static void sem_down(void)
-{
-	keydown_sem_helper = 0;
-//	printf("[evremote2] SEM down\n");
-	sem_wait(&keydown_sem);
-}
-
 int timeval_subtract(result, x, y)
 struct timeval *result, *x, *y;
 {
@@ -186,6 +250,7 @@ int processComplex(Context_r_t *context_r, Context_t *context, int argc, char *a
 	int keyCount = 0;
 	bool newKey = false;
 	bool startFlag = false;
+	tKeySample sample;
 
 //	printf("[evremote2] %s >\n", __func__);
 	if (context_r->br->Init)
@@ -217,8 +282,20 @@ int processComplex(Context_r_t *context_r, Context_t *context, int argc, char *a
 	{
 		setInputEventRepeatRate(500, 200);
 	}
-	sem_init(&keydown_sem, 0, 0);
-	pthread_create(&keydown_thread, NULL, detectKeyUpTask, context_r);
+	// SIGUSR1 (dump latency histogram) is taken by the key up task's signalfd
+	sigset_t vMask;
+	sigemptyset(&vMask);
+	sigaddset(&vMask, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &vMask, NULL);
+
+	static tKeyUpArgs keyUpArgs;
+	keyUpArgs.context_r = context_r;
+	keyUpArgs.context = context;
+	if (pipe(keydown_pipe) != 0 || pthread_create(&keydown_thread, NULL, detectKeyUpTask, &keyUpArgs) != 0)
+	{
+		fprintf(stderr, "[evremote2] Error creating key up task\n");
+		exit(1);
+	}
 
 	struct timeval time;
 	gettimeofday(&profilerLast, NULL);
@@ -236,6 +313,7 @@ int processComplex(Context_r_t *context_r, Context_t *context, int argc, char *a
 		{
 			continue;
 		}
+		sample.readUs = monotonicUs();
 		gKeyCode = vCurrentCode & 0xFFFF;
 		nextKeyFlag = (vCurrentCode >> 16) & 0xFFFF;
 		if (gNextKeyFlag != nextKeyFlag)
@@ -306,7 +384,13 @@ int processComplex(Context_r_t *context_r, Context_t *context, int argc, char *a
 		{
 			startFlag = false;
 		}
-		sem_up();
+		sample.keyCode = gKeyCode;
+		sample.nextKey = gNextKey;
+		sample.suppress = countFlag;
+		if (write(keydown_pipe[1], &sample, sizeof(sample)) != sizeof(sample))
+		{
+			fprintf(stderr, "[evremote2] Error passing key to key up task\n");
+		}
 	}
 	if (context_r->br->Shutdown)
 	{
@@ -320,60 +404,73 @@ int processComplex(Context_r_t *context_r, Context_t *context, int argc, char *a
 	return 0;
 }
 
+// Sends press and release events. A key is released when no sample of it
+// arrived for period + delay ms (timerfd) or when another key is pressed.
 void *detectKeyUpTask(void *dummy)
 {
-	Context_r_t *context_r = (Context_r_t *)dummy;
-	Context_t *context = (Context_t *)dummy;
-	struct timeval time;
+	tKeyUpArgs *args = (tKeyUpArgs *)dummy;
+	Context_r_t *context_r = args->context_r;
+	Context_t *context = args->context;
+	struct epoll_event ev;
+	struct itimerspec timeout;
+	sigset_t mask;
+	int epollFd, timerFd, signalFd;
+	bool pressed = false;
+	bool tux = false;
+	bool suppress = false;
+	unsigned int keyCode = 0;
+	unsigned int nextKey = 0;
+
+	epollFd = epoll_create(3);
+	timerFd = timerfd_create(CLOCK_MONOTONIC, 0);
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	signalFd = signalfd(-1, &mask, 0);
+	if (epollFd < 0 || timerFd < 0)
+	{
+		fprintf(stderr, "[evremote2] Error creating key up timer\n");
+		exit(1);
+	}
+	ev.events = EPOLLIN;
+	ev.data.fd = keydown_pipe[0];
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, keydown_pipe[0], &ev);
+	ev.data.fd = timerFd;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &ev);
+	if (signalFd >= 0)
+	{
+		ev.data.fd = signalFd;
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, signalFd, &ev);
+	}
+	memset(&timeout, 0, sizeof(timeout));
 
 	while (1)
 	{
-		unsigned int keyCode = 0;
-		unsigned int nextKey = 0;
-		sem_down();  // Wait until the next keypress
-
-		while (1)
+		if (epoll_wait(epollFd, &ev, 1, -1) <= 0)
 		{
-			int tux;
-
-			tux = 0;
-			keyCode = gKeyCode;
-			nextKey = gNextKey;
+			continue;
+		}
+		if (ev.data.fd == signalFd)
+		{
+			struct signalfd_siginfo info;
 
-			// activate visual notification
-			if (context_r->br->Notification)
+			if (read(signalFd, &info, sizeof(info)) == sizeof(info))
 			{
-				context_r->br->Notification(context, 1);
+				printLatency();
 			}
-			printf("[evremote2] KEY_PRESS   - %02X %d\n", keyCode, nextKey);
-
-			// Check if tuxtxt is running
-			tux = checkTuxTxt(keyCode);
+		}
+		else if (ev.data.fd == timerFd)
+		{
+			uint64_t expirations;
 
-			if (tux == false && !countFlag)
+			if (read(timerFd, &expirations, sizeof(expirations)) != sizeof(expirations) || !pressed)
 			{
-				sendInputEventT(INPUT_PRESS, keyCode);
+				continue;
 			}
-			// usleep(gBtnDelay*1000);
-			while (gKeyCode && nextKey == gNextKey)
+			if (gPrintKeys)
 			{
-				unsigned int sleep;
-
-				gettimeofday(&time, NULL);
-				sleep = gBtnPeriod + gBtnDelay - diffMilli(profilerLast, time);
-
-				if (sleep > (gBtnPeriod + gBtnDelay))
-				{
-					sleep = (gBtnPeriod + gBtnDelay);
-				}
-//				printf("[evremote2] ++++ %12u ms ++++\n", (unsigned int)diffMilli(profilerLast, time));
-				gKeyCode = 0;
-				usleep(sleep * 1000);
+				printf("[evremote2] KEY_RELEASE - %02X CAUSE: Timeout\n", keyCode);
 			}
-			printf("[evremote2] KEY_RELEASE - %02X gKeycode=%02X nextKey=%02X gNextKey=%02X CAUSE: %s\n", keyCode, gKeyCode, nextKey, gNextKey, (gKeyCode == 0) ? "Timeout" : "New key");
-
-			// Check if tuxtxt is running
-			if (tux == false && !countFlag)
+			if (tux == false && !suppress)
 			{
 				sendInputEventT(INPUT_RELEASE, keyCode);
 			}
@@ -382,12 +479,65 @@ void *detectKeyUpTask(void *dummy)
 			{
 				context_r->br->Notification(context, 0);
 			}
-			gettimeofday(&time, NULL);
-//			printf("[evremote2] ---- %12u ms ----\n", (unsigned int)diffMilli(profilerLast, time));
-			if (nextKey == gNextKey)
+			pressed = false;
+		}
+		else
+		{
+			tKeySample sample;
+
+			if (read(keydown_pipe[0], &sample, sizeof(sample)) != sizeof(sample))
+			{
+				continue;
+			}
+			if (pressed && sample.nextKey != nextKey)
 			{
-				break;
+				if (gPrintKeys)
+				{
+					printf("[evremote2] KEY_RELEASE - %02X CAUSE: New key\n", keyCode);
+				}
+				if (tux == false && !suppress)
+				{
+					sendInputEventT(INPUT_RELEASE, keyCode);
+				}
+				if (context_r->br->Notification)
+				{
+					context_r->br->Notification(context, 0);
+				}
+				pressed = false;
 			}
+			if (!pressed)
+			{
+				keyCode = sample.keyCode;
+				nextKey = sample.nextKey;
+				suppress = sample.suppress;
+
+				// activate visual notification
+				if (context_r->br->Notification)
+				{
+					context_r->br->Notification(context, 1);
+				}
+				if (gPrintKeys)
+				{
+					printf("[evremote2] KEY_PRESS   - %02X %d\n", keyCode, nextKey);
+				}
+				// Check if tuxtxt is running
+				tux = checkTuxTxt(keyCode);
+
+				if (tux == false && !suppress)
+				{
+					sendInputEventT(INPUT_PRESS, keyCode);
+					addLatency(sample.readUs);
+				}
+				pressed = true;
+			}
+			// (re)start the key up timeout with every sample of the key
+			timeout.it_value.tv_sec = (gBtnPeriod + gBtnDelay) / 1000;
+			timeout.it_value.tv_nsec = ((gBtnPeriod + gBtnDelay) % 1000) * 1000000;
+			if (timeout.it_value.tv_sec == 0 && timeout.it_value.tv_nsec == 0)
+			{
+				timeout.it_value.tv_nsec = 1000000;
+			}
+			timerfd_settime(timerFd, 0, &timeout, NULL);
 		}
 	}
 	return 0;
@@ -586,7 +736,9 @@ int main(int argc, char *argv[])
 		printf("<period> - time of pressing a key.\n");
 		printf("<delay> - delay between pressing keys. Increase if RC is too sensitive\n");
 		printf("<IconNumber> - Number of feedback Icon\n");
-		printf("No parameters - autoselection of RC driver with standard features.\n\n");
+		printf("No parameters - autoselection of RC driver with standard features.\n");
+		printf("EVREMOTE2_DEBUG set in the environment logs every key.\n");
+		printf("SIGUSR1 prints the key press latency histogram to stderr.\n\n");
 		return 0;
 	}
 	if (argc >= 2 && !strncmp(argv[1], "useLircdName", 12))
@@ -682,6 +834,11 @@ int main(int argc, char *argv[])
 
 	printf("[evremote2] Supports Long KeyPress: %s\n", context.r->supportsLongKeyPress == 0 ? "no" : "yes");
 
+	compileKeyMap(context.r->RemoteControl);
+	compileKeyMap(context.r->Frontpanel);
+	gPrintKeys = getenv("EVREMOTE2_DEBUG") != NULL;
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
 	if (context.r->supportsLongKeyPress)
 	{
 		processComplex(&context_r, &context, argc, argv);
@@ -39,6 +39,23 @@
 
 #define DEVICENAME "SH4 RC event driver for remote control"
 char eventPath[] = "/dev/input/event0";
+static int sEventFd = -1;  // kept open, opening the device per key costs time
+
+bool gPrintKeys = false;  // log every key, set by EVREMOTE2_DEBUG
+
+// Key tables compiled to a direct index for the lowercase hex codes the
+// drivers deliver, built on first use of a table.
+#define MAX_KEY_MAPS 32
+
+typedef struct
+{
+	tButton *Buttons;
+	short Index[256];  // entry of Buttons per code, -1 if none
+} tKeyMap;
+
+static tKeyMap sKeyMaps[MAX_KEY_MAPS];
+static int sKeyMapCount = 0;
+static int sKeyMapNext = 0;  // replaced next when all slots are used
 
 // Checks which event device is created by simubutton.ko
 int getEventDevice()
@@ -68,10 +85,97 @@ int getEventDevice()
 	return vDeviceFound;
 }
 
+static int hexValue(const char cChar)
+{
+	if (cChar >= '0' && cChar <= '9')
+	{
+		return cChar - '0';
+	}
+	if (cChar >= 'a' && cChar <= 'f')
+	{
+		return cChar - 'a' + 10;
+	}
+	if (cChar >= 'A' && cChar <= 'F')
+	{
+		return cChar - 'A' + 10;
+	}
+	return -1;
+}
+
+// Builds the direct index of a key table. A lowercase code also matches
+// uppercase key words, so the index is case insensitive. First entry wins.
+static tKeyMap *getKeyMap(tButton *cButtons)
+{
+	tKeyMap *vMap;
+	int vLoop;
+
+	for (vLoop = 0; vLoop < sKeyMapCount; vLoop++)
+	{
+		if (sKeyMaps[vLoop].Buttons == cButtons)
+		{
+			return &sKeyMaps[vLoop];
+		}
+	}
+	if (sKeyMapCount < MAX_KEY_MAPS)
+	{
+		vMap = &sKeyMaps[sKeyMapCount++];
+	}
+	else
+	{
+		vMap = &sKeyMaps[sKeyMapNext];
+		sKeyMapNext = (sKeyMapNext + 1) % MAX_KEY_MAPS;
+	}
+	vMap->Buttons = cButtons;
+	memset(vMap->Index, 0xff, sizeof(vMap->Index));
+
+	for (vLoop = 0; cButtons[vLoop].KeyCode != KEY_NULL; vLoop++)
+	{
+		int vHigh = hexValue(cButtons[vLoop].KeyWord[0]);
+		int vLow = hexValue(cButtons[vLoop].KeyWord[1]);
+
+		if (vHigh >= 0 && vLow >= 0 && vMap->Index[(vHigh << 4) | vLow] < 0)
+		{
+			vMap->Index[(vHigh << 4) | vLow] = vLoop;
+		}
+	}
+	return vMap;
+}
+
+void compileKeyMap(tButton *cButtons)
+{
+	if (cButtons != NULL)
+	{
+		getKeyMap(cButtons);
+	}
+}
+
+static int getInternalCodeIndex(tButton *cButtons, const unsigned char cCode)
+{
+	int vIndex = getKeyMap(cButtons)->Index[cCode];
+
+	if (vIndex < 0)
+	{
+		return 0;
+	}
+	if (gPrintKeys)
+	{
+		printf("[evremote2] KEY by code: %d (0x%02x, %s)\n", cButtons[vIndex].KeyCode, cButtons[vIndex].KeyCode, cButtons[vIndex].KeyName);
+	}
+	return cButtons[vIndex].KeyCode;
+}
+
 // Translates internal remote control value to known linux input key value
 int getInternalCode(tButton *cButtons, const char cCode[3])
 {
 	int vLoop = 0;
+	int vHigh = hexValue(cCode[0]);
+	int vLow = hexValue(cCode[1]);
+
+	// lowercase hex codes (all the hex drivers deliver) go by the index
+	if (vHigh >= 0 && vLow >= 0 && !(cCode[0] >= 'A' && cCode[0] <= 'F') && !(cCode[1] >= 'A' && cCode[1] <= 'F'))
+	{
+		return getInternalCodeIndex(cButtons, (vHigh << 4) | vLow);
+	}
 
 	for (vLoop = 0; cButtons[vLoop].KeyCode != KEY_NULL; vLoop++)
 	{
@@ -79,7 +183,10 @@ int getInternalCode(tButton *cButtons, const char cCode[3])
 		if ((cButtons[vLoop].KeyWord[0] == cCode[0] || cButtons[vLoop].KeyWord[0] == (cCode[0] - 32))
 		&&  (cButtons[vLoop].KeyWord[1] == cCode[1] || cButtons[vLoop].KeyWord[1] == (cCode[1] - 32)))
 		{
-			printf("[evremote2] KEY by code: %d (0x%02x, %s)\n", cButtons[vLoop].KeyCode, cButtons[vLoop].KeyCode, cButtons[vLoop].KeyName);
+			if (gPrintKeys)
+			{
+				printf("[evremote2] KEY by code: %d (0x%02x, %s)\n", cButtons[vLoop].KeyCode, cButtons[vLoop].KeyCode, cButtons[vLoop].KeyName);
+			}
 			return cButtons[vLoop].KeyCode;
 		}
 	}
@@ -96,7 +203,10 @@ int getInternalCodeLircKeyName(tButton *cButtons, const char cCode[30])
 		//printf("%20s - %2s - %3d\n", cButtons[vLoop].KeyName, cButtons[vLoop].KeyWord, cButtons[vLoop].KeyCode);
 		if (strcmp(cCode, cButtons[vLoop].KeyName) == 0)
 		{
-			printf("[evremote2] KEY by name: %d (0x%02x, %s)\n", cButtons[vLoop].KeyCode, cButtons[vLoop].KeyCode, cButtons[vLoop].KeyName);
+			if (gPrintKeys)
+			{
+				printf("[evremote2] KEY by name: %d (0x%02x, %s)\n", cButtons[vLoop].KeyCode, cButtons[vLoop].KeyCode, cButtons[vLoop].KeyName);
+			}
 			return cButtons[vLoop].KeyCode;
 		}
 	}
@@ -120,11 +230,7 @@ int printKeyMap(tButton *cButtons)
 // Translates internal remote control hex value to known linux input key value
 int getInternalCodeHex(tButton *cButtons, const unsigned char cCode)
 {
-	char vCode[3];
-
-	sprintf(vCode, "%.2hhx", cCode);
-	vCode[2] = '\0';
-	return getInternalCode(cButtons, vCode);
+	return getInternalCodeIndex(cButtons, cCode);
 }
 
 static int tuxtxt_exit_count = 0;
@@ -202,7 +308,6 @@ void sendInputEvent(const int cCode)
 
 void sendInputEventT(const unsigned int type, const int cCode)
 {
-	int vFd = -1;
 	struct input_event vInev;
 	int cSize = sizeof(struct input_event);
 
@@ -210,11 +315,18 @@ void sendInputEventT(const unsigned int type, const int cCode)
 	vInev.type = 1;
 	vInev.code = cCode;
 
-	vFd = open(eventPath, O_WRONLY);
+	if (sEventFd < 0)
+	{
+		sEventFd = open(eventPath, O_WRONLY);
+	}
 
 	vInev.value = type;
-	write(vFd, &vInev, cSize);
-	close(vFd);
+	if (write(sEventFd, &vInev, cSize) != cSize)
+	{
+		// device gone (driver reloaded), reopen with the next key
+		close(sEventFd);
+		sEventFd = -1;
+	}
 }
 
 void setInputEventRepeatRate(unsigned int delay, unsigned int period)
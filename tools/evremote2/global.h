@@ -84,6 +84,9 @@ typedef struct Context_r_s
 	BoxRoutines_t *br;  // box specific routines
 } Context_r_t;
 
+extern bool gPrintKeys;
+
+void compileKeyMap(tButton *cButtons);
 int getInternalCode(tButton *cButtons, const char cCode[3]);
 int getInternalCodeHex(tButton *cButtons, const unsigned char cCode);
 int getInternalCodeLircKeyName(tButton *cButtons, const char cCode[30]);
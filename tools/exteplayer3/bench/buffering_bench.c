@@ -0,0 +1,262 @@
+/*
+ * linuxdvb write buffering benchmark
+ *
+ * Pushes PES sized chunks through the old malloc-per-chunk list queue
+ * and through the ring from output/linuxdvb_buffering.c. The buffering
+ * threads write to /dev/null, so only the queue cost is measured.
+ *
+ * usage: buffering_bench [chunk size] [chunks]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+static volatile uint32_t allocCnt = 0;
+
+static void *bench_malloc(size_t size)
+{
+    __sync_add_and_fetch(&allocCnt, 1);
+    return malloc(size);
+}
+
+#define malloc(size) bench_malloc(size)
+#include "../output/linuxdvb_buffering.c"
+#undef malloc
+
+/* ***************************** */
+/* exteplayer3 stubs             */
+/* ***************************** */
+static int8_t dieNow = 0;
+
+int8_t PlaybackDieNow(int8_t val)
+{
+    if (val)
+    {
+        dieNow = 1;
+    }
+    return dieNow;
+}
+
+bool PlaybackDieNowRegisterCallback(PlaybackDieNowCallback callback)
+{
+    return true;
+}
+
+ssize_t WriteWithRetry(Context_t *context, int pipefd, int fd, const void *buf, int size)
+{
+    return write(fd, buf, size) == size ? 0 : -1;
+}
+
+/* ***************************** */
+/* old list queue, as it was     */
+/* before the ring               */
+/* ***************************** */
+typedef struct ListNode_s {
+    uint32_t dataSize;
+    int fd;
+    struct ListNode_s *next;
+} ListNode_t;
+
+static pthread_mutex_t listMtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t listAddedCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t listConsumedCond = PTHREAD_COND_INITIALIZER;
+static ListNode_t *listHead = NULL;
+static ListNode_t *listTail = NULL;
+static uint32_t listDataSize = 0;
+static uint32_t listMaxDataSize = 0;
+static bool listExit = false;
+
+static void *ListThread(void *arg)
+{
+    ListNode_t *nodePtr = NULL;
+
+    while (1)
+    {
+        pthread_mutex_lock(&listMtx);
+        if (nodePtr)
+        {
+            free(nodePtr);
+            nodePtr = NULL;
+            pthread_cond_signal(&listConsumedCond);
+        }
+        if (!listHead)
+        {
+            if (listExit)
+            {
+                pthread_mutex_unlock(&listMtx);
+                break;
+            }
+            pthread_cond_wait(&listAddedCond, &listMtx);
+            pthread_mutex_unlock(&listMtx);
+            continue;
+        }
+        nodePtr = listHead;
+        listHead = listHead->next;
+        if (!listHead)
+        {
+            listTail = NULL;
+        }
+        listDataSize -= nodePtr->dataSize + sizeof(ListNode_t);
+        pthread_mutex_unlock(&listMtx);
+
+        write(nodePtr->fd, (uint8_t *)nodePtr + sizeof(ListNode_t), nodePtr->dataSize);
+    }
+    return NULL;
+}
+
+static ssize_t ListWriteV(int fd, const struct iovec *iov, int ic)
+{
+    ListNode_t *nodePtr = NULL;
+    uint8_t *dataPtr = NULL;
+    uint32_t chunkSize = sizeof(ListNode_t);
+    int i = 0;
+
+    for (i = 0; i < ic; ++i)
+    {
+        chunkSize += iov[i].iov_len;
+    }
+
+    nodePtr = bench_malloc(chunkSize);
+    if (!nodePtr)
+    {
+        return -1;
+    }
+    dataPtr = (uint8_t *)nodePtr + sizeof(ListNode_t);
+    for (i = 0; i < ic; ++i)
+    {
+        memcpy(dataPtr, iov[i].iov_base, iov[i].iov_len);
+        dataPtr += iov[i].iov_len;
+    }
+
+    pthread_mutex_lock(&listMtx);
+    while (listDataSize + chunkSize >= listMaxDataSize)
+    {
+        pthread_cond_wait(&listConsumedCond, &listMtx);
+    }
+    nodePtr->dataSize = chunkSize - sizeof(ListNode_t);
+    nodePtr->fd = fd;
+    nodePtr->next = NULL;
+    if (listTail)
+    {
+        listTail->next = nodePtr;
+    }
+    else
+    {
+        listHead = nodePtr;
+    }
+    listTail = nodePtr;
+    listDataSize += chunkSize;
+    pthread_cond_signal(&listAddedCond);
+    pthread_mutex_unlock(&listMtx);
+
+    return chunkSize - sizeof(ListNode_t);
+}
+
+/* ***************************** */
+/* Benchmark                     */
+/* ***************************** */
+static int64_t GetTimeUs(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* every chunk goes as PES header + payload, like the writers send it,
+ * every fourth chunk is audio
+ */
+static void PushChunks(ssize_t (*writeV)(int, const struct iovec *, int), int videofd, int audiofd,
+                       uint8_t *payload, uint32_t chunkSize, uint32_t chunks)
+{
+    uint8_t pesHeader[14] = {0x00, 0x00, 0x01, 0xE0};
+    struct iovec iov[2];
+    uint32_t i = 0;
+
+    for (i = 0; i < chunks; ++i)
+    {
+        bool isAudio = (i & 3) == 3;
+        iov[0].iov_base = pesHeader;
+        iov[0].iov_len = sizeof(pesHeader);
+        iov[1].iov_base = payload;
+        iov[1].iov_len = isAudio ? chunkSize / 4 : chunkSize;
+        writeV(isAudio ? audiofd : videofd, iov, 2);
+    }
+}
+
+static void PrintResult(const char *name, uint32_t chunks, int64_t us, uint32_t allocs)
+{
+    double secs = us / 1000000.0;
+    printf("%-5s %10.0f packets/s %12.0f allocations/s (%u allocations, %.3f s)\n",
+           name, chunks / secs, allocs / secs, allocs, secs);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t chunkSize = argc > 1 ? atoi(argv[1]) : 4096;
+    uint32_t chunks = argc > 2 ? atoi(argv[2]) : 500000;
+    uint32_t bufferSize = 8 * 1024 * 1024;
+    PlaybackHandler_t playback;
+    Context_t context;
+    pthread_t listThread;
+    uint8_t *payload = NULL;
+    int videofd = open("/dev/null", O_WRONLY);
+    int audiofd = open("/dev/null", O_WRONLY);
+    int64_t start = 0;
+    uint32_t allocs = 0;
+
+    payload = calloc(1, chunkSize);
+    if (!payload || videofd < 0 || audiofd < 0)
+    {
+        return 1;
+    }
+
+    printf("%u chunks of %u bytes, buffer %u bytes\n", chunks, chunkSize, bufferSize);
+
+    /* before */
+    listMaxDataSize = bufferSize;
+    pthread_create(&listThread, NULL, ListThread, NULL);
+    allocs = allocCnt;
+    start = GetTimeUs();
+    PushChunks(ListWriteV, videofd, audiofd, payload, chunkSize, chunks);
+    pthread_mutex_lock(&listMtx);
+    listExit = true;
+    pthread_cond_signal(&listAddedCond);
+    pthread_mutex_unlock(&listMtx);
+    pthread_join(listThread, NULL);
+    PrintResult("list", chunks, GetTimeUs() - start, allocCnt - allocs);
+
+    /* after */
+    memset(&playback, 0, sizeof(playback));
+    memset(&context, 0, sizeof(context));
+    context.playback = &playback;
+    LinuxDvbBuffSetSize(bufferSize);
+    allocs = allocCnt;
+    start = GetTimeUs();
+    if (LinuxDvbBuffOpen(&context, "video", videofd) || LinuxDvbBuffOpen(&context, "audio", audiofd))
+    {
+        return 1;
+    }
+    PushChunks(BufferingWriteV, videofd, audiofd, payload, chunkSize, chunks);
+    while (!IsRingEmpty(&videoLane) || !IsRingEmpty(&audioLane))
+    {
+        usleep(1000);
+    }
+    PrintResult("ring", chunks, GetTimeUs() - start, allocCnt - allocs);
+    LinuxDvbBuffClose(&context);
+
+    free(payload);
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * sh4 H.264 writer benchmark
+ *
+ * Feeds synthetic length-prefixed access units to the H.264 writer
+ * and counts the writev calls it makes per frame. Every writev goes
+ * to /dev/null, so the run time is the writer and syscall cost.
+ * Before the access unit was coalesced the writer made one writev
+ * per NAL unit, that count is printed for comparison.
+ *
+ * usage: h264_bench [slices per frame] [frames]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include "common.h"
+#include "writer.h"
+
+#define SLICE_SIZE 4096
+
+static uint32_t writevCnt = 0;
+
+static ssize_t CountingWriteV(int fd, const struct iovec *iov, int ic)
+{
+    writevCnt += 1;
+    return writev(fd, iov, ic);
+}
+
+static int64_t GetTimeUs(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* AUD, SEI and the slices, each NAL unit with 4 bytes length prefix */
+static uint32_t BuildAccessUnit(uint8_t *data, uint32_t slices)
+{
+    uint32_t sizes[2 + 256];
+    uint32_t pos = 0;
+    uint32_t nals = 0;
+    uint32_t i = 0;
+
+    sizes[nals++] = 2;
+    sizes[nals++] = 24;
+    for (i = 0; i < slices; ++i)
+    {
+        sizes[nals++] = SLICE_SIZE;
+    }
+
+    for (i = 0; i < nals; ++i)
+    {
+        data[pos++] = (sizes[i] >> 24) & 0xff;
+        data[pos++] = (sizes[i] >> 16) & 0xff;
+        data[pos++] = (sizes[i] >> 8) & 0xff;
+        data[pos++] = sizes[i] & 0xff;
+        memset(data + pos, 0x55, sizes[i]);
+        data[pos] = i == 0 ? 0x09 : (i == 1 ? 0x06 : 0x01);
+        pos += sizes[i];
+    }
+    return pos;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t slices = argc > 1 ? atoi(argv[1]) : 20;
+    uint32_t frames = argc > 2 ? atoi(argv[2]) : 100000;
+    /* avcC with 4 bytes NAL length, one SPS and one PPS */
+    uint8_t avcC[] = {0x01, 0x64, 0x00, 0x28, 0xff, 0xe1, 0x00, 0x04, 0x67, 0x64, 0x00, 0x28,
+                      0x01, 0x00, 0x04, 0x68, 0xee, 0x3c, 0x80};
+    WriterAVCallData_t call;
+    uint8_t *data = NULL;
+    uint32_t headerWrites = 0;
+    int64_t start = 0;
+    double secs = 0;
+    uint32_t i = 0;
+
+    if (slices > 256)
+    {
+        slices = 256;
+    }
+
+    data = malloc((2 + slices) * (4 + SLICE_SIZE));
+    if (!data)
+    {
+        return 1;
+    }
+
+    memset(&call, 0, sizeof(call));
+    call.fd = open("/dev/null", O_WRONLY);
+    call.data = data;
+    call.len = BuildAccessUnit(data, slices);
+    call.private_data = avcC;
+    call.private_size = sizeof(avcC);
+    call.FrameRate = 1001;
+    call.FrameScale = 30000;
+    call.WriteV = CountingWriteV;
+    if (call.fd < 0)
+    {
+        return 1;
+    }
+
+    /* first call writes the codec parameters too */
+    WriterVideoH264.reset();
+    WriterVideoH264.writeData(&call);
+    headerWrites = writevCnt - 1;
+
+    writevCnt = 0;
+    start = GetTimeUs();
+    for (i = 0; i < frames; ++i)
+    {
+        call.Pts = i * 3003;
+        WriterVideoH264.writeData(&call);
+    }
+    secs = (GetTimeUs() - start) / 1000000.0;
+
+    printf("%u frames, %u NAL units (%u bytes) per frame, %u initial header writes\n", frames, slices + 2, call.len, headerWrites);
+    printf("writev per frame: %.2f now, %u with PES per NAL unit\n", (double)writevCnt / frames, slices + 2);
+    printf("%.0f frames/s, %.0f writev/s\n", frames / secs, writevCnt / secs);
+
+    free(data);
+    return 0;
+}
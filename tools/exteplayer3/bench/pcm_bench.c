@@ -0,0 +1,215 @@
+/*
+ * sh4 PCM writer benchmark
+ *
+ * Feeds 16 bit little endian PCM, as the software audio decoder
+ * outputs it, to the PCM writer for 2 and 6 channels at 48 kHz and
+ * prints the throughput. The writer before the one pass conversion
+ * (malloc per call, break buffer, byte swap in place) is kept here
+ * for comparison, both must pass the same LPCM payload to WriteV.
+ * WriteV only checksums the payload, so the run time is the writer.
+ *
+ * usage: pcm_bench [samples per write] [writes]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include <libavcodec/avcodec.h>
+
+#include "common.h"
+#include "pes.h"
+#include "writer.h"
+#include "pcm.h"
+
+static uint32_t payloadSum = 0;
+static uint64_t payloadLen = 0;
+
+static ssize_t SummingWriteV(int fd __attribute__((unused)), const struct iovec *iov, int ic)
+{
+    const uint8_t *data = iov[ic - 1].iov_base;
+    uint32_t len = iov[ic - 1].iov_len;
+    uint32_t i = 0;
+
+    /* odd stride, so both bytes of the samples are sampled */
+    for (i = 0; i < len; i += 15)
+    {
+        payloadSum = payloadSum * 31 + data[i];
+    }
+    payloadLen += len;
+    return len;
+}
+
+static int64_t GetTimeUs(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* the writer before the one pass conversion, 16 bit 48 kHz only */
+static uint8_t  oldBreakBuffer[8192];
+static uint32_t oldBreakBufferFillSize = 0;
+static uint8_t  oldLpcmPrv[14];
+
+static int32_t oldWriteData(WriterAVCallData_t *call, uint32_t channels)
+{
+    unsigned char PesHeader[PES_MAX_HEADER_SIZE];
+    uint32_t SubFrameLen = 40 * channels * 2;
+    uint32_t SubFramesPerPES = ((2048 - 18) - sizeof(oldLpcmPrv)) / SubFrameLen;
+    uint8_t *buffer = call->data;
+    uint32_t size = call->len;
+    uint32_t n;
+    uint32_t pos;
+
+    SubFrameLen *= SubFramesPerPES;
+    uint8_t *injectBuffer = malloc(SubFrameLen);
+
+    for (pos = 0; pos < size; )
+    {
+        if ((size - pos) < SubFrameLen)
+        {
+            oldBreakBufferFillSize = size - pos;
+            memcpy(oldBreakBuffer, &buffer[pos], sizeof(uint8_t) * oldBreakBufferFillSize);
+            break;
+        }
+
+        if (oldBreakBufferFillSize > 0)
+        {
+            memcpy(injectBuffer, oldBreakBuffer, sizeof(uint8_t) * oldBreakBufferFillSize);
+            memcpy(&injectBuffer[oldBreakBufferFillSize], &buffer[pos], sizeof(unsigned char) * (SubFrameLen - oldBreakBufferFillSize));
+            pos += (SubFrameLen - oldBreakBufferFillSize);
+            oldBreakBufferFillSize = 0;
+        }
+        else
+        {
+            memcpy(injectBuffer, &buffer[pos], sizeof(uint8_t) * SubFrameLen);
+            pos += SubFrameLen;
+        }
+
+        struct iovec iov[3];
+        iov[0].iov_base = PesHeader;
+        iov[1].iov_base = oldLpcmPrv;
+        iov[1].iov_len = sizeof(oldLpcmPrv);
+        iov[2].iov_base = injectBuffer;
+        iov[2].iov_len = SubFrameLen;
+
+        for (n = 0; n < SubFrameLen; n += 2)
+        {
+            uint8_t tmp;
+            tmp = injectBuffer[n];
+            injectBuffer[n] = injectBuffer[n + 1];
+            injectBuffer[n + 1] = tmp;
+        }
+
+        oldLpcmPrv[1] = ((oldLpcmPrv[1] + SubFramesPerPES) & 0x1F);
+
+        iov[0].iov_len = InsertPesHeader(PesHeader, iov[1].iov_len + iov[2].iov_len, PCM_PES_START_CODE, call->Pts, 0);
+        if (call->WriteV(call->fd, iov, 3) < 0)
+        {
+            break;
+        }
+    }
+    free(injectBuffer);
+
+    return size;
+}
+
+static double Run(WriterAVCallData_t *call, uint32_t channels, uint32_t writes, int32_t old, uint32_t *sum)
+{
+    int64_t start = 0;
+    uint32_t i = 0;
+
+    payloadSum = 0;
+    payloadLen = 0;
+    oldBreakBufferFillSize = 0;
+    WriterAudioPCM.reset();
+
+    start = GetTimeUs();
+    for (i = 0; i < writes; ++i)
+    {
+        call->Pts = (int64_t)i * 2160;
+        if (old)
+        {
+            oldWriteData(call, channels);
+        }
+        else
+        {
+            WriterAudioPCM.writeData(call);
+        }
+    }
+    *sum = payloadSum;
+    return payloadLen / ((GetTimeUs() - start) / 1000000.0) / (1024 * 1024);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t samples = argc > 1 ? atoi(argv[1]) : 1152;
+    uint32_t writes = argc > 2 ? atoi(argv[2]) : 200000;
+    uint32_t channels[] = {2, 6};
+    uint32_t c = 0;
+    int32_t ret = 0;
+
+    if (!samples || !writes)
+    {
+        return 1;
+    }
+
+    for (c = 0; c < sizeof(channels) / sizeof(channels[0]); ++c)
+    {
+        pcmPrivateData_t pcmExtradata;
+        WriterAVCallData_t call;
+        uint32_t len = samples * channels[c] * sizeof(int16_t);
+        uint8_t *data = malloc(len);
+        uint32_t oldSum = 0;
+        uint32_t newSum = 0;
+        double oldRate = 0;
+        double newRate = 0;
+        uint32_t i = 0;
+
+        if (!data)
+        {
+            return 1;
+        }
+        for (i = 0; i < len; ++i)
+        {
+            data[i] = (uint8_t)(i * 7 + (i >> 8));
+        }
+
+        memset(&pcmExtradata, 0, sizeof(pcmExtradata));
+        pcmExtradata.channels = channels[c];
+        pcmExtradata.bits_per_coded_sample = 16;
+        pcmExtradata.sample_rate = 48000;
+        pcmExtradata.ffmpeg_codec_id = AV_CODEC_ID_PCM_S16LE;
+
+        memset(&call, 0, sizeof(call));
+        call.fd = 1;
+        call.data = data;
+        call.len = len;
+        call.private_data = (uint8_t *)&pcmExtradata;
+        call.private_size = sizeof(pcmExtradata);
+        call.WriteV = SummingWriteV;
+
+        oldRate = Run(&call, channels[c], writes, 1, &oldSum);
+        newRate = Run(&call, channels[c], writes, 0, &newSum);
+
+        printf("%uch 48 kHz, %u samples per write: %.0f MB/s before, %.0f MB/s now, payload %s\n",
+               channels[c], samples, oldRate, newRate, oldSum == newSum ? "identical" : "DIFFERS");
+        if (oldSum != newSum)
+        {
+            ret = 1;
+        }
+        free(data);
+    }
+
+    return ret;
+}
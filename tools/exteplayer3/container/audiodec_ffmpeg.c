@@ -0,0 +1,498 @@
+/*
+ * Software audio decoding thread for stream's handled by ffmpeg
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+/* Audio tracks decoded in software (inject_as_pcm) are not decoded
+ * on the demux thread. Packets are passed through a bounded queue to
+ * the decoder thread, which resamples into a recycled PCM buffer and
+ * writes it to the audio output, so video injection does not wait
+ * for audio decoding. The track pts and the output are only touched
+ * with the container mutex held, as on the demux thread.
+ */
+#define AUDIODEC_QUEUE_SIZE 32
+#define AUDIODEC_WAIT_MS    20
+
+typedef struct
+{
+	AVPacket packet;
+	Track_t *track;
+	uint32_t avIdx;
+	uint8_t  restart;   // restart resampling with this packet
+	uint32_t generation;
+} AudioDecItem;
+
+typedef struct
+{
+	pthread_t       thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t  cond;   // queue changed or decoder became idle
+	int8_t          isInitialized;
+	int8_t          isRunning;
+	int8_t          terminate;
+	int8_t          busy;   // decoder works on a packet taken from queue
+
+	AudioDecItem    queue[AUDIODEC_QUEUE_SIZE];
+	uint32_t        head;
+	uint32_t        count;
+	uint32_t        generation; // bumped by flush, drops packets pushed before
+
+	/* used by decoder thread only */
+	Context_t      *context;
+	SwrContext     *swr;
+	AVFrame        *frame;
+	uint8_t        *pcm;    // output buffer, grows to the largest frame
+	uint32_t        pcmSize;
+	int32_t         outSampleRate;
+	int32_t         outChannels;
+	uint64_t        outChannelLayout;
+	uint8_t         restart;
+} AudioDecContext;
+
+static AudioDecContext audioDec;
+
+static void audiodec_reset_resampling(AudioDecContext *ad)
+{
+	if (ad->swr)
+	{
+		swr_free(&ad->swr);
+		ad->swr = NULL;
+	}
+	if (ad->frame)
+	{
+		wrapped_frame_free(&ad->frame);
+		ad->frame = NULL;
+	}
+}
+
+static int32_t audiodec_init_resampling(AudioDecContext *ad, AVCodecContext *c)
+{
+	if (insert_pcm_as_lpcm)
+	{
+		ad->outSampleRate = 48000;
+	}
+	else
+	{
+		int32_t rates[] = { 48000, 96000, 192000, 44100, 88200, 176400, 0 };
+		int32_t *rate = rates;
+		int32_t in_rate = c->sample_rate;
+		while (*rate && ((*rate / in_rate) * in_rate != *rate) && (in_rate / *rate) * *rate != in_rate)
+		{
+			rate++;
+		}
+		ad->outSampleRate = *rate ? *rate : 44100;
+	}
+
+	ad->swr = swr_alloc();
+	ad->outChannels = c->channels;
+
+	if (c->channel_layout == 0)
+	{
+		c->channel_layout = av_get_default_channel_layout( c->channels );
+	}
+	ad->outChannelLayout = c->channel_layout;
+
+	uint8_t downmix = stereo_software_decoder && ad->outChannels > 2 ? 1 : 0;
+#ifdef __sh__
+	// player2 won't play mono
+	if (ad->outChannelLayout == AV_CH_LAYOUT_MONO)
+	{
+		downmix = 1;
+	}
+#endif
+	if(downmix)
+	{
+		ad->outChannelLayout = AV_CH_LAYOUT_STEREO_DOWNMIX;
+		ad->outChannels = 2;
+	}
+
+	av_opt_set_int(ad->swr, "in_channel_layout",	c->channel_layout,	0);
+	av_opt_set_int(ad->swr, "out_channel_layout",	ad->outChannelLayout,	0);
+	av_opt_set_int(ad->swr, "in_sample_rate",	c->sample_rate,		0);
+	av_opt_set_int(ad->swr, "out_sample_rate",	ad->outSampleRate,	0);
+	av_opt_set_int(ad->swr, "in_sample_fmt",	c->sample_fmt,		0);
+	av_opt_set_int(ad->swr, "out_sample_fmt",	AV_SAMPLE_FMT_S16,	0);
+
+	int32_t e = swr_init(ad->swr);
+	if (e < 0)
+	{
+		ffmpeg_err("swr_init: %d (icl=%d ocl=%d isr=%d osr=%d isf=%d osf=%d\n",
+			-e, (int32_t)c->channel_layout, (int32_t)ad->outChannelLayout, c->sample_rate, ad->outSampleRate, c->sample_fmt, AV_SAMPLE_FMT_S16);
+		swr_free(&ad->swr);
+		ad->swr = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/* decode one packet and write all frames it contains */
+static void audiodec_decode(AudioDecContext *ad, AudioDecItem *item)
+{
+	Context_t *context = ad->context;
+	Track_t *audioTrack = item->track;
+	AVCodecContext *c = audioTrack->avCodecCtx;
+	AVStream *stream = audioTrack->stream;
+	AVPacket *packet = &item->packet;
+	pcmPrivateData_t pcmExtradata;
+	AudioVideoOut_t avOut;
+	int64_t pts;
+
+	uint8_t restart = item->restart || ad->restart;
+	ad->restart = 0;
+	if (restart)
+	{
+		audiodec_reset_resampling(ad);
+	}
+	pcmExtradata.bResampling = restart;
+	pcmExtradata.bit_rate    = get_codecpar(stream)->bit_rate;
+
+#if (LIBAVFORMAT_VERSION_MAJOR > 57) || ((LIBAVFORMAT_VERSION_MAJOR == 57) && (LIBAVFORMAT_VERSION_MINOR > 32))
+	while (packet->size > 0 || (!packet->size && !packet->data))
+#else
+	while(packet->size > 0)
+#endif
+	{
+		if(do_seek_target_seconds || do_seek_target_bytes || ad->terminate || !context->playback->isPlaying)
+		{
+			break;
+		}
+
+		if (!ad->frame)
+		{
+			ad->frame = wrapped_frame_alloc();
+			if (!ad->frame)
+			{
+				ffmpeg_err("out of memory\n");
+				exit(1);
+			}
+		}
+		else
+		{
+			wrapped_frame_unref(ad->frame);
+		}
+#if (LIBAVFORMAT_VERSION_MAJOR > 57) || ((LIBAVFORMAT_VERSION_MAJOR == 57) && (LIBAVFORMAT_VERSION_MINOR > 32))
+		int ret = avcodec_send_packet(c, packet);
+		if (ret < 0 && ret != AVERROR(EAGAIN) && ret != AVERROR_EOF)
+		{
+			ad->restart = 1;
+			break;
+		}
+
+		if (ret >= 0)
+		{
+			packet->size = 0;
+		}
+
+		ret = avcodec_receive_frame(c, ad->frame);
+		if (ret < 0)
+		{
+			if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF)
+			{
+				ad->restart = 1;
+				break;
+			}
+			else
+			{
+				continue;
+			}
+		}
+#else
+		int32_t got_frame = 0;
+		int32_t len = avcodec_decode_audio4(c, ad->frame, &got_frame, packet);
+		if (len < 0)
+		{
+			ffmpeg_err("avcodec_decode_audio4: %d\n", len);
+			break;
+		}
+
+		packet->data += len;
+		packet->size -= len;
+
+		if (!got_frame)
+		{
+			continue;
+		}
+#endif
+		if (!ad->swr && audiodec_init_resampling(ad, c) < 0)
+		{
+			break;
+		}
+
+		int32_t in_samples = ad->frame->nb_samples;
+		int32_t out_samples = av_rescale_rnd(swr_get_delay(ad->swr, c->sample_rate) + in_samples, ad->outSampleRate, c->sample_rate, AV_ROUND_UP);
+		int32_t size = av_samples_get_buffer_size(NULL, ad->outChannels, out_samples, AV_SAMPLE_FMT_S16, 1);
+		if (size < 0)
+		{
+			ffmpeg_err("av_samples_get_buffer_size: %d\n", -size);
+			continue;
+		}
+		/* the buffer is kept between frames, it is only reallocated when a frame is bigger */
+		av_fast_malloc(&ad->pcm, &ad->pcmSize, size);
+		if (!ad->pcm)
+		{
+			ffmpeg_err("out of memory\n");
+			ad->pcmSize = 0;
+			continue;
+		}
+		uint8_t *output[8] = {ad->pcm};
+
+		int64_t next_in_pts = av_rescale(av_frame_get_best_effort_timestamp(ad->frame),
+						 stream->time_base.num * (int64_t)ad->outSampleRate * c->sample_rate,
+						 stream->time_base.den);
+		int64_t next_out_pts = av_rescale(swr_next_pts(ad->swr, next_in_pts),
+						 stream->time_base.den,
+						 stream->time_base.num * (int64_t)ad->outSampleRate * c->sample_rate);
+
+		pts = calcPts(item->avIdx, stream, next_out_pts);
+		out_samples = swr_convert(ad->swr, &output[0], out_samples, (const uint8_t **) &ad->frame->data[0], in_samples);
+
+		//////////////////////////////////////////////////////////////////////
+		// Update pcmExtradata according to decode parameters
+		pcmExtradata.channels              = av_get_channel_layout_nb_channels(ad->outChannelLayout);
+		pcmExtradata.bits_per_coded_sample = 16;
+		pcmExtradata.sample_rate           = ad->outSampleRate;
+		// The data described by the sample format is always in native-endian order
+#ifdef WORDS_BIGENDIAN
+		pcmExtradata.ffmpeg_codec_id       = AV_CODEC_ID_PCM_S16BE;
+#else
+		pcmExtradata.ffmpeg_codec_id       = AV_CODEC_ID_PCM_S16LE;
+#endif
+
+		//////////////////////////////////////////////////////////////////////
+
+		memset(&avOut, 0, sizeof(avOut));
+		avOut.data       = output[0];
+		avOut.len        = out_samples * sizeof(int16_t) * ad->outChannels;
+		avOut.pts        = pts;
+		avOut.extradata  = (unsigned char *) &pcmExtradata;
+		avOut.extralen   = sizeof(pcmExtradata);
+		avOut.type       = "audio";
+
+		getMutex(__FILE__, __FUNCTION__,__LINE__);
+		/* flushed while decoding (seek, track switch), the data is stale */
+		pthread_mutex_lock(&ad->mutex);
+		uint8_t stale = item->generation != ad->generation || ad->terminate;
+		pthread_mutex_unlock(&ad->mutex);
+		if (stale)
+		{
+			releaseMutex(__FILE__, __FUNCTION__,__LINE__);
+			break;
+		}
+		audioTrack->pts = pts;
+		if (out_samples > 0 && !context->playback->BackWard && Write(context->output->audio->Write, context, &avOut, pts) < 0)
+		{
+			ffmpeg_err("writing data to audio device failed\n");
+		}
+		releaseMutex(__FILE__, __FUNCTION__,__LINE__);
+		pcmExtradata.bResampling = 0;
+	}
+}
+
+static void audiodec_thread(AudioDecContext *ad)
+{
+	char threadname[17];
+	strncpy(threadname, __func__, sizeof(threadname));
+	threadname[16] = 0;
+	prctl (PR_SET_NAME, (unsigned long)&threadname);
+
+	ffmpeg_printf(10, "\n");
+	pthread_mutex_lock(&ad->mutex);
+	while (!ad->terminate)
+	{
+		if (0 == ad->count)
+		{
+			pthread_cond_wait(&ad->cond, &ad->mutex);
+			continue;
+		}
+
+		AudioDecItem item = ad->queue[ad->head];
+		ad->head = (ad->head + 1) % AUDIODEC_QUEUE_SIZE;
+		ad->count -= 1;
+		ad->busy = 1;
+		pthread_cond_broadcast(&ad->cond);
+		pthread_mutex_unlock(&ad->mutex);
+
+		audiodec_decode(ad, &item);
+		wrapped_packet_unref(&item.packet);
+
+		pthread_mutex_lock(&ad->mutex);
+		ad->busy = 0;
+		pthread_cond_broadcast(&ad->cond);
+	}
+	pthread_mutex_unlock(&ad->mutex);
+	ffmpeg_printf(10, "terminating\n");
+}
+
+static int32_t audiodec_start(Context_t *context)
+{
+	AudioDecContext *ad = &audioDec;
+	if (!ad->isInitialized)
+	{
+		pthread_mutex_init(&ad->mutex, NULL);
+		pthread_cond_init(&ad->cond, NULL);
+		ad->isInitialized = 1;
+	}
+	ad->context = context;
+	ad->terminate = 0;
+	ad->head = 0;
+	ad->count = 0;
+	ad->busy = 0;
+	ad->restart = 1;
+	if (pthread_create(&ad->thread, NULL, (void *)&audiodec_thread, ad) != 0)
+	{
+		ffmpeg_err("cannot create audio decoder thread\n");
+		return -1;
+	}
+	ad->isRunning = 1;
+	return 0;
+}
+
+/* drop queued packets, called with ad->mutex locked */
+static void audiodec_drop(AudioDecContext *ad)
+{
+	ad->generation += 1;
+	while (ad->count)
+	{
+		wrapped_packet_unref(&ad->queue[ad->head].packet);
+		ad->head = (ad->head + 1) % AUDIODEC_QUEUE_SIZE;
+		ad->count -= 1;
+	}
+}
+
+/* drop queued packets and wait until the decoder is idle, so the
+ * audio codec may be flushed (seek). Called with the container mutex
+ * held, it is released while waiting because the decoder takes it to
+ * write; a frame decoded before the flush is dropped then.
+ */
+static void audiodec_flush(void)
+{
+	AudioDecContext *ad = &audioDec;
+	if (!ad->isRunning)
+	{
+		return;
+	}
+	pthread_mutex_lock(&ad->mutex);
+	for (;;)
+	{
+		audiodec_drop(ad);
+		pthread_cond_broadcast(&ad->cond);
+		if (!ad->busy)
+		{
+			break;
+		}
+		pthread_mutex_unlock(&ad->mutex);
+
+		/* packets pushed meanwhile are dropped in the next round */
+		releaseMutex(__FILE__, __FUNCTION__,__LINE__);
+		pthread_mutex_lock(&ad->mutex);
+		while (ad->busy)
+		{
+			pthread_cond_wait(&ad->cond, &ad->mutex);
+		}
+		pthread_mutex_unlock(&ad->mutex);
+		getMutex(__FILE__, __FUNCTION__,__LINE__);
+		pthread_mutex_lock(&ad->mutex);
+	}
+	pthread_mutex_unlock(&ad->mutex);
+}
+
+static void audiodec_stop(void)
+{
+	AudioDecContext *ad = &audioDec;
+	if (!ad->isRunning)
+	{
+		return;
+	}
+	/* the container mutex is not held here */
+	pthread_mutex_lock(&ad->mutex);
+	audiodec_drop(ad);
+	ad->terminate = 1;
+	pthread_cond_broadcast(&ad->cond);
+	pthread_mutex_unlock(&ad->mutex);
+	pthread_join(ad->thread, NULL);
+	ad->isRunning = 0;
+
+	audiodec_reset_resampling(ad);
+	av_freep(&ad->pcm);
+	ad->pcmSize = 0;
+}
+
+/* Queue packet for decoding, called by demux thread with the container
+ * mutex held. The packet data is taken over. While the queue is full
+ * the mutex is released, as Write() does. Returns -1 if the packet was
+ * dropped (seek, track switch, stop).
+ */
+static int32_t audiodec_push(Context_t *context, Track_t *track, uint32_t avIdx, AVPacket *packet, uint8_t restart)
+{
+	AudioDecContext *ad = &audioDec;
+	pthread_mutex_lock(&ad->mutex);
+	uint32_t generation = ad->generation;
+	pthread_mutex_unlock(&ad->mutex);
+	for (;;)
+	{
+		pthread_mutex_lock(&ad->mutex);
+		if (ad->count < AUDIODEC_QUEUE_SIZE || ad->terminate)
+		{
+			break;
+		}
+		pthread_mutex_unlock(&ad->mutex);
+
+		if (do_seek_target_seconds || do_seek_target_bytes || !context->playback->isPlaying)
+		{
+			return -1;
+		}
+
+		releaseMutex(__FILE__, __FUNCTION__,__LINE__);
+		struct timeval tv;
+		struct timespec ts;
+		gettimeofday(&tv, NULL);
+		ts.tv_sec = tv.tv_sec;
+		ts.tv_nsec = tv.tv_usec * 1000 + AUDIODEC_WAIT_MS * 1000000;
+		if (ts.tv_nsec >= 1000000000)
+		{
+			ts.tv_sec += 1;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_mutex_lock(&ad->mutex);
+		if (ad->count == AUDIODEC_QUEUE_SIZE && !ad->terminate)
+		{
+			pthread_cond_timedwait(&ad->cond, &ad->mutex, &ts);
+		}
+		pthread_mutex_unlock(&ad->mutex);
+		getMutex(__FILE__, __FUNCTION__,__LINE__);
+	}
+
+	int32_t ret = -1;
+	/* flushed while waiting (seek, track switch) */
+	if (!ad->terminate && generation == ad->generation)
+	{
+		AudioDecItem *item = &ad->queue[(ad->head + ad->count) % AUDIODEC_QUEUE_SIZE];
+		if (0 == wrapped_packet_move(&item->packet, packet))
+		{
+			item->track = track;
+			item->avIdx = avIdx;
+			item->restart = restart;
+			item->generation = generation;
+			ad->count += 1;
+			pthread_cond_broadcast(&ad->cond);
+			ret = 0;
+		}
+	}
+	pthread_mutex_unlock(&ad->mutex);
+	return ret;
+}
@@ -22,25 +22,58 @@
 #define FILLBUFSIZE 0
 #define FILLBUFDIFF 1048576
 #define FILLBUFPAKET 5120
+#define FILLBUFPAKETMAX 65536
 #define FILLBUFSEEKTIME 3 //sec
+#define FILLBUFSTATTIME 1000000 //us
+#define FILLBUFSECSMIN 4 //sec
+#define FILLBUFSECSMAX 30 //sec
+#define FILLBUFCALMTIME 60 //stat periods without stall before the target is halved
+#define FILLBUFTARGETMIN 262144
+#define FILLBUFRINGMIN (FILLBUFDIFF + 1048576) //ring at start, grows with the fill target
 #define TIMEOUT_MAX_ITERS 10
 
 static int ffmpeg_buf_size = FILLBUFSIZE + FILLBUFDIFF;
+static int ffmpeg_buf_ring_size = 0;
+static int ffmpeg_buf_ring_max = 0;
 static int ffmpeg_buf_seek_time = FILLBUFSEEKTIME;
 static int(*ffmpeg_read_org)(void *opaque, uint8_t *buf, int buf_size) = NULL;
 static int(*ffmpeg_real_read_org)(void *opaque, uint8_t *buf, int buf_size) = NULL;
 
 static int64_t(*ffmpeg_seek_org)(void *opaque, int64_t offset, int whence) = NULL;
-static unsigned char* ffmpeg_buf_read = NULL;
-static unsigned char* ffmpeg_buf_write = NULL;
+/* single producer (filler thread) / single consumer (ffmpeg read) ring,
+ * only the filler moves the write pointer and only the reader moves
+ * the read pointer. The ring starts small and the filler moves it to
+ * a bigger allocation when the fill target grows, the mutex keeps the
+ * reader away only while the ring is moved.
+ */
+static unsigned char* volatile ffmpeg_buf_read = NULL;
+static unsigned char* volatile ffmpeg_buf_write = NULL;
 static unsigned char* ffmpeg_buf = NULL;
+static pthread_mutex_t ffmpeg_buf_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_t fillerThread;
 static int hasfillerThreadStarted[10] = {0,0,0,0,0,0,0,0,0,0};
 int hasfillerThreadStartedID = 0;
-static pthread_mutex_t fillermutex;
 static int ffmpeg_buf_valid_size = 0;
 static int ffmpeg_do_seek_ret = 0;
-static int ffmpeg_do_seek = 0;
+static volatile int ffmpeg_do_seek = 0;
+
+/* adaptive prefetch, read size follows the link rate and the fill
+ * target follows the consumption rate, more seconds are kept on
+ * slow links or after the reader stalled
+ */
+static int32_t ffmpeg_buf_paket = FILLBUFPAKET;
+static int32_t ffmpeg_buf_target = 0;
+static int32_t ffmpeg_buf_secs = FILLBUFSECSMIN;
+static int32_t ffmpeg_buf_link_rate = 0;
+static int32_t ffmpeg_buf_consume_rate = 0;
+static volatile uint32_t ffmpeg_buf_consumed = 0;
+static volatile uint32_t ffmpeg_buf_stalls = 0;
+static uint32_t ffmpeg_buf_stat_consumed = 0;
+static uint32_t ffmpeg_buf_stat_stalls = 0;
+static int32_t ffmpeg_buf_calm_periods = 0;
+static int64_t ffmpeg_buf_stat_time = 0;
+static int64_t ffmpeg_buf_stat_read_bytes = 0;
+static int64_t ffmpeg_buf_stat_read_time = 0;
 static int ffmpeg_buf_stop = 0;
 
 static Context_t *g_context = 0;
@@ -175,22 +208,183 @@ static int32_t ffmpeg_read_wrapper2(void *opaque, uint8_t *buf, int32_t buf_size
 }
 
 //for buffered io
-void getfillerMutex(const char *filename, const char *function, int line) 
+static int32_t ffmpeg_buf_used(unsigned char *bufRead, unsigned char *bufWrite)
 {
-	ffmpeg_printf(100, "::%d requesting mutex\n", line);
+	if (bufRead <= bufWrite)
+	{
+		return bufWrite - bufRead;
+	}
+	return ffmpeg_buf_ring_size - (bufRead - bufWrite);
+}
 
-	pthread_mutex_lock(&fillermutex);
+static int32_t ffmpeg_buf_fill(void)
+{
+	int32_t used;
 
-	ffmpeg_printf(100, "::%d received mutex\n", line);
+	pthread_mutex_lock(&ffmpeg_buf_mutex);
+	used = ffmpeg_buf_used(ffmpeg_buf_read, ffmpeg_buf_write);
+	pthread_mutex_unlock(&ffmpeg_buf_mutex);
+	return used;
 }
 
-void releasefillerMutex(const char *filename, const const char *function, int line) 
+static int32_t ffmpeg_buf_smooth_rate(int32_t rate, int64_t sample)
 {
-	pthread_mutex_unlock(&fillermutex);
+	if (rate == 0)
+	{
+		return sample;
+	}
+	return (3 * (int64_t)rate + sample) / 4;
+}
+
+/* called by the filler, recalculates read size and fill target once per FILLBUFSTATTIME */
+static void ffmpeg_buf_update_stats(void)
+{
+	int64_t now = av_gettime();
+	int64_t elapsed = now - ffmpeg_buf_stat_time;
+	int32_t maxTarget = ffmpeg_buf_size - FILLBUFDIFF;
+
+	if (ffmpeg_buf_stat_time == 0 || elapsed < 0)
+	{
+		ffmpeg_buf_stat_time = now;
+		ffmpeg_buf_stat_consumed = ffmpeg_buf_consumed;
+		ffmpeg_buf_stat_stalls = ffmpeg_buf_stalls;
+		return;
+	}
+	if (elapsed < FILLBUFSTATTIME)
+	{
+		return;
+	}
+
+	uint32_t consumed = ffmpeg_buf_consumed;
+	uint32_t stalls = ffmpeg_buf_stalls;
+
+	ffmpeg_buf_consume_rate = ffmpeg_buf_smooth_rate(ffmpeg_buf_consume_rate, (int64_t)(consumed - ffmpeg_buf_stat_consumed) * 1000000 / elapsed);
+	/* time spent inside read gives the link rate, also while the buffer is at target */
+	if (ffmpeg_buf_stat_read_time > 0)
+	{
+		ffmpeg_buf_link_rate = ffmpeg_buf_smooth_rate(ffmpeg_buf_link_rate, ffmpeg_buf_stat_read_bytes * 1000000 / ffmpeg_buf_stat_read_time);
+	}
+
+	/* ~50ms of link rate per read */
+	ffmpeg_buf_paket = ffmpeg_buf_link_rate / 20;
+	if (ffmpeg_buf_paket < FILLBUFPAKET)
+	{
+		ffmpeg_buf_paket = FILLBUFPAKET;
+	}
+	else if (ffmpeg_buf_paket > FILLBUFPAKETMAX)
+	{
+		ffmpeg_buf_paket = FILLBUFPAKETMAX;
+	}
+
+	if (stalls != ffmpeg_buf_stat_stalls)
+	{
+		ffmpeg_buf_secs *= 2;
+		ffmpeg_buf_calm_periods = 0;
+	}
+	else if (++ffmpeg_buf_calm_periods >= FILLBUFCALMTIME)
+	{
+		/* no stall for a while, give back the extra read-ahead */
+		ffmpeg_buf_secs /= 2;
+		if (ffmpeg_buf_secs < FILLBUFSECSMIN)
+		{
+			ffmpeg_buf_secs = FILLBUFSECSMIN;
+		}
+		ffmpeg_buf_calm_periods = 0;
+	}
+	if (ffmpeg_buf_link_rate < ffmpeg_buf_consume_rate + ffmpeg_buf_consume_rate / 2)
+	{
+		/* link is barely faster than the stream, buffer as much as possible */
+		ffmpeg_buf_secs = FILLBUFSECSMAX;
+	}
+	if (ffmpeg_buf_secs > FILLBUFSECSMAX)
+	{
+		ffmpeg_buf_secs = FILLBUFSECSMAX;
+	}
+
+	if (ffmpeg_buf_consume_rate > 0)
+	{
+		int64_t target = (int64_t)ffmpeg_buf_consume_rate * ffmpeg_buf_secs;
+		if (target < FILLBUFTARGETMIN)
+		{
+			target = FILLBUFTARGETMIN;
+		}
+		ffmpeg_buf_target = (target < maxTarget) ? target : maxTarget;
+	}
+
+	ffmpeg_printf(20, "link rate=%d consume rate=%d read size=%d target=%d (%ds) stalls=%u\n", ffmpeg_buf_link_rate, ffmpeg_buf_consume_rate, ffmpeg_buf_paket, ffmpeg_buf_target, ffmpeg_buf_secs, stalls);
+
+	ffmpeg_buf_stat_time = now;
+	ffmpeg_buf_stat_consumed = consumed;
+	ffmpeg_buf_stat_stalls = stalls;
+	ffmpeg_buf_stat_read_bytes = 0;
+	ffmpeg_buf_stat_read_time = 0;
+}
+
+/* called by the filler, the ring follows the fill target up to the configured
+ * size, so memory is only taken when the link or the stream need it
+ */
+static void ffmpeg_buf_grow(void)
+{
+	int32_t ringSize = ffmpeg_buf_target + FILLBUFDIFF;
+	unsigned char *newBuf = NULL;
+	unsigned char *oldBuf = NULL;
+
+	if (ringSize <= ffmpeg_buf_ring_size)
+	{
+		return;
+	}
+	/* grow in big steps, the data has to be copied every time */
+	if (ringSize < ffmpeg_buf_ring_size + ffmpeg_buf_ring_size / 2)
+	{
+		ringSize = ffmpeg_buf_ring_size + ffmpeg_buf_ring_size / 2;
+	}
+	if (ringSize > ffmpeg_buf_ring_max)
+	{
+		ringSize = ffmpeg_buf_ring_max;
+	}
+	if (ringSize <= ffmpeg_buf_ring_size)
+	{
+		return;
+	}
+
+	newBuf = av_malloc(ringSize);
+	if (newBuf == NULL)
+	{
+		/* stay with the current ring */
+		ffmpeg_err("can not grow buffer to %d\n", ringSize);
+		ffmpeg_buf_ring_max = ffmpeg_buf_ring_size;
+		return;
+	}
 
-	ffmpeg_printf(100, "::%d released mutex\n", line);
+	pthread_mutex_lock(&ffmpeg_buf_mutex);
+	/* history for backward seeks and unread data go to the start of the new ring */
+	int32_t history = ffmpeg_buf_valid_size;
+	int32_t used = ffmpeg_buf_used(ffmpeg_buf_read, ffmpeg_buf_write);
+	int32_t len = history + used;
+	unsigned char *bufStart = ffmpeg_buf_read - history;
+	if (bufStart < ffmpeg_buf)
+	{
+		bufStart += ffmpeg_buf_ring_size;
+	}
+	int32_t span = (ffmpeg_buf + ffmpeg_buf_ring_size) - bufStart;
+	if (span > len)
+	{
+		span = len;
+	}
+	memcpy(newBuf, bufStart, span);
+	memcpy(newBuf + span, ffmpeg_buf, len - span);
+
+	oldBuf = ffmpeg_buf;
+	ffmpeg_buf = newBuf;
+	ffmpeg_buf_ring_size = ringSize;
+	ffmpeg_buf_read = newBuf + history;
+	ffmpeg_buf_write = newBuf + len;
+	pthread_mutex_unlock(&ffmpeg_buf_mutex);
+
+	av_free(oldBuf);
+	ffmpeg_printf(10, "buffer grown to %d (target=%d)\n", ringSize, ffmpeg_buf_target);
 }
-//for buffered io (end)encoding
+//for buffered io (end)
 
 static int32_t container_set_ffmpeg_buf_seek_time(int32_t* time)
 {
@@ -221,22 +415,24 @@ static int32_t container_get_ffmpeg_buf_size(int32_t* size)
 	return cERR_CONTAINER_FFMPEG_NO_ERROR;
 }
 
-static int32_t container_get_fillbufstatus(int32_t* size)
+static int32_t container_get_fillbufstatus(ContainerBufferStatus_t* status)
 {
-	int32_t rwdiff = 0;
+	unsigned char *bufRead = ffmpeg_buf_read;
+	unsigned char *bufWrite = ffmpeg_buf_write;
 
-	if (ffmpeg_buf != NULL && ffmpeg_buf_read != NULL && ffmpeg_buf_write != NULL)
+	memset(status, 0, sizeof(*status));
+	if (ffmpeg_buf != NULL && bufRead != NULL && bufWrite != NULL)
 	{
-		if (ffmpeg_buf_read < ffmpeg_buf_write)
+		status->size = ffmpeg_buf_fill();
+		status->target = ffmpeg_buf_target;
+		status->linkRate = ffmpeg_buf_link_rate;
+		status->consumeRate = ffmpeg_buf_consume_rate;
+		status->bufferedMs = 0;
+		if (ffmpeg_buf_consume_rate > 0)
 		{
-			rwdiff = ffmpeg_buf_write - ffmpeg_buf_read;
+			status->bufferedMs = (int64_t)status->size * 1000 / ffmpeg_buf_consume_rate;
 		}
-		if (ffmpeg_buf_read > ffmpeg_buf_write)
-		{
-			rwdiff = (ffmpeg_buf + ffmpeg_buf_size) - ffmpeg_buf_read;
-			rwdiff += ffmpeg_buf_write - ffmpeg_buf;
-		}
-		*size = rwdiff;
+		status->stalls = ffmpeg_buf_stalls;
 	}
 	return cERR_CONTAINER_FFMPEG_NO_ERROR;
 }
@@ -252,19 +448,24 @@ static int32_t container_stop_buffer()
 static void ffmpeg_filler(Context_t *context, int32_t id, int32_t* inpause, int32_t flag)
 {
 	int32_t len = 0;
-	int32_t rwdiff = ffmpeg_buf_size;
-	uint8_t buf[FILLBUFPAKET];
+	int32_t rwdiff = ffmpeg_buf_ring_size;
+	unsigned char *bufWrite = NULL;
 
 	if (ffmpeg_read_org == NULL || ffmpeg_seek_org == NULL)
 	{
 		ffmpeg_err("ffmpeg_read_org or ffmpeg_seek_org is NULL\n");
 		return;
 	}
+	if (ffmpeg_buf_target == 0)
+	{
+		/* no rates measured yet, fill the initial ring */
+		ffmpeg_buf_target = ffmpeg_buf_ring_size - FILLBUFDIFF;
+	}
 
 	while ((flag == 0 && avContextTab[0] != NULL && avContextTab[0]->pb != NULL && rwdiff > FILLBUFDIFF)
 	   ||  (flag == 1 && hasfillerThreadStarted[id] == 1 && avContextTab[0] != NULL && avContextTab[0]->pb != NULL && rwdiff > FILLBUFDIFF))
 	{
-		 if ( 0 == PlaybackDieNow(0))
+		 if (PlaybackDieNow(0))
 		 {
 			break;
 		 }
@@ -273,8 +474,7 @@ static void ffmpeg_filler(Context_t *context, int32_t id, int32_t* inpause, int3
 			 ffmpeg_buf_stop = 0;
 			 break;
 		 }
-		 getfillerMutex(__FILE__, __FUNCTION__,__LINE__);
-		 //do a seek
+		 //do a seek, reader waits till ffmpeg_do_seek is cleared
 		 if (ffmpeg_do_seek != 0)
 		 {
 			 ffmpeg_do_seek_ret = ffmpeg_seek_org(avContextTab[0]->pb->opaque, avContextTab[0]->pb->pos + ffmpeg_do_seek, SEEK_SET);
@@ -282,38 +482,35 @@ static void ffmpeg_filler(Context_t *context, int32_t id, int32_t* inpause, int3
 			 {
 				 ffmpeg_buf_write = ffmpeg_buf;
 				 ffmpeg_buf_read = ffmpeg_buf;
+				 ffmpeg_buf_valid_size = 0;
 			 }
+			 __sync_synchronize();
 			 ffmpeg_do_seek = 0;
 		 }
-		 if (ffmpeg_buf_read == ffmpeg_buf_write)
-		 {
-			 ffmpeg_buf_valid_size = 0;
-			 rwdiff = ffmpeg_buf_size;
-		 }
-		 if (ffmpeg_buf_read < ffmpeg_buf_write)
-		 {
-			 rwdiff = (ffmpeg_buf + ffmpeg_buf_size) - ffmpeg_buf_write;
-			 rwdiff += ffmpeg_buf_read - ffmpeg_buf;
-		 }
-		 if (ffmpeg_buf_read > ffmpeg_buf_write)
+
+		 ffmpeg_buf_update_stats();
+		 ffmpeg_buf_grow();
+
+		 /* FILLBUFDIFF bytes behind the read pointer are kept for backward seeks,
+		  * and no more than ffmpeg_buf_target is read ahead
+		  */
+		 bufWrite = ffmpeg_buf_write;
+		 int32_t used = ffmpeg_buf_used(ffmpeg_buf_read, bufWrite);
+		 rwdiff = ffmpeg_buf_ring_size - used;
+		 if (rwdiff > ffmpeg_buf_target - used + FILLBUFDIFF)
 		 {
-			rwdiff = ffmpeg_buf_read - ffmpeg_buf_write;
+			 rwdiff = ffmpeg_buf_target - used + FILLBUFDIFF;
 		 }
-		 int32_t size = FILLBUFPAKET;
+
+		 int32_t size = ffmpeg_buf_paket;
 		 if (rwdiff - FILLBUFDIFF < size)
 		 {
 			 size = (rwdiff - FILLBUFDIFF);
 		 }
-
-		 if (ffmpeg_buf_write + size > ffmpeg_buf + ffmpeg_buf_size)
+		 if (bufWrite + size > ffmpeg_buf + ffmpeg_buf_ring_size)
 		 {
-			 size = (ffmpeg_buf + ffmpeg_buf_size) - ffmpeg_buf_write;
+			 size = (ffmpeg_buf + ffmpeg_buf_ring_size) - bufWrite;
 		 }
-		 if (ffmpeg_buf_write == ffmpeg_buf + ffmpeg_buf_size)
-		 {
-			 ffmpeg_buf_write = ffmpeg_buf;
-		 }
-		 releasefillerMutex(__FILE__, __FUNCTION__,__LINE__);
 
 		 if (size > 0)
 		 {
@@ -321,26 +518,36 @@ static void ffmpeg_filler(Context_t *context, int32_t id, int32_t* inpause, int3
 			{
 				break;
 			}
-			len = ffmpeg_read_org(avContextTab[0]->pb->opaque, buf, size);
+			/* read straight into the free region of the ring */
+			int64_t readStart = av_gettime();
+			len = ffmpeg_read_org(avContextTab[0]->pb->opaque, bufWrite, size);
+			if (len > 0)
+			{
+				ffmpeg_buf_stat_read_bytes += len;
+				ffmpeg_buf_stat_read_time += av_gettime() - readStart;
+			}
 			if (flag == 1 && hasfillerThreadStarted[id] == 2)
 			{
 				break;
 			}
 			ffmpeg_printf(20, "buffer-status (free buffer=%d)\n", rwdiff - FILLBUFDIFF - len);
 
-			getfillerMutex(__FILE__, __FUNCTION__,__LINE__);
 			if (len > 0)
 			{
-				memcpy(ffmpeg_buf_write, buf, len);
-				ffmpeg_buf_write += len;
+				bufWrite += len;
+				if (bufWrite == ffmpeg_buf + ffmpeg_buf_ring_size)
+				{
+					bufWrite = ffmpeg_buf;
+				}
+				/* data must be visible before the reader sees the new write pointer */
+				__sync_synchronize();
+				ffmpeg_buf_write = bufWrite;
 			}
 			else
 			{
-				releasefillerMutex(__FILE__, __FUNCTION__,__LINE__);
 				ffmpeg_err("read not ok ret=%d\n", len);
 			 	break;
 			 }
-			 releasefillerMutex(__FILE__, __FUNCTION__,__LINE__);
 		}
 		else
 		{
@@ -353,21 +560,10 @@ static void ffmpeg_filler(Context_t *context, int32_t id, int32_t* inpause, int3
 				}
 				else if ((*inpause) == 1 && !context->playback->isPaused)
 				{
-					int32_t buflen = 0;
+					int32_t buflen = ffmpeg_buf_used(ffmpeg_buf_read, ffmpeg_buf_write);
 					(*inpause) = 0;
 
-					getfillerMutex(__FILE__, __FUNCTION__,__LINE__);
-					if (ffmpeg_buf_read < ffmpeg_buf_write)
-					{
-						buflen = ffmpeg_buf_write - ffmpeg_buf_read;
-					}
-					if (ffmpeg_buf_read > ffmpeg_buf_write)
-					{
-						buflen = (ffmpeg_buf + ffmpeg_buf_size) - ffmpeg_buf_read;
-						buflen += ffmpeg_buf_write - ffmpeg_buf;
-					} 
 					ffmpeg_seek_org(avContextTab[0]->pb->opaque, avContextTab[0]->pb->pos + buflen, SEEK_SET);
-					releasefillerMutex(__FILE__, __FUNCTION__,__LINE__);
 				}
 			}
 		}
@@ -445,6 +641,30 @@ static int32_t ffmpeg_start_fillerTHREAD(Context_t *context)
 	return ret;
 }
 
+/* the filler reads from the AVIO context, so it has to be gone
+ * before the container closes it
+ */
+static void ffmpeg_stop_fillerTHREAD()
+{
+	int32_t id = hasfillerThreadStartedID;
+	int32_t count = 20;
+
+	if (hasfillerThreadStarted[id] != 1)
+	{
+		return;
+	}
+
+	hasfillerThreadStarted[id] = 2;
+	while (hasfillerThreadStarted[id] != 0 && (--count) > 0)
+	{
+		usleep(100000);
+	}
+	if (hasfillerThreadStarted[id] != 0)
+	{
+		ffmpeg_err("filler thread ID=%d does not terminate\n", id);
+	}
+}
+
 static int32_t ffmpeg_read_real(void *opaque, uint8_t *buf, int32_t buf_size)
 {
 	int32_t len = buf_size;
@@ -452,33 +672,36 @@ static int32_t ffmpeg_read_real(void *opaque, uint8_t *buf, int32_t buf_size)
 
 	if (buf_size > 0)
 	{
-		getfillerMutex(__FILE__, __FUNCTION__,__LINE__);
-
-		if (ffmpeg_buf_read < ffmpeg_buf_write)
-		{
-			rwdiff = ffmpeg_buf_write - ffmpeg_buf_read;
-		}
-		if (ffmpeg_buf_read > ffmpeg_buf_write)
-		{
-			rwdiff = (ffmpeg_buf + ffmpeg_buf_size) - ffmpeg_buf_read;
-			rwdiff += ffmpeg_buf_write - ffmpeg_buf;
-		}
-		rwdiff--;
+		pthread_mutex_lock(&ffmpeg_buf_mutex);
+		unsigned char *bufRead = ffmpeg_buf_read;
+		unsigned char *bufWrite = ffmpeg_buf_write;
+		/* write pointer is loaded before the data it covers */
+		__sync_synchronize();
 
+		rwdiff = ffmpeg_buf_used(bufRead, bufWrite);
 		if (len > rwdiff)
 		{
 			len = rwdiff;
 		}
 
-		if (ffmpeg_buf_read + len > ffmpeg_buf + ffmpeg_buf_size)
-		{
-			len = (ffmpeg_buf + ffmpeg_buf_size) - ffmpeg_buf_read;
-		}
-
 		if (len > 0)
 		{
-			memcpy(buf, ffmpeg_buf_read, len);
-			ffmpeg_buf_read += len;
+			/* available data is at most two contiguous spans */
+			int32_t span = (ffmpeg_buf + ffmpeg_buf_ring_size) - bufRead;
+			if (span > len)
+			{
+				span = len;
+			}
+			memcpy(buf, bufRead, span);
+			if (len > span)
+			{
+				memcpy(buf + span, ffmpeg_buf, len - span);
+			}
+			bufRead += len;
+			if (bufRead >= ffmpeg_buf + ffmpeg_buf_ring_size)
+			{
+				bufRead -= ffmpeg_buf_ring_size;
+			}
 
 			if (ffmpeg_buf_valid_size < FILLBUFDIFF)
 			{
@@ -491,16 +714,16 @@ static int32_t ffmpeg_read_real(void *opaque, uint8_t *buf, int32_t buf_size)
 					ffmpeg_buf_valid_size += len;
 				}
 			}
-			if (ffmpeg_buf_read == ffmpeg_buf + ffmpeg_buf_size)
-			{
-				ffmpeg_buf_read = ffmpeg_buf;
-			}
+			/* data is copied out before the filler may reuse it */
+			__sync_synchronize();
+			ffmpeg_buf_read = bufRead;
+			ffmpeg_buf_consumed += len;
 		}
 		else
 		{
 			len = 0;
 		}
-		releasefillerMutex(__FILE__, __FUNCTION__,__LINE__);
+		pthread_mutex_unlock(&ffmpeg_buf_mutex);
 	}
 	return len;
 }
@@ -510,6 +733,7 @@ static int32_t ffmpeg_read(void *opaque, uint8_t *buf, int32_t buf_size)
 	int32_t sumlen = 0;
 	int32_t len = 0;
 	int32_t count = 2000;
+	int8_t stalled = 0;
 
 	while (sumlen < buf_size && (--count) > 0 && 0 == PlaybackDieNow(0))
 	{
@@ -518,6 +742,12 @@ static int32_t ffmpeg_read(void *opaque, uint8_t *buf, int32_t buf_size)
 		buf += len;
 		if (len == 0)
 		{
+			if (!stalled)
+			{
+				/* reader ran dry, filler will keep more seconds */
+				stalled = 1;
+				ffmpeg_buf_stalls++;
+			}
 			usleep(10000);
 		}
 	}
@@ -558,56 +788,64 @@ static int64_t ffmpeg_seek(void *opaque, int64_t offset, int32_t whence)
 	{
 		return avContextTab[0]->pb->pos;
 	}
-	getfillerMutex(__FILE__, __FUNCTION__,__LINE__);
 
-	if (ffmpeg_buf_read < ffmpeg_buf_write)
-	{
-		rwdiff = ffmpeg_buf_write - ffmpeg_buf_read;
-	}
-	if (ffmpeg_buf_read > ffmpeg_buf_write)
-	{
-		rwdiff = (ffmpeg_buf + ffmpeg_buf_size) - ffmpeg_buf_read;
-		rwdiff += ffmpeg_buf_write - ffmpeg_buf;
-	}
+	pthread_mutex_lock(&ffmpeg_buf_mutex);
+	unsigned char *bufRead = ffmpeg_buf_read;
+	rwdiff = ffmpeg_buf_used(bufRead, ffmpeg_buf_write);
+
 	if (diff > 0 && diff < rwdiff)
 	{
 		/* can do the seek inside the buffer */
 		ffmpeg_printf(20, "buffer-seek diff=%lld\n", diff);
-		if (diff > (ffmpeg_buf + ffmpeg_buf_size) - ffmpeg_buf_read)
+		if (diff >= (ffmpeg_buf + ffmpeg_buf_ring_size) - bufRead)
 		{
-			ffmpeg_buf_read = ffmpeg_buf + (diff - ((ffmpeg_buf + ffmpeg_buf_size) - ffmpeg_buf_read));
+			bufRead = ffmpeg_buf + (diff - ((ffmpeg_buf + ffmpeg_buf_ring_size) - bufRead));
 		}
 		else
 		{
-			ffmpeg_buf_read = ffmpeg_buf_read + diff;
+			bufRead = bufRead + diff;
 		}
+		ffmpeg_buf_read = bufRead;
+		pthread_mutex_unlock(&ffmpeg_buf_mutex);
 	}
 	else if (diff < 0 && diff * -1 < ffmpeg_buf_valid_size)
 	{
-		/* can do the seek inside the buffer */
+		/* can do the seek inside the buffer, the filler never
+		 * writes into the FILLBUFDIFF bytes behind the read pointer
+		 */
 		ffmpeg_printf(20, "buffer-seek diff=%lld\n", diff);
 		int32_t tmpdiff = diff * -1;
-		if (tmpdiff > ffmpeg_buf_read - ffmpeg_buf)
+		if (tmpdiff > bufRead - ffmpeg_buf)
 		{
-			ffmpeg_buf_read = (ffmpeg_buf + ffmpeg_buf_size) - (tmpdiff - (ffmpeg_buf_read - ffmpeg_buf));
+			bufRead = (ffmpeg_buf + ffmpeg_buf_ring_size) - (tmpdiff - (bufRead - ffmpeg_buf));
 		}
 		else
 		{
-			ffmpeg_buf_read = ffmpeg_buf_read - tmpdiff;
+			bufRead = bufRead - tmpdiff;
 		}
+		ffmpeg_buf_valid_size -= tmpdiff;
+		ffmpeg_buf_read = bufRead;
+		pthread_mutex_unlock(&ffmpeg_buf_mutex);
 	}
 	else
 	{
-		releasefillerMutex(__FILE__, __FUNCTION__,__LINE__);
+		pthread_mutex_unlock(&ffmpeg_buf_mutex);
 		ffmpeg_printf(20, "real-seek diff=%lld\n", diff);
 
 		ffmpeg_do_seek_ret = 0;
 		ffmpeg_do_seek = diff;
-		while (ffmpeg_do_seek != 0)
+		while (ffmpeg_do_seek != 0 && 0 == PlaybackDieNow(0) && hasfillerThreadStarted[hasfillerThreadStartedID] == 1)
 		{
 			usleep(100000);
 		}
-		ffmpeg_do_seek = 0;
+		__sync_synchronize();
+		if (ffmpeg_do_seek != 0)
+		{
+			/* filler is stopping, nobody will do the seek */
+			ffmpeg_do_seek = 0;
+			ffmpeg_err("seek not done, filler is not running\n");
+			return AVERROR(EIO);
+		}
 		if (ffmpeg_do_seek_ret < 0)
 		{
 			ffmpeg_err("seek not ok ret=%d\n", ffmpeg_do_seek_ret);
@@ -616,17 +854,13 @@ static int64_t ffmpeg_seek(void *opaque, int64_t offset, int32_t whence)
 
 		//fill buffer
 		int32_t count = ffmpeg_buf_seek_time * 10;
-		int32_t size = 0;
 
-		container_get_fillbufstatus(&size);
-		while (size < ffmpeg_buf_size - FILLBUFDIFF && (--count) > 0)
+		while (ffmpeg_buf_fill() < ffmpeg_buf_target && (--count) > 0)
 		{
 			usleep(100000);
-			container_get_fillbufstatus(&size);
 		}
 		return avContextTab[0]->pb->pos + diff;
 	}
-	releasefillerMutex(__FILE__, __FUNCTION__,__LINE__);
 	return avContextTab[0]->pb->pos + diff;
 }
 
@@ -636,12 +870,25 @@ static void ffmpeg_buf_free()
 	ffmpeg_seek_org = NULL;
 	ffmpeg_buf_read = NULL;
 	ffmpeg_buf_write = NULL;
-	free(ffmpeg_buf);
+	av_free(ffmpeg_buf);
 	ffmpeg_buf = NULL;
+	ffmpeg_buf_ring_size = 0;
+	ffmpeg_buf_ring_max = 0;
 	ffmpeg_buf_valid_size = 0;
 	ffmpeg_do_seek_ret = 0;
 	ffmpeg_do_seek = 0;
 	ffmpeg_buf_stop = 0;
 	hasfillerThreadStartedID = 0;
+	ffmpeg_buf_paket = FILLBUFPAKET;
+	ffmpeg_buf_target = 0;
+	ffmpeg_buf_secs = FILLBUFSECSMIN;
+	ffmpeg_buf_link_rate = 0;
+	ffmpeg_buf_consume_rate = 0;
+	ffmpeg_buf_consumed = 0;
+	ffmpeg_buf_stalls = 0;
+	ffmpeg_buf_calm_periods = 0;
+	ffmpeg_buf_stat_time = 0;
+	ffmpeg_buf_stat_read_bytes = 0;
+	ffmpeg_buf_stat_read_time = 0;
 }
 // vim:ts=4
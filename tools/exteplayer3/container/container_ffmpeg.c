@@ -38,6 +38,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/poll.h>
+#include <sys/time.h>
 #include <pthread.h>
 #include <sys/prctl.h>
 #include <stdint.h>
@@ -207,6 +208,7 @@ static int32_t Write(Write_FN WriteFun, void *context, void *privateData, int64_
 
 #include "buff_ffmpeg.c"
 #include "wrapped_ffmpeg.c"
+#include "reverse_ffmpeg.c"
 #if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(56, 34, 100)
 #include "mpeg4p2_ffmpeg.c"
 #endif
@@ -623,6 +625,9 @@ static char* searchMeta(void * metadata, char* ourTag)
    return NULL;
 }
 
+#include "audiodec_ffmpeg.c"
+#include "demux_ffmpeg.c"
+
 /* **************************** */
 /* Worker Thread                */
 /* **************************** */
@@ -634,6 +639,7 @@ static void FFMPEGThread(Context_t *context)
 	threadname[16] = 0;
 	prctl (PR_SET_NAME, (unsigned long)&threadname);
 	AVPacket   packet;
+	DemuxStreamInfo streamInfo;
 	off_t   lastSeek = -1;
 	int64_t lastPts = -1;
 	int64_t currentVideoPts = -1;
@@ -649,14 +655,11 @@ static void FFMPEGThread(Context_t *context)
 	int64_t bofcount = 0;
 	int32_t       err = 0;
 	AudioVideoOut_t avOut;
+	ReverseContext reverseCtx;
+	memset(&reverseCtx, 0, sizeof(reverseCtx));
 	
 	g_context = context;
 
-	SwrContext *swr = NULL;
-	AVFrame *decoded_frame = NULL;
-	int32_t out_sample_rate = 44100;
-	int32_t out_channels = 2;
-	uint64_t out_channel_layout = AV_CH_LAYOUT_STEREO;
 	uint32_t cAVIdx = 0;
 
 #if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(56, 34, 100)
@@ -675,6 +678,8 @@ static void FFMPEGThread(Context_t *context)
 		usleep(1000);
 	}
 	ffmpeg_printf(10, "Running!\n");
+	audiodec_start(context);
+	demux_start();
 	
 #ifdef __sh__
 	uint32_t bufferSize = 0;
@@ -723,9 +728,47 @@ static void FFMPEGThread(Context_t *context)
 			continue;
 		}
 
+		if (context->playback->BackWard && !reverseCtx.isActive)
+		{
+			isWaitingForFinish = 0;
+			/* reverse play seeks and reads the contexts itself */
+			demux_pause(-1);
+			reverse_context_start(&reverseCtx, currentVideoPts > 0 ? currentVideoPts : latestPts);
+		}
+		else if (!context->playback->BackWard && reverseCtx.isActive)
+		{
+			/* it will set seek target to the last displayed key frame,
+			 * the seek resumes the reader threads */
+			reverse_context_stop(&reverseCtx);
+			if (!do_seek_target_seconds)
+			{
+				demux_resume(-1);
+			}
+		}
+
+		if (reverseCtx.isActive)
+		{
+			Track_t *videoTrack = NULL;
+			int32_t res = 1;
+			context->manager->video->Command(context, MANAGER_GET_TRACK, &videoTrack);
+			if (videoTrack)
+			{
+				res = reverse_write_step(context, &reverseCtx, videoTrack);
+			}
+			releaseMutex(__FILE__, __FUNCTION__,__LINE__);
+			reset_finish_timeout();
+			if (res)
+			{
+				usleep(10000);
+			}
+			continue;
+		}
+
 		if (do_seek_target_seconds || do_seek_target_bytes) 
 		{
 			isWaitingForFinish = 0;
+			audiodec_flush();
+			demux_pause(-1);
 			if (do_seek_target_seconds)
 			{
 				ffmpeg_printf(10, "seek_target_seconds[%lld]\n", seek_target_seconds);
@@ -792,6 +835,8 @@ static void FFMPEGThread(Context_t *context)
 #ifdef HAVE_FLV2MPEG4_CONVERTER
 			flv2mpeg4_context_reset(&flv2mpeg4_context);
 #endif
+			/* the second source is seeked again to the first video pts */
+			demux_resume(prev_seek_time_sec >= 0 ? 0 : -1);
 		}
 
 		int ffmpegStatus = 0;
@@ -799,21 +844,39 @@ static void FFMPEGThread(Context_t *context)
 		{
 			if(NULL != avContextTab[1])
 			{
-				cAVIdx = currentVideoPts <= currentAudioPts ? 0 : 1;
-				if (1 == cAVIdx && prev_seek_time_sec >= 0 )
+				if (prev_seek_time_sec >= 0 && currentVideoPts > currentAudioPts)
 				{
+					demux_pause(1);
 					avformat_seek_file(avContextTab[1], -1, (currentVideoPts / 90000) * AV_TIME_BASE - AV_TIME_BASE, (currentVideoPts / 90000) * AV_TIME_BASE, (currentVideoPts / 90000) * AV_TIME_BASE + AV_TIME_BASE, 0);
 					prev_seek_time_sec = -1;
+					audiodec_flush();
 					wrapped_avcodec_flush_buffers(1);
+					demux_resume(1);
+				}
+				if (demux.isRunning)
+				{
+					ffmpegStatus = demux_read(context, &packet, &cAVIdx, &streamInfo);
+					if (1 == ffmpegStatus)
+					{
+						// seek or stop pending
+						releaseMutex(__FILE__, __FUNCTION__,__LINE__);
+						continue;
+					}
+				}
+				else
+				{
+					cAVIdx = currentVideoPts <= currentAudioPts ? 0 : 1;
+					ffmpegStatus = demux_read_frame(cAVIdx, &packet, &streamInfo, NULL);
 				}
 			}
 			else
 			{
 				cAVIdx = 0;
+				ffmpegStatus = demux_read_frame(cAVIdx, &packet, &streamInfo, NULL);
 			}
 		}
 		
-		if (!isWaitingForFinish && (ffmpegStatus = av_read_frame(avContextTab[cAVIdx], &packet)) == 0 )
+		if (!isWaitingForFinish && 0 == ffmpegStatus)
 		{
 			int64_t pts = 0;
 			int64_t dts = 0;
@@ -821,10 +884,10 @@ static void FFMPEGThread(Context_t *context)
 			Track_t *audioTrack = NULL;
 			Track_t *subtitleTrack = NULL;
 
-			int32_t pid = avContextTab[cAVIdx]->streams[packet.stream_index]->id;
+			int32_t pid = streamInfo.id;
 			
 			reset_finish_timeout();
-			if(avContextTab[cAVIdx]->streams[packet.stream_index]->discard != AVDISCARD_ALL)
+			if(streamInfo.discard != AVDISCARD_ALL)
 			{
 				if (context->manager->video->Command(context, MANAGER_GET_TRACK, &videoTrack) < 0)
 				{
@@ -870,7 +933,7 @@ static void FFMPEGThread(Context_t *context)
 				else
 #endif
 #ifdef HAVE_FLV2MPEG4_CONVERTER
-				if (get_codecpar(avContextTab[cAVIdx]->streams[packet.stream_index])->codec_id == AV_CODEC_ID_FLV1 &&
+				if (streamInfo.codecId == AV_CODEC_ID_FLV1 &&
 					0 == memcmp(videoTrack->Encoding, "V_MPEG4", 7) )
 				{
 					flv2mpeg4_write_packet(context, &flv2mpeg4_context, videoTrack, cAVIdx, &currentVideoPts, &latestPts, &packet);
@@ -1021,199 +1084,12 @@ static void FFMPEGThread(Context_t *context)
 				}
 				else if (audioTrack->inject_as_pcm == 1 && audioTrack->avCodecCtx)
 				{
-					AVCodecContext *c = audioTrack->avCodecCtx;
-
-					if (restart_audio_resampling)
+					/* decoded and written by the audio decoder thread */
+					uint8_t restart = restart_audio_resampling;
+					restart_audio_resampling = 0;
+					if (audiodec_push(context, audioTrack, cAVIdx, &packet, restart) < 0)
 					{
-						restart_audio_resampling = 0;
-						if (swr)
-						{
-							swr_free(&swr);
-							swr = NULL;
-						}
-						if (decoded_frame)
-						{
-							wrapped_frame_free(&decoded_frame);
-							decoded_frame = NULL;
-						}
-					}
-#if (LIBAVFORMAT_VERSION_MAJOR > 57) || ((LIBAVFORMAT_VERSION_MAJOR == 57) && (LIBAVFORMAT_VERSION_MINOR > 32))
-					while (packet.size > 0 || (!packet.size && !packet.data)) 
-#else
-					while(packet.size > 0)
-#endif
-					{
-						if(do_seek_target_seconds || do_seek_target_bytes)
-						{
-							break;
-						}
-						
-						if (!decoded_frame)
-						{
-							decoded_frame = wrapped_frame_alloc();
-							if (!decoded_frame)
-							{
-								ffmpeg_err("out of memory\n");
-								exit(1);
-							}
-						} 
-						else
-						{
-							wrapped_frame_unref(decoded_frame);
-						}
-#if (LIBAVFORMAT_VERSION_MAJOR > 57) || ((LIBAVFORMAT_VERSION_MAJOR == 57) && (LIBAVFORMAT_VERSION_MINOR > 32))
-						int ret = avcodec_send_packet(c, &packet);
-						if (ret < 0 && ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) 
-						{
-							restart_audio_resampling = 1;
-							break;
-						}
-						
-						if (ret >= 0)
-						{
-							packet.size = 0;
-						}
-						
-						ret = avcodec_receive_frame(c, decoded_frame);
-						if (ret < 0)
-						{
-							if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) 
-							{
-								restart_audio_resampling = 1;
-								break;
-							}
-							else
-							{
-								continue;
-							}
-						}
-#else
-						int32_t got_frame = 0;
-						int32_t len = avcodec_decode_audio4(c, decoded_frame, &got_frame, &packet);
-						if (len < 0) 
-						{
-							ffmpeg_err("avcodec_decode_audio4: %d\n", len);
-							break;
-						}
-
-						packet.data += len;
-						packet.size -= len;
-						
-						if (!got_frame)
-						{
-							continue;
-						}
-#endif
-						int32_t e = 0;
-						if (!swr) 
-						{
-							if(insert_pcm_as_lpcm)
-							{
-								out_sample_rate = 48000;
-							}
-							else
-							{
-								int32_t rates[] = { 48000, 96000, 192000, 44100, 88200, 176400, 0 };
-								int32_t *rate = rates;
-								int32_t in_rate = c->sample_rate;
-								while (*rate && ((*rate / in_rate) * in_rate != *rate) && (in_rate / *rate) * *rate != in_rate)
-								{
-									rate++;
-								}
-								out_sample_rate = *rate ? *rate : 44100;
-							}
-							
-							swr = swr_alloc();
-							out_channels = c->channels;
-							
-							if (c->channel_layout == 0)
-							{
-								c->channel_layout = av_get_default_channel_layout( c->channels );
-							}
-							out_channel_layout = c->channel_layout;
-							
-							uint8_t downmix = stereo_software_decoder && out_channels > 2 ? 1 : 0;
-#ifdef __sh__
-							// player2 won't play mono
-							if (out_channel_layout == AV_CH_LAYOUT_MONO)
-							{
-								downmix = 1;
-							}
-#endif
-							if(downmix)
-							{
-								out_channel_layout = AV_CH_LAYOUT_STEREO_DOWNMIX;
-								out_channels = 2;
-							}
-							
-							av_opt_set_int(swr, "in_channel_layout",	c->channel_layout,	0);
-							av_opt_set_int(swr, "out_channel_layout",	out_channel_layout,	0);
-							av_opt_set_int(swr, "in_sample_rate",		c->sample_rate,		0);
-							av_opt_set_int(swr, "out_sample_rate",		out_sample_rate,	0);
-							av_opt_set_int(swr, "in_sample_fmt",		c->sample_fmt,		0);
-							av_opt_set_int(swr, "out_sample_fmt",		AV_SAMPLE_FMT_S16,	0);
-		
-
-							e = swr_init(swr);
-							if (e < 0) 
-							{
-								ffmpeg_err("swr_init: %d (icl=%d ocl=%d isr=%d osr=%d isf=%d osf=%d\n",
-									-e, (int32_t)c->channel_layout, (int32_t)out_channel_layout, c->sample_rate, out_sample_rate, c->sample_fmt, AV_SAMPLE_FMT_S16);
-								swr_free(&swr);
-								swr = NULL;
-							}
-						}
-						
-						uint8_t *output[8] = {NULL};
-						int32_t in_samples = decoded_frame->nb_samples;
-						int32_t out_samples = av_rescale_rnd(swr_get_delay(swr, c->sample_rate) + in_samples, out_sample_rate, c->sample_rate, AV_ROUND_UP);
-						e = av_samples_alloc(&output[0], NULL, out_channels, out_samples, AV_SAMPLE_FMT_S16, 1);
-						if (e < 0) 
-						{
-							ffmpeg_err("av_samples_alloc: %d\n", -e);
-							continue;
-						}
-						int64_t next_in_pts = av_rescale(av_frame_get_best_effort_timestamp(decoded_frame),
-										 ((AVStream*) audioTrack->stream)->time_base.num * (int64_t)out_sample_rate * c->sample_rate,
-										 ((AVStream*) audioTrack->stream)->time_base.den);
-						int64_t next_out_pts = av_rescale(swr_next_pts(swr, next_in_pts),
-										 ((AVStream*) audioTrack->stream)->time_base.den,
-										 ((AVStream*) audioTrack->stream)->time_base.num * (int64_t)out_sample_rate * c->sample_rate);
-						
-						currentAudioPts = audioTrack->pts = pts = calcPts(cAVIdx, audioTrack->stream, next_out_pts);
-						out_samples = swr_convert(swr, &output[0], out_samples, (const uint8_t **) &decoded_frame->data[0], in_samples);
-						
-						//////////////////////////////////////////////////////////////////////
-						// Update pcmExtradata according to decode parameters
-						pcmExtradata.channels              = av_get_channel_layout_nb_channels(out_channel_layout);
-						pcmExtradata.bits_per_coded_sample = 16;
-						pcmExtradata.sample_rate           = out_sample_rate;
-						// The data described by the sample format is always in native-endian order
-#ifdef WORDS_BIGENDIAN
-						pcmExtradata.ffmpeg_codec_id       = AV_CODEC_ID_PCM_S16BE;
-#else
-						pcmExtradata.ffmpeg_codec_id       = AV_CODEC_ID_PCM_S16LE;
-#endif
-
-						//////////////////////////////////////////////////////////////////////
-
-						avOut.data       = output[0];
-						avOut.len        = out_samples * sizeof(int16_t) * out_channels;
-
-						avOut.pts        = pts;
-						avOut.extradata  = (unsigned char *) &pcmExtradata;
-						avOut.extralen   = sizeof(pcmExtradata);
-						avOut.frameRate  = 0;
-						avOut.timeScale  = 0;
-						avOut.width      = 0;
-						avOut.height     = 0;
-						avOut.type       = "audio";
-
-						if (!context->playback->BackWard && Write(context->output->audio->Write, context, &avOut, pts) < 0)
-						{
-							ffmpeg_err("writing data to audio device failed\n");
-						}
-						av_freep(&output[0]);
+						ffmpeg_printf(200, "audio packet dropped\n");
 					}
 				}
 				else if (audioTrack->have_aacheader == 1)
@@ -1369,15 +1245,8 @@ static void FFMPEGThread(Context_t *context)
 		releaseMutex(__FILE__, __FUNCTION__,__LINE__);
 	} /* while */
 
-	if (swr)
-	{
-		swr_free(&swr);
-	}
-	
-	if (decoded_frame)
-	{
-		wrapped_frame_free(&decoded_frame);
-	}
+	demux_stop();
+	audiodec_stop();
 	
 #if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(56, 34, 100)
 	mpeg4p2_context_reset(&mpeg4p2_context);
@@ -1876,11 +1745,14 @@ int32_t container_ffmpeg_init_av_context(Context_t *context, char *filename, uin
 			{
 				if(avContextTab[AVIdx] != NULL && avContextTab[AVIdx]->pb != NULL)
 				{
-					ffmpeg_buf = av_malloc(ffmpeg_buf_size);
+					/* ring grows up to ffmpeg_buf_size with the fill target */
+					ffmpeg_buf_ring_size = ffmpeg_buf_size < FILLBUFRINGMIN ? ffmpeg_buf_size : FILLBUFRINGMIN;
+					ffmpeg_buf_ring_max = ffmpeg_buf_size;
+					ffmpeg_buf = av_malloc(ffmpeg_buf_ring_size);
 
 					if(ffmpeg_buf != NULL)
 					{
-						ffmpeg_printf(10, "buffer size=%d\n", ffmpeg_buf_size);
+						ffmpeg_printf(10, "buffer size=%d (max %d)\n", ffmpeg_buf_ring_size, ffmpeg_buf_size);
 						
 						ffmpeg_read_org = avContextTab[AVIdx]->pb->read_packet;
 						avContextTab[AVIdx]->pb->read_packet = ffmpeg_read;
@@ -1991,6 +1863,8 @@ int32_t container_ffmpeg_update_tracks(Context_t *context, char *filename, int32
 	}
 	
 	getMutex(__FILE__, __FUNCTION__,__LINE__);
+	/* the reader threads may be inside av_read_frame */
+	demux_lock_contexts();
 	
 	if (initial && context->manager->subtitle)
 	{
@@ -2647,6 +2521,7 @@ int32_t container_ffmpeg_update_tracks(Context_t *context, char *filename, int32
 		}
 	}
 	
+	demux_unlock_contexts();
 	releaseMutex(__FILE__, __FUNCTION__,__LINE__);
 	return cERR_CONTAINER_FFMPEG_NO_ERROR;
 }
@@ -2738,6 +2613,7 @@ static int32_t container_ffmpeg_stop(Context_t *context)
 	getMutex(__FILE__, __FUNCTION__,__LINE__);
 	
 	free_all_stored_avcodec_context();
+	ffmpeg_stop_fillerTHREAD();
 	
 	uint32_t i = 0;
 	for(i=0; i<IPTV_AV_CONTEXT_MAX_NUM; i+=1)
@@ -2832,7 +2708,7 @@ static int32_t container_ffmpeg_seek_rel(Context_t *context, off_t pos, int64_t
 
 	if (pos == -1)
 	{
-		pos = avio_tell(avContextTab[0]->pb);
+		pos = demux_tell(0);
 	}
 
 	if (pts == -1)
@@ -2969,7 +2845,7 @@ static int32_t container_ffmpeg_seek(Context_t *context, int64_t sec, uint8_t ab
 		*/
 
 		getMutex(__FILE__, __FUNCTION__,__LINE__);
-		off_t pos = avio_tell(avContextTab[0]->pb);
+		off_t pos = demux_tell(0);
 		releaseMutex(__FILE__, __FUNCTION__,__LINE__);
 
 		ffmpeg_printf(10, "pos %lld %d\n", pos, avContextTab[0]->bit_rate);
@@ -3049,7 +2925,9 @@ static int32_t container_ffmpeg_get_length(Context_t *context, int64_t *length)
 	{
 		if (avContextTab[0] != NULL)
 		{
+			demux_lock_context(0);
 			*length = avContextTab[0]->duration / 1000;
+			demux_unlock_context(0);
 		} 
 		else
 		{
@@ -3065,6 +2943,9 @@ static int32_t container_ffmpeg_switch_audio(Context_t *context, int32_t *arg)
 {
 	ffmpeg_printf(10, "track %d\n", *arg);
 	getMutex(__FILE__, __FUNCTION__,__LINE__);
+	/* the decoder thread must not write old track data while
+	 * FFMPEGThread already writes the new one */
+	audiodec_flush();
 	if (context->manager->audio)
 	{
 		Track_t *Tracks = NULL;
@@ -3075,10 +2956,12 @@ static int32_t container_ffmpeg_switch_audio(Context_t *context, int32_t *arg)
 		if (Tracks && TrackCount)
 		{
 			int32_t i;
+			demux_lock_contexts();
 			for (i=0; i < TrackCount; ++i)
 			{
 				((AVStream*)Tracks[i].stream)->discard = Tracks[i].Id == *arg ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
 			}
+			demux_unlock_contexts();
 		}
 	}
 	releaseMutex(__FILE__, __FUNCTION__,__LINE__);
@@ -3132,6 +3015,8 @@ static int32_t container_ffmpeg_get_info(Context_t* context, char ** infoString)
 		context->manager->video->Command(context, MANAGER_GET_TRACK, &videoTrack);
 		context->manager->audio->Command(context, MANAGER_GET_TRACK, &audioTrack);
 
+		/* metadata may be updated by av_read_frame */
+		demux_lock_contexts();
 		if ((meta = searchMeta(avContextTab[0]->metadata, *infoString)) == NULL)
 		{
 			if (audioTrack != NULL)
@@ -3156,6 +3041,7 @@ static int32_t container_ffmpeg_get_info(Context_t* context, char ** infoString)
 			ffmpeg_printf(1, "no metadata found for \"%s\"\n", *infoString);
 			*infoString = strdup("not found");
 		}
+		demux_unlock_contexts();
 	} 
 	else
 	{
@@ -3244,6 +3130,15 @@ static int32_t Command(void  *_context, ContainerCmd_t command, void *argument)
 		*((int64_t*)argument) = latestPts;
 		break;
 	}
+	case CONTAINER_REVERSE_PTS:
+	{
+		*((int64_t*)argument) = reversePts;
+		if (reversePts == INVALID_PTS_VALUE)
+		{
+			ret = cERR_CONTAINER_FFMPEG_ERR;
+		}
+		break;
+	}
 	case CONTAINER_SET_BUFFER_SIZE:
 	{
 		ret = container_set_ffmpeg_buf_size((int32_t *) argument);
@@ -3256,6 +3151,11 @@ static int32_t Command(void  *_context, ContainerCmd_t command, void *argument)
 		*((int32_t*)argument) = size;
 		break;
 	}   
+	case CONTAINER_GET_BUFFER_STATUS:
+	{
+		ret = container_get_fillbufstatus((ContainerBufferStatus_t *) argument);
+		break;
+	}
 	default:
 		ffmpeg_err("ContainerCmd %d not supported!\n", command);
 		ret = cERR_CONTAINER_FFMPEG_ERR;
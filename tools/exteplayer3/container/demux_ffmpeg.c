@@ -0,0 +1,500 @@
+/*
+ * Reader threads for streams with separate audio and video sources
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+/* When the stream has more than one AVFormatContext (separate audio
+ * url), every context gets its own reader thread which fills a queue.
+ * FFMPEGThread takes the packet with the lowest PTS from the queue
+ * heads, so a slow read on one source does not stall the other one.
+ * Readers are paused while the contexts are seeked.
+ * The id, discard and codec of the packet's stream are copied into the
+ * queue by the reader, FFMPEGThread must not look into the streams of a
+ * context while its reader is inside av_read_frame. Other threads lock
+ * the context with demux_lock_context.
+ */
+#define DEMUX_QUEUE_SIZE      64
+#define DEMUX_QUEUE_BYTES     (4 * 1024 * 1024)
+#define DEMUX_WAIT_MS         20
+#define DEMUX_MERGE_WAIT_MS   100   // max time a packet waits for the other source
+
+typedef struct
+{
+	int32_t         id;
+	enum AVDiscard  discard;
+	enum AVCodecID  codecId;
+} DemuxStreamInfo;
+
+typedef struct
+{
+	AVPacket        packet;
+	int64_t         pts;    // 90kHz, only used for ordering
+	DemuxStreamInfo info;
+} DemuxItem;
+
+typedef struct
+{
+	pthread_t       thread;
+	uint32_t        avIdx;
+	int8_t          isRunning;
+	int8_t          paused;
+	int8_t          busy;   // inside av_read_frame
+	int32_t         status; // av_read_frame error, reader stopped until resumed
+	int64_t         pos;    // byte position of the last packet passed on
+
+	DemuxItem       queue[DEMUX_QUEUE_SIZE];
+	uint32_t        head;
+	uint32_t        count;
+	uint32_t        bytes;
+} DemuxReader;
+
+typedef struct
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t  cond;   // queue or reader state changed
+	int8_t          isInitialized;
+	int8_t          isRunning;
+	int8_t          terminate;
+	uint32_t        seq;    // bumped on every change, avoids lost wakeups
+	int64_t         mergeWaitStart;
+	uint32_t        num;
+	DemuxReader     readers[IPTV_AV_CONTEXT_MAX_NUM];
+} DemuxContext;
+
+static DemuxContext demux;
+
+/* held around av_read_frame, by the reader thread or by FFMPEGThread */
+static pthread_mutex_t demuxContextLock[IPTV_AV_CONTEXT_MAX_NUM] = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER};
+
+static void demux_lock_context(uint32_t avIdx)
+{
+	pthread_mutex_lock(&demuxContextLock[avIdx]);
+}
+
+static void demux_unlock_context(uint32_t avIdx)
+{
+	pthread_mutex_unlock(&demuxContextLock[avIdx]);
+}
+
+static void demux_lock_contexts(void)
+{
+	uint32_t i;
+	for (i = 0; i < IPTV_AV_CONTEXT_MAX_NUM; i++)
+	{
+		demux_lock_context(i);
+	}
+}
+
+static void demux_unlock_contexts(void)
+{
+	uint32_t i;
+	for (i = IPTV_AV_CONTEXT_MAX_NUM; i > 0; i--)
+	{
+		demux_unlock_context(i - 1);
+	}
+}
+
+static int64_t demux_time_ms(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static void demux_queue_clear(DemuxReader *r)
+{
+	while (r->count)
+	{
+		wrapped_packet_unref(&r->queue[r->head].packet);
+		r->head = (r->head + 1) % DEMUX_QUEUE_SIZE;
+		r->count -= 1;
+	}
+	r->head = 0;
+	r->bytes = 0;
+}
+
+/* PTS of the packet in 90kHz, only used for ordering,
+ * called with the context locked */
+static int64_t demux_packet_pts(uint32_t avIdx, AVPacket *packet)
+{
+	AVStream *stream = avContextTab[avIdx]->streams[packet->stream_index];
+	int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+
+	if (pts == AV_NOPTS_VALUE)
+	{
+		return INVALID_PTS_VALUE;
+	}
+	if (stream->time_base.den > 0)
+	{
+		pts = av_rescale(pts, (int64_t)stream->time_base.num * 90000, stream->time_base.den);
+	}
+	if (avContextTab[avIdx]->start_time != AV_NOPTS_VALUE)
+	{
+		pts -= 90000 * avContextTab[avIdx]->start_time / AV_TIME_BASE;
+	}
+	return pts;
+}
+
+/* av_read_frame with the context locked, info is set on success */
+static int32_t demux_read_frame(uint32_t avIdx, AVPacket *packet, DemuxStreamInfo *info, int64_t *pts)
+{
+	demux_lock_context(avIdx);
+	int32_t err = av_read_frame(avContextTab[avIdx], packet);
+	if (0 == err)
+	{
+		AVStream *stream = avContextTab[avIdx]->streams[packet->stream_index];
+		info->id = stream->id;
+		info->discard = stream->discard;
+		info->codecId = get_codecpar(stream)->codec_id;
+		if (pts)
+		{
+			*pts = demux_packet_pts(avIdx, packet);
+		}
+	}
+	demux_unlock_context(avIdx);
+	return err;
+}
+
+static void demux_reader_thread(DemuxReader *r)
+{
+	DemuxContext *d = &demux;
+	char threadname[17];
+	snprintf(threadname, sizeof(threadname), "demux_reader%u", r->avIdx);
+	threadname[16] = 0;
+	prctl (PR_SET_NAME, (unsigned long)&threadname);
+
+	ffmpeg_printf(10, "cAVIdx[%u]\n", r->avIdx);
+	pthread_mutex_lock(&d->mutex);
+	while (!d->terminate)
+	{
+		if (r->paused || r->status || r->count == DEMUX_QUEUE_SIZE || r->bytes >= DEMUX_QUEUE_BYTES)
+		{
+			pthread_cond_wait(&d->cond, &d->mutex);
+			continue;
+		}
+
+		r->busy = 1;
+		pthread_mutex_unlock(&d->mutex);
+
+		AVPacket packet;
+		DemuxStreamInfo info;
+		int64_t pts = INVALID_PTS_VALUE;
+		int32_t err = demux_read_frame(r->avIdx, &packet, &info, &pts);
+
+		pthread_mutex_lock(&d->mutex);
+		r->busy = 0;
+		if (r->paused || d->terminate)
+		{
+			// the context will be seeked, packet is not needed anymore
+			if (0 == err)
+			{
+				wrapped_packet_unref(&packet);
+			}
+		}
+		else if (err)
+		{
+			r->status = err;
+		}
+		else
+		{
+			DemuxItem *item = &r->queue[(r->head + r->count) % DEMUX_QUEUE_SIZE];
+			if (0 == wrapped_packet_move(&item->packet, &packet))
+			{
+				item->pts = pts;
+				item->info = info;
+				r->count += 1;
+				r->bytes += item->packet.size;
+			}
+			else
+			{
+				wrapped_packet_unref(&packet);
+			}
+		}
+		d->seq += 1;
+		pthread_cond_broadcast(&d->cond);
+	}
+	pthread_mutex_unlock(&d->mutex);
+	ffmpeg_printf(10, "cAVIdx[%u] terminating\n", r->avIdx);
+}
+
+static void demux_stop(void)
+{
+	DemuxContext *d = &demux;
+	uint32_t i;
+
+	if (!d->isRunning)
+	{
+		return;
+	}
+	pthread_mutex_lock(&d->mutex);
+	d->terminate = 1;
+	pthread_cond_broadcast(&d->cond);
+	pthread_mutex_unlock(&d->mutex);
+	for (i = 0; i < d->num; i++)
+	{
+		DemuxReader *r = &d->readers[i];
+		if (r->isRunning)
+		{
+			pthread_join(r->thread, NULL);
+			r->isRunning = 0;
+		}
+		demux_queue_clear(r);
+	}
+	d->num = 0;
+	d->isRunning = 0;
+}
+
+/* start reader threads if there is more than one context,
+ * otherwise FFMPEGThread reads itself */
+static int32_t demux_start(void)
+{
+	DemuxContext *d = &demux;
+	uint32_t i;
+
+	if (NULL == avContextTab[1])
+	{
+		return 0;
+	}
+	if (!d->isInitialized)
+	{
+		pthread_mutex_init(&d->mutex, NULL);
+		pthread_cond_init(&d->cond, NULL);
+		d->isInitialized = 1;
+	}
+	d->terminate = 0;
+	d->mergeWaitStart = -1;
+	d->num = 0;
+	for (i = 0; i < IPTV_AV_CONTEXT_MAX_NUM && NULL != avContextTab[i]; i++)
+	{
+		DemuxReader *r = &d->readers[i];
+		memset(r, 0, sizeof(*r));
+		r->avIdx = i;
+		if (pthread_create(&r->thread, NULL, (void *)&demux_reader_thread, r) != 0)
+		{
+			ffmpeg_err("cannot create reader thread for cAVIdx[%u]\n", i);
+			break;
+		}
+		r->isRunning = 1;
+		d->num += 1;
+	}
+	d->isRunning = 1;
+	if (d->num < 2)
+	{
+		demux_stop();
+		return -1;
+	}
+	return 0;
+}
+
+/* Pause readers and drop queued packets. Waits until no reader is
+ * inside av_read_frame, so the context may be seeked by the caller.
+ * avIdx < 0 pauses all readers. */
+static void demux_pause(int32_t avIdx)
+{
+	DemuxContext *d = &demux;
+	uint32_t i;
+
+	if (!d->isRunning)
+	{
+		return;
+	}
+	pthread_mutex_lock(&d->mutex);
+	for (i = 0; i < d->num; i++)
+	{
+		if (avIdx < 0 || (uint32_t)avIdx == i)
+		{
+			d->readers[i].paused = 1;
+			demux_queue_clear(&d->readers[i]);
+		}
+	}
+	for (i = 0; i < d->num; i++)
+	{
+		while (d->readers[i].paused && d->readers[i].busy)
+		{
+			pthread_cond_wait(&d->cond, &d->mutex);
+		}
+	}
+	d->mergeWaitStart = -1;
+	d->seq += 1;
+	pthread_cond_broadcast(&d->cond);
+	pthread_mutex_unlock(&d->mutex);
+}
+
+static void demux_resume(int32_t avIdx)
+{
+	DemuxContext *d = &demux;
+	uint32_t i;
+
+	if (!d->isRunning)
+	{
+		return;
+	}
+	pthread_mutex_lock(&d->mutex);
+	for (i = 0; i < d->num; i++)
+	{
+		if (avIdx < 0 || (uint32_t)avIdx == i)
+		{
+			d->readers[i].paused = 0;
+			d->readers[i].status = 0;
+		}
+	}
+	d->seq += 1;
+	pthread_cond_broadcast(&d->cond);
+	pthread_mutex_unlock(&d->mutex);
+}
+
+/* Byte position of the context for seeking. While reader threads run
+ * the AVIOContext belongs to them, so the position of the last packet
+ * taken by FFMPEGThread is returned instead. */
+static int64_t demux_tell(uint32_t avIdx)
+{
+	DemuxContext *d = &demux;
+	int64_t pos;
+
+	if (!d->isRunning || avIdx >= d->num)
+	{
+		return avio_tell(avContextTab[avIdx]->pb);
+	}
+	pthread_mutex_lock(&d->mutex);
+	pos = d->readers[avIdx].pos;
+	if (d->readers[avIdx].paused && !d->readers[avIdx].busy)
+	{
+		pos = avio_tell(avContextTab[avIdx]->pb);
+	}
+	pthread_mutex_unlock(&d->mutex);
+	return pos;
+}
+
+/* Merge the reader queues by PTS, called by FFMPEGThread with the
+ * container mutex held. A packet is returned once every running reader
+ * has one queued, or when it waited DEMUX_MERGE_WAIT_MS for an empty
+ * one. The mutex is released while waiting.
+ * Returns 0 with packet, avIdx and info set, 1 if a seek or stop is
+ * pending, or the read error when all readers stopped and their queues
+ * are empty.
+ */
+static int32_t demux_read(Context_t *context, AVPacket *packet, uint32_t *avIdx, DemuxStreamInfo *info)
+{
+	DemuxContext *d = &demux;
+
+	for (;;)
+	{
+		if (do_seek_target_seconds || do_seek_target_bytes || !context->playback->isPlaying)
+		{
+			return 1;
+		}
+
+		pthread_mutex_lock(&d->mutex);
+		DemuxReader *best = NULL;
+		int64_t bestPts = 0;
+		int8_t waiting = 0;
+		int32_t status = 0;
+		uint32_t i;
+		for (i = 0; i < d->num; i++)
+		{
+			DemuxReader *r = &d->readers[i];
+			if (r->count)
+			{
+				int64_t pts = r->queue[r->head].pts;
+				// packets without timestamp are passed on first
+				if (!best || pts == INVALID_PTS_VALUE || (bestPts != INVALID_PTS_VALUE && pts < bestPts))
+				{
+					best = r;
+					bestPts = pts;
+				}
+			}
+			else if (r->status)
+			{
+				status = status ? status : r->status;
+			}
+			else if (!r->paused)
+			{
+				waiting = 1;
+			}
+		}
+
+		if (!waiting)
+		{
+			d->mergeWaitStart = -1;
+		}
+		else if (best)
+		{
+			/* the empty source is late, keep passing on the other one
+			 * until it delivers again */
+			int64_t now = demux_time_ms();
+			if (d->mergeWaitStart < 0)
+			{
+				d->mergeWaitStart = now;
+			}
+			if (now - d->mergeWaitStart >= DEMUX_MERGE_WAIT_MS)
+			{
+				ffmpeg_printf(20, "cAVIdx[%u] not waiting for other source\n", best->avIdx);
+				waiting = 0;
+			}
+		}
+
+		if (best && !waiting)
+		{
+			DemuxItem *item = &best->queue[best->head];
+			best->bytes -= item->packet.size;
+			wrapped_packet_move(packet, &item->packet);
+			*info = item->info;
+			best->head = (best->head + 1) % DEMUX_QUEUE_SIZE;
+			best->count -= 1;
+			*avIdx = best->avIdx;
+			if (packet->pos >= 0)
+			{
+				best->pos = packet->pos;
+			}
+			pthread_cond_broadcast(&d->cond);
+			pthread_mutex_unlock(&d->mutex);
+			return 0;
+		}
+
+		if (!best && !waiting)
+		{
+			pthread_mutex_unlock(&d->mutex);
+			av_init_packet(packet);
+			packet->data = NULL;
+			packet->size = 0;
+			return status ? status : AVERROR_EOF;
+		}
+
+		uint32_t seq = d->seq;
+		pthread_mutex_unlock(&d->mutex);
+
+		releaseMutex(__FILE__, __FUNCTION__,__LINE__);
+		struct timeval tv;
+		struct timespec ts;
+		gettimeofday(&tv, NULL);
+		ts.tv_sec = tv.tv_sec;
+		ts.tv_nsec = tv.tv_usec * 1000 + DEMUX_WAIT_MS * 1000000;
+		if (ts.tv_nsec >= 1000000000)
+		{
+			ts.tv_sec += 1;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_mutex_lock(&d->mutex);
+		if (seq == d->seq && !d->terminate)
+		{
+			pthread_cond_timedwait(&d->cond, &d->mutex, &ts);
+		}
+		pthread_mutex_unlock(&d->mutex);
+		getMutex(__FILE__, __FUNCTION__,__LINE__);
+	}
+}
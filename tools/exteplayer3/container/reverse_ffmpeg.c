@@ -0,0 +1,214 @@
+/*
+ * Reverse trick play for stream's handled by ffmpeg
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+/* Reverse play walks the stream backwards GOP by GOP.
+ * Only key frames are injected, with PTS re-stamped
+ * so decoder sees them as normal forward playback.
+ * Each key frame is displayed for REVERSE_FRAME_TIME_MS,
+ * the distance between key frames depends on the speed.
+ */
+#define REVERSE_FRAME_TIME_MS 200
+#define REVERSE_MAX_PACKETS_PER_STEP 2048
+#define REVERSE_MAX_SEEKS_PER_STEP 8
+
+typedef struct
+{
+	int8_t  isActive;
+	int8_t  isBof;
+	int64_t targetPts;  // position (90kHz) where next key frame will be searched
+	int64_t searchStep; // how far to go back, grows with long GOPs
+	int64_t lastKeyPts; // position (90kHz) of last injected key frame
+	int64_t outPts;     // re-stamped PTS for decoder
+	int64_t showTime;   // time (us) when next key frame should be injected
+} ReverseContext;
+
+/* position of the shown key frame, reported as play position because
+ * the decoder only sees the re-stamped PTS */
+static int64_t reversePts = INVALID_PTS_VALUE;
+
+static void reverse_context_start(ReverseContext *ctx, int64_t startPts)
+{
+	ctx->isActive = 1;
+	ctx->isBof = 0;
+	ctx->targetPts = startPts;
+	ctx->searchStep = 0;
+	ctx->lastKeyPts = INVALID_PTS_VALUE;
+	ctx->outPts = startPts;
+	ctx->showTime = 0;
+	reversePts = startPts;
+}
+
+static void reverse_context_stop(ReverseContext *ctx)
+{
+	ctx->isActive = 0;
+	reversePts = INVALID_PTS_VALUE;
+
+	/* continue normal playback from the last displayed key frame */
+	if (ctx->lastKeyPts != INVALID_PTS_VALUE)
+	{
+		seek_target_seconds = ctx->lastKeyPts * AV_TIME_BASE / 90000;
+		do_seek_target_seconds = 1;
+	}
+}
+
+/* Reads packets from current position till key frame of video track.
+ * Returns 0 and packet which must be unref by caller, or -1.
+ */
+static int32_t reverse_read_key_frame(Track_t *videoTrack, AVPacket *packet)
+{
+	AVFormatContext *avContext = avContextTab[videoTrack->AVIdx];
+	int32_t streamIndex = ((AVStream*)videoTrack->stream)->index;
+	uint32_t i = 0;
+
+	for (i = 0; i < REVERSE_MAX_PACKETS_PER_STEP; ++i)
+	{
+		if (av_read_frame(avContext, packet) != 0)
+		{
+			break;
+		}
+
+		if (packet->stream_index == streamIndex && (packet->flags & AV_PKT_FLAG_KEY) && packet->pts != AV_NOPTS_VALUE)
+		{
+			return 0;
+		}
+		wrapped_packet_unref(packet);
+	}
+	return -1;
+}
+
+/* Returns 1 if caller should wait, 0 if key frame was written, or -1 */
+static int32_t reverse_write_step(Context_t *context, ReverseContext *ctx, Track_t *videoTrack)
+{
+	AVFormatContext *avContext = avContextTab[videoTrack->AVIdx];
+	int64_t now = av_gettime();
+	int64_t step = 0;
+	int64_t keyPts = INVALID_PTS_VALUE;
+	int8_t isBof = 0;
+	uint32_t i = 0;
+	AVPacket packet;
+	AudioVideoOut_t avOut;
+
+	if (ctx->isBof || now < ctx->showTime)
+	{
+		return 1;
+	}
+
+	step = (int64_t)abs(context->playback->Speed) * REVERSE_FRAME_TIME_MS * 90;
+	if (ctx->searchStep < step)
+	{
+		ctx->searchStep = step;
+	}
+
+	for (i = 0; i < REVERSE_MAX_SEEKS_PER_STEP; ++i)
+	{
+		int64_t seekTs = ctx->targetPts * AV_TIME_BASE / 90000;
+		if (avContext->start_time != AV_NOPTS_VALUE)
+		{
+			seekTs += avContext->start_time;
+		}
+
+		/* max_ts = target, so we land on the key frame before target */
+		if (avformat_seek_file(avContext, -1, INT64_MIN, seekTs, seekTs, 0) < 0)
+		{
+			ffmpeg_printf(10, "reverse seek to %lld failed\n", ctx->targetPts);
+			isBof = 1;
+			break;
+		}
+
+		av_init_packet(&packet);
+		packet.data = NULL;
+		packet.size = 0;
+		if (reverse_read_key_frame(videoTrack, &packet) == 0)
+		{
+			keyPts = calcPts(videoTrack->AVIdx, videoTrack->stream, packet.pts);
+			if (keyPts != INVALID_PTS_VALUE && (ctx->lastKeyPts == INVALID_PTS_VALUE || keyPts < ctx->lastKeyPts))
+			{
+				break;
+			}
+			/* still in the same GOP, go back more */
+			wrapped_packet_unref(&packet);
+			keyPts = INVALID_PTS_VALUE;
+		}
+
+		if (ctx->targetPts <= 0)
+		{
+			isBof = 1;
+			break;
+		}
+		ctx->targetPts -= ctx->searchStep;
+		if (ctx->targetPts < 0)
+		{
+			ctx->targetPts = 0;
+		}
+		/* GOP longer than the step, widen the search */
+		ctx->searchStep *= 2;
+	}
+
+	if (keyPts == INVALID_PTS_VALUE)
+	{
+		if (!isBof)
+		{
+			/* no earlier key frame yet, the search goes on with next call */
+			return 1;
+		}
+		/* begin of file reached, keep last key frame on the screen */
+		ffmpeg_printf(10, "reverse play reached begin of file\n");
+		ctx->isBof = 1;
+		return -1;
+	}
+
+	ffmpeg_printf(20, "reverse key frame pts[%lld] out pts[%lld]\n", keyPts, ctx->outPts);
+
+	memset(&avOut, 0, sizeof(avOut));
+	avOut.data       = packet.data;
+	avOut.len        = packet.size;
+	avOut.pts        = ctx->outPts;
+	avOut.dts        = INVALID_PTS_VALUE;
+	avOut.extradata  = videoTrack->extraData;
+	avOut.extralen   = videoTrack->extraSize;
+	avOut.frameRate  = videoTrack->frame_rate;
+	avOut.timeScale  = videoTrack->TimeScale;
+	avOut.width      = videoTrack->width;
+	avOut.height     = videoTrack->height;
+	avOut.type       = "video";
+	if (avContext->iformat->flags & AVFMT_TS_DISCONT)
+	{
+		avOut.infoFlags = 1; // TS container
+	}
+
+	if (Write(context->output->video->Write, context, &avOut, avOut.pts) < 0)
+	{
+		ffmpeg_err("writing reverse data to video device failed\n");
+	}
+	wrapped_packet_unref(&packet);
+
+	ctx->lastKeyPts = keyPts;
+	reversePts = keyPts;
+	ctx->searchStep = step;
+	ctx->targetPts = keyPts - step;
+	if (ctx->targetPts < 0)
+	{
+		ctx->targetPts = 0;
+	}
+	ctx->outPts = (ctx->outPts + REVERSE_FRAME_TIME_MS * 90) & 0x01FFFFFFFF;
+	ctx->showTime = now + REVERSE_FRAME_TIME_MS * 1000;
+
+	return 0;
+}
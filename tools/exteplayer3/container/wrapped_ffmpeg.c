@@ -39,6 +39,25 @@ static void wrapped_packet_unref(void *param)
 #endif
 }
 
+/* move packet data to dst, src is left empty */
+static int wrapped_packet_move(AVPacket *dst, AVPacket *src)
+{
+#if (LIBAVCODEC_VERSION_MAJOR > 56)
+    av_packet_move_ref(dst, src);
+#else
+    /* data may still belong to the demuxer */
+    if (av_dup_packet(src) < 0)
+    {
+        return -1;
+    }
+    *dst = *src;
+    av_init_packet(src);
+    src->data = NULL;
+    src->size = 0;
+#endif
+    return 0;
+}
+
 static void wrapped_set_max_analyze_duration(void *param, int val)
 {
 #if (LIBAVFORMAT_VERSION_MAJOR > 55) && (LIBAVFORMAT_VERSION_MAJOR < 56)
@@ -2,6 +2,7 @@
 #define CONTAINER_H_
 
 #include <stdio.h>
+#include <stdint.h>
 
 typedef enum { 
 CONTAINER_INIT, 
@@ -24,11 +25,21 @@ CONTAINER_SET_BUFFER_SIZE,
 CONTAINER_GET_BUFFER_SIZE,
 CONTAINER_GET_BUFFER_STATUS,
 CONTAINER_STOP_BUFFER,
+CONTAINER_REVERSE_PTS,
 //obi
 CONTAINER_GET_SUBTEXT
 //obi
 } ContainerCmd_t;
 
+typedef struct ContainerBufferStatus_s {
+    int32_t size;        /* bytes buffered */
+    int32_t target;      /* bytes the filler keeps buffered */
+    int32_t bufferedMs;  /* size at consumption rate */
+    int32_t linkRate;    /* bytes/s */
+    int32_t consumeRate; /* bytes/s */
+    uint32_t stalls;     /* reads which found the buffer empty */
+} ContainerBufferStatus_t;
+
 typedef struct Container_s {
     char * Name;
     int (* Command) (/*Context_t*/void  *, ContainerCmd_t, void *);
@@ -28,6 +28,7 @@ typedef enum {
     OUTPUT_GET_PROGRESSIVE,
     OUTPUT_SET_BUFFER_SIZE,
     OUTPUT_GET_BUFFER_SIZE,
+    OUTPUT_GET_BUFFER_STATUS,
 } OutputCmd_t;
 
 typedef struct
@@ -52,6 +53,14 @@ typedef struct
     char            *type;
 } AudioVideoOut_t;
 
+typedef struct
+{
+    uint32_t         size;
+    uint32_t         fill;
+
+    char            *type;
+} OutputBufferStatus_t;
+
 typedef struct
 {
     uint32_t         trackId;
@@ -46,20 +46,67 @@ typedef enum OutputType_e{
     OUTPUT_UNK,
     OUTPUT_AUDIO,
     OUTPUT_VIDEO,
+    OUTPUT_WRAP,
 } OutputType_t;
 
+/* Header of every record stored in the ring,
+ * record data follows the header directly
+ */
 typedef struct BufferingNode_s {
     uint32_t dataSize;
     OutputType_t dataType;
-    struct BufferingNode_s *next;
+    uint32_t generation;
 } BufferingNode_t;
 
+/* Single producer (BufferingWriteV) / single consumer (LinuxDvbBuffThread) ring.
+ * writePos is only changed by the producer, readPos only by the consumer,
+ * so the fast path does not need the mutex. The mutex and conditions are
+ * used only to sleep when the ring is full or empty.
+ *
+ * Audio and video have separate lanes, each drained by its own thread,
+ * so a blocking write to one decoder does not starve the other one.
+ */
+typedef struct BufferingLane_s {
+    OutputType_t type;
+    int fd;
+    int pfd[2];
+
+    pthread_t thread;
+    bool hasThreadStarted;
+    pthread_cond_t dataConsumedCond;
+    pthread_cond_t dataAddedCond;
+
+    uint8_t *ring;
+    uint32_t size;
+    /* producer waits when fill level would exceed high watermark
+     * and it is woken up when fill level drops to low watermark
+     */
+    uint32_t lowWatermark;
+    uint32_t highWatermark;
+
+    volatile uint32_t readPos;
+    volatile uint32_t writePos;
+    volatile bool isProducerWaiting;
+    volatile bool isConsumerWaiting;
+
+    /* statistics */
+    uint32_t packetsCnt;
+    uint32_t splitCnt;
+    uint32_t droppedCnt;
+} BufferingLane_t;
+
 /* ***************************** */
 /* Makros/Constants              */
 /* ***************************** */
 #define cERR_LINUX_DVB_BUFFERING_NO_ERROR      0
 #define cERR_LINUX_DVB_BUFFERING_ERROR        -1
 
+/* records are kept 4-byte aligned, sh4 does not like unaligned header access */
+#define BUFFERING_ALIGN(x) (((x) + 3) & ~3U)
+
+/* part of the buffering size reserved for the audio lane */
+#define AUDIO_LANE_DIVISOR 4
+
 //#define SAM_WITH_DEBUG
 #ifdef SAM_WITH_DEBUG
 #define LINUX_DVB_BUFFERING_DEBUG
@@ -86,21 +133,21 @@ if (debug_level >= level) printf("[%s:%d:%s] " fmt, __FILE__, __LINE__, __FUNCTI
 /* ***************************** */
 /* Varaibles                     */
 /* ***************************** */
-static pthread_t bufferingThread;
 static pthread_mutex_t bufferingMtx;
 static pthread_cond_t  bufferingExitCond;
-static pthread_cond_t  bufferingDataConsumedCond;
-static pthread_cond_t  bufferingdDataAddedCond;
-static bool hasBufferingThreadStarted = false;
-static BufferingNode_t *bufferingQueueHead = NULL;
-static BufferingNode_t *bufferingQueueTail = NULL;
+static bool isBufferingInitialized = false;
 
-static uint32_t maxBufferingDataSize = 0;
-static uint32_t bufferingDataSize = 0;
+static BufferingLane_t audioLane = {OUTPUT_AUDIO, -1, {-1, -1}};
+static BufferingLane_t videoLane = {OUTPUT_VIDEO, -1, {-1, -1}};
+static BufferingLane_t *bufferingLanes[] = {&audioLane, &videoLane};
+
+/* Incremented by every flush. Records are tagged with generation
+ * valid at the time they were passed to BufferingWriteV, so the
+ * buffering threads can drop stale data without any handshake.
+ */
+static volatile uint32_t bufferingGeneration = 0;
 
-static int videofd = -1;
-static int audiofd = -1;
-static int g_pfd[2] = {-1, -1};
+static uint32_t maxBufferingDataSize = 0;
 
 /* ***************************** */
 /* Prototypes                    */
@@ -109,116 +156,267 @@ static int g_pfd[2] = {-1, -1};
 /* ***************************** */
 /* MISC Functions                */
 /* ***************************** */
+static void LaneWakeUp(BufferingLane_t *lane)
+{
+    if (lane->pfd[1] != -1)
+    {
+        write(lane->pfd[1], "x", 1);
+    }
+}
+
 static void WriteWakeUp()
 {
-    write(g_pfd[1], "x", 1);
+    LaneWakeUp(&audioLane);
+    LaneWakeUp(&videoLane);
 }
 
-/* **************************** */
-/* Worker Thread                */
-/* **************************** */
-static void LinuxDvbBuffThread(Context_t *context) 
+static uint32_t GetRecordSize(const uint32_t dataSize)
+{
+    return BUFFERING_ALIGN(sizeof(BufferingNode_t) + dataSize);
+}
+
+static uint32_t GetFillLevel(const BufferingLane_t *lane)
+{
+    uint32_t r = lane->readPos;
+    uint32_t w = lane->writePos;
+    return w >= r ? w - r : lane->size - r + w;
+}
+
+/* Returns offset at which record of recSize can be placed
+ * or -1 if there is not enough free space in the ring.
+ * Called by producer only.
+ */
+static int64_t GetWriteOffset(const BufferingLane_t *lane, const uint32_t recSize)
+{
+    uint32_t r = lane->readPos;
+    uint32_t w = lane->writePos;
+
+    if (GetFillLevel(lane) + recSize > lane->highWatermark)
+    {
+        return -1;
+    }
+
+    if (w >= r)
+    {
+        /* write position can not catch up read position,
+         * because then the ring will be seen as empty
+         */
+        if (recSize < lane->size - w || (recSize == lane->size - w && r != 0))
+        {
+            return w;
+        }
+
+        /* wrap to the beginning */
+        if (recSize < r)
+        {
+            return 0;
+        }
+    }
+    else if (w + recSize < r)
+    {
+        return w;
+    }
+
+    return -1;
+}
+
+static bool IsRingEmpty(const BufferingLane_t *lane)
+{
+    return lane->readPos == lane->writePos;
+}
+
+static void SignalProducer(BufferingLane_t *lane)
+{
+    __sync_synchronize();
+    if (lane->isProducerWaiting && GetFillLevel(lane) <= lane->lowWatermark)
+    {
+        pthread_mutex_lock(&bufferingMtx);
+        pthread_cond_broadcast(&lane->dataConsumedCond);
+        pthread_mutex_unlock(&bufferingMtx);
+    }
+}
+
+static void SignalConsumer(BufferingLane_t *lane)
+{
+    __sync_synchronize();
+    if (lane->isConsumerWaiting)
+    {
+        pthread_mutex_lock(&bufferingMtx);
+        pthread_cond_signal(&lane->dataAddedCond);
+        pthread_mutex_unlock(&bufferingMtx);
+    }
+}
+
+static void WaitForSpace(BufferingLane_t *lane, const uint32_t recSize)
+{
+    pthread_mutex_lock(&bufferingMtx);
+    lane->isProducerWaiting = true;
+    __sync_synchronize();
+    if (0 == PlaybackDieNow(0) && lane->hasThreadStarted &&
+        (recSize ? GetWriteOffset(lane, recSize) < 0 : !IsRingEmpty(lane)))
+    {
+        pthread_cond_wait(&lane->dataConsumedCond, &bufferingMtx);
+    }
+    lane->isProducerWaiting = false;
+    pthread_mutex_unlock(&bufferingMtx);
+}
+
+/* Copies len bytes from the iovec array, *idx and *off keep
+ * the position between calls, so one chunk can be queued in parts
+ */
+static void CopyFromIov(uint8_t *dataPtr, const struct iovec *iov, int *idx, size_t *off, uint32_t len)
+{
+    while (len > 0)
+    {
+        size_t n = iov[*idx].iov_len - *off;
+        if (n > len)
+        {
+            n = len;
+        }
+        memcpy(dataPtr, (uint8_t *)iov[*idx].iov_base + *off, n);
+        dataPtr += n;
+        len -= n;
+        *off += n;
+        if (*off == iov[*idx].iov_len)
+        {
+            *idx += 1;
+            *off = 0;
+        }
+    }
+}
+
+static void SetLaneSize(BufferingLane_t *lane, const uint32_t size)
+{
+    lane->size = BUFFERING_ALIGN(size);
+    lane->highWatermark = lane->size - lane->size / 8;
+    lane->lowWatermark = lane->size / 2;
+}
+
+static int32_t InitPipe(int pfd[2])
 {
     int flags = 0;
-    static BufferingNode_t *nodePtr = NULL;
-    buff_printf(20, "ENTER\n");
 
-    if (pipe(g_pfd) == -1)
-        buff_err("critical error\n");
-    
-    /* Make read and write ends of pipe nonblocking */
-    if ((flags = fcntl(g_pfd[0], F_GETFL)) == -1)
+    if (pipe(pfd) == -1)
+    {
         buff_err("critical error\n");
-    
+        return cERR_LINUX_DVB_BUFFERING_ERROR;
+    }
+
     /* Make read end nonblocking */
-    flags |= O_NONBLOCK;
-    if (fcntl(g_pfd[0], F_SETFL, flags) == -1)
+    if ((flags = fcntl(pfd[0], F_GETFL)) == -1)
         buff_err("critical error\n");
-    
-    if ((flags = fcntl(g_pfd[1], F_GETFL)) == -1)
+    flags |= O_NONBLOCK;
+    if (fcntl(pfd[0], F_SETFL, flags) == -1)
         buff_err("critical error\n");
     
     /* Make write end nonblocking */
+    if ((flags = fcntl(pfd[1], F_GETFL)) == -1)
+        buff_err("critical error\n");
     flags |= O_NONBLOCK;
-    if (fcntl(g_pfd[1], F_SETFL, flags) == -1)
+    if (fcntl(pfd[1], F_SETFL, flags) == -1)
         buff_err("critical error\n");
 
+    return cERR_LINUX_DVB_BUFFERING_NO_ERROR;
+}
+
+/* **************************** */
+/* Worker Thread                */
+/* **************************** */
+static Context_t *bufferingContext = NULL;
+
+static void LinuxDvbBuffThread(BufferingLane_t *lane) 
+{
+    Context_t *context = bufferingContext;
+    buff_printf(20, "ENTER type[%d]\n", lane->type);
+
     PlaybackDieNowRegisterCallback(WriteWakeUp);
     
     while (0 == PlaybackDieNow(0))
     {
-        pthread_mutex_lock(&bufferingMtx);
-        if (nodePtr)
-        {
-            free(nodePtr);
-            nodePtr = NULL;
-            /* signal that we free some space in queue */
-            pthread_cond_signal(&bufferingDataConsumedCond);
-        }
-        
-        if (!bufferingQueueHead)
+        BufferingNode_t *nodePtr = NULL;
+        uint32_t r = lane->readPos;
+
+        if (IsRingEmpty(lane))
         {
-            assert(bufferingQueueTail == NULL);
-            
             /* Queue is empty we need to wait for data to be added */
-            pthread_cond_wait(&bufferingdDataAddedCond, &bufferingMtx);
-            pthread_mutex_unlock(&bufferingMtx);
-            continue; /* To check PlaybackDieNow(0) */
-        }
-        else
-        {
-            nodePtr = bufferingQueueHead;
-            bufferingQueueHead = bufferingQueueHead->next;
-            if (bufferingQueueHead == NULL)
-            {
-                bufferingQueueTail = NULL;
-            }
-            
-            if (bufferingDataSize >= (nodePtr->dataSize + sizeof(BufferingNode_t)))
+            pthread_mutex_lock(&bufferingMtx);
+            lane->isConsumerWaiting = true;
+            __sync_synchronize();
+            if (IsRingEmpty(lane) && 0 == PlaybackDieNow(0) && lane->fd != -1)
             {
-                bufferingDataSize -= (nodePtr->dataSize + sizeof(BufferingNode_t));
+                pthread_cond_wait(&lane->dataAddedCond, &bufferingMtx);
             }
-            else
+            lane->isConsumerWaiting = false;
+            pthread_mutex_unlock(&bufferingMtx);
+            if (lane->fd == -1)
             {
-                assert(bufferingDataSize == 0);
-                bufferingDataSize = 0;
+                break;
             }
+            continue; /* To check PlaybackDieNow(0) */
         }
-        pthread_mutex_unlock(&bufferingMtx);
-        
-        /* We will write data without mutex
-         * this have some disadvantage because we can 
-         * write some portion of data after LinuxDvbBuffFlush,
-         * for example after seek, this will be fixed later 
+
+        /* make sure that record data is read after write position */
+        __sync_synchronize();
+
+        if (lane->size - r < sizeof(BufferingNode_t))
+        {
+            /* no place for header at the end of ring, producer wrapped */
+            lane->readPos = 0;
+            continue;
+        }
+
+        nodePtr = (BufferingNode_t *)(lane->ring + r);
+        if (nodePtr->dataType == OUTPUT_WRAP)
+        {
+            lane->readPos = 0;
+            continue;
+        }
+
+        /* We will write data without mutex, data queued
+         * before LinuxDvbBuffFlush, for example before seek,
+         * is recognized by its generation and skipped
          */
-        if (nodePtr && !context->playback->isSeeking)
+        if (nodePtr->generation != bufferingGeneration)
+        {
+            lane->droppedCnt += 1;
+        }
+        else if (!context->playback->isSeeking)
         {
             /* Write data to valid output */
             uint8_t *dataPtr = (uint8_t *)nodePtr + sizeof(BufferingNode_t);
-            int fd = nodePtr->dataType == OUTPUT_VIDEO ? videofd : audiofd;
-            if (0 != WriteWithRetry(context, g_pfd[0], fd, dataPtr, nodePtr->dataSize))
+            if (0 != WriteWithRetry(context, lane->pfd[0], lane->fd, dataPtr, nodePtr->dataSize))
             {
                 buff_err("Something is WRONG\n");
             }
         }
+
+        /* release record by advancing read position */
+        r += GetRecordSize(nodePtr->dataSize);
+        if (r >= lane->size)
+        {
+            r = 0;
+        }
+        __sync_synchronize();
+        lane->readPos = r;
+
+        /* signal that we free some space in queue */
+        SignalProducer(lane);
     }
     
+    buff_printf(20, "EXIT type[%d] packets[%u] split[%u] dropped[%u]\n", lane->type, lane->packetsCnt, lane->splitCnt, lane->droppedCnt);
+
     pthread_mutex_lock(&bufferingMtx);
+    lane->hasThreadStarted = false;
+    pthread_cond_broadcast(&lane->dataConsumedCond);
     pthread_cond_signal(&bufferingExitCond);
     pthread_mutex_unlock(&bufferingMtx);
-    
-    buff_printf(20, "EXIT\n");
-    hasBufferingThreadStarted = false;
-    
-    close(g_pfd[0]);
-    close(g_pfd[1]);
-    g_pfd[0] = -1;
-    g_pfd[1] = -1;
 }
 
 int32_t LinuxDvbBuffSetSize(const uint32_t bufferSize)
 {
-    maxBufferingDataSize = bufferSize;
+    maxBufferingDataSize = BUFFERING_ALIGN(bufferSize);
+    SetLaneSize(&audioLane, maxBufferingDataSize / AUDIO_LANE_DIVISOR);
+    SetLaneSize(&videoLane, maxBufferingDataSize - audioLane.size);
     return cERR_LINUX_DVB_BUFFERING_NO_ERROR;
 }
 
@@ -227,55 +425,110 @@ uint32_t LinuxDvbBuffGetSize()
     return maxBufferingDataSize;
 }
 
+int32_t LinuxDvbBuffGetStatus(const char *type, uint32_t *size, uint32_t *fill)
+{
+    BufferingLane_t *lane = NULL;
+
+    if (!strcmp("video", type))
+    {
+        lane = &videoLane;
+    }
+    else if (!strcmp("audio", type))
+    {
+        lane = &audioLane;
+    }
+    else
+    {
+        return cERR_LINUX_DVB_BUFFERING_ERROR;
+    }
+
+    *size = lane->size;
+    *fill = lane->hasThreadStarted ? GetFillLevel(lane) : 0;
+    return cERR_LINUX_DVB_BUFFERING_NO_ERROR;
+}
+
 int32_t LinuxDvbBuffOpen(Context_t *context, char *type, int outfd)
 {
     int32_t error = 0;
     int32_t ret = cERR_LINUX_DVB_BUFFERING_NO_ERROR;
+    BufferingLane_t *lane = NULL;
     
     buff_printf(10, "\n");
 
-    if (!hasBufferingThreadStarted) 
+    if (!strcmp("video", type))
+    {
+        lane = &videoLane;
+    }
+    else if (!strcmp("audio", type))
+    {
+        lane = &audioLane;
+    }
+
+    if (!lane || -1 != lane->fd)
+    {
+        return cERR_LINUX_DVB_BUFFERING_ERROR;
+    }
+
+    if (!isBufferingInitialized)
+    {
+        uint32_t i = 0;
+
+        /* init synchronization prymitives */
+        pthread_mutex_init(&bufferingMtx, NULL);
+        pthread_cond_init(&bufferingExitCond, NULL);
+        for (i = 0; i < sizeof(bufferingLanes) / sizeof(bufferingLanes[0]); ++i)
+        {
+            pthread_cond_init(&bufferingLanes[i]->dataConsumedCond, NULL);
+            pthread_cond_init(&bufferingLanes[i]->dataAddedCond, NULL);
+        }
+        isBufferingInitialized = true;
+    }
+
+    if (!lane->hasThreadStarted) 
     {
         pthread_attr_t attr;
         pthread_attr_init(&attr);
         pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
 
-        if((error = pthread_create(&bufferingThread, &attr, (void *)&LinuxDvbBuffThread, context)) != 0) 
+        /* ring is allocated once and reused for the whole process live */
+        if (!lane->ring)
         {
-            buff_printf(10, "Creating thread, error:%d:%s\n", error, strerror(error));
+            lane->ring = malloc(lane->size);
+        }
+        lane->readPos = 0;
+        lane->writePos = 0;
+        lane->fd = outfd;
+        bufferingContext = context;
 
-            hasBufferingThreadStarted = false;
+        if (-1 == lane->pfd[0] && 0 != InitPipe(lane->pfd))
+        {
             ret = cERR_LINUX_DVB_BUFFERING_ERROR;
         }
-        else 
+        else if (!lane->ring)
         {
-            buff_printf(10, "Created thread\n");
-            hasBufferingThreadStarted = true;
-
-            /* init synchronization prymitives */
-            pthread_mutex_init(&bufferingMtx, NULL);
-            
-            pthread_cond_init(&bufferingExitCond, NULL);
-            pthread_cond_init(&bufferingDataConsumedCond, NULL);
-            pthread_cond_init(&bufferingdDataAddedCond, NULL);
+            buff_err("OUT OF MEM\n");
+            ret = cERR_LINUX_DVB_BUFFERING_ERROR;
         }
-    }
-    
-    if (!ret)
-    {
-        if (!strcmp("video", type) && -1 == videofd)
+        else if((error = pthread_create(&lane->thread, &attr, (void *)&LinuxDvbBuffThread, lane)) != 0) 
         {
-            videofd = outfd;
+            buff_printf(10, "Creating thread, error:%d:%s\n", error, strerror(error));
+            ret = cERR_LINUX_DVB_BUFFERING_ERROR;
         }
-        else if (!strcmp("audio", type) && -1 == audiofd)
+        else 
         {
-            audiofd = outfd;
+            buff_printf(10, "Created thread\n");
+            lane->hasThreadStarted = true;
         }
-        else
+
+        if (ret)
         {
-            ret = cERR_LINUX_DVB_BUFFERING_ERROR;
+            lane->fd = -1;
         }
     }
+    else
+    {
+        ret = cERR_LINUX_DVB_BUFFERING_ERROR;
+    }
 
     buff_printf(10, "exiting with value %d\n", ret);
     return ret;
@@ -284,23 +537,26 @@ int32_t LinuxDvbBuffOpen(Context_t *context, char *type, int outfd)
 int32_t LinuxDvbBuffClose(Context_t *context)
 {
     int32_t ret = 0;
+    uint32_t i = 0;
     
     buff_printf(10, "\n");
-    videofd = -1;
-    audiofd = -1;
     
-    if (hasBufferingThreadStarted) 
+    if (isBufferingInitialized) 
     {
         struct timespec max_wait = {0, 0};
         
+        pthread_mutex_lock(&bufferingMtx);
+        for (i = 0; i < sizeof(bufferingLanes) / sizeof(bufferingLanes[0]); ++i)
+        {
+            /* wake up if thread is waiting for data */ 
+            bufferingLanes[i]->fd = -1;
+            pthread_cond_signal(&bufferingLanes[i]->dataAddedCond);
+        }
+
         /* WakeUp if we are waiting in the write */ 
         WriteWakeUp();
         
-        pthread_mutex_lock(&bufferingMtx);
-        /* wake up if thread is waiting for data */ 
-        pthread_cond_signal(&bufferingdDataAddedCond);
-        
-        /* wait for thread end */
+        /* wait for threads end */
 #if 0
         /* This code couse symbol versioning of clock_gettime@GLIBC_2.17 */
         clock_gettime(CLOCK_REALTIME, &max_wait);
@@ -308,24 +564,22 @@ int32_t LinuxDvbBuffClose(Context_t *context)
 #else
         max_wait.tv_sec = time(NULL) + 2;
 #endif
-        pthread_cond_timedwait(&bufferingExitCond, &bufferingMtx, &max_wait);
-        pthread_mutex_unlock(&bufferingMtx);
-
-        if (!hasBufferingThreadStarted)
+        while (audioLane.hasThreadStarted || videoLane.hasThreadStarted)
         {
-            /* destroy synchronization prymitives?
-             * for a moment, we'll exit linux process, 
-             * so the system will do this for us
-             */
-            /*
-            pthread_mutex_destroy(&bufferingMtx);
-            pthread_cond_destroy(&bufferingDataConsumedCond);
-            pthread_cond_destroy(&bufferingdDataAddedCond);
-            */
+            if (ETIMEDOUT == pthread_cond_timedwait(&bufferingExitCond, &bufferingMtx, &max_wait))
+            {
+                break;
+            }
         }
+        pthread_mutex_unlock(&bufferingMtx);
+
+        /* destroy synchronization prymitives?
+         * for a moment, we'll exit linux process, 
+         * so the system will do this for us
+         */
     }
     
-    ret = hasBufferingThreadStarted ? cERR_LINUX_DVB_BUFFERING_ERROR : cERR_LINUX_DVB_BUFFERING_NO_ERROR;
+    ret = (audioLane.hasThreadStarted || videoLane.hasThreadStarted) ? cERR_LINUX_DVB_BUFFERING_ERROR : cERR_LINUX_DVB_BUFFERING_NO_ERROR;
 
     buff_printf(10, "exiting with value %d\n", ret);
     return ret;
@@ -333,31 +587,17 @@ int32_t LinuxDvbBuffClose(Context_t *context)
 
 int32_t LinuxDvbBuffFlush(Context_t *context)
 {
-    static BufferingNode_t *nodePtr = NULL;
-    buff_printf(40, "ENTER bufferingQueueHead[%p]\n", bufferingQueueHead);
-    
+    buff_printf(40, "ENTER generation[%u] audio fill[%u] video fill[%u]\n", bufferingGeneration, GetFillLevel(&audioLane), GetFillLevel(&videoLane));
+
+    /* everything queued till now becomes stale,
+     * buffering threads will skip it
+     */
+    __sync_add_and_fetch(&bufferingGeneration, 1);
+
     /* signal if we are waiting for write to DVB decoders */
     WriteWakeUp();
 
-    pthread_mutex_lock(&bufferingMtx);
-    while (bufferingQueueHead)
-    {
-       nodePtr = bufferingQueueHead;
-       bufferingQueueHead = nodePtr->next;
-       bufferingDataSize -= (nodePtr->dataSize + sizeof(BufferingNode_t));
-       free(nodePtr);
-    }
-    bufferingQueueHead = NULL;
-    bufferingQueueTail = NULL;
-    buff_printf(40, "bufferingDataSize [%u]\n", bufferingDataSize);
-    assert(bufferingDataSize == 0);
-    bufferingDataSize = 0;
-    
-    /* signal that queue is empty */
-    pthread_cond_signal(&bufferingDataConsumedCond);
-    pthread_mutex_unlock(&bufferingMtx);
     buff_printf(40, "EXIT\n");
-    
     return 0;
 }
 
@@ -373,22 +613,29 @@ int32_t LinuxDvbBuffResume(Context_t *context)
 
 ssize_t BufferingWriteV(int fd, const struct iovec *iov, int ic) 
 {
-    OutputType_t dataType = OUTPUT_UNK;
+    BufferingLane_t *lane = NULL;
     BufferingNode_t *nodePtr = NULL;
-    uint8_t *dataPtr = NULL;
     uint32_t chunkSize = 0;
+    uint32_t totalSize = 0;
+    uint32_t partSize = 0;
+    uint32_t maxPartSize = 0;
+    uint32_t recSize = 0;
+    uint32_t generation = bufferingGeneration;
+    int64_t offset = -1;
+    int iovIdx = 0;
+    size_t iovOff = 0;
     uint32_t i = 0;
     
     buff_printf(60, "ENTER\n");
-    if (fd == videofd)
+    if (fd == videoLane.fd)
     {
         buff_printf(60, "VIDEO\n");
-        dataType = OUTPUT_VIDEO;
+        lane = &videoLane;
     }
-    else if (fd == audiofd)
+    else if (fd == audioLane.fd)
     {
         buff_printf(60, "AUDIO\n");
-        dataType = OUTPUT_AUDIO;
+        lane = &audioLane;
     }
     else
     {
@@ -400,58 +647,82 @@ ssize_t BufferingWriteV(int fd, const struct iovec *iov, int ic)
     {
         chunkSize += iov[i].iov_len;
     }
-    chunkSize += sizeof(BufferingNode_t);
-    
-    /* Allocate memory for queue node + data */
-    nodePtr = malloc(chunkSize);
-    if (!nodePtr)
-    {
-        buff_err("OUT OF MEM\n");
-        return cERR_LINUX_DVB_BUFFERING_ERROR;
-    }
-    
-    /* Copy data to new buffer */
-    dataPtr = (uint8_t *)nodePtr + sizeof(BufferingNode_t);
-    for (i=0; i<ic; ++i)
+    totalSize = chunkSize;
+
+    /* Record must be contiguous, so in the worst case only
+     * half of the empty ring can be used. Bigger chunk is queued
+     * as several records, the decoder gets the same byte stream
+     * and only the buffering thread writes to the device.
+     */
+    maxPartSize = lane->size / 4 - sizeof(BufferingNode_t);
+    if (chunkSize > maxPartSize)
     {
-        memcpy(dataPtr, iov[i].iov_base, iov[i].iov_len);
-        dataPtr += iov[i].iov_len;
+        lane->splitCnt += 1;
     }
 
-    pthread_mutex_lock(&bufferingMtx);
-    while (0 == PlaybackDieNow(0))
+    do
     {
-        if (bufferingDataSize + chunkSize >= maxBufferingDataSize)
-        {
-            /* Buffering queue is full we need wait for space*/
-            pthread_cond_wait(&bufferingDataConsumedCond, &bufferingMtx);
-        }
-        else
+        partSize = chunkSize > maxPartSize ? maxPartSize : chunkSize;
+        recSize = GetRecordSize(partSize);
+        offset = -1;
+
+        while (0 == PlaybackDieNow(0) && lane->hasThreadStarted)
         {
-            /* Add chunk to buffering queue */
-            if (bufferingQueueHead == NULL)
+            offset = GetWriteOffset(lane, recSize);
+            if (offset >= 0)
             {
-                bufferingQueueHead = nodePtr;
-                bufferingQueueTail = nodePtr;
+                break;
             }
-            else
-            {
-                bufferingQueueTail->next = nodePtr;
-                bufferingQueueTail = nodePtr;
-            }
-            
-            bufferingDataSize += chunkSize;
-            chunkSize -= sizeof(BufferingNode_t);
-            nodePtr->dataSize = chunkSize;
-            nodePtr->dataType = dataType;
-            nodePtr->next = NULL;
-            
-            /* signal that we added some data to queue */
-            pthread_cond_signal(&bufferingdDataAddedCond);
+
+            /* Buffering queue is full we need wait for space */
+            WaitForSpace(lane, recSize);
+        }
+
+        if (offset < 0)
+        {
+            return cERR_LINUX_DVB_BUFFERING_ERROR;
+        }
+
+        if (generation != bufferingGeneration)
+        {
+            /* flushed while we were waiting for space,
+             * rest of the chunk is stale too
+             */
+            lane->droppedCnt += 1;
             break;
         }
-    }
-    pthread_mutex_unlock(&bufferingMtx);
+
+        if (offset < lane->writePos && lane->size - lane->writePos >= sizeof(BufferingNode_t))
+        {
+            /* mark the rest of the ring as unused */
+            nodePtr = (BufferingNode_t *)(lane->ring + lane->writePos);
+            nodePtr->dataSize = 0;
+            nodePtr->dataType = OUTPUT_WRAP;
+        }
+
+        /* Copy data directly in to the ring */
+        nodePtr = (BufferingNode_t *)(lane->ring + offset);
+        nodePtr->dataSize = partSize;
+        nodePtr->dataType = lane->type;
+        nodePtr->generation = generation;
+        CopyFromIov((uint8_t *)nodePtr + sizeof(BufferingNode_t), iov, &iovIdx, &iovOff, partSize);
+
+        /* publish record, data must be visible before the write position */
+        offset += recSize;
+        if (offset >= lane->size)
+        {
+            offset = 0;
+        }
+        __sync_synchronize();
+        lane->writePos = (uint32_t)offset;
+        lane->packetsCnt += 1;
+
+        /* signal that we added some data to queue */
+        SignalConsumer(lane);
+
+        chunkSize -= partSize;
+    } while (chunkSize > 0);
+
     buff_printf(60, "EXIT\n");
-    return chunkSize;
+    return totalSize;
 }
@@ -104,6 +104,7 @@ int32_t LinuxDvbBuffResume(Context_t *context);
 ssize_t BufferingWriteV(int fd, const struct iovec *iov, int ic);
 int32_t LinuxDvbBuffSetSize(const uint32_t bufferSize);
 uint32_t LinuxDvbBuffGetSize();
+int32_t LinuxDvbBuffGetStatus(const char *type, uint32_t *size, uint32_t *fill);
 
 int LinuxDvbStop(Context_t  *context, char * type);
 
@@ -1015,6 +1016,11 @@ static int Command(void  *_context, OutputCmd_t command, void * argument) {
         *((uint32_t*)argument) = LinuxDvbBuffGetSize();
         break;
     }
+    case OUTPUT_GET_BUFFER_STATUS: {
+        OutputBufferStatus_t *status = (OutputBufferStatus_t*)argument;
+        ret = LinuxDvbBuffGetStatus(status->type, &status->size, &status->fill);
+        break;
+    }
     default:
         linuxdvb_err("ContainerCmd %d not supported!\n", command);
         ret = cERR_LINUXDVB_ERROR;
@@ -96,6 +96,7 @@ typedef struct avcC_s
 /* Varaibles                     */
 /* ***************************** */
 const  uint8_t   Head[] = {0, 0, 0, 1};
+static const uint8_t EndOfSequence[] = {0, 0, 0, 1, 0x0a};
 static int32_t   initialHeader = 1;
 static uint32_t  NalLengthBytes = 1;
 static int       avc3 = 0;
@@ -426,12 +427,19 @@ static int32_t writeData(void* _call)
     unsigned int SampleSize    = call->len;
     unsigned int NalStart      = 0;
     unsigned int VideoPosition = 0;
+    unsigned int PacketLength  = 0;
+    unsigned int WritesCount   = 0;
+
+    /* NAL units are converted to Annex-B by the iovec array,
+     * so the payload is not copied here
+     */
+    ic = 0;
+    iov[ic++].iov_base = PesHeader;
 
     do 
     {
         unsigned int   NalLength;
         unsigned char  NalData[4];
-        int NalPresent = 1;
 
         memcpy (NalData, call->data + VideoPosition, NalLengthBytes);
         VideoPosition += NalLengthBytes;
@@ -456,31 +464,39 @@ static int32_t writeData(void* _call)
         else 
         {
             NalStart += NalLength;
-            ic = 0;
-            iov[ic++].iov_base = PesHeader;
 
-            if (NalPresent) {
-                NalPresent = 0;
-                iov[ic].iov_base = (char *)Head;
-                iov[ic++].iov_len = sizeof(Head);
-            }
+            iov[ic].iov_base = (char *)Head;
+            iov[ic++].iov_len = sizeof(Head);
 
             iov[ic].iov_base = call->data + VideoPosition;
             iov[ic++].iov_len = NalLength;
             VideoPosition += NalLength;
+            PacketLength  += sizeof(Head) + NalLength;
+        }
 
+        /* all NAL units of the access unit go as one PES packet,
+         * it is written when the access unit is complete
+         * or when there is no more place in the iovec array
+         */
+        if (PacketLength && (NalStart >= SampleSize || ic + 2 > (int32_t)(sizeof(iov) / sizeof(iov[0]))))
+        {
             h264_printf (20, "  pts=%llu\n", VideoPts);
 
-            iov[0].iov_len = InsertPesHeader (PesHeader, NalLength, MPEG_VIDEO_PES_START_CODE, VideoPts, 0);
+            iov[0].iov_len = InsertPesHeader (PesHeader, PacketLength, MPEG_VIDEO_PES_START_CODE, VideoPts, 0);
             ssize_t l = call->WriteV(call->fd, iov, ic);
             if (l < 0)
                 return l;
             len += l;
+            WritesCount += 1;
 
             VideoPts = INVALID_PTS_VALUE;
+            PacketLength = 0;
+            ic = 1;
         }
     } while (NalStart < SampleSize);
 
+    h264_printf (20, "access unit written with %u writes\n", WritesCount);
+
     if (len < 0)
     {
         h264_err("error writing data errno = %d\n", errno);
@@ -495,6 +511,11 @@ static int writeReverseData(void* _call)
 {
     WriterAVCallData_t* call = (WriterAVCallData_t*) _call;
 
+    uint8_t   PesHeader[PES_MAX_HEADER_SIZE];
+    struct iovec iov[2];
+    int32_t   len = 0;
+    ssize_t   l = 0;
+
     h264_printf(10, "\n");
 
     if (call == NULL)
@@ -517,7 +538,29 @@ static int writeReverseData(void* _call)
         return 0;
     }
 
-    return 0;
+    /* In reverse play we get only key frames, one by one,
+     * with re-stamped PTS, so they can be written as usual
+     */
+    len = writeData(call);
+    if (len < 0)
+    {
+        return len;
+    }
+
+    /* End of sequence NAL unit makes the decoder output
+     * the picture at once instead of waiting for next one
+     */
+    iov[0].iov_base = PesHeader;
+    iov[0].iov_len = InsertPesHeader(PesHeader, sizeof(EndOfSequence), MPEG_VIDEO_PES_START_CODE, INVALID_PTS_VALUE, 0);
+    iov[1].iov_base = (char *)EndOfSequence;
+    iov[1].iov_len = sizeof(EndOfSequence);
+    l = call->WriteV(call->fd, iov, 2);
+    if (l < 0)
+    {
+        return l;
+    }
+
+    return len + l;
 }
 /* ***************************** */
 /* Writer  Definition            */
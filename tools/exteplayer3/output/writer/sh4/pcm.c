@@ -104,8 +104,12 @@ static const uint8_t clpcm_prv[14] =
 };
 
 static uint8_t lpcm_prv[14];
-static uint8_t breakBuffer[8192];
-static uint32_t breakBufferFillSize = 0;
+
+/* one PES payload, kept between calls: an incomplete subframe waits
+ * here in source order until the next call completes it */
+static uint32_t injectBuffer[2048 / sizeof(uint32_t)];
+static uint32_t injectBufferFillSize = 0;
+static uint8_t  sourceLittleEndian = 1;
 
 /* ***************************** */
 /* Prototypes                    */
@@ -115,7 +119,7 @@ static uint32_t breakBufferFillSize = 0;
 /* MISC Functions                */
 /* ***************************** */
 
-static int32_t prepareClipPlay(int32_t uNoOfChannels, int32_t uSampleRate, int32_t uBitsPerSample, uint8_t bLittleEndian __attribute__((unused)))
+static int32_t prepareClipPlay(int32_t uNoOfChannels, int32_t uSampleRate, int32_t uBitsPerSample, uint8_t bLittleEndian)
 {
     printf("rate: %d ch: %d bits: %d (%d bps)\n",
         uSampleRate/*Format->dwSamplesPerSec*/,
@@ -126,7 +130,8 @@ static int32_t prepareClipPlay(int32_t uNoOfChannels, int32_t uSampleRate, int32
 
     SubFrameLen = 0;
     SubFramesPerPES = 0;
-    breakBufferFillSize = 0;
+    injectBufferFillSize = 0;
+    sourceLittleEndian = bLittleEndian;
 
     memcpy(lpcm_prv, clpcm_prv, sizeof(lpcm_prv));
 
@@ -178,6 +183,93 @@ static int32_t prepareClipPlay(int32_t uNoOfChannels, int32_t uSampleRate, int32
     return 0;
 }
 
+/* LPCM wants big endian 16 bit samples: swap two samples per word
+ * while copying, src and dst may be the same buffer */
+typedef uint32_t __attribute__((__may_alias__)) pcmWord_t;
+
+static void convert16(uint8_t *dst, const uint8_t *src, uint32_t len)
+{
+    if (0 == (((unsigned long)dst | (unsigned long)src) & 3))
+    {
+        const pcmWord_t *s = (const pcmWord_t *)src;
+        pcmWord_t *d = (pcmWord_t *)dst;
+        uint32_t n = len >> 2;
+        for (; n >= 4; n -= 4, s += 4, d += 4)
+        {
+            pcmWord_t w0 = s[0], w1 = s[1], w2 = s[2], w3 = s[3];
+            d[0] = ((w0 & 0x00FF00FF) << 8) | ((w0 >> 8) & 0x00FF00FF);
+            d[1] = ((w1 & 0x00FF00FF) << 8) | ((w1 >> 8) & 0x00FF00FF);
+            d[2] = ((w2 & 0x00FF00FF) << 8) | ((w2 >> 8) & 0x00FF00FF);
+            d[3] = ((w3 & 0x00FF00FF) << 8) | ((w3 >> 8) & 0x00FF00FF);
+        }
+        for (; n > 0; n--, s++, d++)
+        {
+            pcmWord_t w = *s;
+            *d = ((w & 0x00FF00FF) << 8) | ((w >> 8) & 0x00FF00FF);
+        }
+        dst = (uint8_t *)d;
+        src = (const uint8_t *)s;
+        len &= 3;
+    }
+    for (; len >= 2; len -= 2, src += 2, dst += 2)
+    {
+        uint8_t t = src[0];
+        dst[0] = src[1];
+        dst[1] = t;
+    }
+}
+
+/* 24 bit LPCM stores two stereo sample pairs as the upper 16 bits of
+ * all four samples followed by their low bytes:
+ *      0   1   2   3   4   5   6   7   8   9  10  11
+ *    A1c A1b A1a-B1c B1b B1a-A2c A2b A2a-B2c B2b B2a  (little endian)
+ * to A1a A1b B1a B1b.A2a A2b B2a B2b-A1c B1c A2c B2c
+ * src and dst may be the same buffer */
+static void convert24(uint8_t *dst, const uint8_t *src, uint32_t len, uint8_t littleEndian)
+{
+    uint8_t p[12];
+    uint32_t n;
+
+    for (n = 0; n + 12 <= len; n += 12, src += 12, dst += 12)
+    {
+        memcpy(p, src, sizeof(p));
+        if (littleEndian)
+        {
+            dst[ 0] = p[ 2]; dst[ 1] = p[ 1]; dst[ 2] = p[ 5]; dst[ 3] = p[ 4];
+            dst[ 4] = p[ 8]; dst[ 5] = p[ 7]; dst[ 6] = p[11]; dst[ 7] = p[10];
+            dst[ 8] = p[ 0]; dst[ 9] = p[ 3]; dst[10] = p[ 6]; dst[11] = p[ 9];
+        }
+        else
+        {
+            dst[ 0] = p[ 0]; dst[ 1] = p[ 1]; dst[ 2] = p[ 3]; dst[ 3] = p[ 4];
+            dst[ 4] = p[ 6]; dst[ 5] = p[ 7]; dst[ 6] = p[ 9]; dst[ 7] = p[10];
+            dst[ 8] = p[ 2]; dst[ 9] = p[ 5]; dst[10] = p[ 8]; dst[11] = p[11];
+        }
+    }
+}
+
+/* Convert one subframe to LPCM order in a single pass from src into
+ * injectBuffer (src may be injectBuffer itself). Big endian 16 bit
+ * data is already in order and is written from src without a copy. */
+static uint8_t *convertSubFrame(const uint8_t *src, int32_t bitsPerSample)
+{
+    uint8_t *dst = (uint8_t *)injectBuffer;
+
+    if (16 == bitsPerSample)
+    {
+        if (!sourceLittleEndian)
+        {
+            return (uint8_t *)src;
+        }
+        convert16(dst, src, SubFrameLen);
+    }
+    else
+    {
+        convert24(dst, src, SubFrameLen, sourceLittleEndian);
+    }
+    return dst;
+}
+
 static int32_t reset()
 {
     initialHeader = 1;
@@ -250,33 +342,39 @@ static int32_t writeData(void *_call)
 
     uint8_t *buffer = call->data;
     uint32_t size = call->len;
+    uint32_t pos = 0;
 
-    uint32_t n;
-    uint8_t *injectBuffer = malloc(SubFrameLen);
-    uint32_t pos;
+    if (0 == SubFrameLen || SubFrameLen > sizeof(injectBuffer))
+    {
+        pcm_err("unsupported format, subframe length %u\n", SubFrameLen);
+        return 0;
+    }
 
-    for(pos = 0; pos < size; )
+    while (pos < size)
     {
-        //printf("PCM %s - Position=%d\n", __FUNCTION__, pos);
-        if((size - pos) < SubFrameLen)
-        {
-            breakBufferFillSize = size - pos;
-            memcpy(breakBuffer, &buffer[pos], sizeof(uint8_t) * breakBufferFillSize);
-            //printf("PCM %s - Unplayed=%d\n", __FUNCTION__, breakBufferFillSize);
-            break;
-        }
+        uint8_t *subFrame;
 
-        //get first PES's worth
-        if(breakBufferFillSize > 0)
+        if (injectBufferFillSize > 0 || (size - pos) < SubFrameLen)
         {
-            memcpy(injectBuffer, breakBuffer, sizeof(uint8_t)*breakBufferFillSize);
-            memcpy(&injectBuffer[breakBufferFillSize], &buffer[pos], sizeof(unsigned char)*(SubFrameLen - breakBufferFillSize));
-            pos += (SubFrameLen - breakBufferFillSize);
-            breakBufferFillSize = 0;
+            //complete the subframe left from last call or keep the rest for the next one
+            uint32_t n = SubFrameLen - injectBufferFillSize;
+            if (n > size - pos)
+            {
+                n = size - pos;
+            }
+            memcpy((uint8_t *)injectBuffer + injectBufferFillSize, &buffer[pos], n);
+            injectBufferFillSize += n;
+            pos += n;
+            if (injectBufferFillSize < SubFrameLen)
+            {
+                break;
+            }
+            injectBufferFillSize = 0;
+            subFrame = convertSubFrame((uint8_t *)injectBuffer, pcmPrivateData->bits_per_coded_sample);
         }
         else
         {
-            memcpy(injectBuffer, &buffer[pos], sizeof(uint8_t)*SubFrameLen);
+            subFrame = convertSubFrame(&buffer[pos], pcmPrivateData->bits_per_coded_sample);
             pos += SubFrameLen;
         }
 
@@ -285,40 +383,9 @@ static int32_t writeData(void *_call)
         iov[1].iov_base = lpcm_prv;
         iov[1].iov_len = sizeof(lpcm_prv);
 
-        iov[2].iov_base = injectBuffer;
+        iov[2].iov_base = subFrame;
         iov[2].iov_len = SubFrameLen;
 
-        //write the PCM data
-        if(16 == pcmPrivateData->bits_per_coded_sample) 
-        {
-            for(n=0; n<SubFrameLen; n+=2)
-            {
-                uint8_t tmp;
-                tmp=injectBuffer[n];
-                injectBuffer[n]=injectBuffer[n+1];
-                injectBuffer[n+1]=tmp;
-            }
-        } 
-        else
-        {
-            //      0   1   2   3   4   5   6   7   8   9  10  11
-            //    A1c A1b A1a-B1c B1b B1a-A2c A2b A2a-B2c B2b B2a
-            // to A1a A1b B1a B1b.A2a A2b B2a B2b-A1c B1c A2c B2c
-            for(n=0; n<SubFrameLen; n+=12) {
-                unsigned char t, *p = &injectBuffer[n];
-                t = p[0];
-                p[ 0] = p[ 2];
-                p[ 2] = p[ 5];
-                p[ 5] = p[ 7];
-                p[ 7] = p[11];
-                p[11] = p[ 9];
-                p[ 9] = p[ 3];
-                p[ 3] = p[ 4];
-                p[ 4] = p[ 8];
-                p[ 8] = t;
-            }
-        }
-
         //increment err... subframe count?
         lpcm_prv[1] = ((lpcm_prv[1]+SubFramesPerPES) & 0x1F);
 
@@ -329,7 +396,6 @@ static int32_t writeData(void *_call)
             break;
         }
     }
-    free(injectBuffer);
 
     return size;
 }
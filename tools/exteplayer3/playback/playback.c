@@ -337,6 +337,18 @@ static int32_t PlaybackContinue(Context_t  *context)
 
         set_pause_timeout(0);
 
+        if (context->playback->BackWard)
+        {
+            /* drop re-stamped key frames, container will
+             * continue from the last displayed one
+             */
+            context->playback->isSeeking = 1;
+            context->output->Command(context, OUTPUT_CLEAR, NULL);
+            context->output->Command(context, OUTPUT_AUDIOMUTE, "0");
+            context->playback->BackWard = 0;
+            context->playback->isSeeking = 0;
+        }
+
         context->output->Command(context, OUTPUT_CONTINUE, NULL);
 
         context->playback->isPaused     = 0;
@@ -429,6 +441,62 @@ static int32_t PlaybackTerminate(Context_t  *context)
     return ret;
 }
 
+static int32_t PlaybackFastBackward(Context_t  *context, int32_t *speed) 
+{
+    int32_t ret = cERR_PLAYBACK_NO_ERROR;
+
+    playback_printf(10, "speed: %d\n", *speed);
+
+    /* Audio only reverse play not supported */
+    if (context->playback->isPlaying && context->playback->isVideo && !context->playback->isForwarding && 
+        !context->playback->SlowMotion && !context->playback->isPaused && !context->playback->isTSLiveMode) 
+    {
+        if (*speed == 0)
+        {
+            /* reverse end */
+            return context->playback->BackWard ? PlaybackContinue(context) : cERR_PLAYBACK_NO_ERROR;
+        }
+
+        if ((*speed > 0) || (*speed < cMaxSpeed_fr))
+        {
+            playback_err("speed %d out of range (-1 - %d) \n", *speed, cMaxSpeed_fr);
+            return cERR_PLAYBACK_ERROR;
+        }
+
+        context->playback->isSeeking = 1;
+        if (!context->playback->BackWard)
+        {
+            context->output->Command(context, OUTPUT_AUDIOMUTE, "1");
+            context->output->Command(context, OUTPUT_CLEAR, NULL);
+            if (context->output->Command(context, OUTPUT_REVERSE, NULL) < 0)
+            {
+                playback_err("OUTPUT_REVERSE failed\n");
+                ret = cERR_PLAYBACK_ERROR;
+            }
+        }
+
+        if (ret == cERR_PLAYBACK_NO_ERROR)
+        {
+            context->playback->Speed    = *speed;
+            context->playback->BackWard = 1;
+        }
+        else
+        {
+            context->output->Command(context, OUTPUT_AUDIOMUTE, "0");
+        }
+        context->playback->isSeeking = 0;
+    }
+    else
+    {
+        playback_err("fast backward not possible\n");
+        ret = cERR_PLAYBACK_ERROR;
+    }
+
+    playback_printf(10, "exiting with value %d\n", ret);
+
+    return ret;
+}
+
 static int32_t PlaybackSeek(Context_t  *context, int64_t *pos, uint8_t absolute) 
 {
     int32_t ret = cERR_PLAYBACK_NO_ERROR;
@@ -471,6 +539,18 @@ static int32_t PlaybackPts(Context_t  *context, int64_t *pts)
     if (context->playback->isPlaying)
     {
         ret = context->output->Command(context, OUTPUT_PTS, pts);
+
+        /* in reverse play the decoder gets re-stamped pts, the container
+         * knows the position of the key frame on the screen */
+        if (context->playback->BackWard && context->container && context->container->selectedContainer)
+        {
+            int64_t reversePts = 0;
+            if (0 == context->container->selectedContainer->Command(context, CONTAINER_REVERSE_PTS, &reversePts))
+            {
+                *pts = reversePts;
+                ret = cERR_PLAYBACK_NO_ERROR;
+            }
+        }
     } 
     else
     {
@@ -690,6 +770,11 @@ static int32_t Command(void* _context, PlaybackCmd_t command, void *argument)
             ret = PlaybackTerminate(context);
             break;
         }
+        case PLAYBACK_FASTBACKWARD: 
+        {
+            ret = PlaybackFastBackward(context, (int32_t*)argument);
+            break;
+        }
         case PLAYBACK_SEEK: 
         {
             ret = PlaybackSeek(context, (int64_t*)argument, 0);
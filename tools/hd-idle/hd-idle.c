@@ -113,16 +113,27 @@
 #include <errno.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <signal.h>
 
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/select.h>
 #include <scsi/sg.h>
 #include <scsi/scsi.h>
 
 #define STAT_FILE "/proc/diskstats"
 #define DEFAULT_IDLE_TIME 600
+#define MAX_DISKS ('z' - 'a' + 1)  /* sda .. sdz */
+
+/* adaptive mode: idle time per hour of day in percent of the configured one */
+#define ADAPT_MIN 50
+#define ADAPT_MAX 400
+#define ADAPT_DEFAULT 100
+
+/* spin-up latency assumed until a pre-spin has measured the real one */
+#define SPINUP_ESTIMATE_MS 8000
 
 #define dprintf if (debug) printf
 
@@ -136,37 +147,63 @@ typedef struct IDLE_TIME
 
 typedef struct DISKSTATS
 {
-	struct DISKSTATS  *next;
 	char               name[50];
 	int                idle_time;
 	time_t             last_io;
 	time_t             spindown;
 	time_t             spinup;
+	time_t             hold_until;      /* pre-spun, don't spin down before */
 	unsigned int       spun_down : 1;
 	unsigned int       reads;
 	unsigned int       writes;
+	int                spindown_hour;
+	unsigned short     factor[24];      /* adaptive idle time per hour of day */
+
+	/* metrics */
+	unsigned int       spinups;
+	unsigned int       early_spinups;   /* spun up within the idle time */
+	unsigned int       spindowns;
+	unsigned int       prespins;
+	long               spinup_ms;       /* last measured spin-up time */
+	long long          stall_ms;        /* spin-up latency added to I/O */
 } DISKSTATS;
 
 /* function prototypes */
 static void        daemonize(void);
+static ssize_t     read_stats(int fd);
+static int         parse_diskstats(char *line, DISKSTATS *tmp);
 static DISKSTATS  *get_diskstats(const char *name);
+static int         idle_threshold(DISKSTATS *ds, time_t now);
+static void        adapt_idle_time(DISKSTATS *ds, time_t now);
+static int         scsi_start_stop(const char *name, int start);
 static void        spindown_disk(const char *name);
+static void        prespin_disk(char *cmd);
 static void        log_spinup(DISKSTATS *ds);
+static void        log_metrics(void);
+static void        metrics_signal(int sig);
 static char       *disk_name(char *name);
 static void        phex(const void *p, int len,
 			const char *fmt, ...);
 
 /* global/static variables */
 IDLE_TIME *it_root;
-DISKSTATS *ds_root;
+DISKSTATS *ds_table[MAX_DISKS];
 char *logfile = "/dev/null";
+int have_logfile;
+int adaptive;
 int debug;
 
+static char *stats_buf;
+static size_t stats_size;
+static volatile sig_atomic_t metrics_requested;
+
 /* main function */
 int main(int argc, char *argv[])
 {
 	IDLE_TIME *it;
-	int have_logfile = 0;
+	char *fifo = NULL;
+	int fifo_fd = -1;
+	int stats_fd;
 	int min_idle_time;
 	int sleep_time;
 	int opt;
@@ -183,7 +220,7 @@ int main(int argc, char *argv[])
 	it_root = it;
 
 	/* process command line options */
-	while ((opt = getopt(argc, argv, "t:a:i:l:dh")) != -1)
+	while ((opt = getopt(argc, argv, "t:a:i:l:s:Adh")) != -1)
 	{
 		switch (opt)
 		{
@@ -220,6 +257,16 @@ int main(int argc, char *argv[])
 				have_logfile = 1;
 				break;
 			}
+			case 's':
+			{
+				fifo = optarg;
+				break;
+			}
+			case 'A':
+			{
+				adaptive = 1;
+				break;
+			}
 			case 'd':
 			{
 				debug = 1;
@@ -227,7 +274,7 @@ int main(int argc, char *argv[])
 			}
 			case 'h':
 			{
-				printf("usage: hd-idle [-t <disk>] [-a <name>] [-i <idle_time>] [-l <logfile>] [-d] [-h]\n");
+				printf("usage: hd-idle [-t <disk>] [-a <name>] [-i <idle_time>] [-l <logfile>] [-s <fifo>] [-A] [-d] [-h]\n");
 				return (0);
 			}
 			case ':':
@@ -263,14 +310,40 @@ int main(int argc, char *argv[])
 		daemonize();
 	}
 
+	/* /proc/diskstats stays open, every probe re-reads it from offset 0 */
+	if ((stats_fd = open(STAT_FILE, O_RDONLY)) < 0)
+	{
+		perror(STAT_FILE);
+		return (2);
+	}
+
+	/* pre-spin requests, opened read-write so there's always a writer */
+	if (fifo != NULL)
+	{
+		if (mkfifo(fifo, 0600) < 0 && errno != EEXIST)
+		{
+			perror(fifo);
+			return (2);
+		}
+		if ((fifo_fd = open(fifo, O_RDWR | O_NONBLOCK)) < 0)
+		{
+			perror(fifo);
+			return (2);
+		}
+	}
+	signal(SIGUSR1, metrics_signal);
+
 	/* main loop: probe for idle disks and stop them */
 	for (;;)
 	{
 		DISKSTATS tmp;
-		FILE *fp;
-		char buf[200];
+		struct timeval tv;
+		fd_set fds;
+		ssize_t len;
+		char *line;
+		char *eol;
 
-		if ((fp = fopen(STAT_FILE, "r")) == NULL)
+		if ((len = read_stats(stats_fd)) < 0)
 		{
 			perror(STAT_FILE);
 			return (2);
@@ -278,22 +351,20 @@ int main(int argc, char *argv[])
 
 		memset(&tmp, 0x00, sizeof(tmp));
 
-		while (fgets(buf, sizeof(buf), fp) != NULL)
+		for (line = stats_buf; line < stats_buf + len; line = eol + 1)
 		{
-			if (sscanf(buf, "%*d %*d %s %*u %*u %u %*u %*u %*u %u %*u %*u %*u %*u",
-					tmp.name, &tmp.reads, &tmp.writes) == 3)
+			if ((eol = strchr(line, '\n')) == NULL)
+			{
+				eol = stats_buf + len;
+			}
+			*eol = '\0';
+
+			/* only SCSI disks (sd[a-z]) are returned */
+			if (parse_diskstats(line, &tmp))
 			{
 				DISKSTATS *ds;
 				time_t now = time(NULL);
 
-				/* make sure this is a SCSI disk (sd[a-z]) */
-				if (tmp.name[0] != 's'
-				||  tmp.name[1] != 'd'
-				||  !isalpha(tmp.name[2])
-				||  tmp.name[3] != '\0')
-				{
-					continue;
-				}
 				dprintf("[hd-idle] probing %s: reads: %u, writes: %u\n", tmp.name, tmp.reads, tmp.writes);
 
 				/* get previous statistics for this disk */
@@ -301,7 +372,9 @@ int main(int argc, char *argv[])
 
 				if (ds == NULL)
 				{
-					/* new disk; just add it to the linked list */
+					int i;
+
+					/* new disk; just add it to the table */
 					if ((ds = malloc(sizeof(*ds))) == NULL)
 					{
 						fprintf(stderr, "[hd-idle] out of memory\n");
@@ -310,8 +383,11 @@ int main(int argc, char *argv[])
 					memcpy(ds, &tmp, sizeof(*ds));
 					ds->last_io = now;
 					ds->spinup = ds->last_io;
-					ds->next = ds_root;
-					ds_root = ds;
+					for (i = 0; i < 24; i++)
+					{
+						ds->factor[i] = ADAPT_DEFAULT;
+					}
+					ds_table[ds->name[2] - 'a'] = ds;
 
 					/* find idle time for this disk (falling-back to default; default means
 					 * 'it->name == NULL' and this entry will always be the last due to the
@@ -332,10 +408,15 @@ int main(int argc, char *argv[])
 					if (!ds->spun_down)
 					{
 						/* no activity on this disk and still running */
-						if (ds->idle_time != 0 && now - ds->last_io >= ds->idle_time)
+						if (ds->idle_time != 0 && now >= ds->hold_until
+						&&  now - ds->last_io >= idle_threshold(ds, now))
 						{
+							struct tm tm;
+
 							spindown_disk(ds->name);
 							ds->spindown = now;
+							ds->spindown_hour = localtime_r(&now, &tm)->tm_hour;
+							ds->spindowns++;
 							ds->spun_down = 1;
 						}
 					}
@@ -347,6 +428,9 @@ int main(int argc, char *argv[])
 					if (ds->spun_down)
 					{
 						/* disk was spun down, thus it has just spun up */
+						ds->spinups++;
+						ds->stall_ms += ds->spinup_ms ? ds->spinup_ms : SPINUP_ESTIMATE_MS;
+						adapt_idle_time(ds, now);
 						if (have_logfile)
 						{
 							log_spinup(ds);
@@ -360,8 +444,44 @@ int main(int argc, char *argv[])
 				}
 			}
 		}
-		fclose(fp);
-		sleep(sleep_time);
+
+		if (metrics_requested)
+		{
+			metrics_requested = 0;
+			log_metrics();
+		}
+
+		/* sleep until the next probe or a pre-spin request */
+		tv.tv_sec = sleep_time;
+		tv.tv_usec = 0;
+		FD_ZERO(&fds);
+		if (fifo_fd >= 0)
+		{
+			FD_SET(fifo_fd, &fds);
+		}
+		if (select(fifo_fd + 1, &fds, NULL, NULL, &tv) > 0 && FD_ISSET(fifo_fd, &fds))
+		{
+			char cmd[256];
+			ssize_t n;
+
+			/* one request per line: <disk> [<hold time>] */
+			while ((n = read(fifo_fd, cmd, sizeof(cmd) - 1)) > 0)
+			{
+				cmd[n] = '\0';
+				for (line = cmd; *line != '\0'; line = eol + 1)
+				{
+					if ((eol = strchr(line, '\n')) == NULL)
+					{
+						eol = line + strlen(line) - 1;
+					}
+					else
+					{
+						*eol = '\0';
+					}
+					prespin_disk(line);
+				}
+			}
+		}
 	}
 	return (0);
 }
@@ -410,49 +530,169 @@ static void daemonize(void)
 	open("/dev/null", O_WRONLY);
 }
 
+/* read the whole stats file into stats_buf (NUL-terminated), growing it as needed */
+static ssize_t read_stats(int fd)
+{
+	size_t len = 0;
+	ssize_t n;
+
+	for (;;)
+	{
+		if (stats_size - len < 2)
+		{
+			char *buf;
+
+			if ((buf = realloc(stats_buf, stats_size ? stats_size * 2 : 4096)) == NULL)
+			{
+				fprintf(stderr, "[hd-idle] out of memory\n");
+				exit(2);
+			}
+			stats_buf = buf;
+			stats_size = stats_size ? stats_size * 2 : 4096;
+		}
+		if ((n = pread(fd, stats_buf + len, stats_size - len - 1, len)) < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return (-1);
+		}
+		if (n == 0)
+		{
+			break;
+		}
+		len += n;
+	}
+	stats_buf[len] = '\0';
+	return (len);
+}
+
+/* Parse one line of /proc/diskstats: "<major> <minor> <name> <reads completed>
+ * <reads merged> <sectors read> <ms reading> <writes completed> <writes merged>
+ * <sectors written> ...". Returns 0 for anything but a SCSI disk (sd[a-z]).
+ */
+static int parse_diskstats(char *line, DISKSTATS *tmp)
+{
+	unsigned long v[7];
+	char *s = line;
+	char *e;
+	int i;
+
+	for (i = 0; i < 2; i++)
+	{
+		strtoul(s, &e, 10);
+		if (e == s)
+		{
+			return (0);
+		}
+		s = e;
+	}
+	while (*s == ' ')
+	{
+		s++;
+	}
+	if (s[0] != 's'
+	||  s[1] != 'd'
+	||  s[2] < 'a' || s[2] > 'z'
+	||  s[3] != ' ')
+	{
+		return (0);
+	}
+	memcpy(tmp->name, s, 3);
+	tmp->name[3] = '\0';
+	s += 3;
+
+	for (i = 0; i < 7; i++)
+	{
+		v[i] = strtoul(s, &e, 10);
+		if (e == s)
+		{
+			return (0);
+		}
+		s = e;
+	}
+	tmp->reads = v[2];
+	tmp->writes = v[6];
+	return (1);
+}
+
 /* get DISKSTATS entry by name of disk */
 static DISKSTATS *get_diskstats(const char *name)
 {
-	DISKSTATS *ds;
+	if (name[0] != 's' || name[1] != 'd' || name[2] < 'a' || name[2] > 'z' || name[3] != '\0')
+	{
+		return (NULL);
+	}
+	return (ds_table[name[2] - 'a']);
+}
 
-	for (ds = ds_root; ds != NULL; ds = ds->next)
+/* idle time before spinning down, learned per hour of day in adaptive mode */
+static int idle_threshold(DISKSTATS *ds, time_t now)
+{
+	struct tm tm;
+
+	if (!adaptive)
 	{
-		if (!strcmp(ds->name, name))
+		return (ds->idle_time);
+	}
+	return ((long) ds->idle_time * ds->factor[localtime_r(&now, &tm)->tm_hour] / 100);
+}
+
+/* Learn from a spin-up: a disk woken again before its idle time has passed
+ * paid a spin-up for nothing, so that hour of day gets a longer idle time.
+ * A disk staying down for a long time lets the idle time shrink slowly again.
+ */
+static void adapt_idle_time(DISKSTATS *ds, time_t now)
+{
+	unsigned short *factor = &ds->factor[ds->spindown_hour];
+	long idle = (long) ds->idle_time * *factor / 100;
+	long down = now - ds->spindown;
+
+	if (down < idle)
+	{
+		ds->early_spinups++;
+		if (adaptive)
 		{
-			return (ds);
+			*factor = (*factor * 2 > ADAPT_MAX) ? ADAPT_MAX : *factor * 2;
 		}
 	}
-	return (NULL);
+	else if (adaptive && down >= 4 * idle)
+	{
+		*factor = (*factor - 25 < ADAPT_MIN) ? ADAPT_MIN : *factor - 25;
+	}
+	dprintf("[hd-idle] %s was down for %lds, idle time at %02d:00 now %ld s\n", ds->name,
+		down, ds->spindown_hour, (long) ds->idle_time * *factor / 100);
 }
 
-/* spin-down a disk */
-static void spindown_disk(const char *name)
+/* send SCSI start/stop unit; returns 0 on success */
+static int scsi_start_stop(const char *name, int start)
 {
 	struct sg_io_hdr io_hdr;
 	unsigned char sense_buf[255];
 	char dev_name[100];
+	int ret = -1;
 	int fd;
 
-	dprintf("[hd-idle] spindown: %s\n", name);
-
 	/* fabricate SCSI IO request */
 	memset(&io_hdr, 0x00, sizeof(io_hdr));
 	io_hdr.interface_id = 'S';
 	io_hdr.dxfer_direction = SG_DXFER_NONE;
 
-	/* SCSI stop unit command */
-	io_hdr.cmdp = (unsigned char *) "\x1b\x00\x00\x00\x00\x00";
+	/* SCSI start/stop unit command (start returns when the disk is ready) */
+	io_hdr.cmdp = (unsigned char *) (start ? "\x1b\x00\x00\x00\x01\x00" : "\x1b\x00\x00\x00\x00\x00");
 
 	io_hdr.cmd_len = 6;
 	io_hdr.sbp = sense_buf;
 	io_hdr.mx_sb_len = (unsigned char) sizeof(sense_buf);
+	io_hdr.timeout = 60000;
 
 	/* open disk device (kernel 2.4 will probably need "sg" names here) */
 	snprintf(dev_name, sizeof(dev_name), "/dev/%s", name);
 	if ((fd = open(dev_name, O_RDONLY)) < 0)
 	{
 		perror(dev_name);
-		return;
+		return (-1);
 	}
 
 	/* execute SCSI request */
@@ -472,8 +712,86 @@ static void spindown_disk(const char *name)
 			phex(sense_buf, io_hdr.sb_len_wr, "sense buffer:\n");
 		}
 	}
+	else
+	{
+		ret = 0;
+	}
 
 	close(fd);
+	return (ret);
+}
+
+/* spin-down a disk */
+static void spindown_disk(const char *name)
+{
+	dprintf("[hd-idle] spindown: %s\n", name);
+	scsi_start_stop(name, 0);
+}
+
+/* Pre-spin request "<disk> [<hold time>]", e.g. ahead of a scheduled
+ * recording: spin the disk up now, measuring the spin-up time, and keep it
+ * running for at least <hold time> seconds (default: its idle time).
+ */
+static void prespin_disk(char *cmd)
+{
+	struct timespec t0, t1;
+	DISKSTATS *ds;
+	char *arg;
+	char *name;
+	int hold = -1;
+	time_t now;
+
+	while (isspace(*cmd))
+	{
+		cmd++;
+	}
+	if (*cmd == '\0')
+	{
+		return;
+	}
+	if ((arg = strpbrk(cmd, " \t")) != NULL)
+	{
+		*arg++ = '\0';
+		hold = atoi(arg);
+	}
+	name = disk_name(cmd);
+	ds = get_diskstats(name);
+	if (ds == NULL)
+	{
+		fprintf(stderr, "[hd-idle] pre-spin: unknown disk %s\n", name);
+		if (name != cmd)
+		{
+			free(name);
+		}
+		return;
+	}
+	if (name != cmd)
+	{
+		free(name);
+	}
+
+	now = time(NULL);
+	if (hold >= 0)
+	{
+		ds->hold_until = now + hold;
+	}
+	if (!ds->spun_down)
+	{
+		dprintf("[hd-idle] pre-spin: %s is running\n", ds->name);
+		return;
+	}
+
+	dprintf("[hd-idle] pre-spin: %s\n", ds->name);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (scsi_start_stop(ds->name, 1) == 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		ds->spinup_ms = (t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_nsec - t0.tv_nsec) / 1000000;
+		ds->prespins++;
+		ds->spun_down = 0;
+		ds->spinup = ds->last_io = time(NULL);
+		dprintf("[hd-idle] pre-spin: %s ready after %ld ms\n", ds->name, ds->spinup_ms);
+	}
 }
 
 /* write a spin-up event message to the log file */
@@ -498,10 +816,11 @@ static void log_spinup(DISKSTATS *ds)
 		strftime(dstr, sizeof(dstr), "%Y-%m-%d", localtime(&now));
 		strftime(tstr, sizeof(tstr), "%H:%M:%S", localtime(&now));
 		fprintf(fp,
-			"date: %s, time: %s, disk: %s, running: %ld, stopped: %ld\n",
+			"date: %s, time: %s, disk: %s, running: %ld, stopped: %ld, spinups: %u, latency: %ld ms\n",
 			dstr, tstr, ds->name,
 			(long) ds->spindown - (long) ds->spinup,
-			(long) time(NULL) - (long) ds->spindown);
+			(long) time(NULL) - (long) ds->spindown,
+			ds->spinups, ds->spinup_ms ? ds->spinup_ms : SPINUP_ESTIMATE_MS);
 
 		/* Sync to make sure writing to the logfile won't cause another
 		 * spinup in 30 seconds (or whatever bdflush uses as flush interval).
@@ -512,6 +831,47 @@ static void log_spinup(DISKSTATS *ds)
 	}
 }
 
+/* write per-disk spin-up metrics to the log file (stdout in debug mode), on SIGUSR1 */
+static void log_metrics(void)
+{
+	FILE *fp = stdout;
+	int i;
+
+	if (!debug && (fp = fopen(logfile, "a")) == NULL)
+	{
+		return;
+	}
+	for (i = 0; i < MAX_DISKS; i++)
+	{
+		DISKSTATS *ds = ds_table[i];
+
+		if (ds == NULL)
+		{
+			continue;
+		}
+		/* latency is measured by pre-spins, estimated otherwise */
+		fprintf(fp,
+			"disk: %s, spindowns: %u, spinups: %u, early spinups: %u, pre-spins: %u, "
+			"spinup time: %ld ms%s, total spinup latency: %lld ms\n",
+			ds->name, ds->spindowns, ds->spinups, ds->early_spinups, ds->prespins,
+			ds->spinup_ms ? ds->spinup_ms : SPINUP_ESTIMATE_MS, ds->spinup_ms ? "" : " (estimated)",
+			ds->stall_ms);
+	}
+	if (fp != stdout)
+	{
+		fclose(fp);
+	}
+	else
+	{
+		fflush(fp);
+	}
+}
+
+static void metrics_signal(int sig)
+{
+	metrics_requested = 1;
+}
+
 /* Resolve disk names specified as "/dev/disk/by-xxx" or some other symlink.
  * Please note that this function is only called during command line parsing
  * and hd-idle per se does not support dynamic disk additions or removals at
@@ -0,0 +1,174 @@
+/*
+ * demux packet pool benchmark
+ *
+ * Replays a synthetic demuxer packet stream (a 25 frame GOP of video
+ * frames with interleaved audio blocks split into laces) through
+ * new_demux_packet/clone_demux_packet/free_demux_packet, with a queue of
+ * packets in flight like the player keeps between demuxer and output.
+ * The same stream is replayed with a malloc() per packet and payload,
+ * as the packets were allocated before the pool, for comparison.
+ * The pool hit rate is printed by demux_packet_pool_stats().
+ *
+ * usage: pool_bench [frames] [queued packets]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "../container/stream.h"
+#include "../container/demuxer.h"
+
+#define AUDIO_LACES 4
+
+// demuxer.c stubs
+int correct_pts = 0;
+
+int stream_fill_buffer(stream_t *s)
+{
+	return 0;
+}
+
+static unsigned int seed = 1;
+
+static int rnd(int range)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 8) % range;
+}
+
+static long long now_us(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// packet sizes of the stream, negative sizes are laced audio blocks
+static int *make_trace(int frames, int *count)
+{
+	int *trace = malloc(frames * 3 * sizeof(int));
+	int i, n = 0;
+
+	for (i = 0; i < frames; i++)
+	{
+		if (i % 25 == 0)
+			trace[n++] = 80000 + rnd(80000);
+		else
+			trace[n++] = 8000 + rnd(40000);
+		trace[n++] = -(AUDIO_LACES * (384 + rnd(256)));
+		if (i & 1)
+			trace[n++] = -(AUDIO_LACES * (384 + rnd(256)));
+	}
+	*count = n;
+	return trace;
+}
+
+// before the pool: one malloc() for the struct and one for the payload
+static demux_packet_t *malloc_packet(int len)
+{
+	demux_packet_t *dp = (demux_packet_t *)malloc(sizeof(demux_packet_t));
+	memset(dp, 0, sizeof(demux_packet_t));
+	dp->len = len;
+	dp->buffer = (unsigned char *)malloc(len + MP_INPUT_BUFFER_PADDING_SIZE);
+	memset(dp->buffer + len, 0, MP_INPUT_BUFFER_PADDING_SIZE);
+	return dp;
+}
+
+static void malloc_free(demux_packet_t *dp)
+{
+	free(dp->buffer);
+	free(dp);
+}
+
+static long long run(const int *trace, int count, int depth, int pooled)
+{
+	demux_packet_t **queue = calloc(depth, sizeof(demux_packet_t *));
+	long long start = now_us();
+	int head = 0;
+	int i, l;
+
+	for (i = 0; i < count; i++)
+	{
+		int size = trace[i] < 0 ? -trace[i] : trace[i];
+		int laces = trace[i] < 0 ? AUDIO_LACES : 1;
+		demux_packet_t *block = pooled ? new_demux_packet(size) : malloc_packet(size);
+
+		memset(block->buffer, i, size);
+		for (l = 0; l < laces; l++)
+		{
+			demux_packet_t *dp = block;
+			if (laces > 1)
+			{
+				// the old matroska code copied every lace into its own packet
+				if (pooled)
+					dp = clone_demux_packet(block, l * (size / laces), size / laces);
+				else
+				{
+					dp = malloc_packet(size / laces);
+					memcpy(dp->buffer, block->buffer + l * (size / laces), size / laces);
+				}
+			}
+			if (queue[head])
+			{
+				if (pooled)
+					free_demux_packet(queue[head]);
+				else
+					malloc_free(queue[head]);
+			}
+			queue[head] = dp;
+			head = (head + 1) % depth;
+		}
+		if (laces > 1)
+		{
+			if (pooled)
+				free_demux_packet(block);
+			else
+				malloc_free(block);
+		}
+	}
+
+	for (i = 0; i < depth; i++)
+	{
+		if (queue[i])
+		{
+			if (pooled)
+				free_demux_packet(queue[i]);
+			else
+				malloc_free(queue[i]);
+		}
+	}
+	free(queue);
+	return now_us() - start;
+}
+
+int main(int argc, char *argv[])
+{
+	int frames = argc > 1 ? atoi(argv[1]) : 100000;
+	int depth = argc > 2 ? atoi(argv[2]) : 64;
+	int count = 0;
+	int *trace = NULL;
+	long long us;
+
+	if (frames < 1 || depth < 1)
+		return 1;
+
+	trace = make_trace(frames, &count);
+	printf("%d frames, %d blocks, %d packets queued\n", frames, count, depth);
+
+	us = run(trace, count, depth, 0);
+	printf("malloc %8.3f s %10.0f blocks/s\n", us / 1000000.0, count * 1000000.0 / us);
+	us = run(trace, count, depth, 1);
+	printf("pool   %8.3f s %10.0f blocks/s\n", us / 1000000.0, count * 1000000.0 / us);
+	demux_packet_pool_stats();
+
+	free(trace);
+	return 0;
+}
@@ -10,6 +10,7 @@
 #include <string.h>
 
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/poll.h>
@@ -1398,6 +1399,7 @@ int AviInit(Context_t *context, char *filename)
 #endif
 
 	demuxer->stream->fd = context->playback->fd;
+	demuxer->stream->buffer = demuxer->stream->buf_data;
 
 	read(demuxer->stream->fd, demuxer->stream->buffer, 2048); //soviel ??
 
@@ -1453,26 +1455,37 @@ int AviInit(Context_t *context, char *filename)
 			demuxer->video->id = -1;
 			//demuxer->video_play = 0;
 			demuxer->stream->start_pos	= 0;
+			demuxer->stream->flags		= 6;
+			demuxer->stream->sector_size	= 0;
+			demuxer->stream->eof		= 0;
+			demuxer->stream->cache_pid	= 0;
 
 			if (context->playback->isFile)
 			{
+				// buffer may point into the read-only file mapping, let the stream refill it
 				demuxer->stream->type		= STREAMTYPE_FILE;
-				lseek(demuxer->stream->fd, 0L, SEEK_SET);
+				demuxer->stream->buf_pos	= 0;
+				demuxer->stream->buf_len	= 0;
+				demuxer->stream->pos		= 0;
+				stream_seek(demuxer->stream, 0);
 			}
 			else
 			{
 				demuxer->stream->type		= STREAMTYPE_STREAM;
-			}
+				if (demuxer->stream->map)
+				{
+					munmap(demuxer->stream->map, demuxer->stream->map_len);
+					demuxer->stream->map		= NULL;
+					demuxer->stream->map_pos	= 0;
+					demuxer->stream->map_len	= 0;
+				}
+				demuxer->stream->buffer		= demuxer->stream->buf_data;
 
-			read(demuxer->stream->fd, demuxer->stream->buffer, 2048); //soviel ??
-			demuxer->stream->flags		= 6;
-			demuxer->stream->sector_size	= 0;
-			demuxer->stream->buf_pos	= 0;
-			demuxer->stream->buf_len	= 2048;
-			demuxer->stream->pos		= 2048;
-			demuxer->stream->start_pos	= 0;
-			demuxer->stream->eof		= 0;
-			demuxer->stream->cache_pid	= 0;
+				read(demuxer->stream->fd, demuxer->stream->buffer, 2048); //soviel ??
+				demuxer->stream->buf_pos	= 0;
+				demuxer->stream->buf_len	= 2048;
+				demuxer->stream->pos		= 2048;
+			}
 			demux_open_hack_avi(demuxer);
 
 #ifdef DEBUG
@@ -1876,7 +1889,8 @@ static int AviStop(Context_t *context)
 		{
 			demux_close_avi(demuxer);
 
-			free(demuxer->stream);
+			demux_packet_pool_stats();
+			free_stream(demuxer->stream);
 			demuxer->stream = NULL;
 
 			free(demuxer->sub);
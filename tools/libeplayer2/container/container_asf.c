@@ -60,6 +60,7 @@ int ASFInit(Context_t *context, char *filename)
 	memset(ds->demuxer->stream, 0, sizeof(stream_t));
 
 	ds->demuxer->stream->fd = context->playback->fd;
+	ds->demuxer->stream->buffer = ds->demuxer->stream->buf_data;
 
 	read(ds->demuxer->stream->fd, ds->demuxer->stream->buffer, 2048);
 
@@ -466,7 +467,8 @@ static int ASFStop(Context_t *context)
 		{
 			demux_close_asf(ds->demuxer);
 
-			free(ds->demuxer->stream);
+			demux_packet_pool_stats();
+			free_stream(ds->demuxer->stream);
 			ds->demuxer->stream = NULL;
 
 			free(ds->demuxer->sub);
@@ -893,6 +893,7 @@ int AUDIOInit(Context_t *context, char *filename)
 	memset(ds->demuxer->stream, 0, sizeof(stream_t));
 
 	ds->demuxer->stream->fd = context->playback->fd;
+	ds->demuxer->stream->buffer = ds->demuxer->stream->buf_data;
 
 	read(ds->demuxer->stream->fd, ds->demuxer->stream->buffer, 2048); //soviel ??
 
@@ -1170,7 +1171,8 @@ static int AUDIOStop(Context_t *context)
 			{
 				demux_close_audio(ds->demuxer);
 
-				free(ds->demuxer->stream);
+				demux_packet_pool_stats();
+				free_stream(ds->demuxer->stream);
 				ds->demuxer->stream = NULL;
 
 				free(ds->demuxer->audio);
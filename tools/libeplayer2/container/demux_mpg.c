@@ -1541,6 +1541,7 @@ int MpgInit(Context_t *context, char *filename)
 #endif
 
 	demuxer->stream->fd = context->playback->fd;
+	demuxer->stream->buffer = demuxer->stream->buf_data;
 
 	read(demuxer->stream->fd, demuxer->stream->buffer, 2048); //soviel ??
 
@@ -2020,7 +2021,8 @@ static int MpgStop(Context_t *context)
 
 		demux_close_mpg(demuxer);
 
-		free(demuxer->stream);
+		demux_packet_pool_stats();
+		free_stream(demuxer->stream);
 		demuxer->stream = NULL;
 
 		free(demuxer->sub);
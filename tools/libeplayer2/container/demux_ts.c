@@ -4,6 +4,7 @@
 #include <pthread.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 //#include "../config.h"
 
@@ -31,6 +32,11 @@ int debugts = 1;
 #define MAX_HEADER_SIZE 6			/* enough for PES header + length */
 #define MAX_CHECK_SIZE	65535
 #define TS_MAX_PROBE_SIZE 2000000 /* do not forget to change this in cfg-common-opts.h, too */
+
+#define TS_SEEK_PROBE_SIZE (64 * 1024)		/* bytes read per bisection step */
+#define TS_SEEK_MAX_STEPS 40
+#define TS_SEEK_RAP_SCAN (4 * 1024 * 1024)	/* look that far for a video random access point */
+#define TS_CLOCK_MASK ((1LL << 33) - 1)		/* pcr base and pts are 33 bit */
 #define NUM_CONSECUTIVE_TS_PACKETS 32
 #define NUM_CONSECUTIVE_AUDIO_PACKETS 348
 #define MAX_A52_FRAME_SIZE 3840
@@ -239,6 +245,7 @@ typedef struct
 	int keep_broken;
 	int last_aid;
 	int last_vid;
+	int vpid;	//pid of the video stream, -1 if none
 	char packet[TS_FEC_PACKET_SIZE];
 	TS_stream_info vstr, astr;
 } ts_priv_t;
@@ -1180,8 +1187,10 @@ static demuxer_t *demux_open_ts(demuxer_t *demuxer)
 	demuxer->sub->id = params.spid;
 	priv->prog = params.prog;
 
+	priv->vpid = -1;
 	if (params.vtype != UNKNOWN)
 	{
+		priv->vpid = params.vpid;
 		ts_add_stream(demuxer, priv->ts.pids[params.vpid]);
 		sh_video = priv->ts.streams[params.vpid].sh;
 		demuxer->video->id = priv->ts.streams[params.vpid].id;
@@ -3712,6 +3721,224 @@ static void reset_fifos(demuxer_t *demuxer, int a, int v, int s)
 
 static int whileSeeking = 0;
 
+// offset of the first packet start in buf, -1 if there are not three packets in a row
+static int ts_seek_sync(const uint8_t *buf, int len, int packet_size)
+{
+	int i;
+
+	for (i = 0; i + 2 * packet_size < len; i++)
+		if (buf[i] == 0x47 && buf[i + packet_size] == 0x47 && buf[i + 2 * packet_size] == 0x47)
+			return i;
+	return -1;
+}
+
+// 90kHz clock of a packet: pcr base on the pcr pid, pts of a pes start on the video pid otherwise
+static int ts_seek_clock(const uint8_t *p, int pcr_pid, int vpid, int64_t *clock)
+{
+	int pid = ((p[1] & 0x1F) << 8) | p[2];
+	int afc = (p[3] >> 4) & 3;
+	int payload = 4;
+
+	if (afc & 2)
+	{
+		int alen = p[4];
+		if (alen > 183)
+			return 0;
+		if (pcr_pid >= 0)
+		{
+			if (pid != pcr_pid || alen < 7 || !(p[5] & 0x10))
+				return 0;
+			*clock = ((int64_t)p[6] << 25) | (p[7] << 17) | (p[8] << 9) | (p[9] << 1) | (p[10] >> 7);
+			return 1;
+		}
+		payload += 1 + alen;
+	}
+	else if (pcr_pid >= 0)
+		return 0;
+
+	if (pid != vpid || !(p[1] & 0x40) || !(afc & 1) || payload + 14 > TS_PACKET_SIZE)
+		return 0;
+	p += payload;
+	if (p[0] || p[1] || p[2] != 1 || !(p[7] & 0x80))
+		return 0;
+	*clock = ((int64_t)(p[9] & 0x0E) << 29) | (p[10] << 22) | ((p[11] & 0xFE) << 14) | (p[12] << 7) | (p[13] >> 1);
+	return 1;
+}
+
+// first packet of the video stream at which the decoder can start
+static int ts_seek_is_rap(const uint8_t *p, int vpid, unsigned int format)
+{
+	int pid = ((p[1] & 0x1F) << 8) | p[2];
+	int afc = (p[3] >> 4) & 3;
+	int i, payload = 4;
+
+	if (pid != vpid || !(p[1] & 0x40) || !(afc & 1))
+		return 0;
+	if (afc & 2)
+	{
+		if (p[4] > 182)
+			return 0;
+		if (p[4] > 0 && (p[5] & 0x40)) // random_access_indicator
+			return 1;
+		payload += 1 + p[4];
+	}
+	if (payload + 9 > TS_PACKET_SIZE || p[payload] || p[payload + 1] || p[payload + 2] != 1)
+		return 0;
+
+	// not every broadcaster sets the indicator, so look at the start codes of the es
+	for (i = payload + 9 + p[payload + 8]; i + 3 < TS_PACKET_SIZE; i++)
+	{
+		if (p[i] || p[i + 1] || p[i + 2] != 1)
+			continue;
+		switch (format)
+		{
+			case VIDEO_MPEG1:
+			case VIDEO_MPEG2:
+				if (p[i + 3] == 0xB3 || p[i + 3] == 0xB8)
+					return 1;
+				break;
+			case VIDEO_MPEG4:
+				if (p[i + 3] == 0xB0 || p[i + 3] == 0xB3)
+					return 1;
+				break;
+			case VIDEO_VC1:
+				if (p[i + 3] == 0x0E || p[i + 3] == 0x0F)
+					return 1;
+				break;
+			default: // H264
+				if ((p[i + 3] & 0x1F) == 5 || (p[i + 3] & 0x1F) == 7)
+					return 1;
+				break;
+		}
+	}
+	return 0;
+}
+
+// read from pos and return the clock of the first timestamped packet, -1 if there is none
+static int64_t ts_seek_probe(demuxer_t *demuxer, uint8_t *buf, off_t pos, int pcr_pid, off_t *found)
+{
+	ts_priv_t *priv = (ts_priv_t *) demuxer->priv;
+	int len, i;
+	int64_t clock;
+
+	demuxer->stream->eof = 0;
+	if (!stream_seek(demuxer->stream, pos))
+		return -1;
+	len = stream_read(demuxer->stream, buf, TS_SEEK_PROBE_SIZE);
+	i = ts_seek_sync(buf, len, priv->ts.packet_size);
+	if (i < 0)
+		return -1;
+	for (; i + TS_PACKET_SIZE <= len; i += priv->ts.packet_size)
+	{
+		if (buf[i] != 0x47)
+			return -1;
+		if (ts_seek_clock(buf + i, pcr_pid, priv->vpid, &clock))
+		{
+			if (found)
+				*found = pos + i;
+			return clock;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Bisect the file for the position whose clock (pcr, or video pts without
+ * pmt) is just below the target, then move on to the next video random
+ * access point. Returns -1 if the file has no usable timestamps.
+ */
+static off_t ts_seek_bisect(demuxer_t *demuxer, float rel_seek_secs, int flags)
+{
+	ts_priv_t *priv = (ts_priv_t *) demuxer->priv;
+	sh_video_t *sh_video = demuxer->video->sh;
+	int pcr_pid = prog_pcr_pid(priv, priv->prog);
+	int64_t first, clock, target;
+	off_t lo, hi, mid, pos, end;
+	struct stat st;
+	uint8_t *buf;
+	int steps, len, i;
+
+	if (demuxer->stream->type != STREAMTYPE_FILE || fstat(demuxer->stream->fd, &st) < 0 || st.st_size <= demuxer->movi_start)
+		return -1;
+	if (pcr_pid >= NB_PID_MAX - 1) // 0x1FFF, no pcr
+		pcr_pid = -1;
+	if (pcr_pid < 0 && priv->vpid < 0)
+		return -1;
+
+	buf = malloc(TS_SEEK_PROBE_SIZE);
+	if (buf == NULL)
+		return -1;
+
+	first = ts_seek_probe(demuxer, buf, demuxer->movi_start, pcr_pid, NULL);
+	if (first < 0)
+	{
+		free(buf);
+		return -1;
+	}
+	if (flags & SEEK_ABSOLUTE)
+		target = rel_seek_secs * 90000;
+	else
+	{
+		clock = ts_seek_probe(demuxer, buf, demuxer->filepos, pcr_pid, NULL);
+		if (clock < 0)
+		{
+			free(buf);
+			return -1;
+		}
+		target = ((clock - first) & TS_CLOCK_MASK) + (int64_t)(rel_seek_secs * 90000);
+	}
+
+	lo = demuxer->movi_start;
+	hi = st.st_size;
+	for (steps = 0; target > 0 && hi - lo > TS_SEEK_PROBE_SIZE && steps < TS_SEEK_MAX_STEPS; steps++)
+	{
+		mid = lo + (hi - lo) / 2;
+		clock = ts_seek_probe(demuxer, buf, mid, pcr_pid, &pos);
+		if (clock < 0 || pos >= hi)
+		{
+			hi = mid; // no timestamp in this part of the file, e.g. the end
+			continue;
+		}
+		if (((clock - first) & TS_CLOCK_MASK) < target)
+			lo = pos;
+		else
+			hi = mid;
+	}
+#ifdef DEBUG
+	demux_ts_printf("seek bisect: target %"PRId64" -> pos %"PRIu64" in %d steps\n", target, (uint64_t) lo, steps);
+#endif
+
+	// start decoding at a random access point of the video
+	pos = lo;
+	if (sh_video != NULL && priv->vpid >= 0)
+	{
+		for (end = lo + TS_SEEK_RAP_SCAN; pos < end; pos += len - 2 * priv->ts.packet_size)
+		{
+			demuxer->stream->eof = 0;
+			if (!stream_seek(demuxer->stream, pos))
+				break;
+			len = stream_read(demuxer->stream, buf, TS_SEEK_PROBE_SIZE);
+			i = ts_seek_sync(buf, len, priv->ts.packet_size);
+			if (i < 0)
+				break;
+			for (; i + TS_PACKET_SIZE <= len; i += priv->ts.packet_size)
+				if (buf[i] == 0x47 && ts_seek_is_rap(buf + i, priv->vpid, sh_video->format))
+					break;
+			if (i + TS_PACKET_SIZE <= len)
+			{
+				lo = pos + i;
+				break;
+			}
+			if (len < TS_SEEK_PROBE_SIZE)
+				break;
+		}
+	}
+
+	free(buf);
+	demuxer->stream->eof = 0;
+	return lo;
+}
+
 static void demux_seek_ts(demuxer_t *demuxer, float rel_seek_secs, float audio_delay, int flags)
 {
 	demux_stream_t *d_audio = demuxer->audio;
@@ -3720,7 +3947,7 @@ static void demux_seek_ts(demuxer_t *demuxer, float rel_seek_secs, float audio_d
 	sh_video_t *sh_video = d_video->sh;
 	ts_priv_t *priv = (ts_priv_t *) demuxer->priv;
 	int i, video_stats;
-	off_t newpos;
+	off_t newpos, pos;
 
 	//================= seek in MPEG-TS ==========================
 
@@ -3752,6 +3979,8 @@ static void demux_seek_ts(demuxer_t *demuxer, float rel_seek_secs, float audio_d
 	newpos = (flags & SEEK_ABSOLUTE) ? demuxer->movi_start : demuxer->filepos;
 	if (flags & SEEK_FACTOR) // float seek 0..1
 		newpos += (demuxer->movi_end - demuxer->movi_start) * rel_seek_secs;
+	else if ((pos = ts_seek_bisect(demuxer, rel_seek_secs, flags)) >= 0)
+		newpos = pos;
 	else
 	{
 		// time seek (secs)
@@ -4072,6 +4301,7 @@ int TSInit(Context_t *context, char *filename)
 #endif
 
 	demuxer->stream->fd = context->playback->fd;
+	demuxer->stream->buffer = demuxer->stream->buf_data;
 
 	//read(demuxer->stream->fd,demuxer->stream->buffer,2048);//soviel ??
 
@@ -4600,7 +4830,8 @@ static int TSStop(Context_t *context)
 		{
 			demux_close_ts(demuxer);
 
-			free(demuxer->stream);
+			demux_packet_pool_stats();
+			free_stream(demuxer->stream);
 			demuxer->stream = NULL;
 
 			free(demuxer->sub);
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -379,6 +380,228 @@ int demux_info_add(demuxer_t *demuxer, const char *opt, const char *param)
 	return 1;
 }
 
+/*
+ * Packet pool: payloads come in size classes of 256 bytes times powers of
+ * four, freed buffers and packet structs are kept on free lists and reused
+ * by the next packet of the class. Bigger payloads are plain malloc()s.
+ */
+#define DP_POOL_CLASSES 7	// 256 bytes .. 1 MB
+#define DP_POOL_MIN_SHIFT 8
+#define DP_POOL_KEEP_PACKETS 256
+
+static const int dp_pool_keep[DP_POOL_CLASSES] = { 64, 64, 64, 32, 16, 8, 4 };
+
+typedef struct dp_pool_item
+{
+	struct dp_pool_item *next;
+} dp_pool_item_t;
+
+static struct
+{
+	pthread_mutex_t mutex;
+	dp_pool_item_t *buffers[DP_POOL_CLASSES];
+	int num_buffers[DP_POOL_CLASSES];
+	dp_pool_item_t *packets;
+	int num_packets;
+	unsigned int hits, misses, large, clones;
+} dp_pool = { PTHREAD_MUTEX_INITIALIZER };
+
+static inline int dp_pool_size(int pool_class)
+{
+	return 1 << (DP_POOL_MIN_SHIFT + 2 * pool_class);
+}
+
+static demux_packet_t *dp_pool_get_packet(void)
+{
+	demux_packet_t *dp;
+
+	pthread_mutex_lock(&dp_pool.mutex);
+	dp = (demux_packet_t *)dp_pool.packets;
+	if (dp)
+	{
+		dp_pool.packets = dp_pool.packets->next;
+		dp_pool.num_packets--;
+	}
+	pthread_mutex_unlock(&dp_pool.mutex);
+
+	return dp ? dp : (demux_packet_t *)malloc(sizeof(demux_packet_t));
+}
+
+static void dp_pool_put_packet(demux_packet_t *dp)
+{
+	pthread_mutex_lock(&dp_pool.mutex);
+	if (dp_pool.num_packets < DP_POOL_KEEP_PACKETS)
+	{
+		((dp_pool_item_t *)dp)->next = dp_pool.packets;
+		dp_pool.packets = (dp_pool_item_t *)dp;
+		dp_pool.num_packets++;
+		dp = NULL;
+	}
+	pthread_mutex_unlock(&dp_pool.mutex);
+
+	free(dp);
+}
+
+// buffer of at least size bytes
+static unsigned char *dp_pool_get_buffer(int size, int *pool_class)
+{
+	dp_pool_item_t *item = NULL;
+	int c = 0;
+
+	while (c < DP_POOL_CLASSES && dp_pool_size(c) < size)
+		c++;
+
+	pthread_mutex_lock(&dp_pool.mutex);
+	if (c == DP_POOL_CLASSES)
+		dp_pool.large++;
+	else if ((item = dp_pool.buffers[c]) != NULL)
+	{
+		dp_pool.buffers[c] = item->next;
+		dp_pool.num_buffers[c]--;
+		dp_pool.hits++;
+	}
+	else
+		dp_pool.misses++;
+	pthread_mutex_unlock(&dp_pool.mutex);
+
+	if (c == DP_POOL_CLASSES)
+	{
+		*pool_class = -1;
+		return (unsigned char *)malloc(size);
+	}
+	*pool_class = c;
+	return item ? (unsigned char *)item : (unsigned char *)malloc(dp_pool_size(c));
+}
+
+static void dp_pool_put_buffer(unsigned char *buffer, int pool_class)
+{
+	if (buffer == NULL)
+		return;
+
+	if (pool_class >= 0)
+	{
+		pthread_mutex_lock(&dp_pool.mutex);
+		if (dp_pool.num_buffers[pool_class] < dp_pool_keep[pool_class])
+		{
+			((dp_pool_item_t *)buffer)->next = dp_pool.buffers[pool_class];
+			dp_pool.buffers[pool_class] = (dp_pool_item_t *)buffer;
+			dp_pool.num_buffers[pool_class]++;
+			buffer = NULL;
+		}
+		pthread_mutex_unlock(&dp_pool.mutex);
+	}
+
+	free(buffer);
+}
+
+demux_packet_t *new_demux_packet(int len)
+{
+	demux_packet_t *dp = dp_pool_get_packet();
+	dp->len = len;
+	dp->next = NULL;
+	// still using 0 by default in case there is some code that uses 0 for both
+	// unknown and a valid pts value
+	dp->pts = correct_pts ? MP_NOPTS_VALUE : 0;
+	dp->endpts = MP_NOPTS_VALUE;
+	dp->stream_pts = MP_NOPTS_VALUE;
+	dp->pos = 0;
+	dp->flags = 0;
+	dp->refcount = 1;
+	dp->pool_class = -1;
+	dp->master = NULL;
+	dp->buffer = NULL;
+	if (len > 0 && (dp->buffer = dp_pool_get_buffer(len + MP_INPUT_BUFFER_PADDING_SIZE, &dp->pool_class)))
+		memset(dp->buffer + len, 0, MP_INPUT_BUFFER_PADDING_SIZE);
+	else
+		dp->len = 0;
+	return dp;
+}
+
+// a packet sharing len bytes at offset of the payload of pack, no data is copied
+demux_packet_t *clone_demux_packet(demux_packet_t *pack, int offset, int len)
+{
+	demux_packet_t *dp = dp_pool_get_packet();
+	dp->buffer = pack->buffer + offset;
+	dp->len = len;
+	dp->next = NULL;
+	dp->pts = correct_pts ? MP_NOPTS_VALUE : 0;
+	dp->endpts = MP_NOPTS_VALUE;
+	dp->stream_pts = MP_NOPTS_VALUE;
+	dp->pos = 0;
+	dp->flags = 0;
+	dp->refcount = 1;
+	dp->pool_class = -1;
+	dp->master = pack->master ? pack->master : pack;
+
+	// packets may be released by another thread than the demuxer
+	pthread_mutex_lock(&dp_pool.mutex);
+	dp->master->refcount++;
+	dp_pool.clones++;
+	pthread_mutex_unlock(&dp_pool.mutex);
+	return dp;
+}
+
+void resize_demux_packet(demux_packet_t *dp, int len)
+{
+	if (len <= 0)
+	{
+		dp_pool_put_buffer(dp->buffer, dp->pool_class);
+		dp->buffer = NULL;
+	}
+	else if (dp->buffer == NULL || dp->pool_class < 0 || len + MP_INPUT_BUFFER_PADDING_SIZE > dp_pool_size(dp->pool_class))
+	{
+		// shrinking mostly stays within the class, only growing needs a new buffer
+		int pool_class;
+		unsigned char *buffer = dp_pool_get_buffer(len + MP_INPUT_BUFFER_PADDING_SIZE, &pool_class);
+		if (buffer && dp->buffer)
+			memcpy(buffer, dp->buffer, dp->len < len ? dp->len : len);
+		dp_pool_put_buffer(dp->buffer, dp->pool_class);
+		dp->buffer = buffer;
+		dp->pool_class = pool_class;
+	}
+	dp->len = len;
+	if (dp->buffer)
+		memset(dp->buffer + len, 0, MP_INPUT_BUFFER_PADDING_SIZE);
+	else
+		dp->len = 0;
+}
+
+void free_demux_packet(demux_packet_t *dp)
+{
+	if (dp != NULL)
+	{
+		if (dp->master == NULL)  //dp is a master packet
+		{
+			int refcount;
+			pthread_mutex_lock(&dp_pool.mutex);
+			refcount = --dp->refcount;
+			pthread_mutex_unlock(&dp_pool.mutex);
+			if (refcount == 0)
+			{
+				dp_pool_put_buffer(dp->buffer, dp->pool_class);
+				dp->buffer = NULL;
+				dp_pool_put_packet(dp);
+			}
+		}
+		else     // dp is a clone
+		{
+			free_demux_packet(dp->master);
+			dp_pool_put_packet(dp);
+		}
+	}
+}
+
+void demux_packet_pool_stats(void)
+{
+	unsigned int total;
+
+	pthread_mutex_lock(&dp_pool.mutex);
+	total = dp_pool.hits + dp_pool.misses;
+	demuxer_printf("%s: packet pool hits %u misses %u (%u%%), large %u, clones %u\n", FILENAME,
+		       dp_pool.hits, dp_pool.misses, total ? dp_pool.hits * 100 / total : 0, dp_pool.large, dp_pool.clones);
+	pthread_mutex_unlock(&dp_pool.mutex);
+}
+
 void ds_read_packet(demux_stream_t *ds, stream_t *stream, int len, double pts, off_t pos, int flags)
 {
 	demux_packet_t *dp = new_demux_packet(len);
@@ -409,9 +632,7 @@ void ds_free_packs(demux_stream_t *ds)
 		if (ds->asf_packet)
 		{
 			// free unfinished .asf fragments:
-			free(ds->asf_packet->buffer);
-			ds->asf_packet->buffer = NULL;
-			free(ds->asf_packet);
+			free_demux_packet(ds->asf_packet);
 			ds->asf_packet = NULL;
 		}
 
@@ -76,6 +76,7 @@ typedef struct demux_packet_st
 	unsigned char *buffer;
 	int flags; // keyframe, etc
 	int refcount;   //refcounter for the master packet, if 0, buffer can be free()d
+	int pool_class; //size class of the pooled buffer, -1 for a plain malloc()ed buffer
 	struct demux_packet_st *master; //pointer to the master packet if this one is a cloned one
 	struct demux_packet_st *next;
 } demux_packet_t;
@@ -187,70 +188,6 @@ typedef struct
 	int aid, vid, sid; //audio, video and subtitle id
 } demux_program_t;
 
-static inline demux_packet_t *new_demux_packet(int len)
-{
-	demux_packet_t *dp = (demux_packet_t *)malloc(sizeof(demux_packet_t));
-	dp->len = len;
-	dp->next = NULL;
-	// still using 0 by default in case there is some code that uses 0 for both
-	// unknown and a valid pts value
-	dp->pts = correct_pts ? MP_NOPTS_VALUE : 0;
-	dp->endpts = MP_NOPTS_VALUE;
-	dp->stream_pts = MP_NOPTS_VALUE;
-	dp->pos = 0;
-	dp->flags = 0;
-	dp->refcount = 1;
-	dp->master = NULL;
-	dp->buffer = NULL;
-	if (len > 0 && (dp->buffer = (unsigned char *)malloc(len + 8)))
-		memset(dp->buffer + len, 0, 8);
-	else
-		dp->len = 0;
-	return dp;
-}
-
-static inline void resize_demux_packet(demux_packet_t *dp, int len)
-{
-	if (len > 0)
-	{
-		dp->buffer = (unsigned char *)realloc(dp->buffer, len + 8);
-	}
-	else
-	{
-		free(dp->buffer);
-		dp->buffer = NULL;
-	}
-	dp->len = len;
-	if (dp->buffer)
-		memset(dp->buffer + len, 0, 8);
-	else
-		dp->len = 0;
-}
-
-static inline void free_demux_packet(demux_packet_t *dp)
-{
-	if (dp != NULL)
-	{
-		if (dp->master == NULL)  //dp is a master packet
-		{
-			dp->refcount--;
-			if (dp->refcount == 0)
-			{
-				free(dp->buffer);
-				dp->buffer = NULL;
-				free(dp);
-				dp = NULL;
-			}
-		}
-		else     // dp is a clone
-		{
-			free_demux_packet(dp->master);
-			free(dp);
-			dp = NULL;
-		}
-	}
-}
-
 static inline int avi_stream_id(unsigned int id)
 {
 	unsigned char *p = (unsigned char *)&id;
@@ -316,6 +253,11 @@ int ds_fill_buffer2(demux_stream_t *ds, demux_stream_t *demuxer); //for avi and
 int demux_read_data(demux_stream_t *ds, unsigned char *mem, int len);
 int demuxer_add_chapter(demuxer_t *demuxer, const char *name, uint64_t start, uint64_t end);
 int demuxer_sub_track_by_lang(demuxer_t *d, char *lang);
+demux_packet_t *new_demux_packet(int len);
+demux_packet_t *clone_demux_packet(demux_packet_t *pack, int offset, int len);
+void resize_demux_packet(demux_packet_t *dp, int len);
+void free_demux_packet(demux_packet_t *dp);
+void demux_packet_pool_stats(void);
 void ds_read_packet(demux_stream_t *ds, stream_t *stream, int len, double pts, off_t pos, int flags);
 void ds_free_packs(demux_stream_t *ds);
 int demux_info_add(demuxer_t *demuxer, const char *opt, const char *param);
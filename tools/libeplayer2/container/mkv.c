@@ -7,6 +7,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -528,16 +529,25 @@ typedef struct mkv_demuxer
 	uint64_t cluster_size;
 	uint64_t blockgroup_size;
 
-	mkv_index_t *indexes;
-	int num_indexes;
+	mkv_index_t *indexes;	// sorted by track and timecode once indexes_sorted is set
+	int num_indexes, max_indexes;
+	int indexes_sorted;
+	int index_complete;	// cues were read or the cluster scan reached the end
 
 	off_t *parsed_cues;
 	int parsed_cues_num;
 	off_t *parsed_seekhead;
 	int parsed_seekhead_num;
 
-	uint64_t *cluster_positions;
-	int num_cluster_pos;
+	uint64_t *cluster_positions;	// sorted
+	int num_cluster_pos, max_cluster_pos;
+
+	// indexes and cluster_positions are also filled by the cluster scan thread
+	pthread_mutex_t index_mutex;
+	pthread_t scan_thread;
+	int scan_started;
+	volatile int scan_abort;
+	uint64_t scan_start;
 
 	int64_t skip_to_timecode;
 	int v_skip_to_keyframe, a_skip_to_keyframe;
@@ -610,6 +620,51 @@ demux_mkv_find_track_by_language(mkv_demuxer_t *d, char *language, int type)
 	return NULL;
 }
 
+/* like grow_array, but doubles the allocation for the big index arrays */
+static void grow_array_double(void **array, int nelem, int *max, size_t elsize)
+{
+	if (nelem < *max)
+		return;
+	*max = *max ? *max * 2 : 256;
+	*array = realloc(*array, *max * elsize);
+}
+
+/* first cluster position >= position */
+static int
+find_cluster_position(mkv_demuxer_t *mkv_d, uint64_t position)
+{
+	int lo = 0, hi = mkv_d->num_cluster_pos;
+
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (mkv_d->cluster_positions[mid] < position)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void
+add_cluster_position_locked(mkv_demuxer_t *mkv_d, uint64_t position)
+{
+	int i = mkv_d->num_cluster_pos;
+
+	/* clusters are mostly found in file order */
+	if (i > 0 && mkv_d->cluster_positions[i - 1] >= position)
+	{
+		i = find_cluster_position(mkv_d, position);
+		if (mkv_d->cluster_positions[i] == position)
+			return;
+	}
+
+	grow_array_double((void **) &mkv_d->cluster_positions, mkv_d->num_cluster_pos, &mkv_d->max_cluster_pos, sizeof(uint64_t));
+	memmove(mkv_d->cluster_positions + i + 1, mkv_d->cluster_positions + i, (mkv_d->num_cluster_pos - i) * sizeof(uint64_t));
+	mkv_d->cluster_positions[i] = position;
+	mkv_d->num_cluster_pos++;
+}
+
 static void
 add_cluster_position(mkv_demuxer_t *mkv_d, uint64_t position)
 {
@@ -617,14 +672,98 @@ add_cluster_position(mkv_demuxer_t *mkv_d, uint64_t position)
 	dprintf("mkv.c add_cluster_position\n\n");
 #endif
 
-	int i = mkv_d->num_cluster_pos;
+	pthread_mutex_lock(&mkv_d->index_mutex);
+	add_cluster_position_locked(mkv_d, position);
+	pthread_mutex_unlock(&mkv_d->index_mutex);
+}
 
-	while (i--)
-		if (mkv_d->cluster_positions[i] == position)
-			return;
+static int
+compare_index(const void *a, const void *b)
+{
+	const mkv_index_t *x = a, *y = b;
+
+	if (x->tnum != y->tnum)
+		return x->tnum < y->tnum ? -1 : 1;
+	if (x->timecode != y->timecode)
+		return x->timecode < y->timecode ? -1 : 1;
+	return 0;
+}
+
+/* entries are appended and only sorted when the index is searched */
+static void
+add_index_locked(mkv_demuxer_t *mkv_d, int tnum, uint64_t timecode, uint64_t filepos)
+{
+	mkv_index_t *index;
+
+	grow_array_double((void **) &mkv_d->indexes, mkv_d->num_indexes, &mkv_d->max_indexes, sizeof(mkv_index_t));
+	index = mkv_d->indexes + mkv_d->num_indexes;
+	index->tnum = tnum;
+	index->timecode = timecode;
+	index->filepos = filepos;
+	if (mkv_d->num_indexes == 0)
+		mkv_d->indexes_sorted = 1;
+	else if (compare_index(index - 1, index) > 0)
+		mkv_d->indexes_sorted = 0;
+	mkv_d->num_indexes++;
+}
+
+/*
+ * Range [*first, *end) of the entries of track tnum, the cluster scan
+ * stores its entries as track 0 which matroska doesn't use.
+ * Must be called with index_mutex held.
+ */
+static void
+find_index_track(mkv_demuxer_t *mkv_d, int tnum, int *first, int *end)
+{
+	int lo, hi;
 
-	grow_array((void **) &mkv_d->cluster_positions, mkv_d->num_cluster_pos, sizeof(uint64_t));
-	mkv_d->cluster_positions[mkv_d->num_cluster_pos++] = position;
+	if (!mkv_d->indexes_sorted)
+	{
+		qsort(mkv_d->indexes, mkv_d->num_indexes, sizeof(mkv_index_t), compare_index);
+		mkv_d->indexes_sorted = 1;
+	}
+
+	for (lo = 0, hi = mkv_d->num_indexes; lo < hi;)
+	{
+		int mid = (lo + hi) / 2;
+		if (mkv_d->indexes[mid].tnum < tnum)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*first = lo;
+	for (hi = mkv_d->num_indexes; lo < hi;)
+	{
+		int mid = (lo + hi) / 2;
+		if (mkv_d->indexes[mid].tnum <= tnum)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*end = lo;
+}
+
+static int64_t
+index_time(mkv_demuxer_t *mkv_d, const mkv_index_t *index)
+{
+	return (int64_t)(index->timecode * mkv_d->tc_scale / 1000000);
+}
+
+/* last entry in [first, end) at or before time (ms), first - 1 if there is none */
+static int
+find_index_before(mkv_demuxer_t *mkv_d, int first, int end, int64_t time)
+{
+	int lo = first, hi = end;
+
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (index_time(mkv_d, mkv_d->indexes + mid) <= time)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo - 1;
 }
 
 
@@ -1891,7 +2030,7 @@ demux_mkv_read_cues(demuxer_t *demuxer, stream_t *s)
 			ebml_read_skip(s, NULL);
 			return 0;
 		}
-	mkv_d->parsed_cues = realloc(mkv_d->parsed_cues, (mkv_d->parsed_cues_num + 1) * sizeof(off_t));
+	grow_array((void **)&mkv_d->parsed_cues, mkv_d->parsed_cues_num, sizeof(off_t));
 	mkv_d->parsed_cues[mkv_d->parsed_cues_num++] = off;
 
 #ifdef DEBUG
@@ -1973,14 +2112,13 @@ demux_mkv_read_cues(demuxer_t *demuxer, stream_t *s)
 
 		if (time != EBML_UINT_INVALID && track != EBML_UINT_INVALID && pos != EBML_UINT_INVALID)
 		{
-			grow_array((void **)&mkv_d->indexes, mkv_d->num_indexes, sizeof(mkv_index_t));
-			mkv_d->indexes[mkv_d->num_indexes].tnum = track;
-			mkv_d->indexes[mkv_d->num_indexes].timecode = time;
-			mkv_d->indexes[mkv_d->num_indexes].filepos = mkv_d->segment_start + pos;
+			pthread_mutex_lock(&mkv_d->index_mutex);
+			add_index_locked(mkv_d, track, time, mkv_d->segment_start + pos);
+			mkv_d->index_complete = 1;
+			pthread_mutex_unlock(&mkv_d->index_mutex);
 #ifdef DEBUG
 			dprintf("[mkv] |+ found cue point for track %"PRIu64": timecode %"PRIu64", filepos: %"PRIu64"\n", track, time, mkv_d->segment_start + pos);
 #endif
-			mkv_d->num_indexes++;
 		}
 	}
 
@@ -1991,6 +2129,129 @@ demux_mkv_read_cues(demuxer_t *demuxer, stream_t *s)
 	return 0;
 }
 
+/*
+ * Read an element id (with marker) or size (without) from buf, returns
+ * its length or 0. An unknown size is returned as EBML_UINT_INVALID.
+ */
+static int
+scan_ebml_num(const uint8_t *buf, int avail, uint64_t *num, int is_id)
+{
+	int i, len = 1, mask = 0x80, all_ones;
+	uint64_t v;
+
+	if (avail < 1)
+		return 0;
+	while (len <= 8 && !(buf[0] & mask))
+	{
+		len++;
+		mask >>= 1;
+	}
+	if (len > (is_id ? 4 : 8) || len > avail)
+		return 0;
+
+	v = is_id ? buf[0] : (buf[0] & (mask - 1));
+	all_ones = (v == (uint64_t)(mask - 1));
+	for (i = 1; i < len; i++)
+	{
+		v = (v << 8) | buf[i];
+		all_ones &= (buf[i] == 0xFF);
+	}
+	*num = (!is_id && all_ones) ? EBML_UINT_INVALID : v;
+	return len;
+}
+
+#define MKV_SCAN_BATCH 64
+#define MKV_SCAN_THROTTLE_US 10000
+
+/*
+ * Files without cues: walk the clusters from the first one with pread, the
+ * cluster header and its timecode are enough. Found clusters go to
+ * cluster_positions and, as track 0, to the index used by demux_mkv_seek.
+ */
+static void *
+demux_mkv_scan_clusters(void *arg)
+{
+	demuxer_t *demuxer = (demuxer_t *) arg;
+	mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
+	uint64_t pos = mkv_d->scan_start, end = demuxer->stream->end_pos;
+	uint64_t batch_pos[MKV_SCAN_BATCH], batch_tc[MKV_SCAN_BATCH];
+	int batch = 0, complete = 0;
+	uint8_t buf[64];
+
+	while (!mkv_d->scan_abort)
+	{
+		uint64_t id, size, cid, csize;
+		int n, l1, l2, off;
+
+		if (pos >= end)
+		{
+			complete = 1;
+			break;
+		}
+		n = pread(demuxer->stream->fd, buf, sizeof(buf), pos);
+		l1 = scan_ebml_num(buf, n, &id, 1);
+		l2 = l1 ? scan_ebml_num(buf + l1, n - l1, &size, 0) : 0;
+		if (!l2 || size == EBML_UINT_INVALID)
+			break;	/* broken, or a live file with clusters of unknown size */
+
+		if (id == MATROSKA_ID_CLUSTER)
+		{
+			/* the timecode is one of the first children, after crc or void */
+			for (off = l1 + l2; off < n;)
+			{
+				int cl1 = scan_ebml_num(buf + off, n - off, &cid, 1);
+				int cl2 = cl1 ? scan_ebml_num(buf + off + cl1, n - off - cl1, &csize, 0) : 0;
+				if (!cl2 || csize == EBML_UINT_INVALID)
+					break;
+				off += cl1 + cl2;
+				if (cid == MATROSKA_ID_CLUSTERTIMECODE)
+				{
+					uint64_t tc = 0;
+					if (csize > 8 || off + (int)csize > n)
+						break;
+					while (csize--)
+						tc = (tc << 8) | buf[off++];
+					batch_pos[batch] = pos;
+					batch_tc[batch] = tc;
+					batch++;
+					break;
+				}
+				off += csize;
+			}
+		}
+		pos += l1 + l2 + size;
+
+		if (batch == MKV_SCAN_BATCH)
+		{
+			int i;
+			pthread_mutex_lock(&mkv_d->index_mutex);
+			for (i = 0; i < batch; i++)
+			{
+				add_cluster_position_locked(mkv_d, batch_pos[i]);
+				add_index_locked(mkv_d, 0, batch_tc[i], batch_pos[i]);
+			}
+			pthread_mutex_unlock(&mkv_d->index_mutex);
+			batch = 0;
+			usleep(MKV_SCAN_THROTTLE_US);
+		}
+	}
+
+	pthread_mutex_lock(&mkv_d->index_mutex);
+	while (batch--)
+	{
+		add_cluster_position_locked(mkv_d, batch_pos[batch]);
+		add_index_locked(mkv_d, 0, batch_tc[batch], batch_pos[batch]);
+	}
+	if (complete)
+		mkv_d->index_complete = 1;
+	pthread_mutex_unlock(&mkv_d->index_mutex);
+
+#ifdef DEBUG
+	dprintf("[mkv] cluster scan %s at %"PRIu64", %d clusters\n", complete ? "complete" : "stopped", pos, mkv_d->num_cluster_pos);
+#endif
+	return NULL;
+}
+
 static int
 demux_mkv_read_chapters(demuxer_t *demuxer, stream_t *s)
 {
@@ -3533,8 +3794,8 @@ flush_cached_dps(demuxer_t *demuxer, mkv_track_t *track/*,demux_stream_t *video*
  *   of \a block_bref. Otherwise it's a B frame.
  */
 static void
-handle_video_bframes(demuxer_t *demuxer, mkv_track_t *track, uint8_t *buffer,
-		     uint32_t size, int block_bref, int block_fref/*,demux_stream_t *audio,demux_stream_t *video,demux_stream_t *sub*/)
+handle_video_bframes(demuxer_t *demuxer, mkv_track_t *track, demux_packet_t *block_dp,
+		     uint8_t *buffer, uint32_t size, int block_bref, int block_fref/*,demux_stream_t *audio,demux_stream_t *video,demux_stream_t *sub*/)
 {
 #ifdef DEBUG
 	dprintf("mkv.c handle_video_bframes->\n");
@@ -3543,8 +3804,8 @@ handle_video_bframes(demuxer_t *demuxer, mkv_track_t *track, uint8_t *buffer,
 	mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
 	demux_packet_t *dp;
 
-	dp = new_demux_packet(size);
-	memcpy(dp->buffer, buffer, size);
+	/* the cached packet keeps a reference to the block instead of a copy */
+	dp = clone_demux_packet(block_dp, buffer - block_dp->buffer, size);
 	dp->pos = demuxer->filepos;
 	dp->pts = mkv_d->last_pts;
 	if ((track->num_cached_dps > 0) && (dp->pts < track->max_pts))
@@ -3591,7 +3852,7 @@ void Hexdump(unsigned char *Data, int length)
 }
 
 static int
-handle_block(demuxer_t *demuxer, uint8_t *block, uint64_t length,
+handle_block(demuxer_t *demuxer, demux_packet_t *block_dp, uint64_t length,
 	     uint64_t block_duration, int64_t block_bref, int64_t block_fref, uint8_t simpleblock)
 {
 
@@ -3609,6 +3870,7 @@ handle_block(demuxer_t *demuxer, uint8_t *block, uint64_t length,
 	int i, num, tmp, use_this_block = 1;
 	float current_pts;
 	int16_t time;
+	uint8_t *block = block_dp->buffer;
 
 	/* first byte(s): track num */
 	num = ebml_read_vlen_uint(block, &tmp);
@@ -3736,7 +3998,7 @@ handle_block(demuxer_t *demuxer, uint8_t *block, uint64_t length,
 			else if (ds == demuxer->audio && track->realmedia)
 				handle_realaudio(demuxer, track, block, lace_size[i], block_bref);
 			else if (ds == demuxer->video && track->reorder_timecodes)
-				handle_video_bframes(demuxer, track, block, lace_size[i],
+				handle_video_bframes(demuxer, track, block_dp, block, lace_size[i],
 						     block_bref, block_fref);
 			else
 			{
@@ -3759,13 +4021,15 @@ handle_block(demuxer_t *demuxer, uint8_t *block, uint64_t length,
 					}
 //DONALD--END----------------
 
-					dp = new_demux_packet(size);
-					memcpy(dp->buffer, buffer, size);
 					if (modified)
 					{
+						dp = new_demux_packet(size);
+						memcpy(dp->buffer, buffer, size);
 						free(buffer);
 						buffer = NULL;
 					}
+					else /* lace is used in place, no copy */
+						dp = clone_demux_packet(block_dp, buffer - block_dp->buffer, size);
 					dp->flags = (block_bref == 0 && block_fref == 0) ? 0x10 : 0;
 					/* If default_duration is 0, assume no pts value is known
 					 * for packets after the first one (rather than all pts
@@ -3860,8 +4124,9 @@ int demux_mkv_open(demuxer_t *demuxer, stream_t *s)
 	demuxer->priv = mkv_d;
 	mkv_d->tc_scale = 1000000;
 	mkv_d->segment_start = stream_tell(s);
-	mkv_d->parsed_cues = malloc(sizeof(off_t));
+	mkv_d->parsed_cues = NULL;
 	mkv_d->parsed_seekhead = malloc(sizeof(off_t));
+	pthread_mutex_init(&mkv_d->index_mutex, NULL);
 //Trick: ab hier gibt es ein problem mit dem read und dem s->buffer
 	while (!cont)
 	{
@@ -3928,6 +4193,7 @@ int demux_mkv_open(demuxer_t *demuxer, stream_t *s)
 					mkv_d->first_tc = num * mkv_d->tc_scale / 1000000.0;
 					mkv_d->has_first_tc = 1;
 				}
+				mkv_d->scan_start = p - 4;
 				stream_seek(s, p - 4);
 				cont = 1;
 				break;
@@ -4115,7 +4381,15 @@ int demux_mkv_open(demuxer_t *demuxer, stream_t *s)
 		            }*/
 	}
 
-	if (s->end_pos == 0 || (mkv_d->indexes == NULL && index_mode < 0))
+	/* without cues the clusters are indexed in the background */
+	if (mkv_d->indexes == NULL && index_mode != 0 && s->type == STREAMTYPE_FILE && s->end_pos > 0 && mkv_d->scan_start > 0)
+	{
+		mkv_d->scan_abort = 0;
+		if (pthread_create(&mkv_d->scan_thread, NULL, demux_mkv_scan_clusters, demuxer) == 0)
+			mkv_d->scan_started = 1;
+	}
+
+	if (s->end_pos == 0 || (mkv_d->indexes == NULL && !mkv_d->scan_started && index_mode < 0))
 		demuxer->seekable = 0;
 	else
 	{
@@ -4157,7 +4431,7 @@ int demux_mkv_fill_buffer(demuxer_t *demuxer, demux_stream_t *ds/*, stream_t *s,
 		{
 			uint64_t block_duration = 0,  block_length = 0;
 			int64_t block_bref = 0, block_fref = 0;
-			uint8_t *block = NULL;
+			demux_packet_t *block = NULL;
 
 //dprintf("blockgroup_size=%u\n", mkv_d->blockgroup_size);
 			while (mkv_d->blockgroup_size > 0)
@@ -4173,7 +4447,7 @@ int demux_mkv_fill_buffer(demuxer_t *demuxer, demux_stream_t *ds/*, stream_t *s,
 						block_duration = ebml_read_uint(s, &l);
 						if (block_duration == EBML_UINT_INVALID)
 						{
-							free(block);
+							free_demux_packet(block);
 							block = NULL;
 							return 0;
 						}
@@ -4196,16 +4470,17 @@ int demux_mkv_fill_buffer(demuxer_t *demuxer, demux_stream_t *ds/*, stream_t *s,
 						dprintf("   ->MATROSKA_ID_BLOCK\n");
 #endif
 						block_length = ebml_read_length(s, &tmp);
-						free(block);
+						free_demux_packet(block);
 						block = NULL;
-						if (block_length > SIZE_MAX - LZO_INPUT_PADDING) return 0;
-						block = malloc(block_length + LZO_INPUT_PADDING);
+						if (block_length > INT_MAX - LZO_INPUT_PADDING) return 0;
+						/* blocks are read into pooled packets, laces reference them */
+						block = new_demux_packet(block_length + LZO_INPUT_PADDING);
 						demuxer->filepos = stream_tell(s);
 
 //we fill the buffer ot the stream!
-						if (stream_read(s, block, block_length) != (int) block_length)
+						if (!block->buffer || stream_read(s, block->buffer, block_length) != (int) block_length)
 						{
-							free(block);
+							free_demux_packet(block);
 							block = NULL;
 							return 0;
 						}
@@ -4221,7 +4496,7 @@ int demux_mkv_fill_buffer(demuxer_t *demuxer, demux_stream_t *ds/*, stream_t *s,
 						int64_t num = ebml_read_int(s, &l);
 						if (num == EBML_INT_INVALID)
 						{
-							free(block);
+							free_demux_packet(block);
 							block = NULL;
 							return 0;
 						}
@@ -4237,7 +4512,7 @@ int demux_mkv_fill_buffer(demuxer_t *demuxer, demux_stream_t *ds/*, stream_t *s,
 						dprintf("   ->EBML_ID_INVALID\n");
 #endif
 
-						free(block);
+						free_demux_packet(block);
 						block = NULL;
 						return 0;
 
@@ -4260,7 +4535,7 @@ int demux_mkv_fill_buffer(demuxer_t *demuxer, demux_stream_t *ds/*, stream_t *s,
 
 				int res = handle_block(demuxer, block, block_length,
 						       block_duration, block_bref, block_fref, 0/*,audio,video,sub*/);
-				free(block);
+				free_demux_packet(block);
 				block = NULL;
 				if (res < 0)
 					return 0;
@@ -4309,11 +4584,12 @@ int demux_mkv_fill_buffer(demuxer_t *demuxer, demux_stream_t *ds/*, stream_t *s,
 
 							int res;
 							block_length = ebml_read_length(s, &tmp);
-							block = malloc(block_length);
+							if (block_length > INT_MAX - LZO_INPUT_PADDING) return 0;
+							block = new_demux_packet(block_length + LZO_INPUT_PADDING);
 							demuxer->filepos = stream_tell(s);
-							if (stream_read(s, block, block_length) != (int) block_length)
+							if (!block->buffer || stream_read(s, block->buffer, block_length) != (int) block_length)
 							{
-								free(block);
+								free_demux_packet(block);
 								block = NULL;
 								return 0;
 							}
@@ -4323,7 +4599,7 @@ int demux_mkv_fill_buffer(demuxer_t *demuxer, demux_stream_t *ds/*, stream_t *s,
 							dprintf("Test MATROSKA_ID_SIMPLEBLOCK\n");
 							for (k = 0; k < block_length; k++)
 							{
-								dprintf("%02x ", block[k]);
+								dprintf("%02x ", block->buffer[k]);
 								if (((k + 1) & 31) == 0)
 									dprintf("\n");
 							}
@@ -4332,7 +4608,7 @@ int demux_mkv_fill_buffer(demuxer_t *demuxer, demux_stream_t *ds/*, stream_t *s,
 							l = tmp + block_length;
 							res = handle_block(demuxer, block, block_length,
 									   block_duration, block_bref, block_fref, 1/*,audio,video,sub*/);
-							free(block);
+							free_demux_packet(block);
 							block = NULL;
 							mkv_d->cluster_size -= l + il;
 							if (res < 0)
@@ -4391,7 +4667,7 @@ demux_mkv_seek(demuxer_t *demuxer, float rel_seek_secs, float audio_delay, int f
 
 		mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
 		stream_t *s = demuxer->stream;
-		int64_t target_timecode = 0, diff, min_diff = 0xFFFFFFFFFFFFFFFLL;
+		int64_t target_timecode = 0;
 		int i;
 
 		if (!(flags & SEEK_ABSOLUTE))  /* relative seek */
@@ -4402,14 +4678,68 @@ demux_mkv_seek(demuxer_t *demuxer, float rel_seek_secs, float audio_delay, int f
 		if (target_timecode < 0)
 			target_timecode = 0;
 
-		if (mkv_d->indexes == NULL)  /* no index was found */
+		mkv_index_t index;
+		int use_index = 0;
+		int seek_id = (demuxer->video->id < 0) ? demuxer->audio->id : demuxer->video->id;
+		int64_t target = target_timecode + mkv_d->first_tc;
+		int num_cluster_pos;
+		uint64_t max_pos = 0;
+
+		pthread_mutex_lock(&mkv_d->index_mutex);
+		/* the cluster scan thread may grow cluster_positions */
+		num_cluster_pos = mkv_d->num_cluster_pos;
+		if (num_cluster_pos > 0)
+			max_pos = mkv_d->cluster_positions[num_cluster_pos - 1];
+		if (mkv_d->indexes != NULL)
+		{
+			int first, end, before;
+
+			find_index_track(mkv_d, seek_id, &first, &end);
+			if (first == end)
+				find_index_track(mkv_d, 0, &first, &end); /* from the cluster scan */
+
+			/* an index that is still being built may not reach the target yet */
+			if (first < end && (mkv_d->index_complete || target <= index_time(mkv_d, mkv_d->indexes + end - 1)))
+			{
+				before = find_index_before(mkv_d, first, end, target);
+				if (flags & SEEK_ABSOLUTE || target_timecode <= mkv_d->last_pts * 1000)
+				{
+					// Absolute seek or seek backward: the last index
+					// position before target time
+					index = mkv_d->indexes[before >= first ? before : first];
+					use_index = 1;
+				}
+				else if (before + 1 < end)
+				{
+					// Relative seek forward: the first index position
+					// after target time
+					index = mkv_d->indexes[before + 1];
+					use_index = 1;
+				}
+				else if (before >= first && index_time(mkv_d, mkv_d->indexes + before) > mkv_d->last_pts * 1000 + mkv_d->first_tc)
+				{
+					// else the last position between current position and target time
+					index = mkv_d->indexes[before];
+					use_index = 1;
+				}
+				else
+					use_index = -1;
+			}
+		}
+		pthread_mutex_unlock(&mkv_d->index_mutex);
+
+		if (use_index > 0)
 		{
-			uint64_t target_filepos, cluster_pos, max_pos;
+			mkv_d->cluster_size = mkv_d->blockgroup_size = 0;
+			stream_seek(s, index.filepos);
+		}
+		else if (use_index == 0 && num_cluster_pos > 0 && mkv_d->last_pts > 0)  /* no index was found */
+		{
+			uint64_t target_filepos, cluster_pos;
 
 			target_filepos = (uint64_t)(target_timecode * mkv_d->last_filepos
 						    / (mkv_d->last_pts * 1000.0));
 
-			max_pos = mkv_d->cluster_positions[mkv_d->num_cluster_pos - 1];
 			if (target_filepos > max_pos)
 			{
 				if ((off_t) max_pos > stream_tell(s))
@@ -4437,73 +4767,25 @@ demux_mkv_seek(demuxer_t *demuxer, float rel_seek_secs, float audio_delay, int f
 					stream_reset(s);
 			}
 
-			if (mkv_d->indexes == NULL)
-			{
-				cluster_pos = mkv_d->cluster_positions[0];
-				/* Let's find the nearest cluster */
-				for (i = 0; i < mkv_d->num_cluster_pos; i++)
-				{
-					diff = mkv_d->cluster_positions[i] - target_filepos;
-
-					if (rel_seek_secs < 0 && diff < 0 && -diff < min_diff)
-					{
-						cluster_pos = mkv_d->cluster_positions[i];
-						min_diff = -diff;
-					}
-					else if (rel_seek_secs > 0 && (diff < 0 ? -1 * diff : diff) < min_diff)
-					{
-						cluster_pos = mkv_d->cluster_positions[i];
-						min_diff = diff < 0 ? -1 * diff : diff;
-					}
-				}
-				mkv_d->cluster_size = mkv_d->blockgroup_size = 0;
-				stream_seek(s, cluster_pos);
-			}
-		}
-		else
-		{
-			mkv_index_t *index = NULL;
-			int seek_id = (demuxer->video->id < 0) ? demuxer->audio->id : demuxer->video->id;
-
-			/* let's find the entry in the indexes with the smallest */
-			/* difference to the wanted timecode. */
-			for (i = 0; i < mkv_d->num_indexes; i++)
+			/* Let's find the nearest cluster */
+			pthread_mutex_lock(&mkv_d->index_mutex);
+			i = find_cluster_position(mkv_d, target_filepos);
+			cluster_pos = mkv_d->cluster_positions[0];
+			if (rel_seek_secs < 0 && i > 0)
+				cluster_pos = mkv_d->cluster_positions[i - 1];
+			else if (rel_seek_secs > 0)
 			{
-				if (mkv_d->indexes[i].tnum == seek_id)
-				{
-					diff = target_timecode + mkv_d->first_tc -
-					       (int64_t) mkv_d->indexes[i].timecode * mkv_d->tc_scale / 1000000.0;
-
-					if ((flags & SEEK_ABSOLUTE || target_timecode <= mkv_d->last_pts * 1000))
-					{
-						// Absolute seek or seek backward: find the last index
-						// position before target time
-						if (diff < 0 || diff >= min_diff)
-							continue;
-					}
-					else
-					{
-						// Relative seek forward: find the first index position
-						// after target time. If no such index exists, find last
-						// position between current position and target time.
-						if (diff <= 0)
-						{
-							if (min_diff <= 0 && diff <= min_diff)
-								continue;
-						}
-						else if (diff >= FFMIN(target_timecode - mkv_d->last_pts, min_diff))
-							continue;
-					}
-					min_diff = diff;
-					index = mkv_d->indexes + i;
-				}
+				if (i == mkv_d->num_cluster_pos)
+					cluster_pos = mkv_d->cluster_positions[i - 1];
+				else if (i > 0 && target_filepos - mkv_d->cluster_positions[i - 1] < mkv_d->cluster_positions[i] - target_filepos)
+					cluster_pos = mkv_d->cluster_positions[i - 1];
+				else
+					cluster_pos = mkv_d->cluster_positions[i];
 			}
+			pthread_mutex_unlock(&mkv_d->index_mutex);
 
-			if (index)   /* We've found an entry. */
-			{
-				mkv_d->cluster_size = mkv_d->blockgroup_size = 0;
-				stream_seek(s, index->filepos);
-			}
+			mkv_d->cluster_size = mkv_d->blockgroup_size = 0;
+			stream_seek(s, cluster_pos);
 		}
 
 		if (demuxer->video->id >= 0)
@@ -4529,11 +4811,19 @@ demux_mkv_seek(demuxer_t *demuxer, float rel_seek_secs, float audio_delay, int f
 		mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
 		stream_t *s = demuxer->stream;
 		uint64_t target_filepos;
-		mkv_index_t *index = NULL;
-		int i;
+		mkv_index_t index;
+		int first = 0, end = 0;
 
-		if (mkv_d->indexes == NULL)  /* no index was found */
+		pthread_mutex_lock(&mkv_d->index_mutex);
+		if (mkv_d->indexes != NULL)
+		{
+			find_index_track(mkv_d, demuxer->video->id, &first, &end);
+			if (first == end)
+				find_index_track(mkv_d, 0, &first, &end);
+		}
+		if (first == end)  /* no index was found */
 		{
+			pthread_mutex_unlock(&mkv_d->index_mutex);
 			/* I'm lazy... */
 #ifdef DEBUG
 			printf("[mkv] seek unsupported flags\n");
@@ -4544,33 +4834,26 @@ demux_mkv_seek(demuxer_t *demuxer, float rel_seek_secs, float audio_delay, int f
 			return;
 		}
 
+		/* first entry at or after target_filepos, the positions grow with the timecodes */
 		target_filepos = (uint64_t)(demuxer->movi_end * rel_seek_secs);
-		for (i = 0; i < mkv_d->num_indexes; i++)
+		while (first < end - 1)
 		{
-			if (mkv_d->indexes[i].tnum == demuxer->video->id)
-			{
-				if ((index == NULL) ||
-						((mkv_d->indexes[i].filepos >= target_filepos) &&
-						 ((index->filepos < target_filepos) ||
-						  (mkv_d->indexes[i].filepos < index->filepos))))
-					index = &mkv_d->indexes[i];
-			}
-
-			if (!index)
-			{
-				releaseMKVMutex(FILENAME, __FUNCTION__, __LINE__);
-				whileSeeking = 0;
-				return;
-			}
+			int mid = (first + end - 1) / 2;
+			if (mkv_d->indexes[mid].filepos < target_filepos)
+				first = mid + 1;
+			else
+				end = mid + 1;
 		}
+		index = mkv_d->indexes[first];
+		pthread_mutex_unlock(&mkv_d->index_mutex);
 
 		mkv_d->cluster_size = mkv_d->blockgroup_size = 0;
-		stream_seek(s, index->filepos);
+		stream_seek(s, index.filepos);
 
 		if (demuxer->video->id >= 0)
 			mkv_d->v_skip_to_keyframe = 1;
 
-		mkv_d->skip_to_timecode = index->timecode;
+		mkv_d->skip_to_timecode = index.timecode;
 		mkv_d->a_skip_to_keyframe = 1;
 
 		demux_mkv_fill_buffer(demuxer, NULL);
@@ -4630,6 +4913,7 @@ int MkvInit(Context_t *context, char *filename)
 
 
 	demuxer->stream->fd = context->playback->fd;
+	demuxer->stream->buffer = demuxer->stream->buf_data;
 
 	read(demuxer->stream->fd, demuxer->stream->buffer, 2048); //this much ??
 
@@ -5094,6 +5378,14 @@ demux_close_mkv(demuxer_t *demuxer)
 			mkv_d->tracks = NULL;
 		}
 
+		if (mkv_d->scan_started)
+		{
+			mkv_d->scan_abort = 1;
+			pthread_join(mkv_d->scan_thread, NULL);
+			mkv_d->scan_started = 0;
+		}
+		pthread_mutex_destroy(&mkv_d->index_mutex);
+
 		free(mkv_d->indexes);
 		mkv_d->indexes = NULL;
 
@@ -5147,7 +5439,8 @@ static int MkvStop(Context_t *context)
 		{
 			demux_close_mkv(demuxer);
 
-			free(demuxer->stream);
+			demux_packet_pool_stats();
+			free_stream(demuxer->stream);
 			demuxer->stream = NULL;
 
 			free(demuxer->sub);
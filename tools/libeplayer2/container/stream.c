@@ -4,11 +4,13 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #ifndef __MINGW32__
 #include <sys/ioctl.h>
 #include <sys/wait.h>
 #endif
 #include <fcntl.h>
+#include <errno.h>
 #include <signal.h>
 #include <strings.h>
 
@@ -26,10 +28,64 @@ int stream_debug = 0;
 
 static int file_fill_buffer(stream_t *s, char *buffer, int max_len)
 {
-	int r = read(s->fd, buffer, max_len);
+	// the mapping doesn't move the file offset, so read at s->pos
+	int r = pread(s->fd, buffer, max_len, s->pos);
+	if (r < 0 && errno == ESPIPE)
+		r = read(s->fd, buffer, max_len);
 	return (r <= 0) ? -1 : r;
 }
 
+// point the buffer at s->pos into a mapped window of the file,
+// returns -2 if the file can't be mapped and has to be read
+static int file_map_buffer(stream_t *s)
+{
+	struct stat st;
+	off_t map_pos, map_end;
+	void *map;
+
+	// after a seek the new position may still be part of the mapping
+	if (s->map && s->pos >= s->map_pos && s->pos < s->map_pos + (off_t)s->map_len)
+	{
+		s->buffer = s->map + (s->pos - s->map_pos);
+		return s->map_pos + s->map_len - s->pos;
+	}
+
+	if (fstat(s->fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return -2;
+	// a recording may still grow, so the size is checked again on every new window
+	if (s->pos >= st.st_size)
+		return -1;
+
+	if (s->map)
+	{
+		munmap(s->map, s->map_len);
+		s->map = NULL;
+		s->map_len = 0;
+	}
+
+	map_pos = s->pos & ~((off_t)sysconf(_SC_PAGESIZE) - 1);
+	map_end = map_pos + STREAM_MAP_SIZE;
+	if (map_end > st.st_size)
+		map_end = st.st_size;
+
+	map = mmap(NULL, map_end - map_pos, PROT_READ, MAP_SHARED, s->fd, map_pos);
+	if (map == MAP_FAILED)
+	{
+		stream_printf("mmap at 0x%"PRIX64" failed, errno=%d\n", (int64_t)map_pos, errno);
+		return -2;
+	}
+	madvise(map, map_end - map_pos, MADV_SEQUENTIAL);
+	// let the kernel fetch the next window while this one is parsed
+	if (map_end < st.st_size)
+		posix_fadvise(s->fd, map_end, STREAM_MAP_SIZE, POSIX_FADV_WILLNEED);
+
+	s->map = map;
+	s->map_pos = map_pos;
+	s->map_len = map_end - map_pos;
+	s->buffer = s->map + (s->pos - s->map_pos);
+	return map_end - s->pos;
+}
+
 static int file_seek(stream_t *s, off_t newpos)
 {
 	s->pos = newpos;
@@ -69,14 +125,21 @@ int stream_fill_buffer(stream_t *s)
 	switch (s->type)
 	{
 		case STREAMTYPE_STREAM:
+			s->buffer = s->buf_data;
 			len = read(s->fd, s->buffer, STREAM_BUFFER_SIZE);
 			break;
 		case STREAMTYPE_DS:
+			s->buffer = s->buf_data;
 			len = demux_read_data((demux_stream_t *)s->priv, s->buffer, STREAM_BUFFER_SIZE);
 			break;
 
 		default:
-			len = file_fill_buffer(s, (char *) s->buffer, STREAM_BUFFER_SIZE);
+			len = file_map_buffer(s);
+			if (len == -2)
+			{
+				s->buffer = s->buf_data;
+				len = file_fill_buffer(s, (char *) s->buffer, STREAM_BUFFER_SIZE);
+			}
 			break;
 	}
 	stream_printf("stream_fill_buffer-< len=%d\n", len);
@@ -176,6 +239,13 @@ int stream_control(stream_t *s, int cmd, void *arg)
 	if (!s->control) return STREAM_UNSUPPORTED;
 	return s->control(s, cmd, arg);
 }
+void free_stream(stream_t *s)
+{
+	if (s->map)
+		munmap(s->map, s->map_len);
+	free(s);
+}
+
 void stream_reset(stream_t *s)
 {
 	if (s->type == STREAMTYPE_FILE)
@@ -20,6 +20,7 @@
 #define MAX_STREAM_PROTOCOLS 10
 
 #define STREAM_BUFFER_SIZE 2048
+#define STREAM_MAP_SIZE (4*1024*1024) // window of a regular file mapped at once
 #define VCD_SECTOR_SIZE 2352
 
 #define STREAM_UNSUPPORTED -1
@@ -83,7 +84,14 @@ typedef struct stream_st
 	void *priv; // used for DVD, TV, RTSP etc
 	char *url;  // strdup() of filename/url
 
-	unsigned char buffer[STREAM_BUFFER_SIZE];
+	// STREAMTYPE_FILE maps the file in windows of STREAM_MAP_SIZE,
+	// buffer then points into the mapping instead of buf_data
+	unsigned char *map;
+	off_t map_pos;
+	size_t map_len;
+
+	unsigned char *buffer;
+	unsigned char buf_data[STREAM_BUFFER_SIZE];
 } stream_t;
 
 int stream_fill_buffer(stream_t *s);
@@ -236,6 +244,7 @@ inline static int stream_skip(stream_t *s, off_t len)
 }
 int stream_control(stream_t *s, int cmd, void *arg);
 void stream_reset(stream_t *s);
+void free_stream(stream_t *s);
 
 stream_t *open_stream(char *filename, char **options, int *file_format);
 
@@ -40,6 +40,9 @@
 #include <sys/poll.h>
 #include <pthread.h>
 #include <sys/prctl.h>
+#include <time.h>
+#include <sys/time.h>
+#include <limits.h>
 
 #include <ass/ass.h>
 
@@ -78,6 +81,12 @@ static short debug_level = 10;
 
 #define ASS_FONT "/usr/share/fonts/LiberationSans-Regular.ttf"
 
+/* longest sleep without a subtitle boundary or wakeup, keeps us in sync
+ * if the pts jumps without notification */
+#define ASS_MAX_SLEEP   1000
+/* render interval while an animated event (move, fade, karaoke) is shown */
+#define ASS_ANIM_TICK     40
+
 /* ***************************** */
 /* Types                         */
 /* ***************************** */
@@ -134,6 +143,30 @@ static ASS_Track *ass_track = NULL;
 
 static region_t *firstRegion = NULL;
 
+/* wakeup of the render thread, protected by mutex */
+static pthread_cond_t wakeup;
+static int wakeupInitialized = 0;
+static int wakeupPending = 0;
+
+/* event index: sorted start and end times (ms) of all events of ass_track,
+ * the rendered image does only change at these boundaries */
+static long long *boundaries = NULL;
+static int boundaryCount = 0;
+static int boundarySize = 0;
+static int indexedEvents = 0;
+
+/* start/end pairs of animated events, they need continuous rendering,
+ * overlapping events are merged so the intervals are sorted and disjoint */
+static long long *animated = NULL;
+static int animatedCount = 0;
+static int animatedSize = 0;
+/* first interval ending after the last pts asked for */
+static int animatedCursor = 0;
+
+/* the image on screen is valid while renderFrom <= pts < renderTo */
+static long long renderFrom = 0;
+static long long renderTo = -1;
+
 /* ***************************** */
 /* Prototypes                    */
 /* ***************************** */
@@ -171,6 +204,190 @@ static void releaseMutex(int line)
 	ass_printf(150, "%d released mutex\n", line);
 }
 
+/* wake the render thread, call with mutex held */
+static void signalWakeup(void)
+{
+	wakeupPending = 1;
+	if (wakeupInitialized)
+		pthread_cond_signal(&wakeup);
+}
+
+/* sleep until timeout (ms) or wakeup */
+static void waitWakeup(long long ms)
+{
+	struct timespec ts;
+	struct timeval tv;
+
+	getMutex(__LINE__);
+	if (!wakeupPending && wakeupInitialized)
+	{
+		gettimeofday(&tv, NULL);
+		ts.tv_sec  = tv.tv_sec + ms / 1000;
+		ts.tv_nsec = tv.tv_usec * 1000 + (ms % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000)
+		{
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&wakeup, &mutex, &ts);
+	}
+	wakeupPending = 0;
+	releaseMutex(__LINE__);
+}
+
+/* ********************************* */
+/* Event index                       */
+/* ********************************* */
+
+static int indexGrow(long long **array, int *size, int count)
+{
+	if (count > *size)
+	{
+		int newSize = *size ? *size * 2 : 256;
+		long long *tmp;
+		while (newSize < count)
+			newSize *= 2;
+		tmp = realloc(*array, newSize * sizeof(long long));
+		if (tmp == NULL)
+		{
+			ass_err("out of memory\n");
+			return -1;
+		}
+		*array = tmp;
+		*size = newSize;
+	}
+	return 0;
+}
+
+/* insert keeping the array sorted, events arrive mostly in order so
+ * the memmove is short */
+static void indexInsert(long long ms)
+{
+	int lo = 0, hi = boundaryCount;
+	if (indexGrow(&boundaries, &boundarySize, boundaryCount + 1) < 0)
+		return;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (boundaries[mid] <= ms)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	memmove(boundaries + lo + 1, boundaries + lo, (boundaryCount - lo) * sizeof(long long));
+	boundaries[lo] = ms;
+	boundaryCount++;
+}
+
+/* first interval at or after index lo ending at or after ms */
+static int animatedSearch(int lo, long long ms)
+{
+	int hi = animatedCount / 2;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (animated[2 * mid + 1] < ms)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* add the interval of an animated event, merged with the ones it overlaps */
+static void animatedInsert(long long start, long long end)
+{
+	int first, last, count = animatedCount / 2;
+	if (start >= end || indexGrow(&animated, &animatedSize, animatedCount + 2) < 0)
+		return;
+	first = animatedSearch(0, start);
+	for (last = first; last < count && animated[2 * last] <= end; last++)
+	{
+		if (animated[2 * last] < start)
+			start = animated[2 * last];
+		if (animated[2 * last + 1] > end)
+			end = animated[2 * last + 1];
+	}
+	/* intervals first..last-1 are replaced by the merged one */
+	memmove(animated + 2 * first + 2, animated + 2 * last, (count - last) * 2 * sizeof(long long));
+	animated[2 * first] = start;
+	animated[2 * first + 1] = end;
+	animatedCount += 2 - 2 * (last - first);
+	animatedCursor = 0;
+}
+
+static int isAnimated(ASS_Event *event)
+{
+	const char *text = event->Text;
+	if (event->Effect && *event->Effect)
+		return 1;
+	if (text == NULL)
+		return 0;
+	return strstr(text, "\\mov") || strstr(text, "\\fad") || strstr(text, "\\t(") ||
+	       strstr(text, "\\k") || strstr(text, "\\K");
+}
+
+/* add events appended to ass_track since the last call, call with mutex held */
+static void updateIndex(void)
+{
+	if (ass_track == NULL)
+		return;
+	for (; indexedEvents < ass_track->n_events; indexedEvents++)
+	{
+		ASS_Event *event = &ass_track->events[indexedEvents];
+		indexInsert(event->Start);
+		indexInsert(event->Start + event->Duration);
+		if (isAnimated(event))
+			animatedInsert(event->Start, event->Start + event->Duration);
+	}
+	/* a new event may start or end within the displayed interval */
+	renderTo = -1;
+}
+
+static void resetIndex(void)
+{
+	free(boundaries);
+	boundaries = NULL;
+	boundaryCount = boundarySize = 0;
+	free(animated);
+	animated = NULL;
+	animatedCount = animatedSize = 0;
+	animatedCursor = 0;
+	indexedEvents = 0;
+	renderFrom = 0;
+	renderTo = -1;
+}
+
+/* set renderFrom/renderTo to the boundaries around ms */
+static void findInterval(long long ms)
+{
+	int lo = 0, hi = boundaryCount;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (boundaries[mid] <= ms)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	renderFrom = lo > 0 ? boundaries[lo - 1] : LLONG_MIN;
+	renderTo = lo < boundaryCount ? boundaries[lo] : LLONG_MAX;
+}
+
+/* while playing ms only grows, the cursor then moves at most a few
+ * intervals per call, after a seek back it is searched again */
+static int isAnimatedAt(long long ms)
+{
+	int count = animatedCount / 2;
+	int i = animatedCursor;
+	if (i > 0 && animated[2 * i - 1] > ms)
+		i = animatedSearch(0, ms + 1);
+	while (i < count && animated[2 * i + 1] <= ms)
+		i++;
+	animatedCursor = i;
+	return i < count && animated[2 * i] <= ms;
+}
+
 /* ********************************* */
 /* Region Undisplay handling         */
 /* ********************************* */
@@ -318,57 +535,67 @@ static void ASSThread(Context_t *context)
 	}
 	while (context && context->playback && context->playback->isPlaying && hasPlayThreadStarted == 1)
 	{
+		long long sleepMs = ASS_MAX_SLEEP;
 		//IF MOVIE IS PAUSED, WAIT
 		if (context->playback->isPaused)
 		{
 			ass_printf(20, "paused\n");
-			usleep(100000);
+			waitWakeup(ASS_MAX_SLEEP);
 			continue;
 		}
 		if (context->playback->isSeeking)
 		{
 			ass_printf(10, "seeking\n");
-			usleep(100000);
+			waitWakeup(100);
 			continue;
 		}
 		if ((isContainerRunning) && (ass_track))
 		{
 			ASS_Image        *img   = NULL;
 			int               change = 0;
-			unsigned long int playPts = 0;
+			unsigned long long int playPts = 0;
+			long long         playMs;
 			if (context && context->playback)
 			{
 				if (context->playback->Command(context, PLAYBACK_PTS, &playPts) < 0)
+				{
+					waitWakeup(100);
 					continue;
+				}
 			}
-			//FIXME: durch den sleep bleibt die cpu usage zw. 5 und 13%, ohne
-			//       steigt sie bei Verwendung von subtiteln bis auf 95%.
-			//       ich hoffe dadurch gehen keine subtitle verloren, wenn die playPts
-			//       durch den sleep verschlafen wird. Besser wäre es den nächsten
-			//       subtitel zeitpunkt zu bestimmen und solange zu schlafen.
-			usleep(1000);
+			playMs = playPts / 90;
 			getMutex(__LINE__);
 			checkRegions(writer);
-			if (ass_renderer && ass_track)
-				img = ass_render_frame(ass_renderer, ass_track, playPts / 90.0, &change);
-			ass_printf(150, "img %p pts %lu %f\n", img, playPts, playPts / 90.0);
-			if (img != NULL && ass_renderer && ass_track)
+			/* the image only changes at event boundaries: render when the pts
+			 * left the interval of the image on screen, else sleep until the
+			 * next boundary (or a seek/pause/new event wakes us up) */
+			if (ass_renderer && ass_track && (playMs < renderFrom || playMs >= renderTo || isAnimatedAt(playMs)))
 			{
+				findInterval(playMs);
+				img = ass_render_frame(ass_renderer, ass_track, playMs, &change);
+				ass_printf(150, "img %p pts %llu next %lld\n", img, playPts, renderTo);
 				/* the spec says, that if a new set of regions is present
 				 * the complete display switches to the new state. So lets
 				 * release the old regions on display.
 				 */
 				if (change != 0)
 					releaseRegions(writer);
+			}
+			if (renderTo != LLONG_MAX)
+				sleepMs = renderTo - playMs;
+			if (isAnimatedAt(playMs) && sleepMs > ASS_ANIM_TICK)
+				sleepMs = ASS_ANIM_TICK;
+			if (img != NULL && ass_renderer && ass_track)
+			{
 				while (context && context->playback && context->playback->isPlaying &&
 						(img) && (change != 0))
 				{
 					WriterFBCallData_t out;
 					time_t now = time(NULL);
 					time_t undisplay = now + 10;
-					if (ass_track && ass_track->events)
+					if (renderTo != LLONG_MAX)
 					{
-						undisplay = now + ass_track->events->Duration / 1000 + 0.5;
+						undisplay = now + (renderTo - playMs) / 1000 + 1;
 					}
 					ass_printf(100, "w %d h %d s %d x %d y %d c %d chg %d now %ld und %ld\n",
 						   img->w, img->h, img->stride,
@@ -409,16 +636,14 @@ static void ASSThread(Context_t *context)
 							 */
 							SubtitleOut_t out;
 							out.type         = eSub_Gfx;
-							if (ass_track->events)
+							out.pts          = playPts;
+							if (renderTo != LLONG_MAX)
 							{
-								/* fixme: check values */
-								out.pts          = ass_track->events->Start * 90.0;
-								out.duration     = ass_track->events->Duration / 1000.0;
+								out.duration = (renderTo - playMs) / 1000.0;
 							}
 							else
 							{
-								out.pts          = playPts;
-								out.duration     = 10.0;
+								out.duration = 10.0;
 							}
 							out.u.gfx.data   = img->bitmap;
 							out.u.gfx.Width  = img->w;
@@ -436,10 +661,6 @@ static void ASSThread(Context_t *context)
 			}
 			releaseMutex(__LINE__);
 		}
-		else
-		{
-			usleep(1000);
-		}
 		/* cleanup no longer used but not overwritten regions */
 		checkRegions(writer);
 		if (framebufferBlit != NULL && needsBlit)
@@ -447,6 +668,14 @@ static void ASSThread(Context_t *context)
 			needsBlit = 0;
 			(*framebufferBlit)();
 		}
+		if (sleepMs > ASS_MAX_SLEEP)
+			sleepMs = ASS_MAX_SLEEP;
+		/* pts does not run at wall clock speed */
+		if ((context->playback->isForwarding || context->playback->BackWard || context->playback->SlowMotion) && sleepMs > 100)
+			sleepMs = 100;
+		if (sleepMs < 1)
+			sleepMs = 1;
+		waitWakeup(sleepMs);
 	} /* while */
 	hasPlayThreadStarted = 0;
 	ass_printf(10, "terminating\n");
@@ -500,6 +729,12 @@ int container_ass_init(Context_t *context)
 	ass_set_line_spacing(ass_renderer, ass_line_spacing);
 	ass_set_fonts(ass_renderer, ASS_FONT, "Arial", 0, NULL, 1);
 	ass_set_aspect_ratio(ass_renderer, 1.0, 1.0);
+	if (!wakeupInitialized)
+	{
+		/* CLOCK_REALTIME, waitWakeup takes the deadline from gettimeofday */
+		pthread_cond_init(&wakeup, NULL);
+		wakeupInitialized = 1;
+	}
 	isContainerRunning = 1;
 	return cERR_CONTAINER_ASS_NO_ERROR;
 }
@@ -514,12 +749,14 @@ int container_ass_process_data(Context_t *context __attribute__((unused)), Subti
 		ass_err("Container not running\n");
 		return cERR_CONTAINER_ASS_ERROR;
 	}
+	getMutex(__LINE__);
 	if (ass_track == NULL)
 	{
 		first_kiss = 1;
 		ass_track = ass_new_track(ass_library);
 		if (ass_track == NULL)
 		{
+			releaseMutex(__LINE__);
 			ass_err("error creating ass_track\n");
 			return cERR_CONTAINER_ASS_ERROR;
 		}
@@ -538,6 +775,9 @@ int container_ass_process_data(Context_t *context __attribute__((unused)), Subti
 		ass_process_data(ass_track, (char *) data->data, data->len);
 		ass_printf(30, "processing data done\n");
 	}
+	updateIndex();
+	signalWakeup();
+	releaseMutex(__LINE__);
 	return cERR_CONTAINER_ASS_NO_ERROR;
 }
 
@@ -556,6 +796,9 @@ static int container_ass_stop(Context_t *context __attribute__((unused)))
 	if (hasPlayThreadStarted != 0)
 	{
 		hasPlayThreadStarted = 2;
+		getMutex(__LINE__);
+		signalWakeup();
+		releaseMutex(__LINE__);
 		while ((hasPlayThreadStarted != 0) && (--wait_time) > 0)
 		{
 			ass_printf(10, "Waiting for ass thread to terminate itself, will try another %d times\n", wait_time);
@@ -573,6 +816,7 @@ static int container_ass_stop(Context_t *context __attribute__((unused)))
 	if (ass_track)
 		ass_free_track(ass_track);
 	ass_track = NULL;
+	resetIndex();
 	if (ass_renderer)
 		ass_renderer_done(ass_renderer);
 	ass_renderer = NULL;
@@ -640,6 +884,7 @@ static int container_ass_switch_subtitle(Context_t *context, int *arg __attribut
 	if (ass_track)
 		ass_free_track(ass_track);
 	ass_track = NULL;
+	resetIndex();
 	releaseMutex(__LINE__);
 	ass_printf(10, "exiting with value %d\n", ret);
 	return ret;
@@ -673,6 +918,13 @@ static int Command(Context_t *context, ContainerCmd_t command, void *argument)
 			ret = container_ass_process_data(context, data);
 			break;
 		}
+		case CONTAINER_WAKEUP:
+		{
+			getMutex(__LINE__);
+			signalWakeup();
+			releaseMutex(__LINE__);
+			break;
+		}
 		default:
 			ass_err("ContainerCmd %d not supported!\n", command);
 			ret = cERR_CONTAINER_ASS_ERROR;
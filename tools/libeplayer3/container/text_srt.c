@@ -65,7 +65,11 @@ static short debug_level = 0;
 #define cERR_SRT_ERROR          -1
 
 #define TRACKWRAP 20
-#define MAXLINELENGTH 80
+
+/* cues are passed to the ass container this far ahead of the playback pts */
+#define SRT_LOOKAHEAD      5000
+/* interval of the playback pts check in ms */
+#define SRT_FEED_INTERVAL  100
 
 static const char FILENAME[] = "text_srt.c";
 
@@ -79,6 +83,14 @@ typedef struct
 	int Id;
 } SrtTrack_t;
 
+/* one cue of the open subtitle file */
+typedef struct
+{
+	unsigned int Start;     /* ms */
+	unsigned int End;       /* ms */
+	unsigned int Text;      /* offset of the text in SrtArena */
+} SrtCue_t;
+
 static pthread_t thread_sub;
 
 /* ***************************** */
@@ -89,9 +101,18 @@ static SrtTrack_t *Tracks;
 static int TrackCount = 0;
 static int CurrentTrack = -1; //no as default.
 
-FILE *fsub = NULL;
+/* the file is read into the arena once, cue texts are compacted in place */
+static char *SrtArena = NULL;
+static SrtCue_t *SrtCues = NULL;
+static unsigned char *SrtFed = NULL;  /* cue was passed to the ass container */
+static int SrtCueCount = 0;
+static unsigned int SrtMaxDuration = 0;
+/* cues before SrtFeedPos are fed or were over at SrtFeedMs */
+static int SrtFeedPos = 0;
+static unsigned int SrtFeedMs = 0;
 
 static int hasThreadStarted = 0;
+static int threadJoinable = 0;
 
 /* ***************************** */
 /* Prototypes                    */
@@ -130,72 +151,241 @@ void data_to_manager(Context_t *context, char *Text, unsigned long long int Pts,
 }
 
 /* ***************************** */
-/* Worker Thread                 */
+/* Cue store                     */
 /* ***************************** */
 
-static void *SrtSubtitleThread(void *data)
+/* parse "hh:mm:ss,mmm" (or '.' as decimal separator) */
+static const char *SrtParseTime(const char *s, unsigned int *ms)
 {
-	int pos = 0;
-	char  Data[MAXLINELENGTH];
-	unsigned long long int Pts = 0;
-	double Duration = 0;
-	char *Text = NULL;
-	Context_t *context = (Context_t *) data;
-	srt_printf(10, "\n");
-	while (context && context->playback && context->playback->isPlaying && fsub && fgets(Data, MAXLINELENGTH, fsub))
+	unsigned int v[3] = { 0, 0, 0 };
+	unsigned int frac = 0, scale = 1000;
+	int i;
+
+	for (i = 0; i < 3; i++)
 	{
-		srt_printf(20, "pos=%d\n", pos);
-		if (pos == 0)
-		{
-			if (Data[0] == '\n' || Data[0] == '\0' || Data[0] == 13 /* ^M */)
-				continue; /* Empty line not allowed here */
-			pos++;
-		}
-		else if (pos == 1)
+		if (*s < '0' || *s > '9')
+			return NULL;
+		while (*s >= '0' && *s <= '9')
+			v[i] = v[i] * 10 + (*s++ - '0');
+		if (i < 2 && *s++ != ':')
+			return NULL;
+	}
+	if (*s == ',' || *s == '.')
+	{
+		s++;
+		while (*s >= '0' && *s <= '9')
 		{
-			int ret, horIni, minIni, secIni, milIni, horFim, minFim, secFim, milFim;
-			ret = sscanf(Data, "%d:%d:%d,%d --> %d:%d:%d,%d", &horIni, &minIni, &secIni, &milIni, &horFim, &minFim, &secFim, &milFim);
-			if (ret != 8) continue; /* Data is not in correct format */
-			Pts = (horIni * 3600 + minIni * 60 + secIni) * 1000 + milIni;
-			Duration = ((horFim * 3600 + minFim * 60 + secFim) * 1000  + milFim - Pts) / 1000.0;
-			pos++;
+			if (scale > 1)
+			{
+				scale /= 10;
+				frac += (*s - '0') * scale;
+			}
+			s++;
 		}
-		else if (pos == 2)
+	}
+	*ms = (v[0] * 3600 + v[1] * 60 + v[2]) * 1000 + frac;
+	return s;
+}
+
+/* "hh:mm:ss,mmm --> hh:mm:ss,mmm" */
+static int SrtParseTiming(const char *line, unsigned int *start, unsigned int *end)
+{
+	while (*line == ' ' || *line == '\t')
+		line++;
+	if ((line = SrtParseTime(line, start)) == NULL)
+		return 0;
+	while (*line == ' ' || *line == '\t')
+		line++;
+	if (strncmp(line, "-->", 3))
+		return 0;
+	line += 3;
+	while (*line == ' ' || *line == '\t')
+		line++;
+	return SrtParseTime(line, end) != NULL;
+}
+
+static int SrtCueCompare(const void *a, const void *b)
+{
+	const SrtCue_t *x = a, *y = b;
+	if (x->Start != y->Start)
+		return x->Start < y->Start ? -1 : 1;
+	return x->Text < y->Text ? -1 : x->Text > y->Text;
+}
+
+static void SrtFree(void)
+{
+	free(SrtArena);
+	SrtArena = NULL;
+	free(SrtCues);
+	SrtCues = NULL;
+	free(SrtFed);
+	SrtFed = NULL;
+	SrtCueCount = 0;
+	SrtMaxDuration = 0;
+	SrtFeedPos = 0;
+	SrtFeedMs = 0;
+}
+
+/* read and parse the whole file, the text lines of a cue are joined with
+ * '\n' and written back into the file buffer, which never overtakes the
+ * parser, so all texts end up in one block */
+static int SrtLoad(const char *File)
+{
+	struct stat st;
+	char *r, *w, *text = NULL;
+	int fd, size = 0, sorted = 1;
+	ssize_t len, n;
+
+	SrtFree();
+	if ((fd = open(File, O_RDONLY)) < 0)
+		return cERR_SRT_ERROR;
+	if (fstat(fd, &st) || (SrtArena = malloc(st.st_size + 1)) == NULL)
+	{
+		close(fd);
+		return cERR_SRT_ERROR;
+	}
+	for (len = 0; len < st.st_size; len += n)
+	{
+		n = read(fd, SrtArena + len, st.st_size - len);
+		if (n <= 0)
+			break;
+	}
+	close(fd);
+	SrtArena[len] = '\0';
+
+	r = w = SrtArena;
+	if (!strncmp(r, "\xef\xbb\xbf", 3))  /* UTF-8 BOM */
+		r += 3;
+	while (*r)
+	{
+		char *line = r;
+		char *eol = strchr(r, '\n');
+		if (eol == NULL)
+			eol = r + strlen(r);
+		r = *eol ? eol + 1 : eol;
+		len = eol - line;
+		while (len > 0 && line[len - 1] == '\r')
+			len--;
+		if (text != NULL)
 		{
-			srt_printf(20, "Data[0] = %d \'%c\'\n", Data[0], Data[0]);
-			if (Data[0] == '\n' || Data[0] == '\0' || Data[0] == 13 /* ^M */)
+			if (len > 0)
 			{
-				if (Text == NULL)
-					Text = strdup(" \n"); /* better to display at least one character */
-				/*Hellmaster 1024 since we have waited, we have to check if we are still paying */
-				data_to_manager(context, Text, Pts, Duration);
-				free(Text);
-				Text = NULL;
-				pos = 0;
+				if (w != text)
+					*w++ = '\n';
+				memmove(w, line, len);
+				w += len;
 				continue;
 			}
-			if (!Text)
-			{
-				Text = strdup(Data);
-			}
-			else
+			/* empty line ends the cue */
+			if (w == text)
+				*w++ = ' ';  /* better to display at least one character */
+			*w++ = '\0';
+			text = NULL;
+			continue;
+		}
+		/* the cue number is skipped, a cue starts with its timing */
+		line[len] = '\0';
+		SrtCue_t cue;
+		if (!SrtParseTiming(line, &cue.Start, &cue.End))
+			continue;
+		if (cue.End < cue.Start)
+			cue.End = cue.Start;
+		if (SrtCueCount == size)
+		{
+			SrtCue_t *tmp;
+			size = size ? size * 2 : 256;
+			if ((tmp = realloc(SrtCues, size * sizeof(SrtCue_t))) == NULL)
 			{
-				int length = strlen(Text) /* \0 -> \n */ + strlen(Data) + 2 /* \0 */;
-				char *tmpText = Text;
-				Text = (char *)malloc(length);
-				strcpy(Text, tmpText);
-				strcat(Text, Data);
-				free(tmpText);
+				SrtFree();
+				return cERR_SRT_ERROR;
 			}
+			SrtCues = tmp;
 		}
-	} /* while */
-	hasThreadStarted = 0;
-	if (Text)
+		text = w;
+		cue.Text = text - SrtArena;
+		if (SrtCueCount > 0 && cue.Start < SrtCues[SrtCueCount - 1].Start)
+			sorted = 0;
+		if (cue.End - cue.Start > SrtMaxDuration)
+			SrtMaxDuration = cue.End - cue.Start;
+		SrtCues[SrtCueCount++] = cue;
+	}
+	if (text != NULL)
+	{
+		if (w == text)
+			*w++ = ' ';
+		*w++ = '\0';
+	}
+	/* give back the space of numbers and timings */
+	if ((r = realloc(SrtArena, w - SrtArena + 1)) != NULL)
+		SrtArena = r;
+	if (!sorted)
+		qsort(SrtCues, SrtCueCount, sizeof(SrtCue_t), SrtCueCompare);
+	SrtFed = calloc(SrtCueCount + 1, 1);
+	if (SrtFed == NULL)
+	{
+		SrtFree();
+		return cERR_SRT_ERROR;
+	}
+	srt_printf(10, "%d cues, %d bytes text\n", SrtCueCount, (int)(w - SrtArena));
+	return cERR_SRT_NO_ERROR;
+}
+
+/* index of the first cue starting at or after ms, O(log n) */
+static int SrtLookup(unsigned int ms)
+{
+	int lo = 0, hi = SrtCueCount;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (SrtCues[mid].Start < ms)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* pass the cues shown now or within the lookahead to the ass container,
+ * every cue once: after a seek back libass still has the earlier ones.
+ * While playing only the cues entering the lookahead are looked at, the
+ * cue shown at ms is searched for only after a jump of the pts */
+static void SrtFeed(Context_t *context, unsigned int ms)
+{
+	int i;
+
+	if (ms < SrtFeedMs || ms > SrtFeedMs + SRT_LOOKAHEAD)
+		SrtFeedPos = SrtLookup(ms > SrtMaxDuration ? ms - SrtMaxDuration : 0);
+	SrtFeedMs = ms;
+	for (i = SrtFeedPos; i < SrtCueCount && SrtCues[i].Start <= ms + SRT_LOOKAHEAD; i++)
 	{
-		data_to_manager(context, Text, Pts, Duration);
-		free(Text);
-		Text = NULL;
+		if (SrtFed[i] || SrtCues[i].End <= ms)
+			continue;
+		SrtFed[i] = 1;
+		data_to_manager(context, SrtArena + SrtCues[i].Text, SrtCues[i].Start,
+				(SrtCues[i].End - SrtCues[i].Start) / 1000.0);
 	}
+	SrtFeedPos = i;
+}
+
+/* ***************************** */
+/* Worker Thread                 */
+/* ***************************** */
+
+static void *SrtSubtitleThread(void *data)
+{
+	Context_t *context = (Context_t *) data;
+	srt_printf(10, "\n");
+	while (context && context->playback && context->playback->isPlaying && hasThreadStarted == 1)
+	{
+		unsigned long long int playPts = 0;
+		if (!context->playback->isSeeking &&
+				context->playback->Command(context, PLAYBACK_PTS, &playPts) >= 0)
+		{
+			SrtFeed(context, playPts / 90);
+		}
+		usleep(SRT_FEED_INTERVAL * 1000);
+	}
+	hasThreadStarted = 0;
 	srt_printf(0, "thread has ended\n");
 	return NULL;
 }
@@ -366,9 +556,7 @@ static int SrtOpenSubtitle(Context_t *context __attribute__((unused)), int pid)
 		return cERR_SRT_ERROR;
 	}
 	srt_printf(10, "%s\n", Tracks[trackid].File);
-	fsub = fopen(Tracks[trackid].File, "rb");
-	srt_printf(10, "%s\n", fsub ? "fsub!=NULL" : "fsub==NULL");
-	if (!fsub)
+	if (SrtLoad(Tracks[trackid].File) != cERR_SRT_NO_ERROR)
 	{
 		srt_err("cannot open file %s\n", Tracks[trackid].File);
 		return cERR_SRT_ERROR;
@@ -379,11 +567,16 @@ static int SrtOpenSubtitle(Context_t *context __attribute__((unused)), int pid)
 static int SrtCloseSubtitle(Context_t *context __attribute__((unused)))
 {
 	srt_printf(10, "\n");
-	if (fsub)
-		fclose(fsub);
-	/* this closes the thread! */
-	fsub = NULL;
+	if (threadJoinable)
+	{
+		/* the thread uses the cue store, it has to be gone before SrtFree */
+		if (hasThreadStarted)
+			hasThreadStarted = 2;
+		pthread_join(thread_sub, NULL);
+		threadJoinable = 0;
+	}
 	hasThreadStarted = 0;
+	SrtFree();
 	return cERR_SRT_NO_ERROR;
 }
 
@@ -392,13 +585,19 @@ static int SrtSwitchSubtitle(Context_t *context, int *arg)
 	int ret = cERR_SRT_NO_ERROR;
 	srt_printf(10, "arg:%d\n", *arg);
 	ret = SrtCloseSubtitle(context);
+	if (*arg < TEXTSRTOFFSET || *arg >= TEXTSSAOFFSET)
+		return ret; /* switched to another subtitle, just stop ours */
 	if (((ret |= SrtOpenSubtitle(context, *arg)) == cERR_SRT_NO_ERROR) && (!hasThreadStarted))
 	{
-		pthread_attr_t attr;
-		pthread_attr_init(&attr);
-		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-		pthread_create(&thread_sub, &attr, &SrtSubtitleThread, context);
 		hasThreadStarted = 1;
+		if (pthread_create(&thread_sub, NULL, &SrtSubtitleThread, context) != 0)
+		{
+			srt_err("Error creating thread\n");
+			hasThreadStarted = 0;
+			ret = cERR_SRT_ERROR;
+		}
+		else
+			threadJoinable = 1;
 	}
 	return ret;
 }
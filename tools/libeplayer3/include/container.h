@@ -26,7 +26,8 @@ typedef enum
 	CONTAINER_SET_BUFFER_SIZE,
 	CONTAINER_GET_BUFFER_SIZE,
 	CONTAINER_GET_BUFFER_STATUS,
-	CONTAINER_STOP_BUFFER
+	CONTAINER_STOP_BUFFER,
+	CONTAINER_WAKEUP	/* playback state changed (seek, pause, continue) */
 } ContainerCmd_t;
 
 struct Context_s;
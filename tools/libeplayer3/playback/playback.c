@@ -93,6 +93,14 @@ static void SupervisorThread(Context_t *context)
 
 static int PlaybackStop(Context_t  *context);
 
+/* the subtitle renderer sleeps until the next subtitle, wake it up on
+ * any change of the playback position or speed */
+static void PlaybackWakeupSubtitle(Context_t  *context)
+{
+	if (context->container && context->container->assContainer)
+		context->container->assContainer->Command(context, CONTAINER_WAKEUP, NULL);
+}
+
 static int PlaybackOpen(Context_t  *context, char *uri)
 {
 	if (context->playback->isPlaying)
@@ -262,6 +270,7 @@ static int PlaybackPause(Context_t  *context)
 		context->playback->BackWard     = 0;
 		context->playback->SlowMotion   = 0;
 		context->playback->Speed        = 1;
+		PlaybackWakeupSubtitle(context);
 	}
 	else
 	{
@@ -288,6 +297,7 @@ static int PlaybackContinue(Context_t  *context)
 		context->playback->BackWard     = 0;
 		context->playback->SlowMotion   = 0;
 		context->playback->Speed        = 1;
+		PlaybackWakeupSubtitle(context);
 	}
 	else
 	{
@@ -392,6 +402,7 @@ static int PlaybackFastForward(Context_t  *context, int *speed)
 		context->playback->Speed = *speed;
 		playback_printf(20, "Speed: %d x {%d}\n", *speed, context->playback->Speed);
 		context->output->Command(context, OUTPUT_FASTFORWARD, NULL);
+		PlaybackWakeupSubtitle(context);
 	}
 	else
 	{
@@ -443,6 +454,7 @@ static int PlaybackFastBackward(Context_t  *context, int *speed)
 		ret = cERR_PLAYBACK_ERROR;
 	}
 	context->playback->isSeeking = 0;
+	PlaybackWakeupSubtitle(context);
 	playback_printf(10, "exiting with value %d\n", ret);
 	return ret;
 }
@@ -470,6 +482,7 @@ static int PlaybackSlowMotion(Context_t  *context, int *speed)
 		}
 		playback_printf(20, "SlowMotion: %d x {%d}\n", *speed, context->playback->SlowMotion);
 		context->output->Command(context, OUTPUT_SLOWMOTION, NULL);
+		PlaybackWakeupSubtitle(context);
 	}
 	else
 	{
@@ -495,6 +508,7 @@ static int PlaybackSeek(Context_t  *context, float *pos, int absolute)
 #endif
 			context->container->selectedContainer->Command(context, CONTAINER_SEEK, pos);
 		context->playback->isSeeking = 0;
+		PlaybackWakeupSubtitle(context);
 	}
 	else
 	{
@@ -597,11 +611,9 @@ static int PlaybackSwitchSubtitle(Context_t  *context, int *track)
 			 */
 			if (context->container && context->container->assContainer)
 				context->container->assContainer->Command(context, CONTAINER_SWITCH_SUBTITLE, &trackid);
-			if (trackid >= TEXTSRTOFFSET)
-			{
-				if (context->container && context->container->textSrtContainer)
-					context->container->textSrtContainer->Command(context, CONTAINER_SWITCH_SUBTITLE, &trackid);
-			}
+			/* srt cues are fed while playing, stop them for any other track */
+			if (context->container && context->container->textSrtContainer)
+				context->container->textSrtContainer->Command(context, CONTAINER_SWITCH_SUBTITLE, &trackid);
 			if (trackid >= TEXTSSAOFFSET)
 			{
 				if (context->container && context->container->textSsaContainer)
@@ -35,6 +35,7 @@ extern "C" {
 }
 
 #include "libthread.h"
+#include "kfindex.h"
 
 class Player;
 class Track;
@@ -60,6 +61,7 @@ class Input
 
 		Player *player;
 		AVFormatContext *avfc;
+		KeyframeIndex kfIndex;
 		uint64_t readCount;
 		int64_t calcPts(AVStream * stream, int64_t pts);
 
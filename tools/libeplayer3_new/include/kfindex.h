@@ -0,0 +1,81 @@
+/*
+ * keyframe index class
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __KFINDEX_H__
+#define __KFINDEX_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#include "libthread.h"
+
+/*
+ * Byte offset and PTS of every video key frame of a local TS file.
+ * The index is built by a background thread with its own demuxer
+ * and stored in a sidecar file (<file>.kfi) next to the recording,
+ * so next open starts with the complete index.
+ */
+class KeyframeIndex
+{
+	public:
+		struct Entry
+		{
+			int64_t pts;	/* 90kHz, relative to start of file */
+			int64_t pos;	/* byte offset of the key frame packet */
+		};
+
+	private:
+		Mutex mutex;
+		std::vector<Entry> entries;	/* sorted by pts */
+		std::vector<Entry> pending;	/* not yet written to sidecar */
+
+		std::string path;
+		std::string sidecar;
+		int fd;
+		int videoId;
+		int64_t startPts;
+		int64_t fileSize;
+		int64_t resumePos;
+		uint32_t savedCount;
+		bool isComplete;
+
+		pthread_t thread;
+		bool hasThreadStarted;
+		bool abortRequested;
+
+		void add(int64_t pts, int64_t pos);
+		bool load();
+		void flush();
+		void run();
+		static void *indexthread(void *arg);
+		static int interrupt_cb(void *arg);
+
+	public:
+		KeyframeIndex();
+		~KeyframeIndex();
+
+		bool Open(const char *filename, int videoStreamId, int64_t startPts90);
+		bool Start();
+		void Close();
+		bool Lookup(int64_t pts, bool before, Entry &entry);
+};
+
+#endif
+// vim:ts=4
@@ -124,6 +124,9 @@ bool Input::Play()
 	// HACK: Dropping all video frames until the first audio frame was seen will keep player2 from stuttering.
 	bool audioSeen = !audioTrack;
 
+	// index key frames of local recordings in the background, used by seek and reverse play
+	kfIndex.Start();
+
 	while (player->isPlaying && !player->abortRequested)
 	{
 		//IF MOVIE IS PAUSED, WAIT
@@ -141,7 +144,22 @@ bool Input::Play()
 		{
 			if (avfc->iformat->flags & AVFMT_TS_DISCONT)
 			{
-				if (avfc->bit_rate)
+				int64_t pts;
+				KeyframeIndex::Entry entry;
+				if (player->output.GetPts(pts) && kfIndex.Lookup(pts + av_rescale(seek_avts_rel, 90000ll, AV_TIME_BASE), false, entry))
+				{
+					// going back, the key frame on the screen must not be found again
+					if (seek_avts_rel < 0 && entry.pts >= pts && !kfIndex.Lookup(pts, true, entry))
+					{
+						bof = player->isBackWard;
+					}
+					else
+					{
+						seek_target_flag = AVSEEK_FLAG_BYTE;
+						seek_target = entry.pos;
+					}
+				}
+				else if (avfc->bit_rate)
 				{
 					seek_target_flag = AVSEEK_FLAG_BYTE;
 					seek_target = avio_tell(avfc->pb) + av_rescale(seek_avts_rel, avfc->bit_rate, 8 * AV_TIME_BASE);
@@ -161,7 +179,13 @@ bool Input::Play()
 		{
 			if (avfc->iformat->flags & AVFMT_TS_DISCONT)
 			{
-				if (avfc->bit_rate)
+				KeyframeIndex::Entry entry;
+				if (kfIndex.Lookup(av_rescale(seek_avts_abs, 90000ll, AV_TIME_BASE), false, entry))
+				{
+					seek_target_flag = AVSEEK_FLAG_BYTE;
+					seek_target = entry.pos;
+				}
+				else if (avfc->bit_rate)
 				{
 					seek_target_flag = AVSEEK_FLAG_BYTE;
 					seek_target = av_rescale(seek_avts_abs, avfc->bit_rate, 8 * AV_TIME_BASE);
@@ -447,6 +471,11 @@ again:
 	{
 		player->output.SwitchAudio(audioTrack);
 	}
+	if (videoTrack && !player->isHttp && (avfc->iformat->flags & AVFMT_TS_DISCONT))
+	{
+		int64_t start = (avfc->start_time != AV_NOPTS_VALUE) ? av_rescale(avfc->start_time, 90000ll, AV_TIME_BASE) : 0;
+		kfIndex.Open(filename, videoTrack->stream->id, start);
+	}
 	return res;
 }
 
@@ -656,6 +685,8 @@ bool Input::Stop()
 	}
 	av_log(NULL, AV_LOG_QUIET, "%s", "");
 
+	kfIndex.Close();
+
 	if (avfc)
 	{
 		ScopedLock lock(mutex);
@@ -0,0 +1,394 @@
+/*
+ * keyframe index class
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/prctl.h>
+#include <algorithm>
+
+extern "C" {
+#include <libavutil/avutil.h>
+#include <libavformat/avformat.h>
+}
+
+#include "kfindex.h"
+
+static const char *FILENAME = "eplayer/kfindex.cpp";
+
+#define KFINDEX_MAGIC		"KFI1"
+#define KFINDEX_VERSION		1
+#define KFINDEX_FLUSH_ENTRIES	64		/* write sidecar every n new key frames */
+#define KFINDEX_THROTTLE_BYTES	(512 * 1024)	/* sleep after each chunk, keep i/o for playback */
+#define KFINDEX_THROTTLE_US	20000
+#define KFINDEX_MAX_GAP		(10 * 90000)	/* don't trust index beyond last entry + gap */
+
+/* sidecar layout: header followed by count entries in scan order, native byte order */
+struct KeyframeIndexHeader
+{
+	char magic[4];
+	uint32_t version;
+	int64_t fileSize;	/* size of the media file when index was complete */
+	int64_t resumePos;	/* byte offset where the indexer continues */
+	uint32_t count;
+	uint32_t complete;
+};
+
+static bool entryLess(const KeyframeIndex::Entry &a, const KeyframeIndex::Entry &b)
+{
+	return a.pts < b.pts;
+}
+
+KeyframeIndex::KeyframeIndex()
+{
+	fd = -1;
+	videoId = -1;
+	startPts = 0;
+	fileSize = 0;
+	resumePos = 0;
+	savedCount = 0;
+	isComplete = false;
+	hasThreadStarted = false;
+	abortRequested = false;
+}
+
+KeyframeIndex::~KeyframeIndex()
+{
+	Close();
+}
+
+bool KeyframeIndex::Open(const char *filename, int videoStreamId, int64_t startPts90)
+{
+	Close();
+
+	if (!strncmp("file://", filename, 7))
+	{
+		filename += 7;
+	}
+	if (*filename != '/')
+	{
+		return false;
+	}
+
+	struct stat st;
+	if (stat(filename, &st) || !S_ISREG(st.st_mode))
+	{
+		return false;
+	}
+	path = filename;
+	sidecar = path + ".kfi";
+	videoId = videoStreamId;
+	startPts = startPts90;
+	fileSize = st.st_size;
+	abortRequested = false;
+
+	if (!load())
+	{
+		fprintf(stderr, "%s %s %d: no usable index %s\n", FILENAME, __func__, __LINE__, sidecar.c_str());
+	}
+	fprintf(stderr, "%s %s %d: %u key frames, %s\n", FILENAME, __func__, __LINE__,
+		(unsigned int) entries.size(), isComplete ? "complete" : "incomplete");
+	return true;
+}
+
+bool KeyframeIndex::load()
+{
+	struct KeyframeIndexHeader header;
+
+	fd = open(sidecar.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+	{
+		/* read-only media, index is kept in memory only */
+		int rfd = open(sidecar.c_str(), O_RDONLY);
+		if (rfd < 0)
+		{
+			return false;
+		}
+		bool res = (pread(rfd, &header, sizeof(header), 0) == sizeof(header));
+		if (res && !memcmp(header.magic, KFINDEX_MAGIC, 4) && header.version == KFINDEX_VERSION && header.fileSize <= fileSize)
+		{
+			entries.resize(header.count);
+			res = header.count == 0 || pread(rfd, &entries[0], header.count * sizeof(Entry), sizeof(header)) == (ssize_t)(header.count * sizeof(Entry));
+		}
+		else
+		{
+			res = false;
+		}
+		close(rfd);
+		if (!res)
+		{
+			entries.clear();
+			return false;
+		}
+	}
+	else
+	{
+		bool res = (pread(fd, &header, sizeof(header), 0) == sizeof(header))
+			&& !memcmp(header.magic, KFINDEX_MAGIC, 4)
+			&& header.version == KFINDEX_VERSION
+			&& header.fileSize <= fileSize; /* a smaller file was replaced */
+		if (res)
+		{
+			entries.resize(header.count);
+			res = header.count == 0 || pread(fd, &entries[0], header.count * sizeof(Entry), sizeof(header)) == (ssize_t)(header.count * sizeof(Entry));
+		}
+		if (!res)
+		{
+			entries.clear();
+			if (ftruncate(fd, 0))
+			{
+				close(fd);
+				fd = -1;
+			}
+			return false;
+		}
+		savedCount = header.count;
+	}
+
+	std::sort(entries.begin(), entries.end(), entryLess);
+	resumePos = header.resumePos;
+	/* a growing recording is indexed further from resumePos */
+	isComplete = header.complete && header.fileSize == fileSize;
+	return true;
+}
+
+void KeyframeIndex::flush()
+{
+	ScopedLock lock(mutex);
+
+	if (fd < 0)
+	{
+		pending.clear();
+		return;
+	}
+	if (!pending.empty())
+	{
+		ssize_t len = pending.size() * sizeof(Entry);
+		if (pwrite(fd, &pending[0], len, sizeof(KeyframeIndexHeader) + savedCount * sizeof(Entry)) != len)
+		{
+			fprintf(stderr, "%s %s %d: write %s failed\n", FILENAME, __func__, __LINE__, sidecar.c_str());
+			close(fd);
+			fd = -1;
+			pending.clear();
+			return;
+		}
+		savedCount += pending.size();
+		pending.clear();
+	}
+
+	/* header last, a partial update leaves the old count valid */
+	struct KeyframeIndexHeader header;
+	memcpy(header.magic, KFINDEX_MAGIC, 4);
+	header.version = KFINDEX_VERSION;
+	header.fileSize = fileSize;
+	header.resumePos = resumePos;
+	header.count = savedCount;
+	header.complete = isComplete;
+	if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+	{
+		fprintf(stderr, "%s %s %d: write %s failed\n", FILENAME, __func__, __LINE__, sidecar.c_str());
+	}
+}
+
+void KeyframeIndex::add(int64_t pts, int64_t pos)
+{
+	ScopedLock lock(mutex);
+	Entry entry;
+	entry.pts = pts;
+	entry.pos = pos;
+
+	resumePos = pos;
+	std::vector<Entry>::iterator it = std::lower_bound(entries.begin(), entries.end(), entry, entryLess);
+	if (it != entries.end() && it->pts == pts)
+	{
+		return; /* already known, e.g. after resume */
+	}
+	entries.insert(it, entry);
+	pending.push_back(entry);
+}
+
+/*static*/ int KeyframeIndex::interrupt_cb(void *arg)
+{
+	KeyframeIndex *index = (KeyframeIndex *) arg;
+	return index->abortRequested;
+}
+
+void KeyframeIndex::run()
+{
+	AVFormatContext *ic = avformat_alloc_context();
+	if (!ic)
+	{
+		return;
+	}
+	ic->interrupt_callback.callback = interrupt_cb;
+	ic->interrupt_callback.opaque = (void *) this;
+
+	if (avformat_open_input(&ic, path.c_str(), NULL, NULL) < 0)
+	{
+		fprintf(stderr, "%s %s %d: open %s failed\n", FILENAME, __func__, __LINE__, path.c_str());
+		return;
+	}
+	if (resumePos > 0)
+	{
+		avformat_seek_file(ic, -1, INT64_MIN, resumePos, INT64_MAX, AVSEEK_FLAG_BYTE);
+	}
+
+	AVRational tb90k = { 1, 90000 };
+	int64_t throttlePos = avio_tell(ic->pb);
+	bool eof = false;
+
+	while (!abortRequested)
+	{
+		AVPacket packet;
+		av_init_packet(&packet);
+
+		int err = av_read_frame(ic, &packet);
+		if (err == AVERROR(EAGAIN))
+		{
+			av_packet_unref(&packet);
+			continue;
+		}
+		if (err < 0)
+		{
+			eof = (err == AVERROR_EOF);
+			break;
+		}
+
+		AVStream *stream = ic->streams[packet.stream_index];
+		if (stream->id == videoId && (packet.flags & AV_PKT_FLAG_KEY) && packet.pts != AV_NOPTS_VALUE && packet.pos >= 0)
+		{
+			int64_t pts = av_rescale_q(packet.pts, stream->time_base, tb90k) - startPts;
+			if (pts >= 0)
+			{
+				add(pts, packet.pos);
+				if (pending.size() >= KFINDEX_FLUSH_ENTRIES)
+				{
+					flush();
+				}
+			}
+		}
+		av_packet_unref(&packet);
+
+		int64_t pos = avio_tell(ic->pb);
+		if (pos - throttlePos >= KFINDEX_THROTTLE_BYTES)
+		{
+			throttlePos = pos;
+			usleep(KFINDEX_THROTTLE_US);
+		}
+	}
+
+	if (eof)
+	{
+		ScopedLock lock(mutex);
+		fileSize = avio_size(ic->pb);
+		isComplete = true;
+	}
+	avformat_close_input(&ic);
+	flush();
+
+	fprintf(stderr, "%s %s %d: %u key frames, %s\n", FILENAME, __func__, __LINE__,
+		(unsigned int) entries.size(), isComplete ? "complete" : "aborted");
+}
+
+void *KeyframeIndex::indexthread(void *arg)
+{
+	char threadname[17];
+	strncpy(threadname, __func__, sizeof(threadname));
+	threadname[16] = 0;
+	prctl(PR_SET_NAME, (unsigned long) threadname);
+
+	KeyframeIndex *index = (KeyframeIndex *) arg;
+	index->run();
+	pthread_exit(NULL);
+}
+
+bool KeyframeIndex::Start()
+{
+	if (path.empty() || isComplete || hasThreadStarted)
+	{
+		return false;
+	}
+	abortRequested = false;
+	int err = pthread_create(&thread, NULL, indexthread, this);
+	if (err)
+	{
+		fprintf(stderr, "%s %s %d: pthread_create: %d (%s)\n", FILENAME, __func__, __LINE__, err, strerror(err));
+		return false;
+	}
+	hasThreadStarted = true;
+	return true;
+}
+
+void KeyframeIndex::Close()
+{
+	abortRequested = true;
+	if (hasThreadStarted)
+	{
+		pthread_join(thread, NULL);
+		hasThreadStarted = false;
+	}
+	if (fd > -1)
+	{
+		flush();
+		close(fd);
+		fd = -1;
+	}
+
+	ScopedLock lock(mutex);
+	entries.clear();
+	pending.clear();
+	path.clear();
+	sidecar.clear();
+	resumePos = 0;
+	savedCount = 0;
+	isComplete = false;
+}
+
+/* Find the last key frame at or before pts (strictly before if requested). */
+bool KeyframeIndex::Lookup(int64_t pts, bool before, Entry &entry)
+{
+	ScopedLock lock(mutex);
+
+	if (entries.empty())
+	{
+		return false;
+	}
+	if (!isComplete && pts > entries.back().pts + KFINDEX_MAX_GAP)
+	{
+		return false; /* indexer did not get there yet */
+	}
+
+	Entry probe;
+	probe.pts = pts;
+	probe.pos = 0;
+	std::vector<Entry>::iterator it = before
+		? std::lower_bound(entries.begin(), entries.end(), probe, entryLess)
+		: std::upper_bound(entries.begin(), entries.end(), probe, entryLess);
+	if (it == entries.begin())
+	{
+		return false;
+	}
+	entry = *(it - 1);
+	return true;
+}
+// vim:ts=4
@@ -0,0 +1,169 @@
+/*
+ * libmmeimage directory decode benchmark
+ *
+ * Decodes every JPEG of a directory to the target size, first with
+ * decode_jpeg_noalloc, then twice with decode_jpeg_thumbnail: once with
+ * an empty thumbnail cache and once served from the cache. Prints the
+ * time per image for each pass. Without libmme_host.so or /dev/bpamem0
+ * the decodes take the libjpeg fallback.
+ *
+ * usage: decode_bench <directory> [width height] [cache directory]
+ */
+
+#include "libmmeimage.h"
+#include "libmmeimg_error.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define BENCH_MAX_FILES 4096
+
+static char *files[BENCH_MAX_FILES];
+static int num_files = 0;
+
+static long long now_us(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static int is_jpeg(const char *name)
+{
+	const char *ext = strrchr(name, '.');
+	return ext && (!strcasecmp(ext, ".jpg") || !strcasecmp(ext, ".jpeg"));
+}
+
+static void scan_dir(const char *dir)
+{
+	struct dirent *de;
+	DIR *d = opendir(dir);
+
+	if (!d)
+		return;
+	while ((de = readdir(d)) != NULL && num_files < BENCH_MAX_FILES)
+	{
+		char path[1024];
+		struct stat st;
+
+		if (!is_jpeg(de->d_name))
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		if (stat(path, &st) || !S_ISREG(st.st_mode))
+			continue;
+		files[num_files++] = strdup(path);
+	}
+	closedir(d);
+}
+
+// removes the files of the benchmark cache, the directory itself is kept
+static void clear_cache(const char *dir)
+{
+	struct dirent *de;
+	DIR *d = opendir(dir);
+
+	if (!d)
+		return;
+	while ((de = readdir(d)) != NULL)
+	{
+		char path[1024];
+
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		unlink(path);
+	}
+	closedir(d);
+}
+
+static void report(const char *pass, int ok, long long us)
+{
+	printf("%-16s %4d images %10.2f ms/image %8.1f images/s\n", pass, ok,
+	       ok ? us / 1000.0 / ok : 0.0, us ? ok * 1000000.0 / us : 0.0);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int width = 160, height = 120;
+	const char *cache = "/tmp/mmeimg_bench";
+	char *dest;
+	long long start, us;
+	int i, ok;
+
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: %s <directory> [width height] [cache directory]\n", argv[0]);
+		return 1;
+	}
+	if (argc > 3)
+	{
+		width = atoi(argv[2]);
+		height = atoi(argv[3]);
+	}
+	if (argc > 4)
+		cache = argv[4];
+	if (!width || !height)
+		return 1;
+
+	scan_dir(argv[1]);
+	if (!num_files)
+	{
+		fprintf(stderr, "no jpeg files in %s\n", argv[1]);
+		return 1;
+	}
+
+	dest = (char *)malloc(width * height * 3);
+	if (!dest)
+		return 1;
+
+	printf("%d images, target %ux%u\n", num_files, width, height);
+
+	ok = 0;
+	start = now_us();
+	for (i = 0; i < num_files; i++)
+	{
+		unsigned int w, h;
+		FILE *fp = fopen(files[i], "rb");
+
+		if (!fp)
+			continue;
+		if (get_jpeg_img_size(fp, &w, &h) == LIBMMEIMG_SUCCESS &&
+		        decode_jpeg_noalloc(fp, w, h, width, height, dest, 0) == LIBMMEIMG_SUCCESS)
+			ok++;
+		fclose(fp);
+	}
+	us = now_us() - start;
+	report("decode", ok, us);
+
+	mkdir(cache, 0755);
+	clear_cache(cache);
+	set_thumbnail_cache_dir(cache);
+
+	ok = 0;
+	start = now_us();
+	for (i = 0; i < num_files; i++)
+		if (decode_jpeg_thumbnail(files[i], width, height, dest) == LIBMMEIMG_SUCCESS)
+			ok++;
+	us = now_us() - start;
+	report("thumbnail cold", ok, us);
+
+	ok = 0;
+	start = now_us();
+	for (i = 0; i < num_files; i++)
+		if (decode_jpeg_thumbnail(files[i], width, height, dest) == LIBMMEIMG_SUCCESS)
+			ok++;
+	us = now_us() - start;
+	report("thumbnail cached", ok, us);
+
+	clear_cache(cache);
+	rmdir(cache);
+
+	for (i = 0; i < num_files; i++)
+		free(files[i]);
+	free(dest);
+	return 0;
+}
@@ -53,6 +53,7 @@ MME_InitTransformer_func MME_InitTransformer = (MME_InitTransformer_func) _mme_d
 MME_TermTransformer_func MME_TermTransformer = (MME_TermTransformer_func) _mme_default_func;
 
 void *libmme;
+static int libmme_unavailable = 0; // dlopen failed once, don't retry for every image
 
 
 MME_ERROR _mme_default_func(void)
@@ -76,6 +77,9 @@ inline void print_mme_error(MME_ERROR e)
 
 LIBMMEIMG_ERROR mme_loadlib(void)
 {
+	if (libmme_unavailable)
+		return LIBMMEIMG_MISC_ERROR;
+
 	if (!libmme)
 	{
 		if ((libmme = dlopen("libmme_host.so", RTLD_LAZY)) != NULL)
@@ -111,6 +115,7 @@ LIBMMEIMG_ERROR mme_loadlib(void)
 		if (!libmme)
 		{
 			DEBUG_PRINT("%s: Couldn't resolve libmme_host.so!\n", __FUNCTION__);
+			libmme_unavailable = 1;
 			return LIBMMEIMG_MISC_ERROR;
 		}
 	}
@@ -22,6 +22,21 @@ LIBMMEIMG_ERROR decode_jpeg(FILE *fp, unsigned int original_width, unsigned int
 // output is in BGR (3 bytes per pixel), but allocs no memory
 LIBMMEIMG_ERROR decode_jpeg_noalloc(FILE *fp, unsigned int original_width, unsigned int original_height, unsigned int dst_width, unsigned int dst_height, char *dest_data, int mem_is_hw_writeable);
 
+// Without the hardware decoder (libmme_host.so or bpamem not available) the decode functions
+// above fall back to libjpeg, decoding scaled down in the DCT domain.
+
+// Decodes path to a dst_width x dst_height BGR thumbnail (3 bytes per pixel). Thumbnails are
+// cached on disk, keyed by path, modification time, file size and thumbnail size, so every
+// image is decoded only once.
+LIBMMEIMG_ERROR decode_jpeg_thumbnail(const char *path, unsigned int dst_width, unsigned int dst_height, char *dest_data);
+
+// directory of the thumbnail cache (default /tmp/mmeimg_thumbs), NULL disables the cache
+void set_thumbnail_cache_dir(const char *dir);
+
+// upper bound of the thumbnail cache in bytes (default 8 MiB), least recently used thumbnails
+// are removed when it is exceeded
+void set_thumbnail_cache_size(unsigned int max_bytes);
+
 #ifdef __cplusplus
 }
 #endif
@@ -119,6 +119,8 @@ void jpeg_transformer_callback(MME_Event_t event, MME_Command_t *callback_data,
 	};
 }
 
+static LIBMMEIMG_ERROR decode_jpeg_sw(FILE *fp, unsigned int dst_width, unsigned int dst_height, char *dest_data);
+
 // sequentiallize the requests
 static sem_t jpeg_sem;
 static int jpeg_sem_initialized = 0;
@@ -168,7 +170,8 @@ LIBMMEIMG_ERROR decode_jpeg_noalloc(FILE *fp, unsigned int original_width, unsig
 	if (res_img != LIBMMEIMG_SUCCESS)
 	{
 		sem_post(&jpeg_sem);
-		return res_img;
+		DEBUG_PRINT("no hardware decoder, decoding in software");
+		return decode_jpeg_sw(fp, dst_width, dst_height, dest_data);
 	}
 
 	fseek(fp, 0, SEEK_END);
@@ -183,9 +186,9 @@ LIBMMEIMG_ERROR decode_jpeg_noalloc(FILE *fp, unsigned int original_width, unsig
 
 	if (fd_bpa < 0)
 	{
-		DEBUG_PRINT("cannot access /dev/bpamem0! err = %d", fd_bpa);
+		DEBUG_PRINT("cannot access /dev/bpamem0! err = %d, decoding in software", fd_bpa);
 		sem_post(&jpeg_sem);
-		return LIBMMEIMG_NO_DEVACCESS;
+		return decode_jpeg_sw(fp, dst_width, dst_height, dest_data);
 	}
 
 	bpa_data.bpa_part = "LMI_VID";		// TODO: good for ufs910 - please adapt this for other boxes
@@ -376,7 +379,8 @@ LIBMMEIMG_ERROR get_jpeg_img_size(FILE *fp, unsigned int *width, unsigned int *h
 	jpeg_stdio_src(ciptr, fp);
 	jpeg_read_header(ciptr, TRUE);
 
-	jpeg_start_decompress(ciptr);
+	// only the dimensions are needed, no need to set up the decoder
+	jpeg_calc_output_dimensions(ciptr);
 
 	*width = ciptr->output_width;
 	*height = ciptr->output_height;
@@ -386,3 +390,157 @@ LIBMMEIMG_ERROR get_jpeg_img_size(FILE *fp, unsigned int *width, unsigned int *h
 	fseek(fp, 0, SEEK_SET);
 	return LIBMMEIMG_SUCCESS;
 }
+
+// choose the smallest DCT scaling (1/8, 1/4, 1/2) that still covers the target size
+static unsigned int sw_scale_denom(unsigned int width, unsigned int height, unsigned int dst_width, unsigned int dst_height)
+{
+	unsigned int denom;
+
+	for (denom = 8; denom > 1; denom >>= 1)
+		if ((width + denom - 1) / denom >= dst_width && (height + denom - 1) / denom >= dst_height)
+			break;
+	return denom;
+}
+
+// libjpeg decode scaled down in the DCT domain, the rest is done by averaging (or
+// picking pixels when the image is smaller than the target)
+static LIBMMEIMG_ERROR decode_jpeg_sw(FILE *fp, unsigned int dst_width, unsigned int dst_height, char *dest_data)
+{
+	struct jpeg_decompress_struct cinfo;
+	struct r_jpeg_error_mgr emgr;
+	unsigned int *volatile sum = NULL;
+	unsigned int *volatile xmap = NULL;
+	unsigned int *xcount;
+	unsigned int out_width, out_height, x, y, c, dy, rows, downscale;
+	unsigned char *dst = (unsigned char *)dest_data;
+	JSAMPARRAY line;
+
+	if (!dst_width || !dst_height)
+		return LIBMMEIMG_INVALIDARG;
+
+	fseek(fp, 0, SEEK_SET);
+
+	cinfo.err = jpeg_std_error(&emgr.pub);
+	emgr.pub.error_exit = jpeg_cb_error_exit;
+	if (setjmp(emgr.envbuffer) == 1)
+	{
+		jpeg_destroy_decompress(&cinfo);
+		free(sum);
+		free(xmap);
+		return LIBMMEIMG_DECODE_ERROR;
+	}
+
+	jpeg_create_decompress(&cinfo);
+	jpeg_stdio_src(&cinfo, fp);
+	jpeg_read_header(&cinfo, TRUE);
+
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = sw_scale_denom(cinfo.image_width, cinfo.image_height, dst_width, dst_height);
+	cinfo.out_color_space = JCS_RGB;
+	cinfo.dct_method = JDCT_IFAST;
+	cinfo.do_fancy_upsampling = FALSE;
+
+	jpeg_start_decompress(&cinfo);
+
+	out_width = cinfo.output_width;
+	out_height = cinfo.output_height;
+	DEBUG_PRINT("software decode %dx%d -> 1/%d %dx%d -> %dx%d", cinfo.image_width, cinfo.image_height, cinfo.scale_denom, out_width, out_height, dst_width, dst_height);
+
+	if (cinfo.output_components != 3)
+	{
+		jpeg_destroy_decompress(&cinfo);
+		return LIBMMEIMG_DECODE_ERROR;
+	}
+
+	downscale = (out_width >= dst_width && out_height >= dst_height);
+	sum = (unsigned int *)calloc(dst_width * 4, sizeof(unsigned int));
+	xmap = (unsigned int *)malloc((downscale ? out_width : dst_width) * sizeof(unsigned int));
+	if (!sum || !xmap)
+	{
+		jpeg_destroy_decompress(&cinfo);
+		free(sum);
+		free(xmap);
+		return LIBMMEIMG_NOMEM;
+	}
+	xcount = sum + dst_width * 3;
+
+	if (downscale)
+	{
+		// destination column of every source column
+		for (x = 0; x < out_width; x++)
+		{
+			xmap[x] = x * dst_width / out_width;
+			xcount[xmap[x]]++;
+		}
+	}
+	else
+	{
+		// source column of every destination column
+		for (x = 0; x < dst_width; x++)
+			xmap[x] = x * out_width / dst_width;
+	}
+
+	line = (*cinfo.mem->alloc_sarray)((j_common_ptr)&cinfo, JPOOL_IMAGE, out_width * 3, 1);
+
+	dy = 0;
+	rows = 0;
+	while (cinfo.output_scanline < out_height)
+	{
+		unsigned char *src;
+
+		y = cinfo.output_scanline;
+		jpeg_read_scanlines(&cinfo, line, 1);
+		src = line[0];
+
+		if (downscale)
+		{
+			for (x = 0; x < out_width; x++, src += 3)
+			{
+				unsigned int *s = sum + xmap[x] * 3;
+				s[0] += src[0];
+				s[1] += src[1];
+				s[2] += src[2];
+			}
+			rows++;
+
+			// last source row of this destination row, output BGR
+			if (y + 1 == out_height || (y + 1) * dst_height / out_height != dy)
+			{
+				unsigned char *d = dst + dy * dst_width * 3;
+				for (x = 0; x < dst_width; x++, d += 3)
+				{
+					unsigned int n = xcount[x] * rows;
+					unsigned int *s = sum + x * 3;
+					d[0] = s[2] / n;
+					d[1] = s[1] / n;
+					d[2] = s[0] / n;
+					s[0] = s[1] = s[2] = 0;
+				}
+				rows = 0;
+				dy++;
+			}
+		}
+		else
+		{
+			// every destination row sampling this source row
+			for (; dy < dst_height && dy * out_height / dst_height == y; dy++)
+			{
+				unsigned char *d = dst + dy * dst_width * 3;
+				for (x = 0; x < dst_width; x++, d += 3)
+				{
+					unsigned char *s = src + xmap[x] * 3;
+					for (c = 0; c < 3; c++)
+						d[c] = s[2 - c];
+				}
+			}
+		}
+	}
+
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	free(sum);
+	free(xmap);
+	fseek(fp, 0, SEEK_SET);
+
+	return LIBMMEIMG_SUCCESS;
+}
@@ -0,0 +1,238 @@
+#include "libmmeimage.h"
+#include "libmmeimg_error.h"
+#include "libmmeimg_debug.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+
+// on-disk thumbnail cache, one file per image and thumbnail size:
+// header followed by the raw BGR thumbnail. The default directory is on tmpfs,
+// so the cache is capped; a hit touches the file and the least recently used
+// thumbnails are removed once the cap is exceeded.
+
+#define THUMB_MAGIC        0x4d4d5431 // "MMT1"
+#define THUMB_DEFAULT_DIR  "/tmp/mmeimg_thumbs"
+#define THUMB_DEFAULT_MAX  (8 * 1024 * 1024)
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t width;
+	uint32_t height;
+	uint32_t reserved;
+	int64_t  mtime;
+	int64_t  size;
+} ThumbHeader;
+
+typedef struct
+{
+	char    name[64];
+	time_t  mtime;
+	off_t   size;
+} ThumbEntry;
+
+static char thumb_dir[256] = THUMB_DEFAULT_DIR;
+static int64_t thumb_max_bytes = THUMB_DEFAULT_MAX;
+static int64_t thumb_bytes = -1; // estimate of the cache size, -1 until the directory was scanned
+
+void set_thumbnail_cache_dir(const char *dir)
+{
+	if (dir)
+	{
+		strncpy(thumb_dir, dir, sizeof(thumb_dir) - 1);
+		thumb_dir[sizeof(thumb_dir) - 1] = 0;
+	}
+	else
+		thumb_dir[0] = 0;
+	thumb_bytes = -1;
+}
+
+void set_thumbnail_cache_size(unsigned int max_bytes)
+{
+	thumb_max_bytes = max_bytes;
+}
+
+// FNV-1a
+static uint64_t thumb_hash(const char *str)
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	while (*str)
+	{
+		hash ^= (unsigned char)*str++;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static void thumb_filename(char *name, size_t len, const char *path, const struct stat *st, unsigned int width, unsigned int height)
+{
+	snprintf(name, len, "%s/%016llx_%llx_%llx_%ux%u", thumb_dir, (unsigned long long)thumb_hash(path),
+		 (unsigned long long)st->st_mtime, (unsigned long long)st->st_size, width, height);
+}
+
+static int thumb_load(const char *name, const struct stat *st, unsigned int width, unsigned int height, char *dest_data)
+{
+	ThumbHeader header;
+	size_t len = width * height * 3;
+	int fd, ok;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	ok = read(fd, &header, sizeof(header)) == sizeof(header) &&
+	     header.magic == THUMB_MAGIC && header.width == width && header.height == height &&
+	     header.mtime == (int64_t)st->st_mtime && header.size == (int64_t)st->st_size &&
+	     read(fd, dest_data, len) == (ssize_t)len;
+	close(fd);
+	if (ok)
+		utime(name, NULL);
+	return ok;
+}
+
+static int thumb_entry_cmp(const void *a, const void *b)
+{
+	const ThumbEntry *ea = a, *eb = b;
+
+	return (ea->mtime > eb->mtime) - (ea->mtime < eb->mtime);
+}
+
+// rescans the directory, the sum is exact again even if other processes share the cache;
+// above the cap the oldest thumbnails are removed down to 3/4 of it, so not every store rescans
+static void thumb_evict(void)
+{
+	ThumbEntry *entries = NULL, *tmp;
+	size_t count = 0, alloc = 0, i;
+	char name[300];
+	struct dirent *de;
+	struct stat st;
+	int64_t total = 0;
+	DIR *dir;
+
+	dir = opendir(thumb_dir);
+	if (!dir)
+		return;
+
+	while ((de = readdir(dir)))
+	{
+		// skips ".", ".." and temporary files still being written
+		if (strchr(de->d_name, '.') || strlen(de->d_name) >= sizeof(entries->name))
+			continue;
+		snprintf(name, sizeof(name), "%s/%s", thumb_dir, de->d_name);
+		if (stat(name, &st) || !S_ISREG(st.st_mode))
+			continue;
+		if (count == alloc)
+		{
+			alloc = alloc ? alloc * 2 : 64;
+			tmp = realloc(entries, alloc * sizeof(*entries));
+			if (!tmp)
+				break;
+			entries = tmp;
+		}
+		strcpy(entries[count].name, de->d_name);
+		entries[count].mtime = st.st_mtime;
+		entries[count].size = st.st_size;
+		total += st.st_size;
+		count++;
+	}
+	closedir(dir);
+
+	if (total > thumb_max_bytes)
+	{
+		qsort(entries, count, sizeof(*entries), thumb_entry_cmp);
+		for (i = 0; i < count && total > thumb_max_bytes / 4 * 3; i++)
+		{
+			snprintf(name, sizeof(name), "%s/%s", thumb_dir, entries[i].name);
+			if (!unlink(name))
+				total -= entries[i].size;
+		}
+		DEBUG_PRINT("thumbnail cache trimmed to %lld bytes", (long long)total);
+	}
+	free(entries);
+	thumb_bytes = total;
+}
+
+// written to a temporary file first, readers never see a partial thumbnail
+static void thumb_store(const char *name, const struct stat *st, unsigned int width, unsigned int height, const char *data)
+{
+	ThumbHeader header;
+	size_t len = width * height * 3;
+	char tmpname[300];
+	int fd, ok;
+
+	if (mkdir(thumb_dir, 0755) && errno != EEXIST)
+	{
+		DEBUG_PRINT("cannot create %s", thumb_dir);
+		return;
+	}
+
+	snprintf(tmpname, sizeof(tmpname), "%s.%d", name, (int)getpid());
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = THUMB_MAGIC;
+	header.width = width;
+	header.height = height;
+	header.mtime = st->st_mtime;
+	header.size = st->st_size;
+
+	ok = write(fd, &header, sizeof(header)) == sizeof(header) &&
+	     write(fd, data, len) == (ssize_t)len;
+	ok = !close(fd) && ok;
+	if (!ok || rename(tmpname, name))
+	{
+		unlink(tmpname);
+		return;
+	}
+
+	if (thumb_bytes >= 0)
+		thumb_bytes += sizeof(header) + len;
+	if (thumb_bytes < 0 || thumb_bytes > thumb_max_bytes)
+		thumb_evict();
+}
+
+LIBMMEIMG_ERROR decode_jpeg_thumbnail(const char *path, unsigned int dst_width, unsigned int dst_height, char *dest_data)
+{
+	char name[300];
+	struct stat st;
+	unsigned int width, height;
+	LIBMMEIMG_ERROR res;
+	FILE *fp;
+
+	if (!path || !dest_data || !dst_width || !dst_height)
+		return LIBMMEIMG_INVALIDARG;
+
+	if (stat(path, &st))
+		return LIBMMEIMG_INVALIDARG;
+
+	if (thumb_dir[0])
+	{
+		thumb_filename(name, sizeof(name), path, &st, dst_width, dst_height);
+		if (thumb_load(name, &st, dst_width, dst_height, dest_data))
+			return LIBMMEIMG_SUCCESS;
+	}
+
+	fp = fopen(path, "rb");
+	if (!fp)
+		return LIBMMEIMG_INVALIDARG;
+
+	res = get_jpeg_img_size(fp, &width, &height);
+	if (res == LIBMMEIMG_SUCCESS)
+		res = decode_jpeg_noalloc(fp, width, height, dst_width, dst_height, dest_data, 0);
+	fclose(fp);
+
+	if (res == LIBMMEIMG_SUCCESS && thumb_dir[0])
+		thumb_store(name, &st, dst_width, dst_height, dest_data);
+
+	return res;
+}
@@ -22,6 +22,9 @@
 #include <linux/dvb/version.h>
 #include <stdarg.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <signal.h>
 #include <errno.h>
 
 #define MAX_PIDS 32
@@ -29,6 +32,11 @@
 
 #define BSIZE                    188*388//1024*16
 
+#define DAEMON_PORT              8001
+#define DAEMON_MAX_EVENTS        32
+#define SERVICE_RING_SIZE        (BSIZE * 16)
+#define CLIENT_REQUEST_LENGTH    (MAX_LINE_LENGTH * 4)
+
 #define HAVE_ADD_PID
 
 #ifdef HAVE_ADD_PID
@@ -46,32 +54,51 @@ typedef enum
 #endif
 
 
-char response_line[MAX_LINE_LENGTH];
-int response_p;
-
-int upstream;
-int upstream_state, upstream_response_code;
-/*
- 0 - response
- 1 - options
- 2 - body
- */
+/* one enigma2 stream request, shared by all clients of a service in daemon mode */
+struct upstream_s
+{
+	int fd;
+	int state;
+	/*
+	 0 - response
+	 1 - options
+	 2 - body
+	 3 - HTTP response sent
+	 */
+	int response_code;
+	char response_line[MAX_LINE_LENGTH];
+	int response_p;
+	int out_fd; /* where the HTTP response goes, -1 if the caller sends it */
 #ifdef HAVE_ADD_PID
-int demux_fd = -1;
+	int demux_fd;
 #else
-int dvr_fd = -1;
-int open_pids[MAX_PIDS];
+	int dvr_fd;
+	int open_pids[MAX_PIDS];
 #endif
+	int active_pids[MAX_PIDS];
+	char *reason;
+	char reason_buf[MAX_LINE_LENGTH];
+	char wwwauthenticate[MAX_LINE_LENGTH]; /* the saved WWW-Authenticate:-server-header, which will be forwarded to user client */
+};
 
-char *reason = "";
+#ifdef HAVE_ADD_PID
+#define UPSTREAM_DATA_FD(u)      ((u)->demux_fd)
+#else
+#define UPSTREAM_DATA_FD(u)      ((u)->dvr_fd)
+#endif
 
-int active_pids[MAX_PIDS];
+static const char response_ok[] = "HTTP/1.0 200 OK\r\nConnection: Close\r\nContent-Type: video/mpeg\r\nServer: stream_enigma2\r\n\r\n";
 
-int handle_upstream(void);
-int handle_upstream_line(void);
+void upstream_init(struct upstream_s *u);
+int upstream_connect(struct upstream_s *u, const char *service_ref, const char *authorization);
+int upstream_open(struct upstream_s *u, int nonblock);
+int upstream_send_request(struct upstream_s *u, const char *service_ref, const char *authorization);
+void upstream_close(struct upstream_s *u);
+int handle_upstream(struct upstream_s *u);
+int handle_upstream_line(struct upstream_s *u);
+int run_daemon(int port);
 
 char authorization[MAX_LINE_LENGTH]; /* the saved Authorization:-client-header which will be forwarded to the server */
-char wwwauthenticate[MAX_LINE_LENGTH]; /* the saved WWW-Authenticate:-server-header, which will be forwarded to user client */
 
 void logOutput(char *FormatStr, ...)
 {
@@ -100,10 +127,11 @@ void logOutput(char *FormatStr, ...)
 
 int main(int argc, char **argv)
 {
-	char request[MAX_LINE_LENGTH], upstream_request[256];
+	char request[MAX_LINE_LENGTH];
 	char *c, *service_ref;
 	int used = 0;
 	char buffer[BSIZE];
+	struct upstream_s upstream;
 
 	if (argc == 2 && !strncmp(argv[1], "--help", 6))
 	{
@@ -117,9 +145,16 @@ int main(int argc, char **argv)
 #else
 		printf("Linux Dvb API 3\n");
 #endif
+		printf("usage: streamproxy            serve one client on stdin/stdout (inetd)\n");
+		printf("       streamproxy -d [port]  serve all clients, one demux per service (default port %d)\n", DAEMON_PORT);
 		exit(0);
 	}
 
+	if (argc >= 2 && !strcmp(argv[1], "-d"))
+	{
+		return run_daemon(argc > 2 ? atoi(argv[2]) : DAEMON_PORT);
+	}
+
 	logOutput("starting streamproxy\n");
 #ifdef HAVE_ADD_PID
 	logOutput("HAVE_ADD_PID\n");
@@ -148,9 +183,8 @@ int main(int argc, char **argv)
 
 	service_ref = c;
 
-	int i;
-	for (i = 0; i < MAX_PIDS; ++i)
-		active_pids[i] = -1;
+	upstream_init(&upstream);
+	upstream.out_fd = 1;
 
 	while (1)
 	{
@@ -171,20 +205,7 @@ int main(int argc, char **argv)
 	}
 
 	/* connect to enigma2 */
-	upstream = socket(PF_INET, SOCK_STREAM, 0);
-
-	struct sockaddr_in sin;
-	sin.sin_family = AF_INET;
-	sin.sin_port = htons(80);
-	sin.sin_addr.s_addr = inet_addr("127.0.0.1");
-	if (connect(upstream, (struct sockaddr *)&sin, sizeof(struct sockaddr_in)))
-	{
-		reason = "Upstream connect failed.";
-		goto bad_gateway;
-	}
-
-	snprintf(upstream_request, sizeof(upstream_request), "GET /web/stream?StreamService=%s HTTP/1.0\r\n%s\r\n", service_ref, authorization);
-	if (write(upstream, upstream_request, strlen(upstream_request)) != strlen(upstream_request))
+	if (upstream_connect(&upstream, service_ref, authorization))
 		goto bad_gateway;
 	while (1)
 	{
@@ -192,12 +213,12 @@ int main(int argc, char **argv)
 		fd_set w;
 		FD_ZERO(&r);
 		FD_ZERO(&w);
-		FD_SET(upstream, &r);
+		FD_SET(upstream.fd, &r);
 		FD_SET(0, &r);
 		FD_SET(1, &w);
 #ifdef HAVE_ADD_PID
-		if (demux_fd != -1)
-			FD_SET(demux_fd, &r);
+		if (upstream.demux_fd != -1)
+			FD_SET(upstream.demux_fd, &r);
 
 		if (select(5, &r, &w , 0, 0) < 0)
 			break;
@@ -207,13 +228,13 @@ int main(int argc, char **argv)
 				break;
 
 		/* handle enigma responses */
-		if (FD_ISSET(upstream, &r))
-			if (handle_upstream())
+		if (FD_ISSET(upstream.fd, &r))
+			if (handle_upstream(&upstream))
 				break;
 
-		if (demux_fd > 0 && BSIZE - used > 187 && FD_ISSET(demux_fd, &r))
+		if (upstream.demux_fd > 0 && BSIZE - used > 187 && FD_ISSET(upstream.demux_fd, &r))
 		{
-			int r = read(demux_fd, buffer + used, BSIZE - used);
+			int r = read(upstream.demux_fd, buffer + used, BSIZE - used);
 			//logOutput("read %d bytes from demux0\n", r);
 			if (r < 0)
 			{
@@ -231,8 +252,8 @@ int main(int argc, char **argv)
 		}
 
 #else
-		if (dvr_fd != -1)
-			FD_SET(dvr_fd, &r);
+		if (upstream.dvr_fd != -1)
+			FD_SET(upstream.dvr_fd, &r);
 
 		if (select(5, &r, 0, 0, 0) < 0)
 			break;
@@ -244,15 +265,15 @@ int main(int argc, char **argv)
 			/* handle enigma responses */
 		}
 
-		if (FD_ISSET(upstream, &r))
+		if (FD_ISSET(upstream.fd, &r))
 		{
-			if (handle_upstream())
+			if (handle_upstream(&upstream))
 				break;
 		}
 
-		if (dvr_fd > 0 && FD_ISSET(dvr_fd, &r))
+		if (upstream.dvr_fd > 0 && FD_ISSET(upstream.dvr_fd, &r))
 		{
-			int r = read(dvr_fd, buffer, BSIZE);
+			int r = read(upstream.dvr_fd, buffer, BSIZE);
 			//logOutput("read %d bytes from dvr0\n", r);
 			if (r < 0)
 			{
@@ -264,7 +285,7 @@ int main(int argc, char **argv)
 #endif
 	}
 
-	if (upstream_state != 3)
+	if (upstream.state != 3)
 		goto bad_gateway;
 
 	return 0;
@@ -273,18 +294,109 @@ bad_request:
 	return 1;
 bad_gateway:
 	printf("HTTP/1.0 %s\r\n%s\r\n%s\r\n",
-	       upstream_response_code == 401 ? "401 Unauthorized" : "502 Bad Gateway",
-	       wwwauthenticate, reason);
+	       upstream.response_code == 401 ? "401 Unauthorized" : "502 Bad Gateway",
+	       upstream.wwwauthenticate, upstream.reason);
 	return 1;
 }
 
-int handle_upstream(void)
+void upstream_init(struct upstream_s *u)
+{
+	int i;
+
+	memset(u, 0, sizeof(*u));
+	u->fd = -1;
+	u->out_fd = -1;
+#ifdef HAVE_ADD_PID
+	u->demux_fd = -1;
+#else
+	u->dvr_fd = -1;
+#endif
+	u->reason = "";
+	for (i = 0; i < MAX_PIDS; ++i)
+		u->active_pids[i] = -1;
+}
+
+int upstream_connect(struct upstream_s *u, const char *service_ref, const char *authorization)
+{
+	if (upstream_open(u, 0))
+		return 1;
+	return upstream_send_request(u, service_ref, authorization);
+}
+
+/* with nonblock the connect is only started, upstream_send_request
+   has to be called when the socket becomes writable */
+int upstream_open(struct upstream_s *u, int nonblock)
+{
+	u->fd = socket(PF_INET, SOCK_STREAM, 0);
+	if (u->fd < 0)
+	{
+		u->reason = "Upstream connect failed.";
+		return 1;
+	}
+	if (nonblock)
+		fcntl(u->fd, F_SETFL, fcntl(u->fd, F_GETFL) | O_NONBLOCK);
+
+	struct sockaddr_in sin;
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(80);
+	sin.sin_addr.s_addr = inet_addr("127.0.0.1");
+	if (connect(u->fd, (struct sockaddr *)&sin, sizeof(struct sockaddr_in)) && !(nonblock && errno == EINPROGRESS))
+	{
+		u->reason = "Upstream connect failed.";
+		return 1;
+	}
+	return 0;
+}
+
+int upstream_send_request(struct upstream_s *u, const char *service_ref, const char *authorization)
+{
+	char upstream_request[256];
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	/* result of a non-blocking connect */
+	if (getsockopt(u->fd, SOL_SOCKET, SO_ERROR, &err, &len) || err)
+	{
+		u->reason = "Upstream connect failed.";
+		return 1;
+	}
+
+	snprintf(upstream_request, sizeof(upstream_request), "GET /web/stream?StreamService=%s HTTP/1.0\r\n%s\r\n", service_ref, authorization);
+	if (write(u->fd, upstream_request, strlen(upstream_request)) != strlen(upstream_request))
+		return 1;
+	return 0;
+}
+
+void upstream_close(struct upstream_s *u)
+{
+	if (u->fd >= 0)
+		close(u->fd);
+	u->fd = -1;
+#ifdef HAVE_ADD_PID
+	if (u->demux_fd >= 0)
+		close(u->demux_fd);
+	u->demux_fd = -1;
+#else
+	int i;
+	for (i = 0; i < MAX_PIDS; ++i)
+		if (u->active_pids[i] != -1)
+			close(u->open_pids[i]);
+	if (u->dvr_fd >= 0)
+		close(u->dvr_fd);
+	u->dvr_fd = -1;
+#endif
+}
+
+int handle_upstream(struct upstream_s *u)
 {
 	char buffer[MAX_LINE_LENGTH];
-	int n = read(upstream, buffer, MAX_LINE_LENGTH);
+	int n = read(u->fd, buffer, MAX_LINE_LENGTH);
 	if (n == 0)
 		return 1;
 
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+
 	if (n < 0)
 	{
 		perror("read");
@@ -304,26 +416,26 @@ int handle_upstream(void)
 			next_line++;
 
 		valid = next_line - c;
-		if (valid > sizeof(response_line) - response_p)
+		if (valid > sizeof(u->response_line) - u->response_p)
 		{
 			return 1;
 		}
 
-		memcpy(response_line + response_p, c, valid);
+		memcpy(u->response_line + u->response_p, c, valid);
 		c += valid;
-		response_p += valid;
+		u->response_p += valid;
 		n -= valid;
 
 		/* line received? */
-		if (response_line[response_p - 1] == '\n')
+		if (u->response_line[u->response_p - 1] == '\n')
 		{
-			response_line[response_p - 1] = 0;
+			u->response_line[u->response_p - 1] = 0;
 
-			if (response_p >= 2 && response_line[response_p - 2] == '\r')
-				response_line[response_p - 2] = 0;
-			response_p = 0;
+			if (u->response_p >= 2 && u->response_line[u->response_p - 2] == '\r')
+				u->response_line[u->response_p - 2] = 0;
+			u->response_p = 0;
 
-			if (handle_upstream_line())
+			if (handle_upstream_line(u))
 			{
 				return 1;
 			}
@@ -332,50 +444,51 @@ int handle_upstream(void)
 	return 0;
 }
 
-int handle_upstream_line(void)
+int handle_upstream_line(struct upstream_s *u)
 {
-	switch (upstream_state)
+	switch (u->state)
 	{
 		case 0:
-			if (strncmp(response_line, "HTTP/1.", 7) || strlen(response_line) < 9)
+			if (strncmp(u->response_line, "HTTP/1.", 7) || strlen(u->response_line) < 9)
 			{
-				reason = "Invalid upstream response.";
+				u->reason = "Invalid upstream response.";
 				return 1;
 			}
-			upstream_response_code = atoi(response_line + 9);
-			reason = strdup(response_line + 9);
-			upstream_state++;
+			u->response_code = atoi(u->response_line + 9);
+			snprintf(u->reason_buf, sizeof(u->reason_buf), "%s", u->response_line + 9);
+			u->reason = u->reason_buf;
+			u->state++;
 			break;
 		case 1:
-			if (!*response_line)
+			if (!*u->response_line)
 			{
-				if (upstream_response_code == 200)
-					upstream_state = 2;
+				if (u->response_code == 200)
+					u->state = 2;
 				else
 				{
 					return 1; /* reason was already set in state 0, but we need all header lines for potential WWW-Authenticate */
 				}
 			}
-			else if (!strncasecmp(response_line, "WWW-Authenticate: ", 18))
-				snprintf(wwwauthenticate, MAX_LINE_LENGTH, "%s\r\n", response_line);
+			else if (!strncasecmp(u->response_line, "WWW-Authenticate: ", 18))
+				snprintf(u->wwwauthenticate, MAX_LINE_LENGTH, "%s\r\n", u->response_line);
 			break;
 		case 2:
 		case 3:
-			if (response_line[0] == '+')
+			if (u->response_line[0] == '+')
 			{
 #ifndef HAVE_ADD_PID
-				int dvr = atoi(response_line + 1);
+				int dvr = atoi(u->response_line + 1);
 
-				if (dvr_fd < 0)
+				if (u->dvr_fd < 0)
 				{
 					char dvrfn[32];
 					sprintf(dvrfn, "/dev/dvb/adapter0/dvr0");
 					logOutput("Open dvr0");
-					dvr_fd = open(dvrfn, O_RDONLY);
-					if (dvr_fd < 0)
+					u->dvr_fd = open(dvrfn, O_RDONLY);
+					if (u->dvr_fd < 0)
 					{
 						logOutput(" - failed\n");
-						reason = "DVR OPEN FAILED";
+						u->reason = "DVR OPEN FAILED";
 						return 2;
 					}
 					logOutput(" - succeeded\n");
@@ -383,18 +496,18 @@ int handle_upstream_line(void)
 
 #else // HAVE_ADD_PID
 				/* parse (and possibly open) demux */
-				int demux = atoi(response_line + 1);
+				int demux = atoi(u->response_line + 1);
 
 #if DVB_API_VERSION < 5 // LINUX_DVB_API 3
-				if (demux_fd < 0)
+				if (u->demux_fd < 0)
 				{
 					struct dmx_pes_filter_params flt;
 					char demuxfn[32];
 					sprintf(demuxfn, "/dev/dvb/adapter0/demux%d", demux);
-					demux_fd = open(demuxfn, O_RDWR);
-					if (demux_fd < 0)
+					u->demux_fd = open(demuxfn, O_RDWR);
+					if (u->demux_fd < 0)
 					{
-						reason = "DEMUX OPEN FAILED";
+						u->reason = "DEMUX OPEN FAILED";
 						return 2;
 					}
 
@@ -404,18 +517,18 @@ int handle_upstream_line(void)
 					flt.pes_type = DMX_TAP_TS;
 					flt.flags = 0;
 
-					if (ioctl(demux_fd, DMX_SET_PES_FILTER, &flt) < 0)
+					if (ioctl(u->demux_fd, DMX_SET_PES_FILTER, &flt) < 0)
 					{
-						reason = "DEMUX PES FILTER SET FAILED";
+						u->reason = "DEMUX PES FILTER SET FAILED";
 						return 2;
 					}
 
-					ioctl(demux_fd, DMX_SET_BUFFER_SIZE, 1024 * 1024);
-					fcntl(demux_fd, F_SETFL, O_NONBLOCK);
+					ioctl(u->demux_fd, DMX_SET_BUFFER_SIZE, 1024 * 1024);
+					fcntl(u->demux_fd, F_SETFL, O_NONBLOCK);
 
-					if (ioctl(demux_fd, DMX_START, 0) < 0)
+					if (ioctl(u->demux_fd, DMX_START, 0) < 0)
 					{
-						reason = "DMX_START FAILED";
+						u->reason = "DMX_START FAILED";
 						return 2;
 					}
 				}
@@ -423,10 +536,10 @@ int handle_upstream_line(void)
 #endif // HAVE_ADD_PID
 
 				/* parse new pids */
-				const char *p = strchr(response_line, ':');
+				const char *p = strchr(u->response_line, ':');
 				int old_active_pids[MAX_PIDS];
 
-				memcpy(old_active_pids, active_pids, sizeof(active_pids));
+				memcpy(old_active_pids, u->active_pids, sizeof(u->active_pids));
 
 				int nr_pids = 0, i, j;
 				while (p)
@@ -437,35 +550,35 @@ int handle_upstream_line(void)
 
 					/* do not add pids twice */
 					for (i = 0; i < nr_pids; ++i)
-						if (active_pids[i] == pid)
+						if (u->active_pids[i] == pid)
 							break;
 
 					if (i != nr_pids)
 						continue;
 
-					active_pids[nr_pids++] = pid;
+					u->active_pids[nr_pids++] = pid;
 
 					if (nr_pids == MAX_PIDS)
 						break;
 				}
 
 				for (i = nr_pids; i < MAX_PIDS; ++i)
-					active_pids[i] = -1;
+					u->active_pids[i] = -1;
 
 				/* check for added pids */
 				for (i = 0; i < nr_pids; ++i)
 				{
 					for (j = 0; j < MAX_PIDS; ++j)
-						if (active_pids[i] == old_active_pids[j])
+						if (u->active_pids[i] == old_active_pids[j])
 							break;
 #ifndef HAVE_ADD_PID
-					logOutput("ADD PID %d - j=%d == MAX_PIDS=%d\n", active_pids[i], j, MAX_PIDS);
+					logOutput("ADD PID %d - j=%d == MAX_PIDS=%d\n", u->active_pids[i], j, MAX_PIDS);
 					if (j == MAX_PIDS)
 					{
 						struct dmx_pes_filter_params flt;
 
 						flt.pes_type = DMX_PES_OTHER;
-						flt.pid     = active_pids[i];
+						flt.pid     = u->active_pids[i];
 						flt.input   = DMX_IN_FRONTEND;
 						flt.output  = DMX_OUT_TS_TAP;
 						flt.flags   = DMX_IMMEDIATE_START;
@@ -487,54 +600,54 @@ int handle_upstream_line(void)
 							break;
 						}
 
-						open_pids[i] = fd;
+						u->open_pids[i] = fd;
 					}
 #else // HAVE_ADD_PID
 					if (j == MAX_PIDS)
 					{
 #if DVB_API_VERSION > 3 // LINUX_DVB_API 5
 
-						if (demux_fd < 0)
+						if (u->demux_fd < 0)
 						{
 							struct dmx_pes_filter_params flt;
 							char demuxfn[32];
 							sprintf(demuxfn, "/dev/dvb/adapter0/demux%d", demux);
-							demux_fd = open(demuxfn, O_RDWR | O_NONBLOCK);
-							if (demux_fd < 0)
+							u->demux_fd = open(demuxfn, O_RDWR | O_NONBLOCK);
+							if (u->demux_fd < 0)
 							{
-								reason = "DEMUX OPEN FAILED";
+								u->reason = "DEMUX OPEN FAILED";
 								return 2;
 							}
 
-							ioctl(demux_fd, DMX_SET_BUFFER_SIZE, 1024 * 1024);
+							ioctl(u->demux_fd, DMX_SET_BUFFER_SIZE, 1024 * 1024);
 
-							flt.pid = active_pids[i];
+							flt.pid = u->active_pids[i];
 							flt.input = DMX_IN_FRONTEND;
 							flt.output = DMX_OUT_TSDEMUX_TAP;
 							flt.pes_type = DMX_PES_OTHER;
 							flt.flags = DMX_IMMEDIATE_START;
 
-							if (ioctl(demux_fd, DMX_SET_PES_FILTER, &flt) < 0)
+							if (ioctl(u->demux_fd, DMX_SET_PES_FILTER, &flt) < 0)
 							{
-								reason = "DEMUX PES FILTER SET FAILED";
+								u->reason = "DEMUX PES FILTER SET FAILED";
 								return 2;
 							}
 
-							fcntl(demux_fd, F_SETFL, O_NONBLOCK);
+							fcntl(u->demux_fd, F_SETFL, O_NONBLOCK);
 
-							if (ioctl(demux_fd, DMX_START, 0) < 0)
+							if (ioctl(u->demux_fd, DMX_START, 0) < 0)
 							{
-								reason = "DMX_START FAILED";
+								u->reason = "DMX_START FAILED";
 								return 2;
 							}
 						}
 						else
 						{
-							uint16_t p = active_pids[i];
-							ioctl(demux_fd, DMX_ADD_PID, &p);
+							uint16_t p = u->active_pids[i];
+							ioctl(u->demux_fd, DMX_ADD_PID, &p);
 						}
 #else // LINUX_DVB_API 3
-						ioctl(demux_fd, DMX_ADD_PID, active_pids[i]);
+						ioctl(u->demux_fd, DMX_ADD_PID, u->active_pids[i]);
 #endif // LINUX_DVB_API 3
 					}
 #endif // HAVE_ADD_PID
@@ -546,38 +659,39 @@ int handle_upstream_line(void)
 					if (old_active_pids[i] == -1)
 						continue;
 					for (j = 0; j < nr_pids; ++j)
-						if (old_active_pids[i] == active_pids[j])
+						if (old_active_pids[i] == u->active_pids[j])
 							break;
 #ifndef HAVE_ADD_PID
 					logOutput("REMOVE PID %d, j=%d == nr_pids=%d\n", old_active_pids[i], j, nr_pids);
 
 					if (j == nr_pids)
 					{
-						logOutput("close fd=%d\n", open_pids[i]);
-						close(open_pids[i]);
+						logOutput("close fd=%d\n", u->open_pids[i]);
+						close(u->open_pids[i]);
 					}
 #else // HAVE_ADD_PID
 					if (j == nr_pids)
 					{
 #if DVB_API_VERSION > 3 // LINUX_DVB_API 5
 						uint16_t p = old_active_pids[i];
-						ioctl(demux_fd, DMX_REMOVE_PID, &p);
+						ioctl(u->demux_fd, DMX_REMOVE_PID, &p);
 #else // LINUX_DVB_API 3
-						ioctl(demux_fd, DMX_REMOVE_PID, old_active_pids[i]);
+						ioctl(u->demux_fd, DMX_REMOVE_PID, old_active_pids[i]);
 #endif // LINUX_DVB_API 3
 					}
 #endif // HAVE_ADD_PID
 				}
-				if (upstream_state == 2)
+				if (u->state == 2)
 				{
-					char *c = "HTTP/1.0 200 OK\r\nConnection: Close\r\nContent-Type: video/mpeg\r\nServer: stream_enigma2\r\n\r\n";
-					write(1, c, strlen(c));
-					upstream_state = 3; /* HTTP response sent */
+					if (u->out_fd >= 0)
+						write(u->out_fd, response_ok, strlen(response_ok));
+					u->state = 3; /* HTTP response sent */
 				}
 			}
-			else if (response_line[0] == '-')
+			else if (u->response_line[0] == '-')
 			{
-				reason = strdup(response_line + 1);
+				snprintf(u->reason_buf, sizeof(u->reason_buf), "%s", u->response_line + 1);
+				u->reason = u->reason_buf;
 				return 1;
 			}
 			/* ignore everything not starting with + or - */
@@ -585,3 +699,560 @@ int handle_upstream_line(void)
 	}
 	return 0;
 }
+
+/*
+ * daemon mode
+ *
+ * One process serves all clients from an epoll loop. Clients asking for the
+ * same service (and sending the same authorization) share one upstream
+ * request and one demux, every chunk read from the demux is copied into the
+ * ring of each streaming client. A client whose ring overflows is dropped,
+ * so a slow client never stalls the others.
+ */
+
+enum
+{
+	ITEM_LISTEN,
+	ITEM_CLIENT,
+	ITEM_UPSTREAM,
+	ITEM_DEMUX
+};
+
+struct poll_item
+{
+	int kind;
+	void *owner;
+};
+
+struct service_s;
+
+struct client_s
+{
+	struct poll_item item;
+	int fd;
+	int state;
+	/*
+	 0 - request
+	 1 - waiting for service
+	 2 - streaming
+	 */
+	int dead;
+	int want_write;
+	char request[CLIENT_REQUEST_LENGTH];
+	int request_p;
+	unsigned int header_left; /* part of response_ok not sent yet */
+	unsigned int ring_tail; /* read position in the service ring, free running */
+	struct service_s *service;
+	struct client_s *next;
+};
+
+struct service_s
+{
+	struct poll_item upstream_item;
+	struct poll_item demux_item;
+	struct upstream_s u;
+	char ref[MAX_LINE_LENGTH];
+	char authorization[MAX_LINE_LENGTH];
+	int demux_registered;
+	int connecting;
+	/* demux data is stored once for all clients, every client has its own read position */
+	unsigned char *ring;
+	unsigned int ring_head; /* write position, free running */
+	int clients;
+	int dead;
+	struct service_s *next;
+};
+
+static int epoll_fd = -1;
+static struct client_s *clients;
+static struct service_s *services;
+
+static int epoll_update(int op, int fd, struct poll_item *item, uint32_t events)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = item;
+	return epoll_ctl(epoll_fd, op, fd, &ev);
+}
+
+static void service_drop(struct service_s *s);
+
+static void client_drop(struct client_s *c)
+{
+	if (c->dead)
+		return;
+	c->dead = 1;
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->fd = -1;
+	if (c->service)
+	{
+		struct service_s *s = c->service;
+		c->service = NULL;
+		if (--s->clients == 0)
+			service_drop(s);
+	}
+}
+
+static void service_drop(struct service_s *s)
+{
+	struct client_s *c;
+
+	if (s->dead)
+		return;
+	s->dead = 1;
+	logOutput("service %s closed\n", s->ref);
+	for (c = clients; c; c = c->next)
+		if (c->service == s)
+		{
+			c->service = NULL;
+			client_drop(c);
+		}
+	if (s->u.fd >= 0)
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s->u.fd, NULL);
+	if (s->demux_registered)
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, UPSTREAM_DATA_FD(&s->u), NULL);
+	upstream_close(&s->u);
+}
+
+/* free everything dropped while handling the last batch of events */
+static void reap(void)
+{
+	struct client_s **pc = &clients;
+	struct service_s **ps = &services;
+
+	while (*pc)
+	{
+		struct client_s *c = *pc;
+		if (c->dead)
+		{
+			*pc = c->next;
+			free(c);
+		}
+		else
+			pc = &c->next;
+	}
+	while (*ps)
+	{
+		struct service_s *s = *ps;
+		if (s->dead)
+		{
+			*ps = s->next;
+			free(s->ring);
+			free(s);
+		}
+		else
+			ps = &s->next;
+	}
+}
+
+static void client_flush(struct client_s *c)
+{
+	while (!c->dead && c->service && (c->header_left || c->ring_tail != c->service->ring_head))
+	{
+		struct service_s *s = c->service;
+		unsigned int used = s->ring_head - c->ring_tail;
+		unsigned int pos = c->ring_tail % SERVICE_RING_SIZE;
+		struct iovec iov[3];
+		int iovcnt = 0;
+
+		if (c->header_left)
+		{
+			iov[iovcnt].iov_base = (char *)response_ok + strlen(response_ok) - c->header_left;
+			iov[iovcnt++].iov_len = c->header_left;
+		}
+		if (used)
+		{
+			iov[iovcnt].iov_base = s->ring + pos;
+			iov[iovcnt++].iov_len = used;
+			if (pos + used > SERVICE_RING_SIZE)
+			{
+				iov[iovcnt - 1].iov_len = SERVICE_RING_SIZE - pos;
+				iov[iovcnt].iov_base = s->ring;
+				iov[iovcnt++].iov_len = used - (SERVICE_RING_SIZE - pos);
+			}
+		}
+
+		ssize_t n = writev(c->fd, iov, iovcnt);
+		if (n > 0)
+		{
+			if (n < (ssize_t)c->header_left)
+			{
+				c->header_left -= n;
+				continue;
+			}
+			n -= c->header_left;
+			c->header_left = 0;
+			c->ring_tail += n;
+			continue;
+		}
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			if (!c->want_write)
+			{
+				c->want_write = 1;
+				epoll_update(EPOLL_CTL_MOD, c->fd, &c->item, EPOLLIN | EPOLLOUT);
+			}
+			return;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		client_drop(c);
+		return;
+	}
+	if (!c->dead && c->want_write)
+	{
+		c->want_write = 0;
+		epoll_update(EPOLL_CTL_MOD, c->fd, &c->item, EPOLLIN);
+	}
+}
+
+/* client starts at the live position of the service ring, after the HTTP response */
+static void client_start(struct client_s *c)
+{
+	c->state = 2;
+	c->header_left = strlen(response_ok);
+	c->ring_tail = c->service->ring_head;
+	client_flush(c);
+}
+
+static void service_queue(struct service_s *s, const void *data, unsigned int len)
+{
+	unsigned int pos = s->ring_head % SERVICE_RING_SIZE;
+	unsigned int part = len;
+	struct client_s *c;
+
+	/* data not sent yet would be overwritten */
+	for (c = clients; c; c = c->next)
+		if (c->service == s && c->state == 2 && len > SERVICE_RING_SIZE - (s->ring_head - c->ring_tail))
+		{
+			logOutput("client %d too slow, dropped\n", c->fd);
+			client_drop(c);
+		}
+	if (s->dead)
+		return;
+
+	if (part > SERVICE_RING_SIZE - pos)
+		part = SERVICE_RING_SIZE - pos;
+	memcpy(s->ring + pos, data, part);
+	memcpy(s->ring, (const char *)data + part, len - part);
+	s->ring_head += len;
+
+	/* while EPOLLOUT is armed the socket is full anyway */
+	for (c = clients; c; c = c->next)
+		if (c->service == s && c->state == 2 && !c->want_write)
+			client_flush(c);
+}
+
+static void client_reply(struct client_s *c, const char *response)
+{
+	/* best effort, the client is closed right after */
+	write(c->fd, response, strlen(response));
+	client_drop(c);
+}
+
+static void service_failed(struct service_s *s)
+{
+	char response[MAX_LINE_LENGTH * 3];
+	struct client_s *c;
+
+	snprintf(response, sizeof(response), "HTTP/1.0 %s\r\n%s\r\n%s\r\n",
+	         s->u.response_code == 401 ? "401 Unauthorized" : "502 Bad Gateway",
+	         s->u.wwwauthenticate, s->u.reason);
+	for (c = clients; c; c = c->next)
+		if (c->service == s && c->state == 1)
+			write(c->fd, response, strlen(response));
+	service_drop(s);
+}
+
+static void service_handle_upstream(struct service_s *s)
+{
+	struct client_s *c;
+	int data_fd;
+
+	if (s->connecting)
+	{
+		s->connecting = 0;
+		if (upstream_send_request(&s->u, s->ref, s->authorization) ||
+		    epoll_update(EPOLL_CTL_MOD, s->u.fd, &s->upstream_item, EPOLLIN))
+			service_failed(s);
+		return;
+	}
+
+	if (handle_upstream(&s->u))
+	{
+		service_failed(s);
+		return;
+	}
+
+	data_fd = UPSTREAM_DATA_FD(&s->u);
+	if (data_fd >= 0 && !s->demux_registered)
+	{
+		if (epoll_update(EPOLL_CTL_ADD, data_fd, &s->demux_item, EPOLLIN))
+		{
+			s->u.reason = "DEMUX POLL FAILED";
+			service_failed(s);
+			return;
+		}
+		s->demux_registered = 1;
+	}
+
+	if (s->u.state == 3)
+	{
+		for (c = clients; c; c = c->next)
+			if (c->service == s && c->state == 1)
+				client_start(c);
+	}
+}
+
+static void service_handle_demux(struct service_s *s)
+{
+	static char buffer[BSIZE];
+
+	int n = read(UPSTREAM_DATA_FD(&s->u), buffer, BSIZE);
+	if (n <= 0)
+	{
+		//continue if in the moment, there are no data in dmx buffer
+		return;
+	}
+	service_queue(s, buffer, n);
+}
+
+static struct service_s *service_get(const char *ref, const char *auth)
+{
+	struct service_s *s;
+
+	for (s = services; s; s = s->next)
+		if (!s->dead && !strcmp(s->ref, ref) && !strcmp(s->authorization, auth))
+			return s;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+	upstream_init(&s->u);
+	s->upstream_item.kind = ITEM_UPSTREAM;
+	s->upstream_item.owner = s;
+	s->demux_item.kind = ITEM_DEMUX;
+	s->demux_item.owner = s;
+	snprintf(s->ref, sizeof(s->ref), "%s", ref);
+	snprintf(s->authorization, sizeof(s->authorization), "%s", auth);
+	s->next = services;
+	services = s;
+
+	logOutput("service %s opened\n", s->ref);
+	/* connect is finished in the epoll loop, it must not block the other clients */
+	s->ring = malloc(SERVICE_RING_SIZE);
+	if (!s->ring || upstream_open(&s->u, 1) ||
+	    epoll_update(EPOLL_CTL_ADD, s->u.fd, &s->upstream_item, EPOLLOUT))
+	{
+		/* caller answers the client */
+		upstream_close(&s->u);
+		s->dead = 1;
+	}
+	else
+		s->connecting = 1;
+	return s;
+}
+
+static void client_request(struct client_s *c)
+{
+	char auth[MAX_LINE_LENGTH] = "";
+	char *line, *next, *ref, *end;
+	struct service_s *s;
+
+	if (strncmp(c->request, "GET /", 5))
+	{
+		client_reply(c, "HTTP/1.0 400 Bad Request\r\n\r\n");
+		return;
+	}
+	ref = c->request + 5;
+	end = strchr(ref, ' ');
+	if (!end || strncmp(end, " HTTP/1.", 7))
+	{
+		client_reply(c, "HTTP/1.0 400 Bad Request\r\n\r\n");
+		return;
+	}
+	*end++ = 0;
+
+	/* save authorization header, including the line end, as inetd mode does */
+	for (line = strchr(end, '\n'); line; line = next)
+	{
+		line++;
+		next = strchr(line, '\n');
+		if (!strncasecmp(line, "Authorization: ", 15) && next && next - line + 2 <= sizeof(auth))
+		{
+			memcpy(auth, line, next - line + 1);
+			auth[next - line + 1] = 0;
+		}
+	}
+
+	s = service_get(ref, auth);
+	if (!s || s->dead)
+	{
+		client_reply(c, "HTTP/1.0 502 Bad Gateway\r\n\r\nUpstream connect failed.\r\n");
+		return;
+	}
+	c->service = s;
+	s->clients++;
+	if (s->u.state == 3)
+		client_start(c);
+	else
+		c->state = 1;
+}
+
+static void client_handle_read(struct client_s *c)
+{
+	char discard[MAX_LINE_LENGTH];
+	int n;
+
+	if (c->state != 0)
+	{
+		/* check for client disconnect */
+		n = read(c->fd, discard, sizeof(discard));
+		if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+			client_drop(c);
+		return;
+	}
+
+	n = read(c->fd, c->request + c->request_p, CLIENT_REQUEST_LENGTH - 1 - c->request_p);
+	if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+	{
+		client_drop(c);
+		return;
+	}
+	if (n < 0)
+		return;
+	c->request_p += n;
+	c->request[c->request_p] = 0;
+
+	if (strstr(c->request, "\r\n\r\n") || strstr(c->request, "\n\n"))
+		client_request(c);
+	else if (c->request_p == CLIENT_REQUEST_LENGTH - 1)
+		client_reply(c, "HTTP/1.0 400 Bad Request\r\n\r\n");
+}
+
+static void client_accept(int listen_fd)
+{
+	struct client_s *c;
+	int fd = accept(listen_fd, NULL, NULL);
+
+	if (fd < 0)
+		return;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+	{
+		close(fd);
+		return;
+	}
+	c->item.kind = ITEM_CLIENT;
+	c->item.owner = c;
+	c->fd = fd;
+	if (epoll_update(EPOLL_CTL_ADD, fd, &c->item, EPOLLIN))
+	{
+		close(fd);
+		free(c);
+		return;
+	}
+	c->next = clients;
+	clients = c;
+}
+
+int run_daemon(int port)
+{
+	struct epoll_event events[DAEMON_MAX_EVENTS];
+	struct poll_item listen_item;
+	struct sockaddr_in sin;
+	int listen_fd, one = 1, i;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	listen_fd = socket(PF_INET, SOCK_STREAM, 0);
+	if (listen_fd < 0)
+	{
+		perror("socket");
+		return 1;
+	}
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	sin.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(listen_fd, (struct sockaddr *)&sin, sizeof(sin)) || listen(listen_fd, 8))
+	{
+		perror("bind");
+		return 1;
+	}
+	fcntl(listen_fd, F_SETFL, O_NONBLOCK);
+
+	epoll_fd = epoll_create(DAEMON_MAX_EVENTS);
+	if (epoll_fd < 0)
+	{
+		perror("epoll_create");
+		return 1;
+	}
+	listen_item.kind = ITEM_LISTEN;
+	listen_item.owner = NULL;
+	epoll_update(EPOLL_CTL_ADD, listen_fd, &listen_item, EPOLLIN);
+
+	logOutput("streamproxy daemon on port %d\n", port);
+
+	while (1)
+	{
+		int n = epoll_wait(epoll_fd, events, DAEMON_MAX_EVENTS, -1);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			break;
+		}
+
+		for (i = 0; i < n; ++i)
+		{
+			struct poll_item *item = events[i].data.ptr;
+			uint32_t ev = events[i].events;
+
+			switch (item->kind)
+			{
+				case ITEM_LISTEN:
+					client_accept(listen_fd);
+					break;
+				case ITEM_CLIENT:
+				{
+					struct client_s *c = item->owner;
+					if (!c->dead && (ev & (EPOLLERR | EPOLLHUP)))
+						client_drop(c);
+					if (!c->dead && (ev & EPOLLOUT))
+						client_flush(c);
+					if (!c->dead && (ev & EPOLLIN))
+						client_handle_read(c);
+					break;
+				}
+				case ITEM_UPSTREAM:
+				{
+					struct service_s *s = item->owner;
+					if (!s->dead)
+						service_handle_upstream(s);
+					break;
+				}
+				case ITEM_DEMUX:
+				{
+					struct service_s *s = item->owner;
+					if (!s->dead)
+						service_handle_demux(s);
+					break;
+				}
+			}
+		}
+		reap();
+	}
+
+	close(epoll_fd);
+	close(listen_fd);
+	return 1;
+}